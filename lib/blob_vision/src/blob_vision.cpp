@@ -0,0 +1,170 @@
+#include "blob_vision.h"
+
+namespace vision
+{
+
+namespace
+{
+
+struct Accumulator
+{
+  uint32_t count;
+  uint32_t sumX;
+  uint32_t sumY;
+};
+
+uint32_t isqrt(uint32_t v)
+{
+  uint32_t root = 0;
+  uint32_t bit = 1UL << 30;
+  while (bit > v)
+  {
+    bit >>= 2;
+  }
+  while (bit)
+  {
+    if (v >= root + bit)
+    {
+      v -= root + bit;
+      root = (root >> 1) + bit;
+    }
+    else
+    {
+      root >>= 1;
+    }
+    bit >>= 2;
+  }
+  return root;
+}
+
+inline int absDiff(int a, int b)
+{
+  return a > b ? a - b : b - a;
+}
+
+// Chroma of a pixel, offset by 64 so it stays positive, and its level. The
+// chroma is scaled to the target's level by cross-multiplying, no division.
+inline bool matchesLanes(int rg, int bg, int level, const ColorTarget &target)
+{
+  if (level < target.minLevel)
+  {
+    return false;
+  }
+  int dr = absDiff((rg - 64) * target.level, target.redMinusGreen * level);
+  int db = absDiff((bg - 64) * target.level, target.blueMinusGreen * level);
+  return dr + db <= target.tolerance * level;
+}
+
+BlobResult result(const Accumulator &acc, uint16_t width, uint16_t height)
+{
+  BlobResult blob = {false, 0, 0, acc.count, 0, 0};
+  uint32_t area = (uint32_t)width * height;
+  if (acc.count == 0 || (acc.count << 12) < area * BlobMinShare)
+  {
+    return blob;
+  }
+  blob.found = true;
+  blob.centerX = acc.sumX / acc.count;
+  blob.centerY = acc.sumY / acc.count;
+  // Centroid in half pixels against the image centre
+  int32_t x2 = (int32_t)(2 * acc.sumX / acc.count) + 1 - width;
+  blob.bearing = x2 * 127 / width;
+  uint32_t size = isqrt((uint32_t)(((uint64_t)acc.count * 65025) / area));
+  blob.size = size > 255 ? 255 : size;
+  return blob;
+}
+
+} // namespace
+
+ColorTarget colorTarget(uint8_t red, uint8_t green, uint8_t blue, uint8_t tolerance)
+{
+  int r = red >> 2;
+  int g = green >> 2;
+  int b = blue >> 2;
+  ColorTarget target;
+  target.redMinusGreen = r - g;
+  target.blueMinusGreen = b - g;
+  target.level = 2 * r + g + 2 * b;
+  target.tolerance = tolerance;
+  // A quarter of the target's own level
+  target.minLevel = target.level / 4;
+  return target;
+}
+
+bool matches(uint16_t pixel, const ColorTarget &target)
+{
+  uint32_t r = (pixel >> 11) << 1;
+  uint32_t g = (pixel >> 5) & 0x3F;
+  uint32_t b = (pixel & 0x1F) << 1;
+  return matchesLanes(r + 64 - g, b + 64 - g, 2 * r + g + 2 * b, target);
+}
+
+BlobResult findBlobReference(const uint16_t *image, uint16_t width, uint16_t height, uint16_t stride,
+                             const ColorTarget &target)
+{
+  Accumulator acc = {0, 0, 0};
+  for (uint16_t y = 0; y < height; y++)
+  {
+    const uint16_t *row = image + (uint32_t)y * stride;
+    for (uint16_t x = 0; x < width; x++)
+    {
+      if (matches(row[x], target))
+      {
+        acc.count++;
+        acc.sumX += x;
+        acc.sumY += y;
+      }
+    }
+  }
+  return result(acc, width, height);
+}
+
+BlobResult findBlob(const uint16_t *image, uint16_t width, uint16_t height, uint16_t stride,
+                    const ColorTarget &target)
+{
+  // Both pixels of a word are split into 16-bit lanes at once. The +64 bias
+  // keeps every lane positive so no borrow crosses into the other lane.
+  const uint32_t Lane_Bias = 0x00400040;
+  Accumulator acc = {0, 0, 0};
+  for (uint16_t y = 0; y < height; y++)
+  {
+    const uint16_t *row = image + (uint32_t)y * stride;
+    const uint32_t *words = (const uint32_t *)row;
+    uint32_t row_count = 0;
+    uint32_t row_sum_x = 0;
+    uint16_t pairs = width / 2;
+    for (uint16_t i = 0; i < pairs; i++)
+    {
+      uint32_t w = words[i];
+      uint32_t r = ((w >> 11) & 0x001F001F) << 1;
+      uint32_t g = (w >> 5) & 0x003F003F;
+      uint32_t b = (w & 0x001F001F) << 1;
+      uint32_t rg = r + Lane_Bias - g;
+      uint32_t bg = b + Lane_Bias - g;
+      uint32_t level = (r << 1) + g + (b << 1);
+
+      // The low lane is the pixel at the lower address on little endian cores
+      if (matchesLanes(rg & 0xFFFF, bg & 0xFFFF, level & 0xFFFF, target))
+      {
+        row_count++;
+        row_sum_x += 2 * i;
+      }
+      if (matchesLanes(rg >> 16, bg >> 16, level >> 16, target))
+      {
+        row_count++;
+        row_sum_x += 2 * i + 1;
+      }
+    }
+    if (width & 1 && matches(row[width - 1], target))
+    {
+      row_count++;
+      row_sum_x += width - 1;
+    }
+    acc.count += row_count;
+    acc.sumX += row_sum_x;
+    acc.sumY += row_count * y;
+  }
+  return result(acc, width, height);
+}
+
+} // namespace vision
@@ -0,0 +1,54 @@
+#ifndef BLOB_VISION_H
+#define BLOB_VISION_H
+
+// Finds the pixels of one colour in an RGB565 image and reports where they
+// are and how big they look. Integer only, two pixels per 32-bit word. Shared
+// by the ESP32-CAM and the host tools, C++11 without Arduino dependencies.
+
+#include <stdint.h>
+
+namespace vision
+{
+
+// Colour as chroma relative to green, compared in proportion to the pixel's
+// level so that it holds up when the light changes. Units are 6-bit channel
+// levels, the level is 2r + g + 2b.
+struct ColorTarget
+{
+  int8_t redMinusGreen;
+  int8_t blueMinusGreen;
+  uint16_t level;
+  uint8_t tolerance; // largest |dr| + |db| that still matches, at the target's level
+  uint16_t minLevel; // darker pixels have no reliable colour
+};
+
+struct BlobResult
+{
+  bool found;
+  int8_t bearing; // centroid, -127 left edge .. 127 right edge
+  uint8_t size;   // side of a square with the blob's area, 255 is the full frame
+  uint32_t pixels;
+  uint16_t centerX;
+  uint16_t centerY;
+};
+
+// Fewer matching pixels than this per 4096 is noise
+const uint8_t BlobMinShare = 12;
+
+ColorTarget colorTarget(uint8_t red, uint8_t green, uint8_t blue, uint8_t tolerance);
+
+// Pixels are native uint16_t RGB565, rows start on a 4 byte boundary.
+// stride is in pixels.
+BlobResult findBlob(const uint16_t *image, uint16_t width, uint16_t height, uint16_t stride,
+                    const ColorTarget &target);
+
+// Reference version, one pixel at a time, for the host tests
+BlobResult findBlobReference(const uint16_t *image, uint16_t width, uint16_t height, uint16_t stride,
+                             const ColorTarget &target);
+
+// Whether one RGB565 pixel matches
+bool matches(uint16_t pixel, const ColorTarget &target);
+
+} // namespace vision
+
+#endif
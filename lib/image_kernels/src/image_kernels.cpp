@@ -0,0 +1,378 @@
+#include "image_kernels.h"
+#include <string.h>
+
+namespace vision
+{
+
+namespace
+{
+
+// Sums of the neighbouring byte pairs of a word in two 16-bit lanes,
+// bytes 0 + 1 in the low lane and 2 + 3 in the high one
+inline uint32_t pairSums(uint32_t w)
+{
+  return (w & 0x00FF00FF) + ((w >> 8) & 0x00FF00FF);
+}
+
+inline uint32_t foldLanes(uint32_t lanes)
+{
+  return (lanes & 0xFFFF) + (lanes >> 16);
+}
+
+// Gray of the two RGB565 pixels of a word, in 16-bit lanes
+inline uint32_t grayLanes(uint32_t w)
+{
+  return (((w >> 11) & 0x001F001F) + ((w >> 5) & 0x003F003F) + (w & 0x001F001F)) << 1;
+}
+
+inline uint8_t log2Factor(uint8_t factor)
+{
+  return factor == 2 ? 1 : factor == 4 ? 2 : factor == 8 ? 3 : 0;
+}
+
+} // namespace
+
+void rgb565ToGrayReference(const uint16_t *src, uint8_t *dst, uint32_t count)
+{
+  for (uint32_t i = 0; i < count; i++)
+  {
+    dst[i] = rgb565Gray(src[i]);
+  }
+}
+
+void rgb565ToGray(const uint16_t *src, uint8_t *dst, uint32_t count)
+{
+  // Two source words make one output word of four pixels
+  const uint32_t *in = (const uint32_t *)src;
+  uint32_t *out = (uint32_t *)dst;
+  uint32_t quads = count / 4;
+  for (uint32_t i = 0; i < quads; i++)
+  {
+    uint32_t a = grayLanes(in[2 * i]);
+    uint32_t b = grayLanes(in[2 * i + 1]);
+    out[i] = (a & 0xFF) | ((a >> 8) & 0xFF00) | ((b & 0xFF) << 16) | ((b << 8) & 0xFF000000);
+  }
+  rgb565ToGrayReference(src + 4 * quads, dst + 4 * quads, count - 4 * quads);
+}
+
+void yuv422ToGrayReference(const uint8_t *src, uint8_t *dst, uint32_t count)
+{
+  for (uint32_t i = 0; i < count; i++)
+  {
+    dst[i] = src[2 * i];
+  }
+}
+
+void yuv422ToGray(const uint8_t *src, uint8_t *dst, uint32_t count)
+{
+  // Y0 U Y1 V: the luma bytes are 0 and 2 of every word
+  const uint32_t *in = (const uint32_t *)src;
+  uint32_t *out = (uint32_t *)dst;
+  uint32_t quads = count / 4;
+  for (uint32_t i = 0; i < quads; i++)
+  {
+    uint32_t a = in[2 * i];
+    uint32_t b = in[2 * i + 1];
+    out[i] = (a & 0xFF) | ((a >> 8) & 0xFF00) | ((b & 0xFF) << 16) | ((b << 8) & 0xFF000000);
+  }
+  yuv422ToGrayReference(src + 8 * quads, dst + 4 * quads, count - 4 * quads);
+}
+
+bool downscaleReference(const uint8_t *src, uint16_t width, uint16_t height, uint16_t stride, uint8_t factor,
+                        uint8_t *dst)
+{
+  uint8_t shift = 2 * log2Factor(factor);
+  if (!shift)
+  {
+    return false;
+  }
+  uint16_t out_width = width / factor;
+  uint16_t out_height = height / factor;
+  for (uint16_t y = 0; y < out_height; y++)
+  {
+    for (uint16_t x = 0; x < out_width; x++)
+    {
+      uint32_t sum = 0;
+      for (uint8_t dy = 0; dy < factor; dy++)
+      {
+        const uint8_t *row = src + (uint32_t)(y * factor + dy) * stride + x * factor;
+        for (uint8_t dx = 0; dx < factor; dx++)
+        {
+          sum += row[dx];
+        }
+      }
+      dst[(uint32_t)y * out_width + x] = (sum + (1 << (shift - 1))) >> shift;
+    }
+  }
+  return true;
+}
+
+bool downscale(const uint8_t *src, uint16_t width, uint16_t height, uint16_t stride, uint8_t factor,
+               uint8_t *dst)
+{
+  uint8_t shift = 2 * log2Factor(factor);
+  if (!shift)
+  {
+    return false;
+  }
+  uint16_t out_width = width / factor;
+  uint16_t out_height = height / factor;
+  for (uint16_t y = 0; y < out_height; y++)
+  {
+    const uint8_t *top = src + (uint32_t)y * factor * stride;
+    uint8_t *out = dst + (uint32_t)y * out_width;
+    if (factor == 2)
+    {
+      // One word per row gives two outputs, rounded in their lanes
+      const uint32_t *w0 = (const uint32_t *)top;
+      const uint32_t *w1 = (const uint32_t *)(top + stride);
+      uint16_t words = width / 4;
+      for (uint16_t i = 0; i < words; i++)
+      {
+        uint32_t lanes = ((pairSums(w0[i]) + pairSums(w1[i]) + 0x00020002) >> 2) & 0x00FF00FF;
+        out[2 * i] = lanes;
+        out[2 * i + 1] = lanes >> 16;
+      }
+      if (out_width > 2 * words)
+      {
+        uint16_t x = 4 * words;
+        out[2 * words] = (top[x] + top[x + 1] + top[stride + x] + top[stride + x + 1] + 2) >> 2;
+      }
+      continue;
+    }
+
+    // 4 and 8: one or two words per row, the rows summed in the lanes. An
+    // 8x8 block peaks at 8160 per lane.
+    uint8_t words = factor / 4;
+    for (uint16_t x = 0; x < out_width; x++)
+    {
+      uint32_t lanes = 0;
+      const uint32_t *w = (const uint32_t *)top + x * words;
+      for (uint8_t dy = 0; dy < factor; dy++, w += stride / 4)
+      {
+        lanes += pairSums(w[0]);
+        if (words == 2)
+        {
+          lanes += pairSums(w[1]);
+        }
+      }
+      out[x] = (foldLanes(lanes) + (1 << (shift - 1))) >> shift;
+    }
+  }
+  return true;
+}
+
+void integralImageReference(const uint8_t *src, uint16_t width, uint16_t height, uint16_t stride,
+                            uint32_t *dst)
+{
+  uint32_t line = width + 1;
+  for (uint16_t x = 0; x <= width; x++)
+  {
+    dst[x] = 0;
+  }
+  for (uint16_t y = 0; y < height; y++)
+  {
+    const uint8_t *row = src + (uint32_t)y * stride;
+    uint32_t *above = dst + (uint32_t)y * line;
+    uint32_t *out = above + line;
+    out[0] = 0;
+    for (uint16_t x = 0; x < width; x++)
+    {
+      out[x + 1] = above[x + 1] + out[x] - above[x] + row[x];
+    }
+  }
+}
+
+void integralImage(const uint8_t *src, uint16_t width, uint16_t height, uint16_t stride, uint32_t *dst)
+{
+  uint32_t line = width + 1;
+  memset(dst, 0, line * sizeof(uint32_t));
+  uint16_t words = width / 4;
+  for (uint16_t y = 0; y < height; y++)
+  {
+    const uint8_t *row = src + (uint32_t)y * stride;
+    const uint32_t *in = (const uint32_t *)row;
+    const uint32_t *above = dst + (uint32_t)y * line + 1;
+    uint32_t *out = dst + (uint32_t)(y + 1) * line;
+    *out++ = 0;
+    // Running sum of the row plus the column above, four pixels per load
+    uint32_t sum = 0;
+    for (uint16_t i = 0; i < words; i++)
+    {
+      uint32_t w = in[i];
+      sum += w & 0xFF;
+      out[0] = above[0] + sum;
+      sum += (w >> 8) & 0xFF;
+      out[1] = above[1] + sum;
+      sum += (w >> 16) & 0xFF;
+      out[2] = above[2] + sum;
+      sum += w >> 24;
+      out[3] = above[3] + sum;
+      out += 4;
+      above += 4;
+    }
+    for (uint16_t x = 4 * words; x < width; x++)
+    {
+      sum += row[x];
+      *out++ = *above++ + sum;
+    }
+  }
+}
+
+uint32_t thresholdReference(const uint8_t *src, uint8_t *dst, uint32_t count, uint8_t level)
+{
+  uint32_t set = 0;
+  for (uint32_t i = 0; i < count; i++)
+  {
+    bool on = src[i] >= level;
+    dst[i] = on ? 255 : 0;
+    set += on;
+  }
+  return set;
+}
+
+uint32_t threshold(const uint8_t *src, uint8_t *dst, uint32_t count, uint8_t level)
+{
+  // Adding 256 - level to a byte in a 16-bit lane carries into bit 8 exactly
+  // when the byte is at least level, the even and odd bytes take a lane each
+  const uint32_t bias = (0x100 - level) * 0x00010001;
+  const uint32_t *in = (const uint32_t *)src;
+  uint32_t *out = (uint32_t *)dst;
+  uint32_t words = count / 4;
+  uint32_t set = 0;
+  for (uint32_t i = 0; i < words; i++)
+  {
+    uint32_t w = in[i];
+    uint32_t even = (((w & 0x00FF00FF) + bias) >> 8) & 0x00010001;
+    uint32_t odd = ((((w >> 8) & 0x00FF00FF) + bias) >> 8) & 0x00010001;
+    out[i] = (even * 0xFF) | ((odd * 0xFF) << 8);
+    set += foldLanes(even + odd);
+  }
+  return set + thresholdReference(src + 4 * words, dst + 4 * words, count - 4 * words, level);
+}
+
+void rowSumsReference(const uint8_t *src, uint16_t width, uint16_t height, uint16_t stride, uint32_t *rows)
+{
+  for (uint16_t y = 0; y < height; y++)
+  {
+    const uint8_t *row = src + (uint32_t)y * stride;
+    uint32_t sum = 0;
+    for (uint16_t x = 0; x < width; x++)
+    {
+      sum += row[x];
+    }
+    rows[y] = sum;
+  }
+}
+
+void rowSums(const uint8_t *src, uint16_t width, uint16_t height, uint16_t stride, uint32_t *rows)
+{
+  // A lane takes at most 510 per word, fold before 128 words overflow it
+  const uint16_t Fold_Words = 128;
+  uint16_t words = width / 4;
+  for (uint16_t y = 0; y < height; y++)
+  {
+    const uint8_t *row = src + (uint32_t)y * stride;
+    const uint32_t *in = (const uint32_t *)row;
+    uint32_t sum = 0;
+    for (uint16_t i = 0; i < words;)
+    {
+      uint16_t end = words - i > Fold_Words ? i + Fold_Words : words;
+      uint32_t lanes = 0;
+      for (; i < end; i++)
+      {
+        lanes += pairSums(in[i]);
+      }
+      sum += foldLanes(lanes);
+    }
+    for (uint16_t x = 4 * words; x < width; x++)
+    {
+      sum += row[x];
+    }
+    rows[y] = sum;
+  }
+}
+
+void columnSumsReference(const uint8_t *src, uint16_t width, uint16_t height, uint16_t stride,
+                         uint32_t *columns)
+{
+  for (uint16_t x = 0; x < width; x++)
+  {
+    columns[x] = 0;
+  }
+  for (uint16_t y = 0; y < height; y++)
+  {
+    const uint8_t *row = src + (uint32_t)y * stride;
+    for (uint16_t x = 0; x < width; x++)
+    {
+      columns[x] += row[x];
+    }
+  }
+}
+
+void columnSums(const uint8_t *src, uint16_t width, uint16_t height, uint16_t stride, uint32_t *columns)
+{
+  memset(columns, 0, width * sizeof(uint32_t));
+  uint16_t words = width / 4;
+  for (uint16_t y = 0; y < height; y++)
+  {
+    const uint8_t *row = src + (uint32_t)y * stride;
+    const uint32_t *in = (const uint32_t *)row;
+    uint32_t *out = columns;
+    for (uint16_t i = 0; i < words; i++, out += 4)
+    {
+      uint32_t w = in[i];
+      out[0] += w & 0xFF;
+      out[1] += (w >> 8) & 0xFF;
+      out[2] += (w >> 16) & 0xFF;
+      out[3] += w >> 24;
+    }
+    for (uint16_t x = 4 * words; x < width; x++)
+    {
+      columns[x] += row[x];
+    }
+  }
+}
+
+uint16_t forEachBand(const uint8_t *src, uint32_t row_bytes, uint16_t height, uint32_t src_stride,
+                     uint8_t *scratch, uint32_t scratch_size, uint16_t row_multiple, BandKernel kernel,
+                     void *ctx)
+{
+  if (!row_multiple || !row_bytes)
+  {
+    return 0;
+  }
+  uint32_t band_rows = scratch_size / row_bytes;
+  band_rows -= band_rows % row_multiple;
+  if (!band_rows)
+  {
+    return 0;
+  }
+  if (band_rows > height)
+  {
+    band_rows = height;
+  }
+
+  uint16_t bands = 0;
+  for (uint16_t first = 0; first < height; first += band_rows, bands++)
+  {
+    uint32_t left = height - first;
+    uint16_t rows = left < band_rows ? left : band_rows;
+    const uint8_t *in = src + first * src_stride;
+    if (src_stride == row_bytes)
+    {
+      memcpy(scratch, in, rows * row_bytes);
+    }
+    else
+    {
+      for (uint16_t r = 0; r < rows; r++)
+      {
+        memcpy(scratch + r * row_bytes, in + r * src_stride, row_bytes);
+      }
+    }
+    kernel(scratch, rows, first, ctx);
+  }
+  return bands;
+}
+
+} // namespace vision
@@ -0,0 +1,86 @@
+#ifndef IMAGE_KERNELS_H
+#define IMAGE_KERNELS_H
+
+// Pixel primitives for camera analysis: conversion to grayscale, box
+// downscaling, integral images, thresholding and row/column projections.
+// The inner loops load 32-bit words, two RGB565 or four gray pixels at a
+// time, and assume a little endian core like the ESP32 and x86. Every kernel
+// has a plain per-pixel Reference version the host tests compare against.
+// C++11 without Arduino dependencies.
+//
+// Unless noted, rows start on a 4 byte boundary and stride is in pixels.
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace vision
+{
+
+// Luma of an RGB565 pixel, 2 * (r5 + g6 + b5), the same (r + 2g + b) / 4
+// weighting the line detection uses for RGB888. Range 0..250.
+inline uint8_t rgb565Gray(uint16_t pixel)
+{
+  return ((pixel >> 11) + ((pixel >> 5) & 0x3F) + (pixel & 0x1F)) << 1;
+}
+
+// count RGB565 pixels, native uint16_t, to gray
+void rgb565ToGray(const uint16_t *src, uint8_t *dst, uint32_t count);
+void rgb565ToGrayReference(const uint16_t *src, uint8_t *dst, uint32_t count);
+
+// count YUYV pixels, two pixels in four bytes as the sensor sends them, to
+// gray by keeping Y. count is even.
+void yuv422ToGray(const uint8_t *src, uint8_t *dst, uint32_t count);
+void yuv422ToGrayReference(const uint8_t *src, uint8_t *dst, uint32_t count);
+
+// Averages factor x factor blocks, factor 2, 4 or 8, rounded to nearest. The
+// output is width / factor by height / factor, packed (stride width / factor),
+// leftover rows and columns are dropped. Returns false for another factor.
+bool downscale(const uint8_t *src, uint16_t width, uint16_t height, uint16_t stride, uint8_t factor,
+               uint8_t *dst);
+bool downscaleReference(const uint8_t *src, uint16_t width, uint16_t height, uint16_t stride, uint8_t factor,
+                        uint8_t *dst);
+
+// Integral image with a zero first row and column, (width + 1) by
+// (height + 1) entries, so any box sum takes four reads without branches.
+// Exact up to 16.8 M pixels.
+void integralImage(const uint8_t *src, uint16_t width, uint16_t height, uint16_t stride, uint32_t *dst);
+void integralImageReference(const uint8_t *src, uint16_t width, uint16_t height, uint16_t stride,
+                            uint32_t *dst);
+
+// Sum of the pixels in [x0, x1) x [y0, y1)
+inline uint32_t boxSum(const uint32_t *integral, uint16_t width, uint16_t x0, uint16_t y0, uint16_t x1,
+                       uint16_t y1)
+{
+  uint32_t line = width + 1;
+  return integral[y1 * line + x1] - integral[y0 * line + x1] - integral[y1 * line + x0] +
+         integral[y0 * line + x0];
+}
+
+// 255 where the pixel is at least level, 0 elsewhere. Returns the number of
+// 255 pixels.
+uint32_t threshold(const uint8_t *src, uint8_t *dst, uint32_t count, uint8_t level);
+uint32_t thresholdReference(const uint8_t *src, uint8_t *dst, uint32_t count, uint8_t level);
+
+// Sum of each row (height entries) and of each column (width entries)
+void rowSums(const uint8_t *src, uint16_t width, uint16_t height, uint16_t stride, uint32_t *rows);
+void rowSumsReference(const uint8_t *src, uint16_t width, uint16_t height, uint16_t stride, uint32_t *rows);
+void columnSums(const uint8_t *src, uint16_t width, uint16_t height, uint16_t stride, uint32_t *columns);
+void columnSumsReference(const uint8_t *src, uint16_t width, uint16_t height, uint16_t stride,
+                         uint32_t *columns);
+
+// Runs a kernel over an image in PSRAM band by band. Each band of rows is
+// copied into scratch, normally internal SRAM, so the kernel's word loads
+// hit fast memory instead of the PSRAM cache. Bands hold a multiple of
+// row_multiple rows, a downscale passes its factor. The kernel gets the band
+// with stride row_bytes and the index of its first row.
+typedef void (*BandKernel)(const uint8_t *band, uint16_t rows, uint16_t first_row, void *ctx);
+
+// Returns the number of bands, 0 when scratch cannot hold row_multiple rows.
+// row_bytes and src_stride are in bytes.
+uint16_t forEachBand(const uint8_t *src, uint32_t row_bytes, uint16_t height, uint32_t src_stride,
+                     uint8_t *scratch, uint32_t scratch_size, uint16_t row_multiple, BandKernel kernel,
+                     void *ctx);
+
+} // namespace vision
+
+#endif
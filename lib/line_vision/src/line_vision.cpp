@@ -0,0 +1,108 @@
+#include "line_vision.h"
+
+namespace vision
+{
+
+int16_t lineCenter(const uint8_t *row, uint16_t width)
+{
+  uint8_t darkest = 255;
+  uint32_t sum = 0;
+  for (uint16_t x = 0; x < width; x++)
+  {
+    uint8_t v = row[x];
+    sum += v;
+    if (v < darkest)
+    {
+      darkest = v;
+    }
+  }
+  uint8_t mean = sum / width;
+  if (mean < darkest + LineMinContrast)
+  {
+    return -1;
+  }
+
+  // Longest run below the midpoint between the darkest pixel and the mean
+  uint8_t threshold = (darkest + mean) / 2;
+  uint16_t best_start = 0;
+  uint16_t best_len = 0;
+  uint16_t start = 0;
+  uint16_t len = 0;
+  for (uint16_t x = 0; x < width; x++)
+  {
+    if (row[x] < threshold)
+    {
+      if (len == 0)
+      {
+        start = x;
+      }
+      len++;
+      if (len > best_len)
+      {
+        best_len = len;
+        best_start = start;
+      }
+    }
+    else
+    {
+      len = 0;
+    }
+  }
+
+  // Wider than a third of the frame is a shadow or the edge of the floor
+  if (best_len == 0 || best_len > width / 3)
+  {
+    return -1;
+  }
+  return 2 * best_start + best_len;
+}
+
+LineFit fitLine(const uint8_t *gray, uint16_t width, uint16_t height, uint16_t stride, uint16_t first_row,
+                uint16_t look_ahead_row)
+{
+  LineFit fit = {false, 0, 0, 0};
+
+  // Least squares x = a + b * y over the rows the line was found in, x in
+  // half pixels
+  int32_t n = 0;
+  int64_t sum_x = 0;
+  int64_t sum_y = 0;
+  int64_t sum_xy = 0;
+  int64_t sum_yy = 0;
+  for (uint16_t y = first_row; y < height; y += LineRowStep)
+  {
+    int16_t x = lineCenter(gray + (uint32_t)y * stride, width);
+    if (x < 0)
+    {
+      continue;
+    }
+    n++;
+    sum_x += x;
+    sum_y += y;
+    sum_xy += (int32_t)x * y;
+    sum_yy += (int32_t)y * y;
+  }
+
+  int64_t den = n * sum_yy - sum_y * sum_y;
+  if (n < LineMinRows || den == 0)
+  {
+    return fit;
+  }
+
+  // Slope in half pixels per row, 8 fractional bits
+  int64_t slope = ((n * sum_xy - sum_x * sum_y) << 8) / den;
+  // Half pixel position at the look-ahead row, relative to the centre
+  int64_t x = (sum_x * 256 + slope * ((int64_t)look_ahead_row * n - sum_y)) / (n * 256) - width;
+
+  int64_t offset = x * 127 / width;
+  // Going up the image is towards decreasing y, 1/64 pixels per row
+  int64_t heading = -slope / 8;
+
+  fit.found = true;
+  fit.offset = offset < -127 ? -127 : offset > 127 ? 127 : offset;
+  fit.heading = heading < -127 ? -127 : heading > 127 ? 127 : heading;
+  fit.rows = n > 255 ? 255 : n;
+  return fit;
+}
+
+} // namespace vision
@@ -0,0 +1,40 @@
+#ifndef LINE_VISION_H
+#define LINE_VISION_H
+
+// Finds a dark line on a light floor in a small grayscale image and fits a
+// straight line through it, integer arithmetic only. Shared by the ESP32-CAM
+// and the host tools, C++11 without Arduino dependencies.
+
+#include <stdint.h>
+
+namespace vision
+{
+
+struct LineFit
+{
+  bool found;
+  int8_t offset;  // line position at the look-ahead row, -127 left edge .. 127 right edge
+  int8_t heading; // columns the line moves right per row going up, 1/64 units
+  uint8_t rows;   // rows the line was found in
+};
+
+// Darkest pixel must be this far below the row mean for the row to count
+const uint8_t LineMinContrast = 24;
+// Fewer rows than this is noise, not a line
+const uint8_t LineMinRows = 4;
+// Every other row is enough for the fit
+const uint8_t LineRowStep = 2;
+
+// Scans the rows from first_row down to the bottom of the image. The fit is
+// evaluated at look_ahead_row, usually first_row, which lies furthest ahead
+// of the car.
+LineFit fitLine(const uint8_t *gray, uint16_t width, uint16_t height, uint16_t stride, uint16_t first_row,
+                uint16_t look_ahead_row);
+
+// Centre of the dark run in one row in half pixels from the left edge, -1
+// when the row has none
+int16_t lineCenter(const uint8_t *row, uint16_t width);
+
+} // namespace vision
+
+#endif
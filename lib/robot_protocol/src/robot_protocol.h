@@ -0,0 +1,404 @@
+#ifndef ROBOT_PROTOCOL_H
+#define ROBOT_PROTOCOL_H
+
+// Serial protocol between the ESP32-CAM and the Arduino UNO. Header only and
+// C++11 so that both firmware targets and host tools can include it.
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace protocol
+{
+
+// Every frame ends with this byte
+const uint8_t FrameTail = 0x5A;
+
+// ---------------------------------------------------------------------------
+// Command frames, ESP32 -> UNO: FrameHeader, command, FrameTail
+
+const uint8_t FrameHeader = 0xA5;
+
+enum Command : uint8_t
+{
+  Stop = 0,
+  Forward = 92,
+  Backward = 163,
+  Turn_Left = 149,    // left translation
+  Turn_Right = 106,   // right translation
+  Top_Left = 20,      // upper left mobile
+  Bottom_Left = 129,  // lower left mobile
+  Top_Right = 72,     // upper right mobile
+  Bottom_Right = 34,  // lower right move
+  Clockwise = 83,     // rotate clockwise
+  Contrarotate = 172, // counterclockwise rotation
+
+  Mode1 = 25, // remote control
+  Mode2 = 26, // obstacle avoidance
+  Mode3 = 27, // follow
+  Mode4 = 28, // line tracking
+
+  MotorLeft = 230,  // servo turn left
+  MotorRight = 231, // servo turn right
+
+  ProfileQuery = 240, // UNO prints its loop timing report
+  ProfileReset = 241, // UNO clears its loop timing statistics
+
+  TraceStart = 242, // UNO starts streaming trace frames
+  TraceStop = 243,  // UNO stops streaming trace frames
+};
+
+// The UNO prints its ProfileQuery report as text lines between these two
+const char ProfileReportBegin[] = "profile begin";
+const char ProfileReportEnd[] = "profile end";
+
+struct CommandFrame
+{
+  uint8_t header;
+  uint8_t command;
+  uint8_t tail;
+};
+
+constexpr CommandFrame encodeCommand(uint8_t command)
+{
+  return CommandFrame{FrameHeader, command, FrameTail};
+}
+
+constexpr bool isCommandFrame(const uint8_t *frame)
+{
+  return frame[0] == FrameHeader && frame[2] == FrameTail;
+}
+
+// Index of the mode selected by a command, -1 for other commands
+constexpr int8_t modeIndex(uint8_t command)
+{
+  return command >= Mode1 && command <= Mode4 ? command - Mode1 : -1;
+}
+
+// ---------------------------------------------------------------------------
+// Drive directions and the pattern each one latches into the 74HC595
+
+enum Direction : uint8_t
+{
+  Dir_Stop,
+  Dir_Forward,
+  Dir_Backward,
+  Dir_Turn_Left,
+  Dir_Turn_Right,
+  Dir_Top_Left,
+  Dir_Bottom_Left,
+  Dir_Top_Right,
+  Dir_Bottom_Right,
+  Dir_Clockwise,
+  Dir_Contrarotate,
+  Direction_Count
+};
+
+constexpr uint8_t DirectionMask[Direction_Count] = {
+    0,   // Dir_Stop
+    92,  // Dir_Forward
+    163, // Dir_Backward
+    149, // Dir_Turn_Left
+    106, // Dir_Turn_Right
+    20,  // Dir_Top_Left
+    129, // Dir_Bottom_Left
+    72,  // Dir_Top_Right
+    34,  // Dir_Bottom_Right
+    83,  // Dir_Clockwise
+    172, // Dir_Contrarotate
+};
+
+// Drive command for each direction, in Direction order
+constexpr uint8_t DirectionCommand[Direction_Count] = {
+    Stop, Forward, Backward, Turn_Left, Turn_Right, Top_Left,
+    Bottom_Left, Top_Right, Bottom_Right, Clockwise, Contrarotate};
+
+// Direction driven by a command, -1 for commands that do not drive
+constexpr int8_t commandDirection(uint8_t command, uint8_t index = 0)
+{
+  return index >= Direction_Count              ? -1
+         : DirectionCommand[index] == command ? (int8_t)index
+                                              : commandDirection(command, index + 1);
+}
+
+// ---------------------------------------------------------------------------
+// Parameter frames, ESP32 -> UNO: parameter id, value, FrameTail
+
+enum Parameter : uint8_t
+{
+  LineKp = 0xB0,    // line follower proportional gain
+  LineKi = 0xB1,    // line follower integral gain
+  LineKd = 0xB2,    // line follower derivative gain
+  LineSpeed = 0xB3, // line follower base speed
+};
+
+struct ParameterFrame
+{
+  uint8_t id;
+  uint8_t value;
+  uint8_t tail;
+};
+
+constexpr ParameterFrame encodeParameter(uint8_t id, uint8_t value)
+{
+  return ParameterFrame{id, value, FrameTail};
+}
+
+constexpr bool isParameterFrame(const uint8_t *frame)
+{
+  return frame[0] >= LineKp && frame[0] <= LineSpeed && frame[2] == FrameTail;
+}
+
+// ---------------------------------------------------------------------------
+// Vision frames, ESP32 -> UNO: id, value, FrameTail
+//
+// VisionLine: where the camera sees the line ahead of the car, 1 (full
+// left) .. 255 (full right) with 128 straight ahead.
+// VisionTarget: the colour target the camera tracks, bearing and apparent
+// size in one byte so the pair cannot be split: bits 7..3 hold bearing / 8
+// + 16 (1 .. 31), bits 2..0 size / VisionTargetSizeStep, 255 fills the frame.
+//
+// VisionNone when nothing is in view.
+
+const uint8_t VisionLine = 0xB8;
+const uint8_t VisionTarget = 0xB9;
+const uint8_t VisionNone = 0;
+const uint8_t VisionTargetSizeStep = 32;
+
+// The UNO reads its RX buffer once per loop pass, which takes about 40 ms in
+// follow mode while the sonar waits for its echo. Each kind of vision frame
+// is sent at most this often, so a pass finds one of each at most.
+const uint8_t VisionIntervalMs = 40;
+
+constexpr uint8_t encodeVisionPosition(bool found, int8_t position)
+{
+  return found ? (uint8_t)(128 + (position < -127 ? -127 : position)) : VisionNone;
+}
+
+constexpr ParameterFrame encodeVisionLine(bool found, int8_t offset)
+{
+  return ParameterFrame{VisionLine, encodeVisionPosition(found, offset), FrameTail};
+}
+
+constexpr uint8_t encodeVisionTargetValue(int8_t bearing, uint8_t size)
+{
+  return (uint8_t)((((bearing < -120 ? -120 : bearing) / 8 + 16) << 3) | size / VisionTargetSizeStep);
+}
+
+constexpr ParameterFrame encodeVisionTarget(bool found, int8_t bearing, uint8_t size)
+{
+  return ParameterFrame{VisionTarget, found ? encodeVisionTargetValue(bearing, size) : VisionNone, FrameTail};
+}
+
+constexpr bool isVisionFrame(const uint8_t *frame)
+{
+  return frame[0] >= VisionLine && frame[0] <= VisionTarget && frame[2] == FrameTail;
+}
+
+// Position -127 .. 127 from a VisionLine frame that is not VisionNone
+constexpr int8_t visionOffset(const uint8_t *frame)
+{
+  return (int8_t)(frame[1] - 128);
+}
+
+// Bearing -120 .. 120 in steps of 8 from a VisionTarget frame that is not
+// VisionNone
+constexpr int8_t visionTargetBearing(const uint8_t *frame)
+{
+  return (int8_t)(((frame[1] >> 3) - 16) * 8);
+}
+
+// Apparent size, the middle of its VisionTargetSizeStep
+constexpr uint8_t visionTargetSize(const uint8_t *frame)
+{
+  return (frame[1] & 7) * VisionTargetSizeStep + VisionTargetSizeStep / 2;
+}
+
+// First byte of every ESP32 -> UNO frame, the UNO skips anything else until
+// one comes along
+constexpr bool isFrameStart(uint8_t c)
+{
+  return c == FrameHeader || (c >= LineKp && c <= LineSpeed) || (c >= VisionLine && c <= VisionTarget);
+}
+
+// ---------------------------------------------------------------------------
+// Radar frames, UNO -> ESP32: RadarHeader, sector, distance (LE), FrameTail
+
+const uint8_t RadarHeader = 0xD0;
+
+// Layout of the sweep scanner map, sector 0 is full right
+const uint8_t RadarSectors = 17;
+const uint8_t RadarFirstAngle = 10;
+const uint8_t RadarSectorWidth = 10;
+
+struct RadarFrame
+{
+  uint8_t header;
+  uint8_t sector;
+  uint8_t distanceLow;
+  uint8_t distanceHigh;
+  uint8_t tail;
+};
+
+constexpr RadarFrame encodeRadar(uint8_t sector, uint16_t distance)
+{
+  return RadarFrame{RadarHeader, sector, (uint8_t)(distance & 0xFF), (uint8_t)(distance >> 8), FrameTail};
+}
+
+constexpr bool isRadarFrame(const uint8_t *frame)
+{
+  return frame[0] == RadarHeader && frame[1] < RadarSectors && frame[4] == FrameTail;
+}
+
+constexpr uint16_t radarDistance(const uint8_t *frame)
+{
+  return frame[2] | (frame[3] << 8);
+}
+
+// ---------------------------------------------------------------------------
+// Trace frames, UNO -> ESP32: TraceHeader, kind, time (ms, LE), three values
+// (LE), FrameTail. The time is millis() truncated to 16 bits, receivers
+// unwrap it against the previous frame.
+
+const uint8_t TraceHeader = 0xD1;
+
+enum TraceKind : uint8_t
+{
+  Trace_Mode,    // tracing started: mode index
+  Trace_Command, // command frame received: command
+  Trace_Range,   // ultrasonic reading: cm
+  Trace_Line,    // line sensors: left, center, right
+  Trace_Drive,   // motor output changed: 74HC595 pattern, left PWM, right PWM
+  Trace_Kinds
+};
+
+struct TraceFrame
+{
+  uint8_t header;
+  uint8_t kind;
+  uint8_t timeLow;
+  uint8_t timeHigh;
+  uint8_t value[6];
+  uint8_t tail;
+};
+
+constexpr TraceFrame encodeTrace(uint8_t kind, uint16_t time, uint16_t a, uint16_t b = 0, uint16_t c = 0)
+{
+  return TraceFrame{TraceHeader,
+                    kind,
+                    (uint8_t)(time & 0xFF),
+                    (uint8_t)(time >> 8),
+                    {(uint8_t)(a & 0xFF), (uint8_t)(a >> 8), (uint8_t)(b & 0xFF), (uint8_t)(b >> 8),
+                     (uint8_t)(c & 0xFF), (uint8_t)(c >> 8)},
+                    FrameTail};
+}
+
+constexpr bool isTraceFrame(const uint8_t *frame)
+{
+  return frame[0] == TraceHeader && frame[1] < Trace_Kinds && frame[10] == FrameTail;
+}
+
+constexpr uint16_t traceTime(const uint8_t *frame)
+{
+  return frame[2] | (frame[3] << 8);
+}
+
+constexpr uint16_t traceValue(const uint8_t *frame, uint8_t index)
+{
+  return frame[4 + 2 * index] | (frame[5 + 2 * index] << 8);
+}
+
+// Names used in the CSV traces
+constexpr const char *traceKindName(uint8_t kind)
+{
+  return kind == Trace_Mode      ? "mode"
+         : kind == Trace_Command ? "command"
+         : kind == Trace_Range   ? "range"
+         : kind == Trace_Line    ? "line"
+         : kind == Trace_Drive   ? "drive"
+                                 : "?";
+}
+
+// ---------------------------------------------------------------------------
+// Ack frames, UNO -> ESP32: AckHeader, command, FrameTail. Sent for every
+// command frame at the end of the loop pass that acted on it, so the time
+// from writing the command to the ack covers the motor output as well.
+
+const uint8_t AckHeader = 0xD2;
+
+constexpr CommandFrame encodeAck(uint8_t command)
+{
+  return CommandFrame{AckHeader, command, FrameTail};
+}
+
+constexpr bool isAckFrame(const uint8_t *frame)
+{
+  return frame[0] == AckHeader && frame[2] == FrameTail;
+}
+
+// ---------------------------------------------------------------------------
+// Frame layout checks
+
+static_assert(sizeof(CommandFrame) == 3, "command frames are 3 bytes on the wire");
+static_assert(offsetof(CommandFrame, command) == 1, "command byte follows the header");
+static_assert(sizeof(ParameterFrame) == 3, "parameter frames are 3 bytes on the wire");
+static_assert(offsetof(ParameterFrame, value) == 1, "value byte follows the parameter id");
+static_assert(sizeof(RadarFrame) == 5, "radar frames are 5 bytes on the wire");
+static_assert(offsetof(RadarFrame, distanceLow) == 2, "distance follows the sector");
+
+static_assert(sizeof(TraceFrame) == 11, "trace frames are 11 bytes on the wire");
+static_assert(offsetof(TraceFrame, value) == 4 && offsetof(TraceFrame, tail) == 10, "trace values follow the time");
+
+static_assert(RadarHeader != FrameHeader && RadarHeader >= 0x80, "radar frames must not look like text or commands");
+static_assert(TraceHeader != FrameHeader && TraceHeader != RadarHeader && TraceHeader >= 0x80,
+              "trace frames must not look like text, commands or radar frames");
+static_assert(AckHeader != FrameHeader && AckHeader != RadarHeader && AckHeader != TraceHeader && AckHeader >= 0x80,
+              "ack frames must not look like text, commands, radar or trace frames");
+static_assert(LineKp != FrameHeader && LineKp >= 0x80, "parameter frames must not look like text or commands");
+static_assert(VisionLine > LineSpeed && VisionTarget < RadarHeader && VisionTarget < TraceHeader,
+              "vision frames must not look like parameter, radar or trace frames");
+static_assert(RadarFirstAngle + (RadarSectors - 1) * RadarSectorWidth <= 180, "sweep exceeds the servo range");
+
+// Drive commands are sent as their own 74HC595 pattern
+static_assert(DirectionMask[Dir_Forward] == Forward && DirectionMask[Dir_Backward] == Backward &&
+                  DirectionMask[Dir_Turn_Left] == Turn_Left && DirectionMask[Dir_Turn_Right] == Turn_Right &&
+                  DirectionMask[Dir_Top_Left] == Top_Left && DirectionMask[Dir_Bottom_Left] == Bottom_Left &&
+                  DirectionMask[Dir_Top_Right] == Top_Right && DirectionMask[Dir_Bottom_Right] == Bottom_Right &&
+                  DirectionMask[Dir_Clockwise] == Clockwise && DirectionMask[Dir_Contrarotate] == Contrarotate &&
+                  DirectionMask[Dir_Stop] == Stop,
+              "drive commands and 74HC595 patterns must match");
+
+static_assert(commandDirection(Forward) == Dir_Forward && commandDirection(Contrarotate) == Dir_Contrarotate &&
+                  commandDirection(Stop) == Dir_Stop && commandDirection(Mode1) == -1 &&
+                  commandDirection(MotorLeft) == -1 && commandDirection(ProfileQuery) == -1,
+              "command to direction lookup");
+static_assert(modeIndex(Mode1) == 0 && modeIndex(Mode4) == 3 && modeIndex(Forward) == -1, "mode lookup");
+
+static_assert(encodeCommand(Forward).header == FrameHeader && encodeCommand(Forward).command == Forward &&
+                  encodeCommand(Forward).tail == FrameTail,
+              "command frame encoding");
+static_assert(encodeAck(Forward).header == AckHeader && encodeAck(Forward).command == Forward &&
+                  encodeAck(Forward).tail == FrameTail,
+              "ack frame encoding");
+static_assert(encodeRadar(3, 0x1234).distanceLow == 0x34 && encodeRadar(3, 0x1234).distanceHigh == 0x12 &&
+                  encodeRadar(3, 0x1234).tail == FrameTail,
+              "radar frame encoding");
+static_assert(encodeVisionLine(true, -127).value == 1 && encodeVisionLine(true, 127).value == 255 &&
+                  encodeVisionLine(true, 0).value == 128 && encodeVisionLine(false, 5).value == VisionNone,
+              "vision line encoding");
+static_assert(encodeVisionTarget(false, 40, 200).value == VisionNone && encodeVisionTarget(true, -128, 0).value == 8 &&
+                  encodeVisionTarget(true, 127, 255).value == 255 && encodeVisionTarget(true, 0, 0).value == 128,
+              "vision target encoding, never VisionNone when found");
+constexpr uint8_t VisionTargetCheck[3] = {VisionTarget, encodeVisionTargetValue(-40, 100), FrameTail};
+static_assert(visionTargetBearing(VisionTargetCheck) == -40 && visionTargetSize(VisionTargetCheck) == 112,
+              "vision target decoding");
+static_assert(isFrameStart(FrameHeader) && isFrameStart(LineSpeed) && isFrameStart(VisionTarget) &&
+                  !isFrameStart(FrameTail) && !isFrameStart('9') && !isFrameStart(VisionNone),
+              "frame starts");
+static_assert(encodeTrace(Trace_Line, 0x0102, 0x0304, 5, 6).timeHigh == 0x01 &&
+                  encodeTrace(Trace_Line, 0x0102, 0x0304, 5, 6).value[1] == 0x03 &&
+                  encodeTrace(Trace_Line, 0x0102, 0x0304, 5, 6).value[4] == 6,
+              "trace frame encoding");
+
+} // namespace protocol
+
+#endif
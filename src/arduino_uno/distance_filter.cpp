@@ -0,0 +1,72 @@
+#include "distance_filter.h"
+
+// Consecutive outliers after which the jump is taken as a real change
+static const uint8_t Max_Rejected = 3;
+// The filtered distance is stale after this long without a good sample
+static const unsigned long Stale_Ms = 300;
+// Weight of a new sample in the velocity estimate
+static const float Velocity_Alpha = 0.3;
+
+DistanceFilter::DistanceFilter(float max_range, float max_jump) {
+    _max_range = max_range;
+    _max_jump = max_jump;
+    reset();
+}
+
+void DistanceFilter::reset() {
+    _count = 0;
+    _next = 0;
+    _rejected = 0;
+    _distance = 0;
+    _velocity = 0;
+    _last_valid = 0;
+}
+
+bool DistanceFilter::add(float distance, unsigned long now_ms) {
+    // SR04() turns a missing echo into the timeout distance, 30000 / 58 or
+    // about 517 cm, which is beyond any _max_range; below 2 cm the sensor
+    // cannot measure
+    if (distance < 2 || distance > _max_range)
+        return false;
+
+    if (_count == Window && fabs(distance - _distance) > _max_jump) {
+        if (++_rejected < Max_Rejected)
+            return false;
+        // The target really moved, restart from the new distance
+        _count = 0;
+        _next = 0;
+        _velocity = 0;
+    }
+    _rejected = 0;
+
+    _samples[_next] = distance;
+    _next = (_next + 1) % Window;
+    if (_count < Window)
+        _count++;
+
+    float filtered = median();
+    if (_count > 1 && _last_valid != 0 && now_ms > _last_valid) {
+        float speed = (filtered - _distance) * 1000.0 / (now_ms - _last_valid);
+        _velocity += (speed - _velocity) * Velocity_Alpha;
+    }
+    _distance = filtered;
+    _last_valid = now_ms;
+    return true;
+}
+
+bool DistanceFilter::valid(unsigned long now_ms) const {
+    return _count > 0 && now_ms - _last_valid <= Stale_Ms;
+}
+
+float DistanceFilter::median() const {
+    float sorted[Window];
+    for (uint8_t i = 0; i < _count; i++) {
+        uint8_t j = i;
+        while (j > 0 && sorted[j - 1] > _samples[i]) {
+            sorted[j] = sorted[j - 1];
+            j--;
+        }
+        sorted[j] = _samples[i];
+    }
+    return sorted[_count / 2];
+}
@@ -0,0 +1,39 @@
+#ifndef DISTANCE_FILTER_H
+#define DISTANCE_FILTER_H
+
+#include <Arduino.h>
+
+// Median-of-N filter for the ultrasonic sensor with outlier rejection and a
+// smoothed estimate of how fast the distance is changing.
+class DistanceFilter {
+public:
+    static const uint8_t Window = 5;
+
+    DistanceFilter(float max_range, float max_jump);
+    void reset();
+
+    // Returns false when the sample was rejected
+    bool add(float distance, unsigned long now_ms);
+
+    bool valid(unsigned long now_ms) const;
+    float distance() const { return _distance; }
+    // cm/s, positive when the target moves away
+    float velocity() const { return _velocity; }
+
+private:
+    float _max_range;
+    float _max_jump;
+
+    float _samples[Window];
+    uint8_t _count;
+    uint8_t _next;
+    uint8_t _rejected;
+
+    float _distance;
+    float _velocity;
+    unsigned long _last_valid;
+
+    float median() const;
+};
+
+#endif
@@ -0,0 +1,124 @@
+#include "line_follower.h"
+
+// Readings at or above this value are on the black line
+static const int Black_Line = 400;
+// Readings below this value carry no weight in the position estimate
+static const int White_Level = 200;
+// Keeps the integral term from winding up while the car is off the line
+static const long Integral_Limit = 20000;
+// The PID runs once per step, a pass of model4 takes far less. Steps missed
+// while the loop was busy stretch dt, they never shrink it.
+static const int Step_Ms = 10;
+
+LineFollower::LineFollower(uint8_t left_pin, uint8_t center_pin, uint8_t right_pin) {
+    _left_pin = left_pin;
+    _center_pin = center_pin;
+    _right_pin = right_pin;
+
+    _kp = 64;
+    _ki = 0;
+    _kd = 16;
+    _base_speed = 250;
+
+    reset();
+}
+
+void LineFollower::begin() {
+    pinMode(_left_pin, INPUT);
+    pinMode(_center_pin, INPUT);
+    pinMode(_right_pin, INPUT);
+}
+
+void LineFollower::reset() {
+    _position = 0;
+    _last_error = 0;
+    _integral = 0;
+    _last_update = 0;
+    _left_speed = 0;
+    _right_speed = 0;
+    _readings[0] = 0;
+    _readings[1] = 0;
+    _readings[2] = 0;
+    _vision_found = false;
+    _vision_position = 0;
+    _vision_time = 0;
+}
+
+void LineFollower::setGains(uint8_t kp, uint8_t ki, uint8_t kd) {
+    _kp = kp;
+    _ki = ki;
+    _kd = kd;
+    _integral = 0;
+}
+
+void LineFollower::setBaseSpeed(uint8_t speed) {
+    _base_speed = speed;
+}
+
+void LineFollower::setVision(bool found, int position, unsigned long now_ms) {
+    _vision_found = found;
+    _vision_position = constrain(position, -PositionRange, PositionRange);
+    _vision_time = now_ms;
+}
+
+bool LineFollower::visionFresh(unsigned long now_ms) const {
+    return _vision_found && _vision_time != 0 && now_ms - _vision_time < VisionMaxAge;
+}
+
+LineFollower::State LineFollower::update(unsigned long now_ms) {
+    int left = analogRead(_left_pin);
+    int center = analogRead(_center_pin);
+    int right = analogRead(_right_pin);
+    _readings[0] = left;
+    _readings[1] = center;
+    _readings[2] = right;
+
+    bool left_black = left >= Black_Line;
+    bool center_black = center >= Black_Line;
+    bool right_black = right >= Black_Line;
+
+    if (left_black && center_black && right_black) {
+        _integral = 0;
+        _last_update = 0;
+        _left_speed = 0;
+        _right_speed = 0;
+        return CrossLine;
+    }
+
+    if (!left_black && !center_black && !right_black) {
+        // Keep _position so the spin goes towards where the line was last
+        // seen, unless the camera still sees it ahead
+        _integral = 0;
+        _last_update = 0;
+        if (visionFresh(now_ms))
+            return _vision_position < 0 ? LostLeft : LostRight;
+        return _position < 0 ? LostLeft : LostRight;
+    }
+
+    // Weighted average of the three sensors at -1000, 0 and 1000
+    long w_left = left > White_Level ? left - White_Level : 0;
+    long w_center = center > White_Level ? center - White_Level : 0;
+    long w_right = right > White_Level ? right - White_Level : 0;
+    _position = (int)((w_right - w_left) * PositionRange / (w_left + w_center + w_right));
+
+    int error = _position;
+    // The camera sees where the line goes, the sensors where the car is
+    if (visionFresh(now_ms))
+        error = (int)(((long)_position * (64 - VisionWeight) + (long)_vision_position * VisionWeight) >> 6);
+    long derivative = 0;
+    if (_last_update != 0 && now_ms - _last_update < 100) {
+        unsigned long dt = now_ms - _last_update;
+        if (dt < Step_Ms)
+            return Tracking;
+        _integral = constrain(_integral + (long)error * (long)dt / Step_Ms, -Integral_Limit, Integral_Limit);
+        derivative = (long)(error - _last_error) * Step_Ms / (long)dt;
+    }
+    _last_error = error;
+    _last_update = now_ms;
+
+    long correction = ((long)_kp * error + (long)_ki * (_integral >> 4) + (long)_kd * derivative) >> GainShift;
+
+    _left_speed = constrain((long)_base_speed + correction, 0L, 255L);
+    _right_speed = constrain((long)_base_speed - correction, 0L, 255L);
+    return Tracking;
+}
@@ -0,0 +1,74 @@
+#ifndef LINE_FOLLOWER_H
+#define LINE_FOLLOWER_H
+
+#include <Arduino.h>
+
+// Estimates the line position from the three analog tracking sensors and
+// steers with a PID controller on the differential wheel speed.
+class LineFollower {
+public:
+    enum State {
+        Tracking,  // line under the sensors, use leftSpeed()/rightSpeed()
+        LostLeft,  // line last seen on the left, spin counterclockwise
+        LostRight, // line last seen on the right, spin clockwise
+        CrossLine  // all three sensors on black, stop
+    };
+
+    // Position is reported in the range -1000 (left sensor) .. 1000 (right sensor)
+    static const int PositionRange = 1000;
+    // Gains are fixed point with this many fractional bits (16 == 0.25)
+    static const int GainShift = 6;
+    // Share of the camera's look-ahead position in the steering error, of 64
+    static const int VisionWeight = 24;
+    // Camera positions older than this are ignored
+    static const unsigned long VisionMaxAge = 150; // ms
+
+    LineFollower(uint8_t left_pin, uint8_t center_pin, uint8_t right_pin);
+    void begin();
+    void reset();
+
+    // Runtime tuning, gains are in 1/64 units
+    void setGains(uint8_t kp, uint8_t ki, uint8_t kd);
+    void setBaseSpeed(uint8_t speed);
+    uint8_t kp() const { return _kp; }
+    uint8_t ki() const { return _ki; }
+    uint8_t kd() const { return _kd; }
+    uint8_t baseSpeed() const { return _base_speed; }
+
+    // Line position the ESP32-CAM sees ahead of the car, same range as
+    // position(). found is false when the camera has no line in view.
+    void setVision(bool found, int position, unsigned long now_ms);
+
+    State update(unsigned long now_ms);
+    int position() const { return _position; }
+    int leftSpeed() const { return _left_speed; }
+    int rightSpeed() const { return _right_speed; }
+    // Raw sensor values from the last update(), 0 left .. 2 right
+    int reading(uint8_t sensor) const { return _readings[sensor]; }
+
+private:
+    uint8_t _left_pin;
+    uint8_t _center_pin;
+    uint8_t _right_pin;
+
+    uint8_t _kp;
+    uint8_t _ki;
+    uint8_t _kd;
+    uint8_t _base_speed;
+
+    int _position;
+    int _last_error;
+    long _integral;
+    unsigned long _last_update;
+    int _left_speed;
+    int _right_speed;
+    int _readings[3];
+
+    bool _vision_found;
+    int _vision_position;
+    unsigned long _vision_time;
+
+    bool visionFresh(unsigned long now_ms) const;
+};
+
+#endif
@@ -0,0 +1,89 @@
+#include "loop_profiler.h"
+
+#ifdef LOOP_PROFILER
+
+LoopProfiler profiler;
+
+LoopProfiler::LoopProfiler() {
+    reset();
+}
+
+void LoopProfiler::reset() {
+    memset(_modes, 0, sizeof(_modes));
+    memset(_sections, 0, sizeof(_sections));
+    _last_tick = 0;
+    _last_mode = 0;
+}
+
+void LoopProfiler::loopTick(uint8_t mode) {
+    unsigned long now = micros();
+    if (_last_tick != 0 && _last_mode < Modes) {
+        unsigned long period = now - _last_tick;
+        ModeStats &stats = _modes[_last_mode];
+        stats.count++;
+        if (period > stats.max)
+            stats.max = period;
+
+        uint8_t bin = 0;
+        for (unsigned long limit = 1UL << First_Bin_Shift; period >= limit && bin < Bins - 1; limit <<= 1)
+            bin++;
+        if (stats.hist[bin] != 0xFFFF)
+            stats.hist[bin]++;
+    }
+    _last_tick = now;
+    _last_mode = mode;
+}
+
+void LoopProfiler::addSection(Section section, unsigned long us) {
+    SectionStats &stats = _sections[section];
+    stats.count++;
+    stats.total += us;
+    if (us > stats.max)
+        stats.max = us;
+}
+
+void LoopProfiler::report(Print &out) const {
+    static const char *const section_names[Section_Count] = {"rx", "sr04", "drive", "line"};
+
+    for (uint8_t m = 0; m < Modes; m++) {
+        const ModeStats &stats = _modes[m];
+        if (stats.count == 0)
+            continue;
+        out.print(F("mode"));
+        out.print(m + 1);
+        out.print(F(" n="));
+        out.print(stats.count);
+        out.print(F(" max="));
+        out.print(stats.max);
+        out.print(F("us hist<us:"));
+        for (uint8_t b = 0; b < Bins; b++) {
+            if (stats.hist[b] == 0)
+                continue;
+            out.print(' ');
+            if (b == Bins - 1)
+                out.print('>');
+            out.print(1UL << (First_Bin_Shift + (b == Bins - 1 ? b - 1 : b)));
+            out.print('=');
+            out.print(stats.hist[b]);
+        }
+        out.println();
+    }
+
+    for (uint8_t s = 0; s < Section_Count; s++) {
+        const SectionStats &stats = _sections[s];
+        out.print(section_names[s]);
+        out.print(F(" n="));
+        out.print(stats.count);
+        out.print(F(" avg="));
+        out.print(stats.count ? stats.total / stats.count : 0);
+        out.print(F("us max="));
+        out.print(stats.max);
+        out.println(F("us"));
+    }
+}
+
+ProfileScope::~ProfileScope() {
+    profiler.addSection(_section, micros() - _start);
+}
+
+#endif
@@ -0,0 +1,83 @@
+#ifndef LOOP_PROFILER_H
+#define LOOP_PROFILER_H
+
+#include <Arduino.h>
+
+// Loop timing instrumentation, compiled in with -DLOOP_PROFILER. Without the
+// flag the PROFILE_* macros expand to nothing.
+
+enum ProfileSection {
+    Section_RX,    // RXpack_func
+    Section_SR04,  // ultrasonic ranging
+    Section_Drive, // MecanumMotor::drive
+    Section_Line,  // model4_func decision
+    Section_Count
+};
+
+#ifdef LOOP_PROFILER
+
+class LoopProfiler {
+public:
+    typedef ProfileSection Section;
+
+    static const uint8_t Modes = 4;
+    // Bin 0 counts loop periods below 128 us, each next bin doubles the
+    // limit and the last one takes everything from about 2 s up
+    static const uint8_t Bins = 16;
+    static const uint8_t First_Bin_Shift = 7;
+
+    LoopProfiler();
+    void reset();
+
+    // Call once at the top of loop(), the period is charged to the mode the
+    // previous iteration ran in
+    void loopTick(uint8_t mode);
+    void addSection(Section section, unsigned long us);
+
+    void report(Print &out) const;
+
+private:
+    struct ModeStats {
+        uint32_t count;
+        uint32_t max;
+        uint16_t hist[Bins];
+    };
+    struct SectionStats {
+        uint32_t count;
+        uint32_t total;
+        uint32_t max;
+    };
+
+    ModeStats _modes[Modes];
+    SectionStats _sections[Section_Count];
+    unsigned long _last_tick;
+    uint8_t _last_mode;
+};
+
+class ProfileScope {
+public:
+    ProfileScope(LoopProfiler::Section section) : _section(section), _start(micros()) {}
+    ~ProfileScope();
+
+private:
+    LoopProfiler::Section _section;
+    unsigned long _start;
+};
+
+extern LoopProfiler profiler;
+
+#define PROFILE_LOOP(mode) profiler.loopTick(mode)
+#define PROFILE_SECTION(section) ProfileScope _profile_scope(section)
+#define PROFILE_REPORT(out) profiler.report(out)
+#define PROFILE_RESET() profiler.reset()
+
+#else
+
+#define PROFILE_LOOP(mode)
+#define PROFILE_SECTION(section)
+#define PROFILE_REPORT(out)
+#define PROFILE_RESET()
+
+#endif
+
+#endif
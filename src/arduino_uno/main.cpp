@@ -1,6 +1,12 @@
 #include <Arduino.h>
-#include <Servo.h>
+#include <robot_protocol.h>
 #include "mecanum_motor.h"
+#include "servo_motion.h"
+#include "sweep_scanner.h"
+#include "line_follower.h"
+#include "distance_filter.h"
+#include "loop_profiler.h"
+#include "trace_recorder.h"
 
 // servo control pin
 #define MOTOR_PIN 9
@@ -15,6 +21,8 @@
 // 超声波控制引脚
 #define Trig_PIN 12
 #define Echo_PIN 13
+// Echo timeout, a little over the 4 m range of the sensor
+#define ECHO_TIMEOUT_US 30000
 // 循迹控制引脚
 #define LEFT_LINE_TRACKING A0
 #define CENTER_LINE_TRACKING A1
@@ -22,48 +30,96 @@
 
 // Function declarations
 void RXpack_func();
+void RXframe_func(const byte *frame);
+void TXradar_func(uint8_t bin);
+void setParameter(byte param, byte value);
+void setVision(const byte *frame);
 void model1_func(byte orders);
 void model2_func();
+void avoid_reset();
 void model3_func();
 void model4_func();
 void motorleft();
 void motorright();
 float SR04(int Trig, int Echo);
+float ranging();
 
-Servo MOTORservo;
+// Obstacle avoidance steers from the sweep map while driving
+enum AvoidState
+{
+  Avoid_Cruise,  // driving forward while the scanner sweeps
+  Avoid_Maneuver // running one of the escape plans below
+};
+
+struct AvoidStep
+{
+  byte direction;
+  byte speed;
+  uint16_t ms;
+};
 
-const int Mode1 = 25;      // model1
-const int Mode2 = 26;      // model2
-const int Mode3 = 27;      // model3
-const int Mode4 = 28;      // model4
-const int MotorLeft = 230;  // servo turn left
-const int MotorRight = 231; // servo turn right
+const AvoidStep Avoid_Boxed_In[] = {
+    {MecanumMotor::Backward, 180, 1000},
+    {MecanumMotor::Contrarotate, 250, 500}};
 
-int Left_Tra_Value;
-int Center_Tra_Value;
-int Right_Tra_Value;
-int Black_Line = 400;
+// Readings ahead are shortened by what the car has covered since, so they
+// can be older than one sweep of the scanner
+const unsigned long Avoid_Max_Age = 1000; // ms, older map readings are ignored
+const int Avoid_Ahead = 25;               // cm, closer obstacles in the path start a turn
+const uint8_t Avoid_Half_Width = 12;      // cm, half the car's width and a margin
+const uint16_t Avoid_Cruise_Speed = 60;   // cm/s at 250 PWM
+const int Avoid_Min_Room = 20;            // cm, headings with less room are blocked
+const int Avoid_Too_Close = 10;           // cm, back off before turning
+const uint8_t Avoid_Ms_Per_Degree = 5;    // rotation time at 250 PWM
 
-int leftDistance = 0;
-int middleDistance = 0;
-int rightDistance = 0;
+AvoidState avoidState = Avoid_Cruise;
+AvoidStep avoidTurn[2];
+const AvoidStep *avoidPlan = nullptr;
+uint8_t avoidSteps = 0;
+uint8_t avoidStep = 0;
+unsigned long avoidDeadline = 0;
 
 byte RX_package[3] = {0};
-uint16_t angle = 90;
-byte order = MecanumMotor::Stop;
+byte RX_length = 0; // bytes of the frame in RX_package so far
+byte order = protocol::Stop;
 char model_var = 0;
 int UT_distance = 0;
+// Commands to acknowledge once this loop pass has acted on them, more are
+// left for the ESP32 to time out
+const byte Max_Acks = 4;
+byte ackCommands[Max_Acks];
+byte ackCount = 0;
+
+// Follow mode holds the target at this distance with a PD speed controller
+const float Follow_Setpoint = 20; // cm
+const float Follow_Range = 50;    // cm, targets further away are ignored
+const float Follow_Kp = 12;       // PWM per cm of distance error
+const float Follow_Kd = 2;        // PWM per cm/s of target velocity
+const int Follow_Deadband = 40;   // smaller outputs stop the car
+const int Follow_Min_Speed = 120; // PWM needed to get the wheels turning
+
+// The camera's colour target moves the car sideways towards it
+const unsigned long Follow_Target_Max_Age = 200; // ms, older bearings are ignored
+const int Follow_Bearing_Deadband = 16;          // of 127, the target counts as straight ahead
+const uint8_t Follow_Target_Far = 32;            // smaller targets are beyond the ultrasonic range, a size step
+
+int8_t followBearing = 0;
+uint8_t followSize = 0;
+unsigned long followTargetTime = 0; // 0 when the camera has no target
 
 // Create motor instance
 MecanumMotor motor(PWM1_PIN, PWM2_PIN, SHCP_PIN, EN_PIN, DATA_PIN, STCP_PIN);
+ServoMotion scanner(MOTOR_PIN);
+SweepScanner sweep(scanner, ranging);
+LineFollower lineFollower(LEFT_LINE_TRACKING, CENTER_LINE_TRACKING, RIGHT_LINE_TRACKING);
+DistanceFilter followFilter(400, 15);
+TraceRecorder tracer(Serial);
 
 void setup()
 {
   Serial.setTimeout(10);
   Serial.begin(115200);
 
-  MOTORservo.attach(MOTOR_PIN);
-
   pinMode(SHCP_PIN, OUTPUT);
   pinMode(EN_PIN, OUTPUT);
   pinMode(DATA_PIN, OUTPUT);
@@ -74,18 +130,20 @@ void setup()
   pinMode(Trig_PIN, OUTPUT);
   pinMode(Echo_PIN, INPUT);
 
-  pinMode(LEFT_LINE_TRACKING, INPUT);
-  pinMode(CENTER_LINE_TRACKING, INPUT);
-  pinMode(RIGHT_LINE_TRACKING, INPUT);
+  lineFollower.begin();
 
-  MOTORservo.write(angle);
+  scanner.begin(90);
 
   motor.begin();
 }
 
 void loop()
 {
+  PROFILE_LOOP(model_var);
   RXpack_func();
+  scanner.update(millis());
+  if (model_var != 1)
+    sweep.stop();
   switch (model_var)
   {
   case 0:
@@ -101,377 +159,398 @@ void loop()
     model4_func(); // Tracking model
     break;
   }
+  tracer.drive(millis(), motor.direction(), motor.leftSpeed(), motor.rightSpeed());
+  for (byte i = 0; i < ackCount; i++)
+  {
+    protocol::CommandFrame ack = protocol::encodeAck(ackCommands[i]);
+    Serial.write((const uint8_t *)&ack, sizeof(ack));
+  }
+  ackCount = 0;
 }
 
 void model1_func(byte orders)
 {
+  int8_t direction = protocol::commandDirection(orders);
+  if (direction >= 0)
+  {
+    motor.drive(protocol::DirectionMask[direction], direction == protocol::Dir_Stop ? 0 : 180);
+    scanner.stop();
+    return;
+  }
+
   switch (orders)
   {
-  case MecanumMotor::Stop:
-    motor.drive(MecanumMotor::Stop, 0);
-    break;
-  case MecanumMotor::Forward:
-    motor.drive(MecanumMotor::Forward, 180);
-    break;
-  case MecanumMotor::Backward:
-    motor.drive(MecanumMotor::Backward, 180);
-    break;
-  case MecanumMotor::Turn_Left:
-    motor.drive(MecanumMotor::Turn_Left, 180);
-    break;
-  case MecanumMotor::Turn_Right:
-    motor.drive(MecanumMotor::Turn_Right, 180);
-    break;
-  case MecanumMotor::Top_Left:
-    motor.drive(MecanumMotor::Top_Left, 180);
-    break;
-  case MecanumMotor::Top_Right:
-    motor.drive(MecanumMotor::Top_Right, 180);
-    break;
-  case MecanumMotor::Bottom_Left:
-    motor.drive(MecanumMotor::Bottom_Left, 180);
-    break;
-  case MecanumMotor::Bottom_Right:
-    motor.drive(MecanumMotor::Bottom_Right, 180);
-    break;
-  case MecanumMotor::Clockwise:
-    motor.drive(MecanumMotor::Clockwise, 180);
-    break;
-  case MecanumMotor::Contrarotate:
-    motor.drive(MecanumMotor::Contrarotate, 180);
-    break;
-  case MotorLeft:
+  case protocol::MotorLeft:
     motorleft();
     break;
-  case MotorRight:
+  case protocol::MotorRight:
     motorright();
     break;
   default:
     // Serial.println(".");
-    order = MecanumMotor::Stop;
+    order = protocol::Stop;
     motor.drive(MecanumMotor::Stop, 0);
+    scanner.stop();
     break;
   }
 }
 
 void model2_func() // OA
 {
-  MOTORservo.write(90);
-  UT_distance = SR04(Trig_PIN, Echo_PIN);
-  Serial.println(UT_distance);
-  middleDistance = UT_distance;
+  unsigned long now = millis();
 
-  if (middleDistance <= 25)
+  sweep.start();
+  if (sweep.update(now))
+    TXradar_func(sweep.lastBin());
+
+  if (avoidState == Avoid_Maneuver)
   {
-    motor.drive(MecanumMotor::Stop, 0);
-    for (int i = 0; i < 500; i++)
-    {
-      delay(1);
-      RXpack_func();
-      if (model_var != 1)
-        return;
-    }
-    MOTORservo.write(10);
-    for (int i = 0; i < 300; i++)
-    {
-      delay(1);
-      RXpack_func();
-      if (model_var != 1)
-        return;
-    }
-    rightDistance = SR04(Trig_PIN, Echo_PIN); // SR04();
-    Serial.print("rightDistance:  ");
-    Serial.println(rightDistance);
-    MOTORservo.write(90);
-    for (int i = 0; i < 300; i++)
+    if ((long)(now - avoidDeadline) < 0)
+      return;
+    if (++avoidStep < avoidSteps)
     {
-      delay(1);
-      RXpack_func();
-      if (model_var != 1)
-        return;
+      motor.drive(avoidPlan[avoidStep].direction, avoidPlan[avoidStep].speed);
+      avoidDeadline = now + avoidPlan[avoidStep].ms;
+      return;
     }
-    MOTORservo.write(170);
-    for (int i = 0; i < 300; i++)
-    {
-      delay(1);
-      RXpack_func();
-      if (model_var != 1)
-        return;
-    }
-    leftDistance = SR04(Trig_PIN, Echo_PIN); // SR04();
-    Serial.print("leftDistance:  ");
-    Serial.println(leftDistance);
-    MOTORservo.write(90);
-    if ((rightDistance < 20) && (leftDistance < 20))
-    {
+    // The car has turned, the old map no longer matches
+    sweep.clear();
+    avoidState = Avoid_Cruise;
+  }
 
-      motor.drive(MecanumMotor::Backward, 180);
-      for (int i = 0; i < 1000; i++)
-      {
-        delay(1);
-        RXpack_func();
-        if (model_var != 1)
-          return;
-      }
-      motor.drive(MecanumMotor::Contrarotate, 250);
-      for (int i = 0; i < 500; i++)
-      {
-        delay(1);
-        RXpack_func();
-        if (model_var != 1)
-          return;
-      }
-    }
-    else if (rightDistance < leftDistance)
-    {
-      motor.drive(MecanumMotor::Stop, 0);
-      for (int i = 0; i < 100; i++)
-      {
-        delay(1);
-        RXpack_func();
-        if (model_var != 1)
-          return;
-      }
-      motor.drive(MecanumMotor::Backward, 180);
-      for (int i = 0; i < 500; i++)
-      {
-        delay(1);
-        RXpack_func();
-        if (model_var != 1)
-          return;
-      }
-      motor.drive(MecanumMotor::Contrarotate, 250);
-      for (int i = 0; i < 500; i++)
-      {
-        delay(1);
-        RXpack_func();
-        if (model_var != 1)
-          return;
-      }
-    } // turn right
-    else if (rightDistance > leftDistance)
-    {
-      motor.drive(MecanumMotor::Stop, 0);
-      for (int i = 0; i < 500; i++)
-      {
-        delay(1);
-        RXpack_func();
-        if (model_var != 1)
-          return;
-      }
-      motor.drive(MecanumMotor::Backward, 180);
-      for (int i = 0; i < 500; i++)
-      {
-        delay(1);
-        RXpack_func();
-        if (model_var != 1)
-          return;
-      }
-      motor.drive(MecanumMotor::Clockwise, 250);
-      for (int i = 0; i < 500; i++)
-      {
-        delay(1);
-        RXpack_func();
-        if (model_var != 1)
-          return;
-      }
-    }
-    else
-    {
-      motor.drive(MecanumMotor::Backward, 180);
-      for (int i = 0; i < 500; i++)
-      {
-        delay(1);
-        RXpack_func();
-        if (model_var != 1)
-          return;
-      }
-      motor.drive(MecanumMotor::Clockwise, 250);
-      for (int i = 0; i < 500; i++)
-      {
-        delay(1);
-        RXpack_func();
-        if (model_var != 1)
-          return;
-      }
-    }
+  int ahead = sweep.pathClearance(Avoid_Half_Width, Avoid_Cruise_Speed, now, Avoid_Max_Age);
+  if (ahead < 0)
+  {
+    // Wait for the first readings straight ahead
+    motor.drive(MecanumMotor::Stop, 0);
+    return;
   }
-  else
+  if (ahead > Avoid_Ahead)
   {
     motor.drive(MecanumMotor::Forward, 250);
+    return;
+  }
+
+  int room;
+  uint8_t heading = sweep.freestHeading(now, Avoid_Max_Age, room);
+  if (room < Avoid_Min_Room)
+  {
+    avoidPlan = Avoid_Boxed_In;
+    avoidSteps = sizeof(Avoid_Boxed_In) / sizeof(AvoidStep);
   }
+  else
+  {
+    avoidSteps = 0;
+    if (ahead < Avoid_Too_Close)
+    {
+      avoidTurn[avoidSteps].direction = MecanumMotor::Backward;
+      avoidTurn[avoidSteps].speed = 180;
+      avoidTurn[avoidSteps].ms = 300;
+      avoidSteps++;
+    }
+    // Headings below 90 degrees are on the right
+    int offset = (int)heading - 90;
+    if (offset == 0)
+      offset = -SweepScanner::Bin_Width * 2;
+    avoidTurn[avoidSteps].direction = protocol::DirectionMask[offset < 0 ? protocol::Dir_Clockwise : protocol::Dir_Contrarotate];
+    avoidTurn[avoidSteps].speed = 250;
+    avoidTurn[avoidSteps].ms = abs(offset) * Avoid_Ms_Per_Degree;
+    avoidSteps++;
+    avoidPlan = avoidTurn;
+  }
+
+  avoidStep = 0;
+  motor.drive(avoidPlan[0].direction, avoidPlan[0].speed);
+  avoidDeadline = now + avoidPlan[0].ms;
+  avoidState = Avoid_Maneuver;
+}
+
+void avoid_reset()
+{
+  avoidState = Avoid_Cruise;
+  avoidPlan = nullptr;
+  avoidStep = 0;
+  sweep.clear();
 }
 
 void model3_func() // follow model
 {
-  MOTORservo.write(90);
+  scanner.setSpeed(ServoMotion::Max_Speed);
+  scanner.moveTo(90);
   UT_distance = SR04(Trig_PIN, Echo_PIN);
   Serial.println(UT_distance);
-  if (UT_distance < 15)
-  {
-    motor.drive(MecanumMotor::Backward, 200);
-  }
-  else if (15 <= UT_distance && UT_distance <= 20)
-  {
-    motor.drive(MecanumMotor::Stop, 0);
-  }
-  else if (20 <= UT_distance && UT_distance <= 25)
-  {
-    motor.drive(MecanumMotor::Forward, 180);
-  }
-  else if (25 <= UT_distance && UT_distance <= 50)
+
+  unsigned long now = millis();
+  followFilter.add(UT_distance, now);
+
+  // Distance from the ultrasonic sensor, it only sees straight ahead
+  int output = 0;
+  bool in_range = followFilter.valid(now) && followFilter.distance() <= Follow_Range;
+  if (in_range)
   {
-    motor.drive(MecanumMotor::Forward, 220);
+    float error = followFilter.distance() - Follow_Setpoint;
+    output = Follow_Kp * error + Follow_Kd * followFilter.velocity();
+    if (abs(output) < Follow_Deadband)
+      output = 0;
   }
-  else
+
+  // Side from the camera, also when the target left the ultrasonic beam
+  int lateral = 0;
+  bool target = followTargetTime != 0 && now - followTargetTime < Follow_Target_Max_Age;
+  if (target && abs(followBearing) > Follow_Bearing_Deadband)
+    lateral = followBearing;
+  // A target that looks small is too far for the ultrasonic sensor, close in
+  if (target && !in_range && followSize < Follow_Target_Far)
+    output = Follow_Min_Speed;
+
+  if (output == 0 && lateral == 0)
   {
     motor.drive(MecanumMotor::Stop, 0);
+    return;
   }
+
+  // Diagonals when closing in and sliding at once, in Direction order
+  static const uint8_t Moves[3][3] = {
+      {protocol::Dir_Bottom_Left, protocol::Dir_Backward, protocol::Dir_Bottom_Right},
+      {protocol::Dir_Turn_Left, protocol::Dir_Stop, protocol::Dir_Turn_Right},
+      {protocol::Dir_Top_Left, protocol::Dir_Forward, protocol::Dir_Top_Right}};
+  uint8_t move = Moves[output > 0 ? 2 : output < 0 ? 0 : 1][lateral > 0 ? 2 : lateral < 0 ? 0 : 1];
+  int speed = output != 0 ? abs(output) : Follow_Min_Speed + abs(lateral);
+  motor.drive(protocol::DirectionMask[move], constrain(speed, Follow_Min_Speed, 250));
 }
 
 void model4_func() // tracking model
 {
-  MOTORservo.write(90);
-  Left_Tra_Value = analogRead(LEFT_LINE_TRACKING);
-  Center_Tra_Value = analogRead(CENTER_LINE_TRACKING);
-  Right_Tra_Value = analogRead(RIGHT_LINE_TRACKING);
-  if (Left_Tra_Value < Black_Line && Center_Tra_Value >= Black_Line && Right_Tra_Value < Black_Line)
-  {
-    motor.drive(MecanumMotor::Forward, 250);
-  }
-  else if (Left_Tra_Value >= Black_Line && Center_Tra_Value >= Black_Line && Right_Tra_Value < Black_Line)
+  PROFILE_SECTION(Section_Line);
+  scanner.setSpeed(ServoMotion::Max_Speed);
+  scanner.moveTo(90);
+  unsigned long now = millis();
+  LineFollower::State state = lineFollower.update(now);
+  tracer.line(now, lineFollower.reading(0), lineFollower.reading(1), lineFollower.reading(2));
+  switch (state)
   {
+  case LineFollower::Tracking:
+    motor.drive(MecanumMotor::Forward, lineFollower.leftSpeed(), lineFollower.rightSpeed());
+    break;
+  case LineFollower::LostLeft:
     motor.drive(MecanumMotor::Contrarotate, 220);
-  }
-  else if (Left_Tra_Value >= Black_Line && Center_Tra_Value < Black_Line && Right_Tra_Value < Black_Line)
-  {
-    motor.drive(MecanumMotor::Contrarotate, 250);
-  }
-  else if (Left_Tra_Value < Black_Line && Center_Tra_Value < Black_Line && Right_Tra_Value >= Black_Line)
-  {
-    motor.drive(MecanumMotor::Clockwise, 250);
-  }
-  else if (Left_Tra_Value < Black_Line && Center_Tra_Value >= Black_Line && Right_Tra_Value >= Black_Line)
-  {
+    break;
+  case LineFollower::LostRight:
     motor.drive(MecanumMotor::Clockwise, 220);
-  }
-  else if (Left_Tra_Value >= Black_Line && Center_Tra_Value >= Black_Line && Right_Tra_Value >= Black_Line)
-  {
+    break;
+  case LineFollower::CrossLine:
     motor.drive(MecanumMotor::Stop, 0);
+    break;
   }
 }
 void motorleft() // servo
 {
-  MOTORservo.write(angle);
-  angle += 1;
-  if (angle >= 180)
-    angle = 180;
-  delay(10);
+  // Jog at 100 degrees per second until another order arrives
+  scanner.setSpeed(100);
+  scanner.moveTo(180);
 }
 void motorright() // servo
 {
-  MOTORservo.write(angle);
-  angle -= 1;
-  if (angle <= 1)
-    angle = 1;
-  delay(10);
+  scanner.setSpeed(100);
+  scanner.moveTo(1);
 }
 
 float SR04(int Trig, int Echo) // ultrasonic measured distance
 {
+  PROFILE_SECTION(Section_SR04);
   digitalWrite(Trig, LOW);
   delayMicroseconds(2);
   digitalWrite(Trig, HIGH);
   delayMicroseconds(10);
   digitalWrite(Trig, LOW);
-  float distance = pulseIn(Echo, HIGH) / 58.00;
+  unsigned long echo = pulseIn(Echo, HIGH, ECHO_TIMEOUT_US);
+  if (echo == 0)
+    echo = ECHO_TIMEOUT_US; // no echo, nothing in range
+  float distance = echo / 58.00;
+  tracer.range(millis(), distance);
   delay(10);
 
   return distance;
 }
 
+float ranging()
+{
+  return SR04(Trig_PIN, Echo_PIN);
+}
+
+void TXradar_func(uint8_t bin) // Send one sector of the sweep map
+{
+  protocol::RadarFrame frame = protocol::encodeRadar(bin, sweep.distance(bin));
+  Serial.write((const uint8_t *)&frame, sizeof(frame));
+}
+
 void RXpack_func() // Receive data
 {
-  if (Serial.available() > 0)
+  PROFILE_SECTION(Section_RX);
+  // Everything that came in since the last pass, a follow mode pass with its
+  // sonar wait lasts long enough for several frames. A frame cut short by the
+  // end of the buffer is finished in the next pass.
+  while (Serial.available() > 0)
+  {
+    byte c = Serial.read();
+    if (RX_length == 0 && !protocol::isFrameStart(c))
+      continue; // text, or the rest of a broken frame
+    RX_package[RX_length++] = c;
+    if (RX_length < sizeof(RX_package))
+      continue;
+    if (RX_package[2] == protocol::FrameTail)
+    {
+      RX_length = 0;
+      RXframe_func(RX_package);
+      continue;
+    }
+    // Out of step, start again at the next header byte already read
+    byte next = 1;
+    while (next < sizeof(RX_package) && !protocol::isFrameStart(RX_package[next]))
+      next++;
+    RX_length = sizeof(RX_package) - next;
+    memmove(RX_package, RX_package + next, RX_length);
+  }
+}
+
+void RXframe_func(const byte *frame) // Act on one frame from the ESP32
+{
+  if (protocol::isCommandFrame(frame)) // The header and tail of the packet are verified
   {
-    delay(1); // delay 1MS
-    if (Serial.readBytes(RX_package, 3))
+    if (ackCount < Max_Acks)
+      ackCommands[ackCount++] = frame[1];
+    // Profiler queries must not disturb the current order
+    if (frame[1] == protocol::ProfileQuery)
+    {
+      Serial.println(protocol::ProfileReportBegin);
+      PROFILE_REPORT(Serial);
+      Serial.println(protocol::ProfileReportEnd);
+      return;
+    }
+    if (frame[1] == protocol::ProfileReset)
+    {
+      PROFILE_RESET();
+      return;
+    }
+    if (frame[1] == protocol::TraceStart)
     {
-      if (RX_package[0] == 0xA5 && RX_package[2] == 0x5A) // The header and tail of the packet are verified
-      {
-        order = RX_package[1];
-        Serial.println(order);
-        if (order == Mode1)
-        {
-          model_var = 0;
-        }
-        else if (order == Mode2)
-        {
-          model_var = 1;
-        }
-        else if (order == Mode3)
-        {
-          model_var = 2;
-        }
-        else if (order == Mode4)
-        {
-          model_var = 3;
-        }
-        //////////////////////////////
-        // switch (RX_package[1])
-        // {
-        // case Stop:
-        //     Serial.println("Stop");
-        //     break;
-        // case Forward:
-        //     Serial.println("Forward");
-        //     break;
-        // case Backward:
-        //     Serial.println("Backward");
-        //     break;
-        // case Turn_Left:
-        //     Serial.println("Turn_Left");
-        //     break;
-        // case Turn_Right:
-        //     Serial.println("Turn_Right");
-        //     break;
-        // case Top_Left:
-        //     Serial.println("Top_Left");
-        //     break;
-        // case Bottom_Left:
-        //     Serial.println("Bottom_Left");
-        //     break;
-        // case Top_Right:
-        //     Serial.println("Top_Right");
-        //     break;
-        // case Bottom_Right:
-        //     Serial.println("Bottom_Right");
-        //     break;
-        // case Clockwise:
-        //     Serial.println("Clockwise");
-        //     break;
-        // case MotorLeft:
-        //     Serial.println("MotorLeft");
-        //     break;
-        // case MotorRight:
-        //     Serial.println("MotorRight");
-        //     break;
-        // case Moedl1:
-        //     Serial.println("Moedl1");
-        //     break;
-        // case Moedl2:
-        //     Serial.println("Moedl2");
-        //     break;
-        // case Moedl3:
-        //     Serial.println("Moedl3");
-        //     break;
-        // case Moedl4:
-        //     Serial.println("Moedl4");
-        //     break;
-        // default:
-        //     break;
-        // }
-      }
+      tracer.start(millis(), model_var);
+      return;
     }
+    if (frame[1] == protocol::TraceStop)
+    {
+      tracer.stop();
+      return;
+    }
+    order = frame[1];
+    tracer.command(millis(), order);
+    Serial.println(order);
+    int8_t mode = protocol::modeIndex(order);
+    if (mode >= 0)
+    {
+      // Every mode starts from a clean state
+      avoid_reset();
+      followFilter.reset();
+      followTargetTime = 0;
+      lineFollower.reset();
+      model_var = mode;
+    }
+    //////////////////////////////
+    // switch (frame[1])
+    // {
+    // case Stop:
+    //     Serial.println("Stop");
+    //     break;
+    // case Forward:
+    //     Serial.println("Forward");
+    //     break;
+    // case Backward:
+    //     Serial.println("Backward");
+    //     break;
+    // case Turn_Left:
+    //     Serial.println("Turn_Left");
+    //     break;
+    // case Turn_Right:
+    //     Serial.println("Turn_Right");
+    //     break;
+    // case Top_Left:
+    //     Serial.println("Top_Left");
+    //     break;
+    // case Bottom_Left:
+    //     Serial.println("Bottom_Left");
+    //     break;
+    // case Top_Right:
+    //     Serial.println("Top_Right");
+    //     break;
+    // case Bottom_Right:
+    //     Serial.println("Bottom_Right");
+    //     break;
+    // case Clockwise:
+    //     Serial.println("Clockwise");
+    //     break;
+    // case MotorLeft:
+    //     Serial.println("MotorLeft");
+    //     break;
+    // case MotorRight:
+    //     Serial.println("MotorRight");
+    //     break;
+    // case Moedl1:
+    //     Serial.println("Moedl1");
+    //     break;
+    // case Moedl2:
+    //     Serial.println("Moedl2");
+    //     break;
+    // case Moedl3:
+    //     Serial.println("Moedl3");
+    //     break;
+    // case Moedl4:
+    //     Serial.println("Moedl4");
+    //     break;
+    // default:
+    //     break;
+    // }
+  }
+  else if (protocol::isParameterFrame(frame))
+  {
+    setParameter(frame[0], frame[1]);
+  }
+  else if (protocol::isVisionFrame(frame))
+  {
+    setVision(frame);
+  }
+}
+
+void setVision(const byte *frame) // Results of the ESP32-CAM's image analysis
+{
+  bool found = frame[1] != protocol::VisionNone;
+  switch (frame[0])
+  {
+  case protocol::VisionLine:
+    lineFollower.setVision(found, (long)protocol::visionOffset(frame) * LineFollower::PositionRange / 127, millis());
+    break;
+  case protocol::VisionTarget:
+    followBearing = found ? protocol::visionTargetBearing(frame) : 0;
+    followSize = found ? protocol::visionTargetSize(frame) : 0;
+    followTargetTime = found ? millis() | 1 : 0;
+    break;
+  }
+}
+
+void setParameter(byte param, byte value) // Runtime tuning
+{
+  switch (param)
+  {
+  case protocol::LineKp:
+    lineFollower.setGains(value, lineFollower.ki(), lineFollower.kd());
+    break;
+  case protocol::LineKi:
+    lineFollower.setGains(lineFollower.kp(), value, lineFollower.kd());
+    break;
+  case protocol::LineKd:
+    lineFollower.setGains(lineFollower.kp(), lineFollower.ki(), value);
+    break;
+  case protocol::LineSpeed:
+    lineFollower.setBaseSpeed(value);
+    break;
   }
 }
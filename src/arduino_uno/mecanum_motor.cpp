@@ -1,4 +1,5 @@
 #include "mecanum_motor.h"
+#include "loop_profiler.h"
 
 MecanumMotor::MecanumMotor(uint8_t pwm1_pin, uint8_t pwm2_pin, uint8_t shcp_pin,
                           uint8_t en_pin, uint8_t data_pin, uint8_t stcp_pin) {
@@ -8,6 +9,9 @@ MecanumMotor::MecanumMotor(uint8_t pwm1_pin, uint8_t pwm2_pin, uint8_t shcp_pin,
     _en_pin = en_pin;
     _data_pin = data_pin;
     _stcp_pin = stcp_pin;
+    _direction = Stop;
+    _left_speed = 0;
+    _right_speed = 0;
 }
 
 void MecanumMotor::begin() {
@@ -20,11 +24,20 @@ void MecanumMotor::begin() {
 }
 
 void MecanumMotor::drive(int direction, int speed) {
+    drive(direction, speed, speed);
+}
+
+void MecanumMotor::drive(int direction, int left_speed, int right_speed) {
+    PROFILE_SECTION(Section_Drive);
     digitalWrite(_en_pin, LOW);
-    analogWrite(_pwm1_pin, speed);
-    analogWrite(_pwm2_pin, speed);
+    analogWrite(_pwm1_pin, left_speed);
+    analogWrite(_pwm2_pin, right_speed);
 
     digitalWrite(_stcp_pin, LOW);
     shiftOut(_data_pin, _shcp_pin, MSBFIRST, direction);
     digitalWrite(_stcp_pin, HIGH);
+
+    _direction = direction;
+    _left_speed = left_speed;
+    _right_speed = right_speed;
 }
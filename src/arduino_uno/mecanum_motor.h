@@ -2,26 +2,34 @@
 #define MECANUM_MOTOR_H
 
 #include <Arduino.h>
+#include <robot_protocol.h>
 
 class MecanumMotor {
 public:
-    // Constants for movement directions
-    static const int Forward = 92;       // forward
-    static const int Backward = 163;     // back
-    static const int Turn_Left = 149;    // left translation
-    static const int Turn_Right = 106;   // right translation
-    static const int Top_Left = 20;      // upper left mobile
-    static const int Bottom_Left = 129;  // lower left mobile
-    static const int Top_Right = 72;     // upper right mobile
-    static const int Bottom_Right = 34;  // lower right move
-    static const int Stop = 0;           // stop
-    static const int Contrarotate = 172; // counterclockwise rotation
-    static const int Clockwise = 83;     // rotate clockwise
+    // 74HC595 patterns for the movement directions
+    static const int Forward = protocol::DirectionMask[protocol::Dir_Forward];
+    static const int Backward = protocol::DirectionMask[protocol::Dir_Backward];
+    static const int Turn_Left = protocol::DirectionMask[protocol::Dir_Turn_Left];
+    static const int Turn_Right = protocol::DirectionMask[protocol::Dir_Turn_Right];
+    static const int Top_Left = protocol::DirectionMask[protocol::Dir_Top_Left];
+    static const int Bottom_Left = protocol::DirectionMask[protocol::Dir_Bottom_Left];
+    static const int Top_Right = protocol::DirectionMask[protocol::Dir_Top_Right];
+    static const int Bottom_Right = protocol::DirectionMask[protocol::Dir_Bottom_Right];
+    static const int Stop = protocol::DirectionMask[protocol::Dir_Stop];
+    static const int Contrarotate = protocol::DirectionMask[protocol::Dir_Contrarotate];
+    static const int Clockwise = protocol::DirectionMask[protocol::Dir_Clockwise];
 
     MecanumMotor(uint8_t pwm1_pin, uint8_t pwm2_pin, uint8_t shcp_pin,
                  uint8_t en_pin, uint8_t data_pin, uint8_t stcp_pin);
     void begin();
     void drive(int direction, int speed);
+    // PWM1 feeds the left wheel pair and PWM2 the right one
+    void drive(int direction, int left_speed, int right_speed);
+
+    // Last output, as latched and written to the PWM pins
+    uint8_t direction() const { return _direction; }
+    uint8_t leftSpeed() const { return _left_speed; }
+    uint8_t rightSpeed() const { return _right_speed; }
 
 private:
     uint8_t _pwm1_pin;
@@ -30,6 +38,10 @@ private:
     uint8_t _en_pin;
     uint8_t _data_pin;
     uint8_t _stcp_pin;
+
+    uint8_t _direction;
+    uint8_t _left_speed;
+    uint8_t _right_speed;
 };
 
 #endif
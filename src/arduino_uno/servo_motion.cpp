@@ -0,0 +1,88 @@
+#include "servo_motion.h"
+
+// Time for the horn to stop ringing once the commanded ramp has finished
+static const unsigned long Settle_Ms = 30;
+
+ServoMotion::ServoMotion(uint8_t pin) {
+    _pin = pin;
+    _speed = Max_Speed;
+    _start = 90;
+    _angle = 90;
+    _target = 90;
+    _start_time = 0;
+    _arrival = 0;
+}
+
+void ServoMotion::begin(uint8_t angle) {
+    _servo.attach(_pin);
+    _servo.write(angle);
+    _start = angle;
+    _angle = angle;
+    _target = angle;
+    _start_time = millis();
+    // The starting position is unknown, assume a full sweep
+    _arrival = _start_time + 180UL * 1000 / Max_Speed + Settle_Ms;
+}
+
+void ServoMotion::moveTo(uint8_t angle) {
+    if (angle > 180)
+        angle = 180;
+    if (angle == _target)
+        return;
+
+    _start = _angle;
+    _target = angle;
+    _start_time = millis();
+    uint8_t distance = _target > _start ? _target - _start : _start - _target;
+    _arrival = _start_time + (unsigned long)distance * 1000 / _speed + Settle_Ms;
+}
+
+void ServoMotion::setSpeed(uint16_t degrees_per_s) {
+    if (degrees_per_s == 0)
+        degrees_per_s = 1;
+    if (degrees_per_s > Max_Speed)
+        degrees_per_s = Max_Speed;
+    if (degrees_per_s == _speed)
+        return;
+
+    _speed = degrees_per_s;
+    if (_angle != _target) {
+        // Re-plan the rest of the move at the new speed
+        uint8_t target = _target;
+        _target = _angle;
+        moveTo(target);
+    }
+}
+
+void ServoMotion::stop() {
+    if (_angle == _target)
+        return;
+    _start = _angle;
+    _target = _angle;
+    _start_time = millis();
+    _arrival = _start_time + Settle_Ms;
+}
+
+void ServoMotion::update(unsigned long now_ms) {
+    if (_angle == _target)
+        return;
+
+    unsigned long travelled = (now_ms - _start_time) * _speed / 1000;
+    uint8_t distance = _target > _start ? _target - _start : _start - _target;
+    uint8_t angle;
+    if (travelled >= distance)
+        angle = _target;
+    else if (_target > _start)
+        angle = _start + travelled;
+    else
+        angle = _start - travelled;
+
+    if (angle != _angle) {
+        _angle = angle;
+        _servo.write(_angle);
+    }
+}
+
+bool ServoMotion::settled(unsigned long now_ms) const {
+    return _angle == _target && (long)(now_ms - _arrival) >= 0;
+}
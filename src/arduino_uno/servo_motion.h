@@ -0,0 +1,42 @@
+#ifndef SERVO_MOTION_H
+#define SERVO_MOTION_H
+
+#include <Arduino.h>
+#include <Servo.h>
+
+// Moves the scanner servo towards a target angle at a limited speed without
+// blocking. update() must be called from loop(); settled() tells when the
+// horn is estimated to have reached the target.
+class ServoMotion {
+public:
+    // Speed of an unloaded SG90 class servo, faster requests are clamped to it
+    static const uint16_t Max_Speed = 400; // degrees per second
+
+    ServoMotion(uint8_t pin);
+    void begin(uint8_t angle);
+
+    void moveTo(uint8_t angle);
+    void setSpeed(uint16_t degrees_per_s);
+    // Hold the horn where it is now
+    void stop();
+    void update(unsigned long now_ms);
+
+    bool settled(unsigned long now_ms) const;
+    // Estimated millis() at which the horn is at the target and still
+    unsigned long arrivalTime() const { return _arrival; }
+    uint8_t angle() const { return _angle; }
+    uint8_t target() const { return _target; }
+
+private:
+    Servo _servo;
+    uint8_t _pin;
+    uint16_t _speed;
+
+    uint8_t _start;
+    uint8_t _angle;
+    uint8_t _target;
+    unsigned long _start_time;
+    unsigned long _arrival;
+};
+
+#endif
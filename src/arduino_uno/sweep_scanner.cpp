@@ -0,0 +1,115 @@
+#include "sweep_scanner.h"
+
+static const uint8_t No_Bin = 0xFF;
+static const float Radians_Per_Degree = 3.14159265f / 180;
+
+SweepScanner::SweepScanner(ServoMotion &servo, Ranger ranger) : _servo(servo) {
+    _ranger = ranger;
+    _running = false;
+    _last_bin = No_Bin;
+    _shot_bin = No_Bin;
+    clear();
+}
+
+void SweepScanner::start() {
+    if (_running)
+        return;
+    _running = true;
+    _shot_bin = No_Bin;
+    _servo.setSpeed(Sweep_Speed);
+    // Start towards whichever end is further away
+    _servo.moveTo(_servo.angle() < 90 ? binAngle(Bins - 1) : First_Angle);
+}
+
+void SweepScanner::stop() {
+    if (!_running)
+        return;
+    _running = false;
+    _servo.setSpeed(ServoMotion::Max_Speed);
+    _servo.moveTo(90);
+}
+
+void SweepScanner::clear() {
+    for (uint8_t i = 0; i < Bins; i++) {
+        _distance[i] = 0;
+        _timestamp[i] = 0;
+    }
+}
+
+uint8_t SweepScanner::angleBin(uint8_t angle) {
+    if (angle <= First_Angle)
+        return 0;
+    uint8_t bin = (angle - First_Angle + Bin_Width / 2) / Bin_Width;
+    return bin < Bins ? bin : Bins - 1;
+}
+
+bool SweepScanner::update(unsigned long now_ms) {
+    if (!_running)
+        return false;
+
+    // Turn around at either end without waiting for the horn to settle
+    if (_servo.angle() == _servo.target())
+        _servo.moveTo(_servo.target() <= First_Angle ? binAngle(Bins - 1) : First_Angle);
+
+    uint8_t bin = angleBin(_servo.angle());
+    if (bin == _shot_bin)
+        return false;
+
+    float d = _ranger();
+    _distance[bin] = d < 65535 ? (uint16_t)d : 65535;
+    _timestamp[bin] = now_ms;
+    _shot_bin = bin;
+    _last_bin = bin;
+    return true;
+}
+
+bool SweepScanner::fresh(uint8_t bin, unsigned long now_ms, unsigned long max_age) const {
+    return _timestamp[bin] != 0 && now_ms - _timestamp[bin] <= max_age;
+}
+
+int SweepScanner::pathClearance(uint8_t half_width, uint16_t closing_speed, unsigned long now_ms,
+                                unsigned long max_age) const {
+    int room = -1;
+    for (uint8_t bin = 0; bin < Bins; bin++) {
+        if (!fresh(bin, now_ms, max_age))
+            continue;
+        // The echo can come from anywhere in the sector, take the edge
+        // closest to straight ahead
+        int off = abs((int)binAngle(bin) - 90) - Bin_Width / 2;
+        if (off < 0)
+            off = 0;
+        float angle = off * Radians_Per_Degree;
+        if (_distance[bin] * sin(angle) > half_width)
+            continue;
+        float travelled = (float)closing_speed * (now_ms - _timestamp[bin]) / 1000;
+        int left = (int)(_distance[bin] * cos(angle) - travelled);
+        if (left < 0)
+            left = 0;
+        if (room < 0 || left < room)
+            room = left;
+    }
+    return room;
+}
+
+uint8_t SweepScanner::freestHeading(unsigned long now_ms, unsigned long max_age, int &room) const {
+    uint8_t best = No_Bin;
+    room = -1;
+    for (uint8_t bin = 0; bin < Bins; bin++) {
+        if (!fresh(bin, now_ms, max_age))
+            continue;
+        int width_room = _distance[bin];
+        if (bin > 0 && fresh(bin - 1, now_ms, max_age) && _distance[bin - 1] < width_room)
+            width_room = _distance[bin - 1];
+        if (bin < Bins - 1 && fresh(bin + 1, now_ms, max_age) && _distance[bin + 1] < width_room)
+            width_room = _distance[bin + 1];
+
+        // On a tie prefer the heading closest to straight ahead
+        int centre = Bins / 2;
+        if (width_room > room ||
+            (width_room == room && abs((int)bin - centre) < abs((int)best - centre))) {
+            room = width_room;
+            best = bin;
+        }
+    }
+    return best == No_Bin ? 0 : binAngle(best);
+}
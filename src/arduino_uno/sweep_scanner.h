@@ -0,0 +1,58 @@
+#ifndef SWEEP_SCANNER_H
+#define SWEEP_SCANNER_H
+
+#include <Arduino.h>
+#include <robot_protocol.h>
+#include "servo_motion.h"
+
+// Sweeps the ultrasonic sensor back and forth and keeps the latest reading
+// for each 10 degree sector in a polar map. Angles follow the servo: 10 is
+// full right, 90 straight ahead and 170 full left.
+class SweepScanner {
+public:
+    static const uint8_t Bins = protocol::RadarSectors;
+    static const uint8_t First_Angle = protocol::RadarFirstAngle;
+    static const uint8_t Bin_Width = protocol::RadarSectorWidth;
+    static const uint16_t Sweep_Speed = 250; // degrees per second
+
+    typedef float (*Ranger)();
+
+    SweepScanner(ServoMotion &servo, Ranger ranger);
+
+    void start();
+    void stop();
+    bool running() const { return _running; }
+    void clear();
+
+    // Returns true when a new reading was stored, see lastBin()
+    bool update(unsigned long now_ms);
+    uint8_t lastBin() const { return _last_bin; }
+
+    uint16_t distance(uint8_t bin) const { return _distance[bin]; }
+    unsigned long timestamp(uint8_t bin) const { return _timestamp[bin]; }
+    static uint8_t binAngle(uint8_t bin) { return First_Angle + bin * Bin_Width; }
+    static uint8_t angleBin(uint8_t angle);
+
+    // Room ahead in a corridor half_width to either side of the car's centre
+    // line: the nearest fresh reading inside it, measured along it and less
+    // the distance covered at closing_speed (cm/s) since it was taken. -1
+    // when there is no fresh reading ahead.
+    int pathClearance(uint8_t half_width, uint16_t closing_speed, unsigned long now_ms, unsigned long max_age) const;
+    // Angle with the most room, counting the neighbouring sectors so the car
+    // fits through. Returns 0 when the map holds no fresh reading.
+    uint8_t freestHeading(unsigned long now_ms, unsigned long max_age, int &room) const;
+
+private:
+    ServoMotion &_servo;
+    Ranger _ranger;
+    bool _running;
+    uint8_t _last_bin;
+    uint8_t _shot_bin;
+
+    uint16_t _distance[Bins];
+    unsigned long _timestamp[Bins];
+
+    bool fresh(uint8_t bin, unsigned long now_ms, unsigned long max_age) const;
+};
+
+#endif
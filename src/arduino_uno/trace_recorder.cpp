@@ -0,0 +1,82 @@
+#include "trace_recorder.h"
+
+TraceRecorder::TraceRecorder(Print &out) : _out(out) {
+    _enabled = false;
+    _last_line = 0;
+    _pattern = 0;
+    _left_speed = 0;
+    _right_speed = 0;
+    _last_drive = 0;
+    _left_sum = 0;
+    _right_sum = 0;
+    _drive_count = 0;
+}
+
+void TraceRecorder::start(unsigned long now_ms, uint8_t mode) {
+    _enabled = true;
+    _last_line = now_ms - Line_Interval_Ms;
+    // Force the current motor output into the trace
+    _pattern = 0xFF;
+    send(protocol::Trace_Mode, now_ms, mode);
+}
+
+void TraceRecorder::stop() {
+    _enabled = false;
+}
+
+void TraceRecorder::command(unsigned long now_ms, uint8_t command) {
+    if (_enabled)
+        send(protocol::Trace_Command, now_ms, command);
+}
+
+void TraceRecorder::range(unsigned long now_ms, uint16_t cm) {
+    if (_enabled)
+        send(protocol::Trace_Range, now_ms, cm);
+}
+
+void TraceRecorder::line(unsigned long now_ms, uint16_t left, uint16_t center, uint16_t right) {
+    if (!_enabled || now_ms - _last_line < Line_Interval_Ms)
+        return;
+    _last_line = now_ms;
+    send(protocol::Trace_Line, now_ms, left, center, right);
+}
+
+void TraceRecorder::drive(unsigned long now_ms, uint8_t pattern, uint8_t left_speed, uint8_t right_speed) {
+    if (!_enabled)
+        return;
+    if (pattern != _pattern) {
+        _pattern = pattern;
+        _left_speed = left_speed;
+        _right_speed = right_speed;
+        _last_drive = now_ms;
+        _left_sum = 0;
+        _right_sum = 0;
+        _drive_count = 0;
+        send(protocol::Trace_Drive, now_ms, pattern, left_speed, right_speed);
+        return;
+    }
+
+    // A sample of the speeds every pass would be aliased by the PID's own
+    // oscillation, the mean keeps what the wheels did
+    _left_sum += left_speed;
+    _right_sum += right_speed;
+    _drive_count++;
+    if (now_ms - _last_drive < Drive_Interval_Ms)
+        return;
+    uint8_t left = (_left_sum + _drive_count / 2) / _drive_count;
+    uint8_t right = (_right_sum + _drive_count / 2) / _drive_count;
+    _last_drive = now_ms;
+    _left_sum = 0;
+    _right_sum = 0;
+    _drive_count = 0;
+    if (left == _left_speed && right == _right_speed)
+        return;
+    _left_speed = left;
+    _right_speed = right;
+    send(protocol::Trace_Drive, now_ms, pattern, left, right);
+}
+
+void TraceRecorder::send(uint8_t kind, unsigned long now_ms, uint16_t a, uint16_t b, uint16_t c) {
+    protocol::TraceFrame frame = protocol::encodeTrace(kind, (uint16_t)now_ms, a, b, c);
+    _out.write((const uint8_t *)&frame, sizeof(frame));
+}
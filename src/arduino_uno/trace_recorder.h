@@ -0,0 +1,45 @@
+#ifndef TRACE_RECORDER_H
+#define TRACE_RECORDER_H
+
+#include <Arduino.h>
+#include <robot_protocol.h>
+
+// Streams timestamped sensor readings, received commands and motor decisions
+// as trace frames while enabled by a TraceStart command. The ESP32 collects
+// them for /trace and the native simulation replays them.
+class TraceRecorder {
+public:
+    // Line sensors are read every pass of model4, keep the link from saturating
+    static const uint8_t Line_Interval_Ms = 10;
+    // and the PID changes the speeds just as often. A new direction is sent
+    // at once, speeds as their mean over this interval.
+    static const uint8_t Drive_Interval_Ms = 10;
+
+    TraceRecorder(Print &out);
+
+    void start(unsigned long now_ms, uint8_t mode);
+    void stop();
+    bool enabled() const { return _enabled; }
+
+    void command(unsigned long now_ms, uint8_t command);
+    void range(unsigned long now_ms, uint16_t cm);
+    void line(unsigned long now_ms, uint16_t left, uint16_t center, uint16_t right);
+    // Only changes of the motor output are sent, see Drive_Interval_Ms
+    void drive(unsigned long now_ms, uint8_t pattern, uint8_t left_speed, uint8_t right_speed);
+
+private:
+    Print &_out;
+    bool _enabled;
+    unsigned long _last_line;
+    uint8_t _pattern;
+    uint8_t _left_speed;
+    uint8_t _right_speed;
+    unsigned long _last_drive;
+    uint32_t _left_sum;
+    uint32_t _right_sum;
+    uint16_t _drive_count;
+
+    void send(uint8_t kind, unsigned long now_ms, uint16_t a, uint16_t b = 0, uint16_t c = 0);
+};
+
+#endif
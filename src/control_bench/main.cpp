@@ -0,0 +1,251 @@
+// Control command latency while the camera streams at full rate. Reads the
+// MJPEG stream on port 81 in a second thread as fast as the car sends it,
+// sends commands to port 80 on one kept-alive connection and prints the
+// distribution of the HTTP round trips, then the car's own share from GET
+// /bench/control (handler to UART):
+//
+//   pio run -e control_bench
+//   .pio/build/control_bench/program 192.168.1.50 --commands 500 --interval-ms 20
+//
+// Run it once against the esp32cam build and once against
+// esp32cam_legacy_tasks to compare the task topologies of task_config.h.
+// The default command is /stop so the car does not move. Exits with 1 when
+// the car cannot be reached.
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+typedef std::chrono::steady_clock Clock;
+
+static const int Warm_Up_Ms = 1000;
+static const int Histogram_Step_Ms = 5;
+static const int Histogram_Steps = 20;
+
+static std::atomic<bool> streaming(true);
+static std::atomic<uint64_t> streamBytes(0);
+static std::atomic<uint32_t> streamFrames(0);
+
+static int connectTo(const char *host, int port)
+{
+  addrinfo hints = {};
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo *res = nullptr;
+  char service[8];
+  snprintf(service, sizeof(service), "%d", port);
+  if (getaddrinfo(host, service, &hints, &res) != 0)
+  {
+    return -1;
+  }
+  int fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+  if (fd >= 0 && connect(fd, res->ai_addr, res->ai_addrlen) != 0)
+  {
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(res);
+  if (fd >= 0)
+  {
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  }
+  return fd;
+}
+
+static bool sendRequest(int fd, const char *host, const std::string &path)
+{
+  std::string request = "GET " + path + " HTTP/1.1\r\nHost: " + host + "\r\n\r\n";
+  return send(fd, request.data(), request.size(), 0) == (ssize_t)request.size();
+}
+
+// Reads one response on a kept-alive connection, the body into body
+static bool readResponse(int fd, std::string &body)
+{
+  std::string data;
+  char buf[1024];
+  size_t header_end;
+  while ((header_end = data.find("\r\n\r\n")) == std::string::npos)
+  {
+    ssize_t n = recv(fd, buf, sizeof(buf), 0);
+    if (n <= 0)
+    {
+      return false;
+    }
+    data.append(buf, n);
+  }
+  std::string headers = data.substr(0, header_end);
+  std::transform(headers.begin(), headers.end(), headers.begin(), ::tolower);
+  size_t length = 0;
+  size_t pos = headers.find("content-length:");
+  if (pos != std::string::npos)
+  {
+    length = strtoul(headers.c_str() + pos + 15, nullptr, 10);
+  }
+  body = data.substr(header_end + 4);
+  while (body.size() < length)
+  {
+    ssize_t n = recv(fd, buf, sizeof(buf), 0);
+    if (n <= 0)
+    {
+      return false;
+    }
+    body.append(buf, n);
+  }
+  return true;
+}
+
+static void readStream(const char *host)
+{
+  int fd = connectTo(host, 81);
+  if (fd < 0 || !sendRequest(fd, host, "/stream"))
+  {
+    fprintf(stderr, "stream: cannot connect\n");
+    return;
+  }
+  // Frames are counted by their part headers, which may straddle two reads
+  std::string tail;
+  char buf[16384];
+  while (streaming)
+  {
+    ssize_t n = recv(fd, buf, sizeof(buf), 0);
+    if (n <= 0)
+    {
+      break;
+    }
+    streamBytes += n;
+    std::string chunk = tail + std::string(buf, n);
+    for (size_t pos = 0; (pos = chunk.find("Content-Type: image/jpeg", pos)) != std::string::npos; pos++)
+    {
+      streamFrames++;
+    }
+    tail = chunk.substr(chunk.size() > 32 ? chunk.size() - 32 : 0);
+    if (tail.find("Content-Type: image/jpeg") != std::string::npos)
+    {
+      tail.clear();
+    }
+  }
+  close(fd);
+}
+
+static double percentile(const std::vector<double> &sorted, double percent)
+{
+  size_t rank = (size_t)(percent / 100.0 * (sorted.size() - 1) + 0.5);
+  return sorted[rank];
+}
+
+int main(int argc, char **argv)
+{
+  if (argc < 2)
+  {
+    fprintf(stderr, "usage: %s host [--commands N] [--interval-ms N] [--path /stop] [--no-stream]\n", argv[0]);
+    return 1;
+  }
+  const char *host = argv[1];
+  int commands = 500;
+  int interval_ms = 20;
+  std::string path = "/stop";
+  bool stream = true;
+  for (int i = 2; i < argc; i++)
+  {
+    if (!strcmp(argv[i], "--commands") && i + 1 < argc)
+      commands = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--interval-ms") && i + 1 < argc)
+      interval_ms = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--path") && i + 1 < argc)
+      path = argv[++i];
+    else if (!strcmp(argv[i], "--no-stream"))
+      stream = false;
+  }
+
+  int fd = connectTo(host, 80);
+  std::string body;
+  if (fd < 0 || !sendRequest(fd, host, "/bench/control?reset=1") || !readResponse(fd, body))
+  {
+    fprintf(stderr, "cannot reach %s\n", host);
+    return 1;
+  }
+
+  std::thread reader;
+  if (stream)
+  {
+    reader = std::thread(readStream, host);
+    std::this_thread::sleep_for(std::chrono::milliseconds(Warm_Up_Ms));
+  }
+
+  std::vector<double> rtt_ms;
+  uint32_t frames_before = streamFrames;
+  Clock::time_point started = Clock::now();
+  for (int i = 0; i < commands; i++)
+  {
+    Clock::time_point sent = Clock::now();
+    if (!sendRequest(fd, host, path) || !readResponse(fd, body))
+    {
+      fprintf(stderr, "command %d failed\n", i);
+      break;
+    }
+    rtt_ms.push_back(std::chrono::duration<double, std::milli>(Clock::now() - sent).count());
+    std::this_thread::sleep_for(std::chrono::milliseconds(interval_ms));
+  }
+  double seconds = std::chrono::duration<double>(Clock::now() - started).count();
+  uint32_t frames = streamFrames - frames_before;
+
+  streaming = false;
+  if (reader.joinable())
+  {
+    // The stream socket only notices on the next frame
+    reader.join();
+  }
+  if (rtt_ms.empty())
+  {
+    return 1;
+  }
+
+  std::sort(rtt_ms.begin(), rtt_ms.end());
+  printf("stream: %s, %.1f fps, %.0f kB/s\n", stream ? "on" : "off", frames / seconds,
+         stream ? streamBytes / 1024.0 / (seconds + Warm_Up_Ms / 1000.0) : 0.0);
+  printf("round trip of %u commands: p50 %.1f ms, p90 %.1f ms, p99 %.1f ms, max %.1f ms\n", (unsigned)rtt_ms.size(),
+         percentile(rtt_ms, 50), percentile(rtt_ms, 90), percentile(rtt_ms, 99), rtt_ms.back());
+  std::vector<unsigned> histogram(Histogram_Steps + 1);
+  for (double v : rtt_ms)
+  {
+    int step = v / Histogram_Step_Ms;
+    histogram[step < Histogram_Steps ? step : Histogram_Steps]++;
+  }
+  for (int step = 0; step <= Histogram_Steps; step++)
+  {
+    if (!histogram[step])
+    {
+      continue;
+    }
+    std::string bar(histogram[step] * 60 / rtt_ms.size() + 1, '#');
+    if (step < Histogram_Steps)
+    {
+      printf("  %3d-%3d ms %5u %s\n", step * Histogram_Step_Ms, (step + 1) * Histogram_Step_Ms, histogram[step],
+             bar.c_str());
+    }
+    else
+    {
+      printf("  %3d+    ms %5u %s\n", step * Histogram_Step_Ms, histogram[step], bar.c_str());
+    }
+  }
+
+  if (sendRequest(fd, host, "/bench/control") && readResponse(fd, body))
+  {
+    printf("car: %s\n", body.c_str());
+  }
+  close(fd);
+  return 0;
+}
@@ -0,0 +1,276 @@
+#include "analytics_tap.h"
+#include "esp_heap_caps.h"
+#include "jpeg_decode.h"
+#include "esp_timer.h"
+#include "task_config.h"
+
+static portMUX_TYPE tapLock = portMUX_INITIALIZER_UNLOCKED;
+
+AnalyticsTap::AnalyticsTap(Camera &camera)
+    : camera(camera), task(nullptr), thumbLock(nullptr), consumerTasks(), consumerCount(0), jpeg(nullptr),
+      jpegLen(0), jpegWidth(0), jpegCapturedUs(0), jpegClaimed(false), jpegReady(false), pixels(nullptr), thumb(),
+      counters()
+{
+}
+
+void AnalyticsTap::begin()
+{
+  // The JPEG is only read once per frame, the thumbnail by every consumer
+  jpeg = (uint8_t *)heap_caps_malloc(Max_Jpeg_Bytes, MALLOC_CAP_SPIRAM);
+  size_t size = Max_Width * Max_Height * sizeof(uint16_t);
+  pixels = (uint16_t *)heap_caps_malloc(size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+  if (!pixels)
+  {
+    pixels = (uint16_t *)heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
+  }
+  thumbLock = xSemaphoreCreateMutex();
+  thumb.pixels = pixels;
+  // Same core and priority as the consumers, below the HTTP servers
+  xTaskCreatePinnedToCore(taskMain, "analytics_tap", 4096, this, TASK_VISION_PRIORITY, &task, TASK_VISION_CORE);
+  camera.addFrameCallback(onFrame, this);
+}
+
+void AnalyticsTap::subscribe(TaskHandle_t consumer)
+{
+  bool added = false;
+  portENTER_CRITICAL(&tapLock);
+  bool known = false;
+  for (uint8_t i = 0; i < consumerCount; i++)
+  {
+    known |= consumerTasks[i] == consumer;
+  }
+  if (!known && consumerCount < Max_Consumers)
+  {
+    consumerTasks[consumerCount++] = consumer;
+    added = true;
+  }
+  portEXIT_CRITICAL(&tapLock);
+  if (added && task)
+  {
+    xTaskNotifyGive(task);
+  }
+}
+
+void AnalyticsTap::unsubscribe(TaskHandle_t consumer)
+{
+  portENTER_CRITICAL(&tapLock);
+  for (uint8_t i = 0; i < consumerCount; i++)
+  {
+    if (consumerTasks[i] == consumer)
+    {
+      consumerTasks[i] = consumerTasks[--consumerCount];
+      break;
+    }
+  }
+  portEXIT_CRITICAL(&tapLock);
+}
+
+bool AnalyticsTap::acquire(uint32_t after, Thumbnail &out)
+{
+  if (!thumbLock)
+  {
+    return false;
+  }
+  xSemaphoreTake(thumbLock, portMAX_DELAY);
+  if (!thumb.width || thumb.sequence <= after)
+  {
+    xSemaphoreGive(thumbLock);
+    return false;
+  }
+  out = thumb;
+  return true;
+}
+
+void AnalyticsTap::release()
+{
+  xSemaphoreGive(thumbLock);
+}
+
+AnalyticsTap::Stats AnalyticsTap::stats() const
+{
+  portENTER_CRITICAL(&tapLock);
+  Stats s = counters;
+  portEXIT_CRITICAL(&tapLock);
+  return s;
+}
+
+void AnalyticsTap::onFrame(const camera_fb_t *fb, void *ctx)
+{
+  ((AnalyticsTap *)ctx)->offer(fb);
+}
+
+// Runs in whichever task called capture(), only a copy happens here
+void AnalyticsTap::offer(const camera_fb_t *fb)
+{
+  if (!consumerCount || !jpeg || fb->format != PIXFORMAT_JPEG)
+  {
+    return;
+  }
+
+  portENTER_CRITICAL(&tapLock);
+  counters.offered++;
+  bool take = !jpegClaimed;
+  jpegClaimed = true;
+  if (!take)
+  {
+    counters.busy++;
+  }
+  else if (fb->len > Max_Jpeg_Bytes)
+  {
+    counters.tooLarge++;
+    jpegClaimed = false;
+    take = false;
+  }
+  portEXIT_CRITICAL(&tapLock);
+  if (!take)
+  {
+    return;
+  }
+
+  int64_t start = esp_timer_get_time();
+  memcpy(jpeg, fb->buf, fb->len);
+  jpegLen = fb->len;
+  jpegWidth = fb->width;
+  jpegCapturedUs = (int64_t)fb->timestamp.tv_sec * 1000000 + fb->timestamp.tv_usec;
+  uint32_t copy_us = esp_timer_get_time() - start;
+
+  portENTER_CRITICAL(&tapLock);
+  counters.copied++;
+  counters.copyUs = copy_us;
+  jpegReady = true;
+  portEXIT_CRITICAL(&tapLock);
+  xTaskNotifyGive(task);
+}
+
+void AnalyticsTap::taskMain(void *arg)
+{
+  AnalyticsTap *self = (AnalyticsTap *)arg;
+  for (;;)
+  {
+    if (!self->consumerCount || !self->pixels || !self->jpeg || !self->camera.ready())
+    {
+      ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(500));
+      continue;
+    }
+
+    if (!self->jpegReady && !ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(Idle_Capture_Ms)))
+    {
+      // Nobody is streaming, capture() offers the frame like any other
+      camera_fb_t *fb = self->camera.capture();
+      if (!fb)
+      {
+        vTaskDelay(pdMS_TO_TICKS(10));
+        continue;
+      }
+      self->camera.returnFrame(fb);
+      portENTER_CRITICAL(&tapLock);
+      self->counters.ownCaptures++;
+      portEXIT_CRITICAL(&tapLock);
+    }
+
+    if (self->jpegReady)
+    {
+      self->decode();
+      self->notifyConsumers();
+    }
+  }
+}
+
+void AnalyticsTap::decode()
+{
+  // The finest of the decoder's scales that fits the thumbnail
+  uint8_t scale = jpegWidth <= Max_Width * 2 ? 2 : jpegWidth <= Max_Width * 4 ? 4 : 8;
+  jpg_scale_t jpg_scale = scale == 2 ? JPG_SCALE_2X : scale == 4 ? JPG_SCALE_4X : JPG_SCALE_8X;
+
+  int64_t start = esp_timer_get_time();
+  xSemaphoreTake(thumbLock, portMAX_DELAY);
+  thumb.width = 0;
+  thumb.height = 0;
+  bool ok = jpegDecode(jpegLen, jpg_scale, readJpeg, writeBlock, this) == ESP_OK && thumb.width &&
+            thumb.height;
+  if (ok)
+  {
+    thumb.scale = scale;
+    thumb.sequence++;
+    thumb.capturedUs = jpegCapturedUs;
+  }
+  xSemaphoreGive(thumbLock);
+  uint32_t decode_us = esp_timer_get_time() - start;
+
+  portENTER_CRITICAL(&tapLock);
+  jpegReady = false;
+  jpegClaimed = false;
+  if (ok)
+  {
+    counters.decoded++;
+    counters.decodeUs = decode_us;
+    counters.totalDecodeUs += decode_us;
+  }
+  else
+  {
+    counters.failed++;
+  }
+  portEXIT_CRITICAL(&tapLock);
+}
+
+void AnalyticsTap::notifyConsumers()
+{
+  TaskHandle_t tasks[Max_Consumers];
+  portENTER_CRITICAL(&tapLock);
+  uint8_t count = consumerCount;
+  memcpy(tasks, consumerTasks, sizeof(tasks));
+  portEXIT_CRITICAL(&tapLock);
+  for (uint8_t i = 0; i < count; i++)
+  {
+    xTaskNotifyGive(tasks[i]);
+  }
+}
+
+size_t AnalyticsTap::readJpeg(void *arg, size_t index, uint8_t *buf, size_t len)
+{
+  AnalyticsTap *self = (AnalyticsTap *)arg;
+  if (index + len > self->jpegLen)
+  {
+    len = self->jpegLen - index;
+  }
+  if (buf)
+  {
+    memcpy(buf, self->jpeg + index, len);
+  }
+  return len;
+}
+
+// Blocks arrive as RGB888, stored as native RGB565
+bool AnalyticsTap::writeBlock(void *arg, uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t *data)
+{
+  AnalyticsTap *self = (AnalyticsTap *)arg;
+  if (!data)
+  {
+    // Called with the image size before the first block and once at the end.
+    // Odd widths would break the word alignment of the rows.
+    if (x == 0 && y == 0)
+    {
+      if (w > Max_Width || h > Max_Height)
+      {
+        return false;
+      }
+      self->thumb.width = w & ~1;
+      self->thumb.height = h;
+    }
+    return true;
+  }
+
+  uint16_t width = self->thumb.width;
+  for (uint16_t row = 0; row < h; row++)
+  {
+    uint16_t *out = self->pixels + (uint32_t)(y + row) * width + x;
+    for (uint16_t col = 0; col < w; col++, data += 3)
+    {
+      if (x + col < width)
+      {
+        out[col] = ((data[0] >> 3) << 11) | ((data[1] >> 2) << 5) | (data[2] >> 3);
+      }
+    }
+  }
+  return true;
+}
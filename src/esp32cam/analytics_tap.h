@@ -0,0 +1,93 @@
+#pragma once
+
+#include <Arduino.h>
+#include "camera.h"
+#include "freertos/semphr.h"
+
+// Thumbnails of the JPEG frames for the vision tasks. Every frame capture()
+// hands out, to the stream or anyone else, is offered to the tap, which
+// copies the JPEG into a preallocated buffer and decodes it at 1/2, 1/4 or
+// 1/8 scale, whichever fits the thumbnail, to RGB565. 1/8 only needs the DC
+// term of each block. The sensor keeps its settings and the stream its
+// frames. Without a stream the tap captures on its own.
+class AnalyticsTap
+{
+public:
+  // Largest JPEG that is copied, VGA frames stay well below it
+  static const uint32_t Max_Jpeg_Bytes = 64 * 1024;
+  // Thumbnail buffer, QQVGA
+  static const uint16_t Max_Width = 160;
+  static const uint16_t Max_Height = 120;
+  // The tap captures itself when no frame was offered for this long
+  static const uint32_t Idle_Capture_Ms = 40;
+  static const uint8_t Max_Consumers = 4;
+
+  struct Thumbnail
+  {
+    const uint16_t *pixels; // native RGB565, width is even so rows are word aligned
+    uint16_t width;
+    uint16_t height;
+    uint8_t scale; // 2, 4 or 8
+    uint32_t sequence;
+    int64_t capturedUs;
+  };
+
+  struct Stats
+  {
+    uint32_t offered;
+    uint32_t copied;
+    uint32_t busy;     // offered while the last copy was still being decoded
+    uint32_t tooLarge; // JPEG over Max_Jpeg_Bytes
+    uint32_t ownCaptures;
+    uint32_t decoded;
+    uint32_t failed;
+    uint32_t copyUs;   // last frame
+    uint32_t decodeUs; // last frame
+    uint64_t totalDecodeUs;
+  };
+
+  explicit AnalyticsTap(Camera &camera);
+
+  // Allocates the buffers and starts the task, it idles without consumers
+  void begin();
+
+  // Consumer tasks are notified after every new thumbnail
+  void subscribe(TaskHandle_t task);
+  void unsubscribe(TaskHandle_t task);
+  uint8_t consumers() const { return consumerCount; }
+
+  // Takes the newest thumbnail when it is newer than sequence after, 0 for
+  // any. The thumbnail stays valid and unchanged until release().
+  bool acquire(uint32_t after, Thumbnail &thumb);
+  void release();
+
+  Stats stats() const;
+
+private:
+  Camera &camera;
+  TaskHandle_t task;
+  SemaphoreHandle_t thumbLock;
+  TaskHandle_t consumerTasks[Max_Consumers];
+  volatile uint8_t consumerCount;
+
+  // JPEG copy, owned by offer() until ready, then by the task
+  uint8_t *jpeg;
+  size_t jpegLen;
+  uint16_t jpegWidth;
+  int64_t jpegCapturedUs;
+  volatile bool jpegClaimed;
+  volatile bool jpegReady;
+
+  uint16_t *pixels;
+  Thumbnail thumb;
+  Stats counters;
+
+  static void onFrame(const camera_fb_t *fb, void *ctx);
+  void offer(const camera_fb_t *fb);
+  static void taskMain(void *arg);
+  void decode();
+  void notifyConsumers();
+
+  static size_t readJpeg(void *arg, size_t index, uint8_t *buf, size_t len);
+  static bool writeBlock(void *arg, uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t *data);
+};
@@ -0,0 +1,153 @@
+#include "blob_camera.h"
+#include "esp_timer.h"
+#include <robot_protocol.h>
+#include "task_config.h"
+
+static portMUX_TYPE statsLock = portMUX_INITIALIZER_UNLOCKED;
+
+// Weight of a new interval in the rate average
+static const float Rate_Smoothing = 0.1f;
+
+BlobCamera::BlobCamera(AnalyticsTap &tap, RobotLink &robotLink)
+    : tap(tap), robotLink(robotLink), task(nullptr), running(false), sequence(0), color{200, 40, 40, 12}, colorTarget(),
+      counters(), lastResult(0), lastSent(0)
+{
+  colorTarget = vision::colorTarget(color[0], color[1], color[2], color[3]);
+}
+
+void BlobCamera::begin()
+{
+  xTaskCreatePinnedToCore(taskMain, "blob_camera", 4096, this, TASK_VISION_PRIORITY, &task, TASK_VISION_CORE);
+}
+
+void BlobCamera::setEnabled(bool enable)
+{
+  running = enable;
+  if (enable && task)
+  {
+    xTaskNotifyGive(task);
+  }
+}
+
+void BlobCamera::setTarget(uint8_t red, uint8_t green, uint8_t blue, uint8_t tolerance)
+{
+  vision::ColorTarget target = vision::colorTarget(red, green, blue, tolerance);
+  portENTER_CRITICAL(&statsLock);
+  color[0] = red;
+  color[1] = green;
+  color[2] = blue;
+  color[3] = tolerance;
+  colorTarget = target;
+  portEXIT_CRITICAL(&statsLock);
+}
+
+void BlobCamera::target(uint8_t &red, uint8_t &green, uint8_t &blue, uint8_t &tolerance) const
+{
+  portENTER_CRITICAL(&statsLock);
+  red = color[0];
+  green = color[1];
+  blue = color[2];
+  tolerance = color[3];
+  portEXIT_CRITICAL(&statsLock);
+}
+
+BlobCamera::Stats BlobCamera::stats() const
+{
+  portENTER_CRITICAL(&statsLock);
+  Stats s = counters;
+  portEXIT_CRITICAL(&statsLock);
+  return s;
+}
+
+bool BlobCamera::copyImage(uint8_t *out, size_t size, uint16_t &w, uint16_t &h)
+{
+  AnalyticsTap::Thumbnail thumb;
+  if (!tap.acquire(0, thumb))
+  {
+    return false;
+  }
+  bool ok = (size_t)thumb.width * thumb.height * 3 <= size;
+  if (ok)
+  {
+    for (size_t i = 0; i < (size_t)thumb.width * thumb.height; i++)
+    {
+      uint16_t p = thumb.pixels[i];
+      *out++ = (p >> 11) << 3;
+      *out++ = ((p >> 5) & 0x3F) << 2;
+      *out++ = (p & 0x1F) << 3;
+    }
+    w = thumb.width;
+    h = thumb.height;
+  }
+  tap.release();
+  return ok;
+}
+
+void BlobCamera::taskMain(void *arg)
+{
+  BlobCamera *self = (BlobCamera *)arg;
+  for (;;)
+  {
+    if (!self->running)
+    {
+      self->tap.unsubscribe(xTaskGetCurrentTaskHandle());
+      ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(500));
+      self->lastResult = 0;
+      continue;
+    }
+    // The tap notifies after every thumbnail
+    self->tap.subscribe(xTaskGetCurrentTaskHandle());
+    if (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(500)))
+    {
+      self->process();
+    }
+  }
+}
+
+void BlobCamera::process()
+{
+  AnalyticsTap::Thumbnail thumb;
+  if (!tap.acquire(sequence, thumb))
+  {
+    return;
+  }
+  sequence = thumb.sequence;
+
+  portENTER_CRITICAL(&statsLock);
+  vision::ColorTarget target = colorTarget;
+  portEXIT_CRITICAL(&statsLock);
+
+  // Straight on the tap's buffer, its rows are word aligned
+  int64_t start = esp_timer_get_time();
+  vision::BlobResult blob = vision::findBlob(thumb.pixels, thumb.width, thumb.height, thumb.width, target);
+  tap.release();
+  int64_t done = esp_timer_get_time();
+
+  // No faster than the UNO's loop takes frames off its RX buffer
+  if (done - lastSent >= protocol::VisionIntervalMs * 1000LL)
+  {
+    protocol::ParameterFrame frame = protocol::encodeVisionTarget(blob.found, blob.bearing, blob.size);
+    robotLink.send(&frame, sizeof(frame));
+    lastSent = done;
+  }
+
+  uint32_t total = done - start;
+  portENTER_CRITICAL(&statsLock);
+  counters.frames++;
+  counters.found += blob.found;
+  counters.overBudget += total > Budget_Us;
+  counters.trackUs = total;
+  counters.totalUs += total;
+  if (total > counters.maxUs)
+  {
+    counters.maxUs = total;
+  }
+  if (lastResult && done > lastResult)
+  {
+    float rate = 1000000.0f / (done - lastResult);
+    counters.rateHz = counters.rateHz ? counters.rateHz + Rate_Smoothing * (rate - counters.rateHz) : rate;
+  }
+  counters.last = blob;
+  portEXIT_CRITICAL(&statsLock);
+  lastResult = done;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <Arduino.h>
+#include <blob_vision.h>
+#include "analytics_tap.h"
+#include "robot_link.h"
+
+// Colour target tracking for the UNO's follow mode. A task takes the RGB565
+// thumbnails of the analytics tap, QQVGA for the QVGA and VGA profiles,
+// finds the target colour with lib/blob_vision and sends its bearing and
+// size to the UNO, at most every protocol::VisionIntervalMs.
+class BlobCamera
+{
+public:
+  // Tracking rate the task has to sustain
+  static const uint32_t Target_Rate_Hz = 15;
+  static const uint32_t Budget_Us = 1000000 / Target_Rate_Hz;
+  // Largest image, the tap's thumbnail
+  static const uint16_t Max_Width = AnalyticsTap::Max_Width;
+  static const uint16_t Max_Height = AnalyticsTap::Max_Height;
+
+  struct Stats
+  {
+    uint32_t frames;
+    uint32_t found;
+    uint32_t overBudget; // frames that took longer than Budget_Us
+    uint32_t trackUs;    // last frame
+    uint32_t maxUs;
+    uint64_t totalUs;
+    float rateHz; // tracking results per second, smoothed
+    vision::BlobResult last;
+  };
+
+  BlobCamera(AnalyticsTap &tap, RobotLink &robotLink);
+
+  // Starts the task, it idles until enabled
+  void begin();
+  void setEnabled(bool enable);
+  bool enabled() const { return running; }
+  void setTarget(uint8_t red, uint8_t green, uint8_t blue, uint8_t tolerance);
+  void target(uint8_t &red, uint8_t &green, uint8_t &blue, uint8_t &tolerance) const;
+  Stats stats() const;
+
+  // Copies the newest thumbnail as RGB888, false when there is none yet
+  bool copyImage(uint8_t *out, size_t size, uint16_t &width, uint16_t &height);
+
+private:
+  AnalyticsTap &tap;
+  RobotLink &robotLink;
+  TaskHandle_t task;
+  volatile bool running;
+  uint32_t sequence; // last thumbnail taken
+  uint8_t color[4]; // red, green, blue, tolerance
+  vision::ColorTarget colorTarget;
+  Stats counters;
+  int64_t lastResult;
+  int64_t lastSent; // last frame to the UNO
+
+  static void taskMain(void *arg);
+  void process();
+};
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "esp_timer.h"
+
+// Boot milestones in microseconds since reset, 0 until reached
+struct BootTimeline
+{
+  int64_t wifiStart;
+  int64_t cameraReady;
+  int64_t networkUp;
+  int64_t serversUp;
+  int64_t firstFrame;
+
+  // Records the milestone the first time, returns true when it did
+  static bool mark(int64_t &milestone)
+  {
+    if (milestone)
+    {
+      return false;
+    }
+    milestone = esp_timer_get_time();
+    return true;
+  }
+
+  static uint32_t ms(int64_t milestone)
+  {
+    return (uint32_t)(milestone / 1000);
+  }
+};
+
+extern BootTimeline bootTimeline;
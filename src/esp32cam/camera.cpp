@@ -1,6 +1,21 @@
 #include "camera.h"
 
-Camera::Camera() : sensor(nullptr) {}
+static const int Frame_Buffers = 2;
+
+// Low latency fixes the exposure below one frame time at the higher clock so
+// the sensor never stretches frames in dim rooms. Auto gain makes up for dim
+// light but cannot go below 1x, so a bright scene overexposes.
+const CaptureProfile Camera::Profiles[Profile_Count] = {
+    {"low-latency", FRAMESIZE_QVGA, 12, 24, 400, GAINCEILING_16X},
+    {"quality", FRAMESIZE_VGA, 10, 20, 0, GAINCEILING_4X},
+};
+
+// Weight of a new frame interval in the fps average
+static const float Fps_Smoothing = 0.1f;
+// Intervals this much longer than the average spanned a skipped frame
+static const float Fps_Skip_Ratio = 1.5f;
+
+Camera::Camera() : sensor(nullptr), initialized(false), lock(nullptr), activeProfile(Profile_Low_Latency), overridden(false), fps(), lastFrameUs(0), roi(), frameCallbacks(), frameCallbackCtx(), frameCallbackCount(0) {}
 
 bool Camera::init()
 {
@@ -29,12 +44,15 @@ bool Camera::init()
     sensor->set_saturation(sensor, -2);
   }
 
+  lock = xSemaphoreCreateMutex();
+  prefs.begin("camera", false);
   if (config.pixel_format == PIXFORMAT_JPEG)
   {
-    sensor->set_framesize(sensor, FRAMESIZE_QVGA);
-    sensor->set_quality(sensor, 10);
+    uint8_t id = prefs.getUChar("profile", Profile_Low_Latency);
+    applyProfile(id < Profile_Count ? id : Profile_Low_Latency, false);
   }
 
+  initialized = true;
   return true;
 }
 
@@ -59,19 +77,21 @@ void Camera::initCameraConfig(camera_config_t &config)
   config.pin_pwdn = PWDN_GPIO_NUM;
   config.pin_reset = RESET_GPIO_NUM;
   config.xclk_freq_hz = 20000000;
-  config.frame_size = FRAMESIZE_QVGA;
+  // Frame buffers are sized for the init frame size, it has to hold the
+  // largest profile
+  config.frame_size = Max_Frame_Size;
   config.pixel_format = PIXFORMAT_JPEG;
   config.grab_mode = CAMERA_GRAB_LATEST;
   config.fb_location = CAMERA_FB_IN_PSRAM;
   config.jpeg_quality = 12;
-  config.fb_count = 2;
+  config.fb_count = Frame_Buffers;
 
   if (config.pixel_format == PIXFORMAT_JPEG)
   {
     if (psramFound())
     {
       config.jpeg_quality = 10;
-      config.fb_count = 2;
+      config.fb_count = Frame_Buffers;
       config.grab_mode = CAMERA_GRAB_LATEST;
     }
     else
@@ -93,7 +113,32 @@ sensor_t *Camera::getSensor()
 
 camera_fb_t *Camera::capture()
 {
-  return esp_camera_fb_get();
+  xSemaphoreTake(lock, portMAX_DELAY);
+  camera_fb_t *fb = esp_camera_fb_get();
+  if (fb && !overridden)
+  {
+    updateFps(fb);
+  }
+  xSemaphoreGive(lock);
+
+  for (uint8_t i = 0; fb && i < frameCallbackCount; i++)
+  {
+    frameCallbacks[i](fb, frameCallbackCtx[i]);
+  }
+  return fb;
+}
+
+// Registered once at startup, the count is raised after the slot is filled
+bool Camera::addFrameCallback(FrameCallback callback, void *ctx)
+{
+  if (frameCallbackCount >= Max_Frame_Callbacks)
+  {
+    return false;
+  }
+  frameCallbacks[frameCallbackCount] = callback;
+  frameCallbackCtx[frameCallbackCount] = ctx;
+  frameCallbackCount++;
+  return true;
 }
 
 void Camera::returnFrame(camera_fb_t *fb)
@@ -113,23 +158,225 @@ void Camera::setQuality(int quality)
     sensor->set_quality(sensor, quality);
 }
 
-void Camera::setXclk(int xclk)
+// The raw sensor calls below replace the profile settings like configure()
+// does, so they hold off capture() and drop the frames queued before them
+int Camera::setXclk(int xclk)
 {
-  if (sensor)
-    sensor->set_xclk(sensor, LEDC_TIMER_0, xclk);
+  if (!sensor)
+    return -1;
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  int res = sensor->set_xclk(sensor, LEDC_TIMER_0, xclk);
+  overridden = true;
+  dropQueuedFrames();
+  xSemaphoreGive(lock);
+  return res;
 }
 
-int Camera::setReg(uint8_t reg, uint8_t mask, uint8_t value)
+int Camera::setReg(int reg, int mask, int value)
 {
-  return sensor ? sensor->set_reg(sensor, reg, mask, value) : -1;
+  if (!sensor)
+    return -1;
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  int res = sensor->set_reg(sensor, reg, mask, value);
+  overridden = true;
+  dropQueuedFrames();
+  xSemaphoreGive(lock);
+  return res;
 }
 
-int Camera::getReg(uint8_t reg, uint8_t mask)
+// Locked as well, the OV2640 selects the register bank with a write first
+int Camera::getReg(int reg, int mask)
 {
-  return sensor ? sensor->get_reg(sensor, reg, mask) : -1;
+  if (!sensor)
+    return -1;
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  int res = sensor->get_reg(sensor, reg, mask);
+  xSemaphoreGive(lock);
+  return res;
 }
 
 int Camera::setPLL(int bypass, int mul, int sys, int root, int pre, int seld5, int pclken, int pclk)
 {
-  return sensor ? sensor->set_pll(sensor, bypass, mul, sys, root, pre, seld5, pclken, pclk) : -1;
+  if (!sensor)
+    return -1;
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  int res = sensor->set_pll(sensor, bypass, mul, sys, root, pre, seld5, pclken, pclk);
+  overridden = true;
+  dropQueuedFrames();
+  xSemaphoreGive(lock);
+  return res;
+}
+
+int Camera::setResRaw(int startX, int startY, int endX, int endY, int offsetX, int offsetY, int totalX, int totalY,
+                      int outputX, int outputY, bool scale, bool binning)
+{
+  if (!sensor || !fitsFrameBuffers(outputX, outputY))
+    return -1;
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  int res = sensor->set_res_raw(sensor, startX, startY, endX, endY, offsetX, offsetY, totalX, totalY, outputX,
+                                outputY, scale, binning);
+  overridden = true;
+  roi.active = false;
+  dropQueuedFrames();
+  xSemaphoreGive(lock);
+  return res;
+}
+
+bool Camera::fitsFrameBuffers(int width, int height)
+{
+  return width <= resolution[Max_Frame_Size].width && height <= resolution[Max_Frame_Size].height;
+}
+
+bool Camera::configure(framesize_t size, int xclkMhz, const int *pll)
+{
+  if (!sensor)
+    return false;
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  // The frame size rewrites the clock tree on the OV3660, the PLL goes last
+  bool ok = sensor->set_xclk(sensor, LEDC_TIMER_0, xclkMhz) == 0;
+  ok = sensor->set_framesize(sensor, size) == 0 && ok;
+  if (pll)
+  {
+    ok = sensor->set_pll(sensor, pll[0], pll[1], pll[2], pll[3], pll[4], pll[5], pll[6], pll[7]) == 0 && ok;
+  }
+  overridden = true;
+  roi.active = false;
+  dropQueuedFrames();
+  xSemaphoreGive(lock);
+  return ok;
+}
+
+int Camera::profileByName(const char *name)
+{
+  for (int i = 0; i < Profile_Count; i++)
+  {
+    if (!strcmp(name, Profiles[i].name))
+      return i;
+  }
+  return -1;
+}
+
+bool Camera::applyProfile(uint8_t id, bool persist)
+{
+  if (!sensor || id >= Profile_Count)
+    return false;
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  setProfile(Profiles[id]);
+  activeProfile = id;
+  overridden = false;
+  roi.active = false;
+  dropQueuedFrames();
+  xSemaphoreGive(lock);
+
+  if (persist && prefs.getUChar("profile", Profile_Count) != id)
+    prefs.putUChar("profile", id);
+  Serial.printf("Capture profile: %s\n", Profiles[id].name);
+  return true;
+}
+
+void Camera::setProfile(const CaptureProfile &profile)
+{
+  sensor->set_xclk(sensor, LEDC_TIMER_0, profile.xclkMhz);
+  sensor->set_framesize(sensor, profile.framesize);
+  sensor->set_quality(sensor, profile.quality);
+  sensor->set_gain_ctrl(sensor, 1);
+  sensor->set_gainceiling(sensor, profile.gainCeiling);
+  if (profile.fixedExposure)
+  {
+    sensor->set_exposure_ctrl(sensor, 0);
+    sensor->set_aec2(sensor, 0);
+    sensor->set_aec_value(sensor, profile.fixedExposure);
+  }
+  else
+  {
+    sensor->set_exposure_ctrl(sensor, 1);
+  }
+}
+
+// The sensor's frame rate from the timestamps of the frames handed out, so it
+// does not depend on how often or from how many tasks capture() is called.
+// With CAMERA_GRAB_LATEST the driver skips frames nobody took in time, an
+// interval that spans more than one frame is left out. Called with the lock
+// held.
+void Camera::updateFps(const camera_fb_t *fb)
+{
+  int64_t stamp = (int64_t)fb->timestamp.tv_sec * 1000000 + fb->timestamp.tv_usec;
+  float &rate = fps[activeProfile];
+  if (lastFrameUs && stamp > lastFrameUs)
+  {
+    float frame_rate = 1000000.0f / (stamp - lastFrameUs);
+    if (!rate || frame_rate > rate * Fps_Skip_Ratio)
+    {
+      // No estimate yet or the last one spanned skipped frames
+      rate = frame_rate;
+    }
+    else if (frame_rate > rate / Fps_Skip_Ratio)
+    {
+      rate += Fps_Smoothing * (frame_rate - rate);
+    }
+  }
+  lastFrameUs = stamp;
+}
+
+// Frames already queued were taken with the old settings. Called with the
+// lock held.
+void Camera::dropQueuedFrames()
+{
+  for (int i = 0; i < Frame_Buffers; i++)
+  {
+    camera_fb_t *fb = esp_camera_fb_get();
+    if (fb)
+      esp_camera_fb_return(fb);
+  }
+  lastFrameUs = 0;
+}
+
+bool Camera::setWindow(int x, int y, int width, int height, framesize_t output)
+{
+  if (!sensor || sensor->id.PID != OV2640_PID || output > Max_Frame_Size)
+    return false;
+
+  int out_w = resolution[output].width;
+  int out_h = resolution[output].height;
+  // The sensor only scales down, and its window registers count in steps of
+  // 8 pixels, 16 before 2x2 binning
+  width = constrain((max(width, out_w) + 15) & ~15, out_w, Sensor_Width);
+  height = constrain((max(height, out_h) + 15) & ~15, out_h, Sensor_Height);
+  x = constrain(x, 0, Sensor_Width - width) & ~15;
+  y = constrain(y, 0, Sensor_Height - height) & ~15;
+
+  // SVGA mode bins 2x2 and runs twice the frame rate of UXGA mode, use it
+  // whenever the binned window still covers the output
+  int mode = 0; // OV2640_MODE_UXGA
+  int scale = 1;
+  if (width / 2 >= out_w && height / 2 >= out_h)
+  {
+    mode = 1; // OV2640_MODE_SVGA
+    scale = 2;
+  }
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  bool ok = sensor->set_res_raw(sensor, mode, 0, 0, 0, x / scale, y / scale, width / scale, height / scale, out_w,
+                                out_h, false, false) == 0;
+  if (ok)
+  {
+    roi = CameraWindow{true, x, y, width, height, output};
+    overridden = true;
+  }
+  dropQueuedFrames();
+  xSemaphoreGive(lock);
+  return ok;
+}
+
+void Camera::clearWindow()
+{
+  if (roi.active)
+    applyProfile(activeProfile, false);
 }
@@ -34,27 +34,115 @@
 #include "esp_camera.h"
 #include "camera_pins.h"
 #include <Arduino.h>
+#include <Preferences.h>
+#include "freertos/semphr.h"
+
+// Named sensor setups that can be switched while streaming
+enum CaptureProfileId : uint8_t
+{
+  Profile_Low_Latency,
+  Profile_Quality,
+  Profile_Count
+};
+
+struct CaptureProfile
+{
+  const char *name;
+  framesize_t framesize;
+  int quality;               // JPEG quality, lower is better
+  int xclkMhz;               // sensor input clock
+  int fixedExposure;         // exposure in lines with auto exposure off, 0 keeps auto exposure
+  gainceiling_t gainCeiling; // auto gain makes up for a fixed exposure in dim light
+};
+
+// Sensor region streamed instead of the full field, in full resolution
+// sensor pixels
+struct CameraWindow
+{
+  bool active;
+  int x;
+  int y;
+  int width;
+  int height;
+  framesize_t output;
+};
 
 class Camera
 {
 public:
+  // Sees every frame capture() hands out, before the caller gets it
+  typedef void (*FrameCallback)(const camera_fb_t *fb, void *ctx);
+
   Camera();
   bool init();
+  // False until init() has succeeded, init may run in another task
+  bool ready() const { return initialized; }
 
   // Core methods used in the original code
   sensor_t *getSensor();
   camera_fb_t *capture();
   void returnFrame(camera_fb_t *fb);
+  // Callbacks run in the capturing task so they have to be quick. False
+  // when all Max_Frame_Callbacks are taken.
+  static const uint8_t Max_Frame_Callbacks = 4;
+  bool addFrameCallback(FrameCallback callback, void *ctx);
 
   // Most commonly used settings
   void setFrameSize(framesize_t size);
   void setQuality(int quality);
-  void setXclk(int xclk);
-  int setReg(uint8_t reg, uint8_t mask, uint8_t value);
-  int getReg(uint8_t reg, uint8_t mask);
+  // Raw sensor access, 0 on success like the sensor driver. Replaces the
+  // profile settings until the next applyProfile().
+  int setXclk(int xclk);
+  // Register addresses carry the bank in the high byte on the OV2640
+  int setReg(int reg, int mask, int value);
+  int getReg(int reg, int mask);
   int setPLL(int bypass, int mul, int sys, int root, int pre, int seld5, int pclken, int pclk);
+  int setResRaw(int startX, int startY, int endX, int endY, int offsetX, int offsetY, int totalX, int totalY,
+                int outputX, int outputY, bool scale, bool binning);
+
+  // Frame size, input clock and optionally the PLL (bypass, mul, sys, root,
+  // pre, seld5, pclken, pclk) in one step, like applyProfile() but not kept.
+  // Returns false when the sensor refused one of them.
+  bool configure(framesize_t size, int xclkMhz, const int *pll = nullptr);
+
+  // Capture profiles. Switching holds off capture() until every setting is
+  // in and the frames queued with the old ones are dropped.
+  static const CaptureProfile Profiles[Profile_Count];
+  // Frame buffers are sized for this, larger frame sizes do not fit
+  static const framesize_t Max_Frame_Size = FRAMESIZE_VGA;
+  static bool fitsFrameBuffers(int width, int height);
+  static int profileByName(const char *name);
+  bool applyProfile(uint8_t id, bool persist = true);
+  uint8_t profile() const { return activeProfile; }
+  // Sensor frame rate while each profile was active, from the frame
+  // timestamps, 0 before the first frames
+  float measuredFps(uint8_t id) const { return id < Profile_Count ? fps[id] : 0; }
+
+  // Region of interest: the sensor crops the window and scales it to the
+  // output frame size, so a zoomed view costs what the output size costs.
+  // Only the OV2640 is supported. clearWindow() goes back to the profile.
+  static const int Sensor_Width = 1600;
+  static const int Sensor_Height = 1200;
+  bool setWindow(int x, int y, int width, int height, framesize_t output);
+  void clearWindow();
+  CameraWindow window() const { return roi; }
 
 private:
   sensor_t *sensor;
+  volatile bool initialized;
+  SemaphoreHandle_t lock;
+  Preferences prefs;
+  uint8_t activeProfile;
+  bool overridden; // configure() replaced the profile settings
+  float fps[Profile_Count];
+  int64_t lastFrameUs; // timestamp of the last frame handed out
+  CameraWindow roi;
+  FrameCallback frameCallbacks[Max_Frame_Callbacks];
+  void *frameCallbackCtx[Max_Frame_Callbacks];
+  volatile uint8_t frameCallbackCount;
+
   void initCameraConfig(camera_config_t &config);
+  void setProfile(const CaptureProfile &profile);
+  void updateFps(const camera_fb_t *fb);
+  void dropQueuedFrames();
 };
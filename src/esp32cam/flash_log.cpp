@@ -0,0 +1,434 @@
+#include "flash_log.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "task_config.h"
+
+static portMUX_TYPE statsLock = portMUX_INITIALIZER_UNLOCKED;
+
+// A frame does not start in less room than this, the sector is closed instead
+static const uint32_t Min_Fragment_Bytes = 256;
+
+static void putU16(uint8_t *p, uint16_t v)
+{
+  p[0] = v;
+  p[1] = v >> 8;
+}
+
+static void putU32(uint8_t *p, uint32_t v)
+{
+  putU16(p, v);
+  putU16(p + 2, v >> 16);
+}
+
+static uint32_t getU32(const uint8_t *p)
+{
+  return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint32_t recordBytes(uint16_t len)
+{
+  return (FlashLog::Record_Header_Bytes + len + 3) & ~3u;
+}
+
+FlashLog::FlashLog(Camera &camera, RobotLink &robotLink)
+    : camera(camera), robotLink(robotLink), partition(nullptr), sectors(0), task(nullptr),
+      settings{true, Default_Frame_Ms, Default_Telemetry_Ms}, lock(nullptr), buffer(nullptr), sector(0),
+      sequence(0), fill(0), flushed(0), frame(nullptr), frameLen(0), frameClaimed(false), frameReady(false),
+      lastFrameMs(0), traceCursor(0), lastTelemetryMs(0), lastFlushMs(0), counters()
+{
+}
+
+bool FlashLog::begin()
+{
+  partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_SPIFFS, nullptr);
+  if (!partition)
+  {
+    Serial.println("Flash log: no spiffs partition");
+    return false;
+  }
+  // Flash writes from internal RAM need no bounce buffer
+  buffer = (uint8_t *)heap_caps_malloc(Sector_Bytes, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+  frame = (uint8_t *)heap_caps_malloc(Max_Frame_Bytes, MALLOC_CAP_SPIRAM);
+  if (!buffer || !frame)
+  {
+    Serial.println("Flash log: out of memory");
+    return false;
+  }
+  lock = xSemaphoreCreateMutex();
+  sectors = partition->size / Sector_Bytes;
+
+  // Only the headers are read, a few milliseconds for the whole partition
+  bool found = false;
+  sector = sectors - 1;
+  for (uint16_t s = 0; s < sectors; s++)
+  {
+    uint8_t header[8];
+    if (esp_partition_read(partition, s * Sector_Bytes, header, sizeof(header)) != ESP_OK ||
+        getU32(header) != Sector_Magic)
+    {
+      continue;
+    }
+    uint32_t seq = getU32(header + 4);
+    if (!found || seq > sequence)
+    {
+      sector = s;
+      sequence = seq;
+      found = true;
+    }
+  }
+  openSector();
+  Serial.printf("Flash log: %u sectors, continuing at %u\n", sectors, (unsigned)sequence);
+
+  // Lowest priority, on the networking core away from capture
+  xTaskCreatePinnedToCore(taskMain, "flash_log", 4096, this, TASK_FLASH_LOG_PRIORITY, &task, TASK_FLASH_LOG_CORE);
+  camera.addFrameCallback(onFrame, this);
+  return true;
+}
+
+void FlashLog::configure(const Config &config)
+{
+  portENTER_CRITICAL(&statsLock);
+  settings = config;
+  portEXIT_CRITICAL(&statsLock);
+}
+
+FlashLog::Stats FlashLog::stats() const
+{
+  portENTER_CRITICAL(&statsLock);
+  Stats s = counters;
+  portEXIT_CRITICAL(&statsLock);
+  s.sequence = sequence;
+  s.sectors = sectors;
+  return s;
+}
+
+void FlashLog::onFrame(const camera_fb_t *fb, void *ctx)
+{
+  ((FlashLog *)ctx)->offer(fb);
+}
+
+// Runs in whichever task called capture(), the frame is only copied here
+void FlashLog::offer(const camera_fb_t *fb)
+{
+  if (!settings.enabled || !settings.frameMs || !frame || fb->format != PIXFORMAT_JPEG ||
+      millis() - lastFrameMs < settings.frameMs)
+  {
+    return;
+  }
+
+  portENTER_CRITICAL(&statsLock);
+  bool take = !frameClaimed && fb->len <= Max_Frame_Bytes;
+  if (take)
+  {
+    frameClaimed = true;
+    lastFrameMs = millis();
+  }
+  else
+  {
+    counters.framesSkipped++;
+  }
+  portEXIT_CRITICAL(&statsLock);
+  if (!take)
+  {
+    return;
+  }
+
+  memcpy(frame, fb->buf, fb->len);
+  frameLen = fb->len;
+  portENTER_CRITICAL(&statsLock);
+  frameReady = true;
+  portEXIT_CRITICAL(&statsLock);
+  if (task)
+  {
+    xTaskNotifyGive(task);
+  }
+}
+
+void FlashLog::taskMain(void *arg)
+{
+  FlashLog *self = (FlashLog *)arg;
+  for (;;)
+  {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(100));
+    Config c = self->config();
+    if (!c.enabled)
+    {
+      continue;
+    }
+
+    uint32_t now = millis();
+    if (!self->frameReady && c.frameMs && self->camera.ready() && now - self->lastFrameMs > c.frameMs * 3UL / 2)
+    {
+      // Nobody is streaming, capture() offers the frame like any other
+      camera_fb_t *fb = self->camera.capture();
+      if (fb)
+      {
+        self->camera.returnFrame(fb);
+        portENTER_CRITICAL(&statsLock);
+        self->counters.ownCaptures++;
+        portEXIT_CRITICAL(&statsLock);
+      }
+    }
+    if (self->frameReady)
+    {
+      self->writeFrame();
+      portENTER_CRITICAL(&statsLock);
+      self->frameReady = false;
+      self->frameClaimed = false;
+      self->counters.frames++;
+      portEXIT_CRITICAL(&statsLock);
+    }
+    if (c.telemetryMs && now - self->lastTelemetryMs >= c.telemetryMs)
+    {
+      self->writeTelemetry();
+      self->lastTelemetryMs = now;
+    }
+    self->flushIfDue();
+  }
+}
+
+void FlashLog::writeFrame()
+{
+  uint8_t type = Record_Frame_Start;
+  for (uint32_t done = 0; done < frameLen;)
+  {
+    if (room() < Min_Fragment_Bytes)
+    {
+      flush(true);
+      openSector();
+    }
+    uint32_t len = frameLen - done;
+    if (len > room())
+    {
+      len = room();
+    }
+    append(type, frame + done, len);
+    type = Record_Frame_Data;
+    done += len;
+    flushIfDue();
+  }
+}
+
+void FlashLog::writeTelemetry()
+{
+  TraceSample samples[Trace_Batch];
+  uint8_t payload[Trace_Batch * Trace_Sample_Bytes];
+  for (;;)
+  {
+    uint32_t lost;
+    size_t count = robotLink.traceSince(traceCursor, samples, Trace_Batch, lost);
+    if (lost)
+    {
+      portENTER_CRITICAL(&statsLock);
+      counters.traceLost += lost;
+      portEXIT_CRITICAL(&statsLock);
+    }
+    if (!count)
+    {
+      break;
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+      uint8_t *p = payload + i * Trace_Sample_Bytes;
+      putU32(p, samples[i].time);
+      p[4] = samples[i].kind;
+      for (uint8_t v = 0; v < 3; v++)
+      {
+        putU16(p + 5 + 2 * v, samples[i].value[v]);
+      }
+    }
+    append(Record_Trace, payload, count * Trace_Sample_Bytes);
+  }
+
+  uint8_t radar[protocol::RadarSectors * 2];
+  for (uint8_t bin = 0; bin < protocol::RadarSectors; bin++)
+  {
+    putU16(radar + 2 * bin, robotLink.radarDistance(bin));
+  }
+  append(Record_Radar, radar, sizeof(radar));
+}
+
+// Payload bytes one more record can take in the current sector
+uint32_t FlashLog::room() const
+{
+  uint32_t left = Sector_Bytes - fill;
+  return left > Record_Header_Bytes ? (left - Record_Header_Bytes) & ~3u : 0;
+}
+
+// Only the writer task changes the sector, the lock keeps dump() from
+// copying half a record or reading a sector while it is erased
+void FlashLog::append(uint8_t type, const uint8_t *payload, uint16_t len)
+{
+  if (fill + recordBytes(len) > Sector_Bytes)
+  {
+    flush(true);
+    openSector();
+  }
+  xSemaphoreTake(lock, portMAX_DELAY);
+  uint8_t *p = buffer + fill;
+  p[0] = Record_Magic;
+  p[1] = type;
+  putU16(p + 2, len);
+  putU32(p + 4, millis());
+  memcpy(p + Record_Header_Bytes, payload, len);
+  fill += recordBytes(len);
+  xSemaphoreGive(lock);
+
+  portENTER_CRITICAL(&statsLock);
+  counters.records++;
+  portEXIT_CRITICAL(&statsLock);
+}
+
+void FlashLog::flushIfDue()
+{
+  if (fill - flushed >= Batch_Bytes || millis() - lastFlushMs >= Flush_Ms)
+  {
+    flush(false);
+  }
+}
+
+// Writes the complete pages, or with all the last partial one as well, a
+// batch at a time. Nothing else writes this sector so no lock is needed.
+void FlashLog::flush(bool all)
+{
+  uint32_t end = all ? (fill + Page_Bytes - 1) & ~(Page_Bytes - 1) : fill & ~(Page_Bytes - 1);
+  while (flushed < end)
+  {
+    uint32_t len = end - flushed;
+    if (len > Batch_Bytes)
+    {
+      len = Batch_Bytes;
+    }
+    int64_t start = esp_timer_get_time();
+    esp_partition_write(partition, sector * Sector_Bytes + flushed, buffer + flushed, len);
+    flashTimed(start);
+    flushed += len;
+    portENTER_CRITICAL(&statsLock);
+    counters.bytesWritten += len;
+    portEXIT_CRITICAL(&statsLock);
+    // Let the camera and HTTP tasks run between flash operations
+    vTaskDelay(1);
+  }
+  lastFlushMs = millis();
+}
+
+void FlashLog::openSector()
+{
+  xSemaphoreTake(lock, portMAX_DELAY);
+  sector = (sector + 1) % sectors;
+  sequence++;
+  int64_t start = esp_timer_get_time();
+  esp_partition_erase_range(partition, sector * Sector_Bytes, Sector_Bytes);
+  flashTimed(start);
+  memset(buffer, 0xFF, Sector_Bytes);
+  putU32(buffer, Sector_Magic);
+  putU32(buffer + 4, sequence);
+  fill = Header_Bytes;
+  flushed = 0;
+  xSemaphoreGive(lock);
+
+  portENTER_CRITICAL(&statsLock);
+  counters.erases++;
+  portEXIT_CRITICAL(&statsLock);
+  vTaskDelay(1);
+}
+
+void FlashLog::flashTimed(int64_t start_us)
+{
+  uint32_t us = esp_timer_get_time() - start_us;
+  portENTER_CRITICAL(&statsLock);
+  if (us > counters.maxFlashUs)
+  {
+    counters.maxFlashUs = us;
+  }
+  portEXIT_CRITICAL(&statsLock);
+}
+
+uint32_t FlashLog::dump(Format format, Writer writer, void *ctx)
+{
+  if (!lock)
+  {
+    return 0;
+  }
+  uint8_t *data = (uint8_t *)heap_caps_malloc(Sector_Bytes, MALLOC_CAP_SPIRAM);
+  if (!data)
+  {
+    data = (uint8_t *)malloc(Sector_Bytes);
+  }
+  if (!data)
+  {
+    return 0;
+  }
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  uint16_t newest = sector;
+  uint32_t newest_seq = sequence;
+  xSemaphoreGive(lock);
+
+  uint32_t written = 0;
+  uint32_t last_seq = 0;
+  bool in_frame = false;
+  bool ok = true;
+  for (uint16_t i = 1; i <= sectors && ok; i++)
+  {
+    uint16_t s = (newest + i) % sectors;
+    xSemaphoreTake(lock, portMAX_DELAY);
+    if (s == sector)
+    {
+      // Includes the records not written to flash yet
+      memcpy(data, buffer, Sector_Bytes);
+    }
+    else
+    {
+      esp_partition_read(partition, s * Sector_Bytes, data, Sector_Bytes);
+    }
+    xSemaphoreGive(lock);
+
+    // Sectors the writer reused since the dump started would come out of
+    // order, a frame does not go on across a missing sector
+    uint32_t seq = getU32(data + 4);
+    if (getU32(data) != Sector_Magic || seq > newest_seq || (last_seq && seq <= last_seq))
+    {
+      in_frame = false;
+      continue;
+    }
+    if (seq != last_seq + 1)
+    {
+      in_frame = false;
+    }
+    last_seq = seq;
+
+    for (uint32_t off = Header_Bytes; ok && off + Record_Header_Bytes <= Sector_Bytes && data[off] == Record_Magic;)
+    {
+      uint8_t type = data[off + 1];
+      uint16_t len = data[off + 2] | data[off + 3] << 8;
+      uint32_t size = recordBytes(len);
+      if (off + size > Sector_Bytes)
+      {
+        break;
+      }
+      if (type == Record_Frame_Start)
+      {
+        in_frame = true;
+      }
+      else if (type != Record_Frame_Data)
+      {
+        in_frame = false;
+      }
+
+      if (format == Format_Raw)
+      {
+        ok = writer(data + off, size, ctx);
+        written++;
+      }
+      else if (in_frame)
+      {
+        ok = writer(data + off + Record_Header_Bytes, len, ctx);
+        written += type == Record_Frame_Start;
+      }
+      off += size;
+    }
+  }
+  free(data);
+  return written;
+}
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <Arduino.h>
+#include "camera.h"
+#include "robot_link.h"
+#include "esp_partition.h"
+#include "freertos/semphr.h"
+
+// Timelapse and telemetry log in the spiffs partition of huge_app.csv, which
+// is not mounted as a file system. The partition is a ring of 4 KB sectors,
+// each one starts with a 16 byte header:
+//
+//   uint32 Sector_Magic, uint32 sequence (one more per sector), 8 bytes 0xFF
+//
+// followed by records that never cross a sector:
+//
+//   uint8 Record_Magic, uint8 type, uint16 payload length, uint32 millis(),
+//   payload, 0xFF up to the next multiple of 4
+//
+// A JPEG frame is a Record_Frame_Start and as many Record_Frame_Data records
+// as it takes. Trace records hold 11 bytes per sample (uint32 time, uint8
+// kind, 3 x uint16 value), a radar record one uint16 per sector. Everything
+// is little endian.
+//
+// A low priority task owns the flash: producers only copy into RAM. It writes
+// whole 256 byte pages in batches and erases one sector at a time, sleeping
+// in between, because every flash operation stops the caches of both cores.
+// After a reset writing carries on in the sector after the newest one.
+class FlashLog
+{
+public:
+  static const uint32_t Sector_Bytes = 4096;
+  static const uint32_t Page_Bytes = 256;
+  static const uint32_t Batch_Bytes = 1024;
+  static const uint32_t Sector_Magic = 0x474F4C4D; // "MLOG"
+  static const uint8_t Record_Magic = 0xA5;
+  static const uint8_t Header_Bytes = 16;
+  static const uint8_t Record_Header_Bytes = 8;
+
+  enum RecordType : uint8_t
+  {
+    Record_Frame_Start = 1,
+    Record_Frame_Data = 2,
+    Record_Trace = 3,
+    Record_Radar = 4,
+  };
+
+  // Frames larger than this are not logged
+  static const uint32_t Max_Frame_Bytes = 64 * 1024;
+  // Trace samples per record
+  static const uint8_t Trace_Batch = 32;
+  static const uint8_t Trace_Sample_Bytes = 11;
+  static const uint16_t Default_Frame_Ms = 5000;
+  static const uint16_t Default_Telemetry_Ms = 500;
+  // Complete pages still in RAM are written after this long
+  static const uint16_t Flush_Ms = 1000;
+
+  struct Config
+  {
+    bool enabled;
+    uint16_t frameMs;     // timelapse interval, 0 logs no frames
+    uint16_t telemetryMs; // trace and radar records
+  };
+
+  struct Stats
+  {
+    uint32_t sequence; // of the sector being written
+    uint16_t sectors;
+    uint32_t frames;
+    uint32_t framesSkipped; // the last one was still being written, or too large
+    uint32_t ownCaptures;   // frames taken because nobody else captured
+    uint32_t records;
+    uint32_t traceLost; // samples RobotLink dropped before they were logged
+    uint32_t bytesWritten;
+    uint32_t erases;
+    uint32_t maxFlashUs; // longest single erase or write
+  };
+
+  enum Format
+  {
+    Format_Raw,   // the records, oldest first, without sector headers
+    Format_Mjpeg, // the logged frames back to back
+  };
+
+  // Receives the log in pieces, returns false to stop
+  typedef bool (*Writer)(const uint8_t *data, size_t len, void *ctx);
+
+  FlashLog(Camera &camera, RobotLink &robotLink);
+
+  // Finds the partition and the newest sector, then starts the writer. False
+  // when the partition table has no spiffs partition.
+  bool begin();
+  void configure(const Config &config);
+  Config config() const { return settings; }
+  Stats stats() const;
+
+  // Reads the partition one sector at a time, the writer keeps going. Frames
+  // whose start was overwritten are left out. Returns the records, or the
+  // frames for Format_Mjpeg, written.
+  uint32_t dump(Format format, Writer writer, void *ctx);
+
+private:
+  Camera &camera;
+  RobotLink &robotLink;
+  const esp_partition_t *partition;
+  uint16_t sectors;
+  TaskHandle_t task;
+  Config settings;
+
+  // Sector being written, shared with dump() under lock
+  SemaphoreHandle_t lock;
+  uint8_t *buffer;
+  uint16_t sector;
+  uint32_t sequence;
+  uint32_t fill;
+  uint32_t flushed;
+
+  // Frame handed over by capture()
+  uint8_t *frame;
+  uint32_t frameLen;
+  bool frameClaimed;
+  bool frameReady;
+  uint32_t lastFrameMs;
+
+  uint32_t traceCursor;
+  uint32_t lastTelemetryMs;
+  uint32_t lastFlushMs;
+  Stats counters;
+
+  static void onFrame(const camera_fb_t *fb, void *ctx);
+  void offer(const camera_fb_t *fb);
+  static void taskMain(void *arg);
+  void writeFrame();
+  void writeTelemetry();
+
+  void append(uint8_t type, const uint8_t *payload, uint16_t len);
+  uint32_t room() const;
+  void flushIfDue();
+  void flush(bool all);
+  void openSector();
+  void flashTimed(int64_t start_us);
+};
@@ -0,0 +1,103 @@
+#include "frame_change.h"
+#include "jpeg_decode.h"
+#include "esp_timer.h"
+
+FrameChangeDetector::FrameChangeDetector()
+    : source(nullptr), sourceOffset(0), current(), reference(), currentSize(0), referenceSize(0), currentValid(false),
+      referenceValid(false), lastCostUs(0)
+{
+}
+
+bool FrameChangeDetector::changed(const camera_fb_t *fb)
+{
+  int64_t start = esp_timer_get_time();
+  currentSize = fb->len;
+  currentValid = decode(fb);
+
+  bool result = true;
+  if (currentValid && referenceValid)
+  {
+    size_t delta = currentSize > referenceSize ? currentSize - referenceSize : referenceSize - currentSize;
+    result = delta * 100 > referenceSize * Size_Change_Percent;
+
+    uint32_t total = 0;
+    for (int i = 0; i < Thumb_Width * Thumb_Height && !result; i++)
+    {
+      uint8_t diff = abs(cell(i) - reference[i]);
+      total += diff;
+      result = diff > Cell_Threshold;
+    }
+    result = result || total > (uint32_t)Mean_Threshold * Thumb_Width * Thumb_Height;
+  }
+
+  lastCostUs = esp_timer_get_time() - start;
+  return result;
+}
+
+void FrameChangeDetector::accept()
+{
+  referenceValid = currentValid;
+  referenceSize = currentSize;
+  for (int i = 0; i < Thumb_Width * Thumb_Height; i++)
+  {
+    reference[i] = cell(i);
+  }
+}
+
+uint8_t FrameChangeDetector::cell(int index) const
+{
+  return current.count[index] ? current.sum[index] / current.count[index] : 0;
+}
+
+bool FrameChangeDetector::decode(const camera_fb_t *fb)
+{
+  memset(&current, 0, sizeof(current));
+  source = fb;
+  sourceOffset = 0;
+  return jpegDecode(fb->len, JPG_SCALE_8X, readJpeg, writeBlock, this) == ESP_OK && current.width &&
+         current.height;
+}
+
+size_t FrameChangeDetector::readJpeg(void *arg, size_t index, uint8_t *buf, size_t len)
+{
+  FrameChangeDetector *self = (FrameChangeDetector *)arg;
+  if (index + len > self->source->len)
+  {
+    len = self->source->len - index;
+  }
+  if (buf)
+  {
+    memcpy(buf, self->source->buf + index, len);
+  }
+  return len;
+}
+
+// Blocks arrive as RGB888, each pixel is added to the cell it falls in
+bool FrameChangeDetector::writeBlock(void *arg, uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t *data)
+{
+  Thumbnail &thumb = ((FrameChangeDetector *)arg)->current;
+  if (!data)
+  {
+    // Called with the image size before the first block and once at the end
+    if (x == 0 && y == 0)
+    {
+      thumb.width = w;
+      thumb.height = h;
+    }
+    return true;
+  }
+
+  for (uint16_t row = 0; row < h; row++)
+  {
+    int cy = (y + row) * Thumb_Height / thumb.height;
+    for (uint16_t col = 0; col < w; col++, data += 3)
+    {
+      int cx = (x + col) * Thumb_Width / thumb.width;
+      int index = cy * Thumb_Width + cx;
+      // Red and blue weigh the same, their order does not matter
+      thumb.sum[index] += (data[0] + 2 * data[1] + data[2]) >> 2;
+      thumb.count[index]++;
+    }
+  }
+  return true;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <Arduino.h>
+#include "esp_camera.h"
+
+// Tells whether a JPEG frame differs from the last one that was sent. Two
+// cheap tests: the JPEG size, and a grayscale thumbnail decoded at 1/8 scale,
+// which only needs the DC term of each block.
+class FrameChangeDetector
+{
+public:
+  static const uint8_t Thumb_Width = 20;
+  static const uint8_t Thumb_Height = 15;
+
+  // JPEG size change that counts as motion on its own
+  static const uint8_t Size_Change_Percent = 12;
+  // Mean thumbnail difference, in gray levels, over the whole frame
+  static const uint8_t Mean_Threshold = 4;
+  // Difference of a single thumbnail cell, catches small moving objects
+  static const uint8_t Cell_Threshold = 40;
+
+  FrameChangeDetector();
+
+  // Compares the frame against the reference, JPEG frames only
+  bool changed(const camera_fb_t *fb);
+  // The frame last passed to changed() was sent and becomes the reference
+  void accept();
+  // Time the last changed() call took
+  uint32_t costUs() const { return lastCostUs; }
+
+private:
+  struct Thumbnail
+  {
+    uint16_t sum[Thumb_Width * Thumb_Height];
+    uint8_t count[Thumb_Width * Thumb_Height];
+    uint16_t width; // decoded image size
+    uint16_t height;
+  };
+
+  const camera_fb_t *source;
+  size_t sourceOffset;
+  Thumbnail current;
+  uint8_t reference[Thumb_Width * Thumb_Height];
+  size_t currentSize;
+  size_t referenceSize;
+  bool currentValid;
+  bool referenceValid;
+  uint32_t lastCostUs;
+
+  bool decode(const camera_fb_t *fb);
+  uint8_t cell(int index) const;
+
+  static size_t readJpeg(void *arg, size_t index, uint8_t *buf, size_t len);
+  static bool writeBlock(void *arg, uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t *data);
+};
@@ -0,0 +1,361 @@
+#include "frame_recorder.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+
+static portMUX_TYPE statsLock = portMUX_INITIALIZER_UNLOCKED;
+
+// RIFF header up to the 'movi' list, see writeAvi()
+static const size_t Avi_Header_Bytes = 224;
+static const uint32_t Avi_Has_Index = 0x10;
+static const uint32_t Avi_Keyframe = 0x10;
+
+static void putU16(uint8_t *&p, uint16_t v)
+{
+  *p++ = v;
+  *p++ = v >> 8;
+}
+
+static void putU32(uint8_t *&p, uint32_t v)
+{
+  putU16(p, v);
+  putU16(p, v >> 16);
+}
+
+static void putFourcc(uint8_t *&p, const char *fourcc)
+{
+  memcpy(p, fourcc, 4);
+  p += 4;
+}
+
+FrameRecorder::FrameRecorder(Camera &camera)
+    : camera(camera), lock(nullptr), settings{true, Default_Ring_Kb, Default_Seconds, Default_Fps}, ring(nullptr),
+      ringBytes(0), index(nullptr), first(0), count(0), next(0), width(0), height(0), lastRecordedUs(0),
+      counters()
+{
+}
+
+void FrameRecorder::begin()
+{
+  lock = xSemaphoreCreateMutex();
+  index = (Entry *)heap_caps_malloc(Max_Frames * sizeof(Entry), MALLOC_CAP_SPIRAM);
+  allocate(settings.ringKb * 1024);
+  camera.addFrameCallback(onFrame, this);
+}
+
+bool FrameRecorder::allocate(uint32_t bytes)
+{
+  free(ring);
+  ring = (uint8_t *)heap_caps_malloc(bytes, MALLOC_CAP_SPIRAM);
+  ringBytes = ring ? bytes : 0;
+  clear();
+  return ring != nullptr;
+}
+
+void FrameRecorder::clear()
+{
+  first = 0;
+  count = 0;
+  next = 0;
+  lastRecordedUs = 0;
+}
+
+bool FrameRecorder::configure(const Config &config)
+{
+  if (!lock)
+  {
+    return false;
+  }
+  Config c = config;
+  c.ringKb = constrain(c.ringKb, Min_Ring_Kb, Max_Ring_Kb);
+  c.seconds = constrain(c.seconds, 1, 60);
+  c.fps = constrain(c.fps, 1, 30);
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  bool ok = true;
+  if (c.ringKb != settings.ringKb || !ring)
+  {
+    ok = allocate(c.ringKb * 1024);
+  }
+  settings = c;
+  xSemaphoreGive(lock);
+  return ok;
+}
+
+FrameRecorder::Stats FrameRecorder::stats() const
+{
+  portENTER_CRITICAL(&statsLock);
+  Stats s = counters;
+  portEXIT_CRITICAL(&statsLock);
+  return s;
+}
+
+uint32_t FrameRecorder::spanMs() const
+{
+  if (count < 2)
+  {
+    return 0;
+  }
+  return index[(first + count - 1) % Max_Frames].timeMs - index[first].timeMs;
+}
+
+void FrameRecorder::onFrame(const camera_fb_t *fb, void *ctx)
+{
+  ((FrameRecorder *)ctx)->record(fb);
+}
+
+// Runs in the capturing task. It never waits: a frame that comes while a
+// dump or another capture holds the ring is skipped.
+void FrameRecorder::record(const camera_fb_t *fb)
+{
+  if (!settings.enabled || !ring || !index || fb->format != PIXFORMAT_JPEG)
+  {
+    return;
+  }
+  int64_t now = esp_timer_get_time();
+  bool early = lastRecordedUs && now - lastRecordedUs < 1000000 / settings.fps;
+  if (early || xSemaphoreTake(lock, 0) != pdTRUE)
+  {
+    portENTER_CRITICAL(&statsLock);
+    counters.skipped++;
+    portEXIT_CRITICAL(&statsLock);
+    return;
+  }
+  // A frame bigger than a quarter of the ring would leave too little pre-roll
+  if (fb->len > ringBytes / 4)
+  {
+    xSemaphoreGive(lock);
+    portENTER_CRITICAL(&statsLock);
+    counters.tooLarge++;
+    portEXIT_CRITICAL(&statsLock);
+    return;
+  }
+
+  // Frames are contiguous, one that does not fit before the end of the ring
+  // starts over at offset 0
+  uint64_t position = next;
+  uint32_t offset = position % ringBytes;
+  if (offset + fb->len > ringBytes)
+  {
+    position += ringBytes - offset;
+    offset = 0;
+  }
+  uint64_t end = position + fb->len;
+  // Drop the frames the new one overwrites, or the oldest when the index is full
+  while (count && (end - index[first].position > ringBytes || count == Max_Frames))
+  {
+    first = (first + 1) % Max_Frames;
+    count--;
+  }
+
+  memcpy(ring + offset, fb->buf, fb->len);
+  Entry &entry = index[(first + count) % Max_Frames];
+  entry.position = position;
+  entry.length = fb->len;
+  entry.timeMs = fb->timestamp.tv_sec * 1000 + fb->timestamp.tv_usec / 1000;
+  count++;
+  // Word aligned starts keep the copies fast
+  next = (end + 3) & ~(uint64_t)3;
+  width = fb->width;
+  height = fb->height;
+  lastRecordedUs = now;
+
+  // Frames older than the window go even if there is room for them
+  while (count > 1 && entry.timeMs - index[first].timeMs > settings.seconds * 1000UL)
+  {
+    first = (first + 1) % Max_Frames;
+    count--;
+  }
+  uint16_t frames = count;
+  uint32_t bytes = next - index[first].position;
+  uint32_t span = spanMs();
+  xSemaphoreGive(lock);
+
+  uint32_t copy_us = esp_timer_get_time() - now;
+  portENTER_CRITICAL(&statsLock);
+  counters.recorded++;
+  counters.copyUs = copy_us;
+  if (copy_us > counters.maxCopyUs)
+  {
+    counters.maxCopyUs = copy_us;
+  }
+  counters.frames = frames;
+  counters.bytes = bytes;
+  counters.spanMs = span;
+  portEXIT_CRITICAL(&statsLock);
+}
+
+uint16_t FrameRecorder::dump(Format format, uint16_t seconds, Writer writer, void *ctx)
+{
+  if (!lock)
+  {
+    return 0;
+  }
+  xSemaphoreTake(lock, portMAX_DELAY);
+  if (!count)
+  {
+    xSemaphoreGive(lock);
+    return 0;
+  }
+
+  // Frames of the last seconds
+  uint32_t window_ms = (seconds ? seconds : settings.seconds) * 1000UL;
+  uint32_t newest = index[(first + count - 1) % Max_Frames].timeMs;
+  uint16_t from = first;
+  uint16_t frames = count;
+  while (frames > 1 && newest - index[from].timeMs > window_ms)
+  {
+    from = (from + 1) % Max_Frames;
+    frames--;
+  }
+
+  uint16_t written = 0;
+  if (format == Format_Avi)
+  {
+    written = writeAvi(from, frames, writer, ctx);
+  }
+  else
+  {
+    for (; written < frames; written++)
+    {
+      const Entry &e = index[(from + written) % Max_Frames];
+      if (!writer(ring + e.position % ringBytes, e.length, ctx))
+      {
+        break;
+      }
+    }
+  }
+  xSemaphoreGive(lock);
+  return written;
+}
+
+// RIFF AVI with one MJPG video stream: header, a 'movi' list with one '00dc'
+// chunk per frame and an 'idx1' index. The frame rate is the recorded one.
+uint16_t FrameRecorder::writeAvi(uint16_t from, uint16_t frames, Writer writer, void *ctx)
+{
+  uint32_t movi_bytes = 4;
+  uint32_t largest = 0;
+  for (uint16_t i = 0; i < frames; i++)
+  {
+    uint32_t length = index[(from + i) % Max_Frames].length;
+    movi_bytes += 8 + length + (length & 1);
+    largest = max(largest, length);
+  }
+  uint32_t first_ms = index[from].timeMs;
+  uint32_t last_ms = index[(from + frames - 1) % Max_Frames].timeMs;
+  uint32_t us_per_frame = frames > 1 && last_ms > first_ms ? (last_ms - first_ms) * 1000 / (frames - 1)
+                                                           : 1000000 / settings.fps;
+  uint32_t index_bytes = 16 * frames;
+  uint32_t riff_bytes = Avi_Header_Bytes - 8 + movi_bytes - 4 + 8 + index_bytes;
+
+  uint8_t header[Avi_Header_Bytes];
+  uint8_t *p = header;
+  putFourcc(p, "RIFF");
+  putU32(p, riff_bytes);
+  putFourcc(p, "AVI ");
+  putFourcc(p, "LIST");
+  putU32(p, 192);
+  putFourcc(p, "hdrl");
+
+  putFourcc(p, "avih");
+  putU32(p, 56);
+  putU32(p, us_per_frame);
+  putU32(p, (uint64_t)largest * 1000000 / us_per_frame); // max bytes per second
+  putU32(p, 0);                                          // padding granularity
+  putU32(p, Avi_Has_Index);
+  putU32(p, frames);
+  putU32(p, 0); // initial frames
+  putU32(p, 1); // streams
+  putU32(p, largest);
+  putU32(p, width);
+  putU32(p, height);
+  for (int i = 0; i < 4; i++)
+  {
+    putU32(p, 0);
+  }
+
+  putFourcc(p, "LIST");
+  putU32(p, 116);
+  putFourcc(p, "strl");
+  putFourcc(p, "strh");
+  putU32(p, 56);
+  putFourcc(p, "vids");
+  putFourcc(p, "MJPG");
+  putU32(p, 0); // flags
+  putU16(p, 0); // priority
+  putU16(p, 0); // language
+  putU32(p, 0); // initial frames
+  putU32(p, us_per_frame);
+  putU32(p, 1000000); // rate / scale is the frame rate
+  putU32(p, 0);       // start
+  putU32(p, frames);
+  putU32(p, largest);
+  putU32(p, 0xFFFFFFFF); // default quality
+  putU32(p, 0);          // sample size, varies
+  putU16(p, 0);
+  putU16(p, 0);
+  putU16(p, width);
+  putU16(p, height);
+
+  putFourcc(p, "strf");
+  putU32(p, 40);
+  putU32(p, 40); // BITMAPINFOHEADER size
+  putU32(p, width);
+  putU32(p, height);
+  putU16(p, 1);  // planes
+  putU16(p, 24); // bits per pixel
+  putFourcc(p, "MJPG");
+  putU32(p, width * height * 3);
+  for (int i = 0; i < 4; i++)
+  {
+    putU32(p, 0);
+  }
+
+  putFourcc(p, "LIST");
+  putU32(p, movi_bytes);
+  putFourcc(p, "movi");
+  if (!writer(header, p - header, ctx))
+  {
+    return 0;
+  }
+
+  uint16_t written = 0;
+  for (; written < frames; written++)
+  {
+    const Entry &e = index[(from + written) % Max_Frames];
+    uint8_t chunk[8];
+    uint8_t *c = chunk;
+    putFourcc(c, "00dc");
+    putU32(c, e.length);
+    static const uint8_t pad = 0;
+    if (!writer(chunk, sizeof(chunk), ctx) || !writer(ring + e.position % ringBytes, e.length, ctx) ||
+        (e.length & 1 && !writer(&pad, 1, ctx)))
+    {
+      return written;
+    }
+  }
+
+  // Offsets count from the 'movi' fourcc
+  uint8_t entries[16 * 16];
+  p = entries;
+  putFourcc(p, "idx1");
+  putU32(p, index_bytes);
+  uint32_t offset = 4;
+  for (uint16_t i = 0; i < frames; i++)
+  {
+    uint32_t length = index[(from + i) % Max_Frames].length;
+    putFourcc(p, "00dc");
+    putU32(p, Avi_Keyframe);
+    putU32(p, offset);
+    putU32(p, length);
+    offset += 8 + length + (length & 1);
+    if (p + 16 > entries + sizeof(entries) || i + 1 == frames)
+    {
+      if (!writer(entries, p - entries, ctx))
+      {
+        return written;
+      }
+      p = entries;
+    }
+  }
+  return written;
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <Arduino.h>
+#include "camera.h"
+#include "freertos/semphr.h"
+
+// Pre-roll recorder: keeps the last seconds of JPEG frames in a PSRAM ring
+// so a run that went wrong can be downloaded afterwards. Frames are copied
+// from capture(), the ones taken for the stream or the vision tasks, the
+// sensor is never asked for extra frames. Memory is the ring and a fixed
+// index of 16 bytes per frame, both allocated once.
+class FrameRecorder
+{
+public:
+  static const uint32_t Default_Ring_Kb = 1536;
+  static const uint32_t Min_Ring_Kb = 256;
+  static const uint32_t Max_Ring_Kb = 3072;
+  static const uint16_t Default_Seconds = 10;
+  static const uint8_t Default_Fps = 15;
+  // Index entries, enough for 30 s at 25 fps
+  static const uint16_t Max_Frames = 750;
+
+  struct Config
+  {
+    bool enabled;
+    uint32_t ringKb;
+    uint16_t seconds; // window kept and dumped
+    uint8_t fps;      // frames recorded per second at most
+  };
+
+  struct Stats
+  {
+    uint32_t recorded;
+    uint32_t skipped; // over the frame rate or while a dump held the ring
+    uint32_t tooLarge;
+    uint32_t copyUs; // last frame, spent in the capturing task
+    uint32_t maxCopyUs;
+    uint16_t frames; // in the ring now
+    uint32_t bytes;
+    uint32_t spanMs; // oldest to newest frame
+  };
+
+  enum Format
+  {
+    Format_Avi,
+    Format_Mjpeg, // JPEG frames back to back
+  };
+
+  // Receives the file in pieces, returns false to stop
+  typedef bool (*Writer)(const uint8_t *data, size_t len, void *ctx);
+
+  explicit FrameRecorder(Camera &camera);
+
+  // Allocates the ring and hooks into capture()
+  void begin();
+  // Reallocates the ring when its size changes, which drops the recording
+  bool configure(const Config &config);
+  Config config() const { return settings; }
+  Stats stats() const;
+
+  // Writes the frames of the last seconds, 0 for the configured window.
+  // Recording pauses while it runs so the window stays as it was. Returns
+  // the number of frames written.
+  uint16_t dump(Format format, uint16_t seconds, Writer writer, void *ctx);
+
+private:
+  // Positions count the bytes written since the start, the ring offset is
+  // the position modulo the ring size
+  struct Entry
+  {
+    uint64_t position;
+    uint32_t length;
+    uint32_t timeMs;
+  };
+
+  Camera &camera;
+  SemaphoreHandle_t lock;
+  Config settings;
+  uint8_t *ring;
+  uint32_t ringBytes;
+  Entry *index;
+  uint16_t first; // oldest entry
+  uint16_t count;
+  uint64_t next; // position of the next frame
+  uint16_t width;
+  uint16_t height;
+  int64_t lastRecordedUs;
+  Stats counters;
+
+  static void onFrame(const camera_fb_t *fb, void *ctx);
+  void record(const camera_fb_t *fb);
+  bool allocate(uint32_t bytes);
+  void clear();
+  uint32_t spanMs() const;
+
+  uint16_t writeAvi(uint16_t from, uint16_t frames, Writer writer, void *ctx);
+};
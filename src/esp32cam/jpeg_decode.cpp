@@ -0,0 +1,26 @@
+#include "jpeg_decode.h"
+
+// A mutex rather than a critical section: decodes take milliseconds, and it
+// lends its priority to the task holding it
+static SemaphoreHandle_t decodeLock()
+{
+  static StaticSemaphore_t buffer;
+  static SemaphoreHandle_t lock = xSemaphoreCreateMutexStatic(&buffer);
+  return lock;
+}
+
+JpegDecodeLock::JpegDecodeLock()
+{
+  xSemaphoreTake(decodeLock(), portMAX_DELAY);
+}
+
+JpegDecodeLock::~JpegDecodeLock()
+{
+  xSemaphoreGive(decodeLock());
+}
+
+esp_err_t jpegDecode(size_t len, jpg_scale_t scale, jpg_reader_cb reader, jpg_writer_cb writer, void *arg)
+{
+  JpegDecodeLock lock;
+  return esp_jpg_decode(len, scale, reader, writer, arg);
+}
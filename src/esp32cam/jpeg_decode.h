@@ -0,0 +1,23 @@
+#pragma once
+
+#include "esp_jpg_decode.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+// esp_jpg_decode() keeps its decoder work buffer in one static variable, so
+// two decodes must never overlap, not even on the same core where a higher
+// priority task would preempt the other in the middle of a block. Every
+// decode goes through jpegDecode(), or holds a JpegDecodeLock around the
+// esp32-camera converters that decode internally, like fmt2rgb888().
+class JpegDecodeLock
+{
+public:
+  JpegDecodeLock();
+  ~JpegDecodeLock();
+
+private:
+  JpegDecodeLock(const JpegDecodeLock &);
+  JpegDecodeLock &operator=(const JpegDecodeLock &);
+};
+
+esp_err_t jpegDecode(size_t len, jpg_scale_t scale, jpg_reader_cb reader, jpg_writer_cb writer, void *arg);
@@ -0,0 +1,238 @@
+#include "kernel_bench.h"
+#include "esp_heap_caps.h"
+#include <image_kernels.h>
+
+namespace
+{
+
+enum Kernel
+{
+  Rgb565_Gray,
+  Yuv422_Gray,
+  Downscale_2x,
+  Downscale_4x,
+  Downscale_8x,
+  Integral,
+  Threshold,
+  Row_Sums,
+  Column_Sums,
+  Kernel_Count
+};
+
+const char *const Kernel_Names[Kernel_Count] = {"rgb565_gray", "yuv422_gray", "downscale_2x",
+                                                "downscale_4x", "downscale_8x", "integral",
+                                                "threshold",    "row_sums",     "column_sums"};
+
+struct Memory
+{
+  const char *name;
+  uint32_t caps;
+  bool banded;
+};
+
+const Memory Memories[] = {{"sram", MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT, false},
+                           {"psram", MALLOC_CAP_SPIRAM, false},
+                           {"psram_banded", MALLOC_CAP_SPIRAM, true}};
+
+const uint8_t Threshold_Level = 100;
+
+uint8_t factor(Kernel kernel)
+{
+  return kernel == Downscale_2x ? 2 : kernel == Downscale_4x ? 4 : kernel == Downscale_8x ? 8 : 1;
+}
+
+// Bytes of one input row
+uint32_t rowBytes(Kernel kernel, uint16_t width)
+{
+  return kernel == Rgb565_Gray || kernel == Yuv422_Gray ? 2 * width : width;
+}
+
+// Integral images and column sums carry state from row to row
+bool bandable(Kernel kernel)
+{
+  return kernel != Integral && kernel != Column_Sums;
+}
+
+uint32_t outBytes(Kernel kernel, uint16_t width, uint16_t height)
+{
+  switch (kernel)
+  {
+  case Rgb565_Gray:
+  case Yuv422_Gray:
+  case Threshold:
+    return (uint32_t)width * height;
+  case Downscale_2x:
+  case Downscale_4x:
+  case Downscale_8x:
+    return (uint32_t)(width / factor(kernel)) * (height / factor(kernel));
+  default:
+    return 0;
+  }
+}
+
+uint32_t sumCount(Kernel kernel, uint16_t width, uint16_t height)
+{
+  switch (kernel)
+  {
+  case Integral:
+    return (uint32_t)(width + 1) * (height + 1);
+  case Threshold:
+    return 1;
+  case Row_Sums:
+    return height;
+  case Column_Sums:
+    return width;
+  default:
+    return 0;
+  }
+}
+
+// Runs a kernel on rows rows of src, writing from out and sums on
+void apply(Kernel kernel, const uint8_t *src, uint16_t width, uint16_t rows, uint8_t *out, uint32_t *sums,
+           bool reference)
+{
+  switch (kernel)
+  {
+  case Rgb565_Gray:
+    (reference ? vision::rgb565ToGrayReference : vision::rgb565ToGray)((const uint16_t *)src, out, width * rows);
+    break;
+  case Yuv422_Gray:
+    (reference ? vision::yuv422ToGrayReference : vision::yuv422ToGray)(src, out, width * rows);
+    break;
+  case Downscale_2x:
+  case Downscale_4x:
+  case Downscale_8x:
+    (reference ? vision::downscaleReference : vision::downscale)(src, width, rows, width, factor(kernel), out);
+    break;
+  case Integral:
+    (reference ? vision::integralImageReference : vision::integralImage)(src, width, rows, width, sums);
+    break;
+  case Threshold:
+    // Summed over the bands
+    sums[0] += (reference ? vision::thresholdReference : vision::threshold)(src, out, width * rows,
+                                                                             Threshold_Level);
+    break;
+  case Row_Sums:
+    (reference ? vision::rowSumsReference : vision::rowSums)(src, width, rows, width, sums);
+    break;
+  case Column_Sums:
+    (reference ? vision::columnSumsReference : vision::columnSums)(src, width, rows, width, sums);
+    break;
+  default:
+    break;
+  }
+}
+
+struct BandContext
+{
+  Kernel kernel;
+  uint16_t width;
+  uint8_t *out;
+  uint32_t *sums;
+};
+
+void runBand(const uint8_t *band, uint16_t rows, uint16_t first_row, void *arg)
+{
+  BandContext *ctx = (BandContext *)arg;
+  uint8_t f = factor(ctx->kernel);
+  uint8_t *out = ctx->out + (uint32_t)(first_row / f) * (ctx->width / f);
+  uint32_t *sums = ctx->kernel == Row_Sums ? ctx->sums + first_row : ctx->sums;
+  apply(ctx->kernel, band, ctx->width, rows, out, sums, false);
+}
+
+// FNV-1a over the outputs, enough to tell the versions apart
+uint32_t checksum(const uint8_t *out, uint32_t out_bytes, const uint32_t *sums, uint32_t sum_count)
+{
+  uint32_t hash = 2166136261u;
+  for (uint32_t i = 0; i < out_bytes; i++)
+  {
+    hash = (hash ^ out[i]) * 16777619u;
+  }
+  for (uint32_t i = 0; i < sum_count; i++)
+  {
+    hash = (hash ^ sums[i]) * 16777619u;
+  }
+  return hash;
+}
+
+} // namespace
+
+void KernelBench::run(uint16_t width, uint16_t height, uint8_t repeats, Report report, void *ctx)
+{
+  uint8_t *scratch = (uint8_t *)heap_caps_malloc(Band_Scratch, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+  uint32_t pixels = (uint32_t)width * height;
+
+  for (int k = 0; k < Kernel_Count; k++)
+  {
+    Kernel kernel = (Kernel)k;
+    uint32_t in_bytes = rowBytes(kernel, width) * height;
+    uint32_t out_bytes = outBytes(kernel, width, height);
+    uint32_t sum_count = sumCount(kernel, width, height);
+
+    for (const Memory &memory : Memories)
+    {
+      if (memory.banded && (!bandable(kernel) || !scratch))
+      {
+        continue;
+      }
+      Result result = {Kernel_Names[k], memory.name, pixels, 0, 0, false, false};
+      // Outputs live next to the input, the banded runs only move the reads
+      uint8_t *src = (uint8_t *)heap_caps_malloc(in_bytes, memory.caps);
+      uint8_t *out = out_bytes ? (uint8_t *)heap_caps_malloc(out_bytes, memory.caps) : nullptr;
+      uint32_t *sums = sum_count ? (uint32_t *)heap_caps_malloc(sum_count * 4, memory.caps) : nullptr;
+      result.allocated = src && (out || !out_bytes) && (sums || !sum_count);
+
+      if (result.allocated)
+      {
+        for (uint32_t i = 0; i < in_bytes; i++)
+        {
+          src[i] = esp_random();
+        }
+        uint32_t expected = 0;
+        uint32_t actual = 0;
+        for (int reference = 1; reference >= 0; reference--)
+        {
+          uint32_t best = UINT32_MAX;
+          for (uint8_t n = 0; n < repeats; n++)
+          {
+            if (sums)
+            {
+              sums[0] = 0;
+            }
+            uint32_t start = ESP.getCycleCount();
+            if (memory.banded && !reference)
+            {
+              BandContext band = {kernel, width, out, sums};
+              vision::forEachBand(src, rowBytes(kernel, width), height, rowBytes(kernel, width), scratch,
+                                  Band_Scratch, factor(kernel), runBand, &band);
+            }
+            else
+            {
+              apply(kernel, src, width, height, out, sums, reference);
+            }
+            uint32_t cycles = ESP.getCycleCount() - start;
+            if (cycles < best)
+            {
+              best = cycles;
+            }
+          }
+          (reference ? result.refCycles : result.cycles) = best;
+          (reference ? expected : actual) = checksum(out, out_bytes, sums, sum_count);
+        }
+        result.ok = expected == actual;
+      }
+      free(src);
+      free(out);
+      free(sums);
+
+      if (!report(result, ctx))
+      {
+        free(scratch);
+        return;
+      }
+      // Let the idle task feed the watchdog between runs
+      vTaskDelay(1);
+    }
+  }
+  free(scratch);
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Times the lib/image_kernels primitives on the ESP32 in CPU cycles per
+// pixel. Each kernel runs on a random image held in internal SRAM, in PSRAM,
+// and in PSRAM copied band by band into a small SRAM buffer, and its output
+// is checked against the reference version.
+class KernelBench
+{
+public:
+  // SRAM buffer the banded runs copy rows into
+  static const uint32_t Band_Scratch = 8 * 1024;
+
+  struct Result
+  {
+    const char *kernel;
+    const char *memory;
+    uint32_t pixels;
+    uint32_t cycles;    // fastest of the repeats
+    uint32_t refCycles; // reference version, same memory
+    bool ok;            // output equal to the reference
+    bool allocated;     // false when the buffers did not fit, nothing was run
+  };
+
+  typedef bool (*Report)(const Result &result, void *ctx);
+
+  // width a multiple of 8. Stops early when report returns false.
+  static void run(uint16_t width, uint16_t height, uint8_t repeats, Report report, void *ctx);
+};
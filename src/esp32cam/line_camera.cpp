@@ -0,0 +1,154 @@
+#include "line_camera.h"
+#include "esp_timer.h"
+#include <image_kernels.h>
+#include <robot_protocol.h>
+#include "task_config.h"
+
+static portMUX_TYPE statsLock = portMUX_INITIALIZER_UNLOCKED;
+
+LineCamera::LineCamera(AnalyticsTap &tap, RobotLink &robotLink)
+    : tap(tap), robotLink(robotLink), task(nullptr), imageLock(nullptr), running(false), gray(nullptr), full(nullptr),
+      width(0), height(0), sequence(0), counters(), lastSent(0)
+{
+}
+
+void LineCamera::begin()
+{
+  // Internal RAM, the row scans read every byte
+  gray = (uint8_t *)malloc(Max_Width * Max_Height);
+  full = (uint8_t *)malloc(AnalyticsTap::Max_Width * AnalyticsTap::Max_Height);
+  imageLock = xSemaphoreCreateMutex();
+  // Core 1 next to capture, below the HTTP servers so the stream keeps going
+  xTaskCreatePinnedToCore(taskMain, "line_camera", 4096, this, TASK_VISION_PRIORITY, &task, TASK_VISION_CORE);
+}
+
+void LineCamera::setEnabled(bool enable)
+{
+  running = enable;
+  if (enable && task)
+  {
+    xTaskNotifyGive(task);
+  }
+}
+
+LineCamera::Stats LineCamera::stats() const
+{
+  portENTER_CRITICAL(&statsLock);
+  Stats s = counters;
+  portEXIT_CRITICAL(&statsLock);
+  return s;
+}
+
+bool LineCamera::copyImage(uint8_t *out, size_t size, uint16_t &w, uint16_t &h)
+{
+  if (!imageLock)
+  {
+    return false;
+  }
+  xSemaphoreTake(imageLock, portMAX_DELAY);
+  bool ok = width && height && (size_t)width * height <= size;
+  if (ok)
+  {
+    memcpy(out, gray, width * height);
+    w = width;
+    h = height;
+  }
+  xSemaphoreGive(imageLock);
+  return ok;
+}
+
+void LineCamera::taskMain(void *arg)
+{
+  LineCamera *self = (LineCamera *)arg;
+  for (;;)
+  {
+    if (!self->running || !self->gray || !self->full)
+    {
+      self->tap.unsubscribe(xTaskGetCurrentTaskHandle());
+      ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(500));
+      continue;
+    }
+    // The tap notifies after every thumbnail
+    self->tap.subscribe(xTaskGetCurrentTaskHandle());
+    if (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(500)))
+    {
+      self->process();
+    }
+  }
+}
+
+void LineCamera::process()
+{
+  AnalyticsTap::Thumbnail thumb;
+  if (!tap.acquire(sequence, thumb))
+  {
+    return;
+  }
+  sequence = thumb.sequence;
+
+  int64_t start = esp_timer_get_time();
+  xSemaphoreTake(imageLock, portMAX_DELAY);
+  bool ok = convert(thumb);
+  // The tap can decode the next frame while the line is fitted
+  tap.release();
+  int64_t converted = esp_timer_get_time();
+
+  vision::LineFit fit = {false, 0, 0, 0};
+  if (ok)
+  {
+    // The top third of the image is too far ahead to see the tape reliably
+    uint16_t first_row = height / 3;
+    fit = vision::fitLine(gray, width, height, width, first_row, first_row);
+  }
+  xSemaphoreGive(imageLock);
+  int64_t done = esp_timer_get_time();
+
+  // No faster than the UNO's loop takes frames off its RX buffer
+  if (done - lastSent >= protocol::VisionIntervalMs * 1000LL)
+  {
+    protocol::ParameterFrame frame = protocol::encodeVisionLine(fit.found, fit.offset);
+    robotLink.send(&frame, sizeof(frame));
+    lastSent = done;
+  }
+
+  uint32_t total = done - start;
+  portENTER_CRITICAL(&statsLock);
+  counters.frames++;
+  counters.found += fit.found;
+  counters.overBudget += total > Budget_Us;
+  counters.convertUs = converted - start;
+  counters.fitUs = done - converted;
+  counters.totalUs += total;
+  if (total > counters.maxUs)
+  {
+    counters.maxUs = total;
+  }
+  counters.last = fit;
+  portEXIT_CRITICAL(&statsLock);
+}
+
+// The fit was tuned on 1/4 scale images, a 1/2 scale thumbnail is halved
+bool LineCamera::convert(const AnalyticsTap::Thumbnail &thumb)
+{
+  uint32_t count = (uint32_t)thumb.width * thumb.height;
+  if (thumb.scale >= 4)
+  {
+    if (thumb.width > Max_Width || thumb.height > Max_Height)
+    {
+      return false;
+    }
+    vision::rgb565ToGray(thumb.pixels, gray, count);
+    width = thumb.width;
+    height = thumb.height;
+    return true;
+  }
+  // Rows of the downscale have to start on a word
+  uint16_t full_width = thumb.width & ~3;
+  for (uint16_t y = 0; y < thumb.height; y++)
+  {
+    vision::rgb565ToGray(thumb.pixels + (uint32_t)y * thumb.width, full + (uint32_t)y * full_width, full_width);
+  }
+  width = full_width / 2;
+  height = thumb.height / 2;
+  return vision::downscale(full, full_width, thumb.height, full_width, 2, gray);
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <Arduino.h>
+#include <line_vision.h>
+#include "analytics_tap.h"
+#include "robot_link.h"
+#include "freertos/semphr.h"
+
+// Camera line detection for the UNO's tracking mode. A task takes the
+// thumbnails of the analytics tap, brings them to 1/4 scale grayscale, fits
+// the line ahead with lib/line_vision and sends its position to the UNO, at
+// most every protocol::VisionIntervalMs.
+class LineCamera
+{
+public:
+  // Processing time per frame the detection has to stay within, 50 Hz
+  static const uint32_t Budget_Us = 20000;
+  // Largest grayscale image, VGA at 1/4 scale
+  static const uint16_t Max_Width = 160;
+  static const uint16_t Max_Height = 120;
+
+  struct Stats
+  {
+    uint32_t frames;
+    uint32_t found;
+    uint32_t overBudget; // frames that took longer than Budget_Us
+    uint32_t convertUs;  // last frame, thumbnail to grayscale
+    uint32_t fitUs;      // last frame
+    uint32_t maxUs;
+    uint64_t totalUs;
+    vision::LineFit last;
+  };
+
+  LineCamera(AnalyticsTap &tap, RobotLink &robotLink);
+
+  // Starts the task, it idles until enabled
+  void begin();
+  void setEnabled(bool enable);
+  bool enabled() const { return running; }
+  Stats stats() const;
+
+  // Copies the last grayscale image, false when there is none yet
+  bool copyImage(uint8_t *out, size_t size, uint16_t &width, uint16_t &height);
+
+private:
+  AnalyticsTap &tap;
+  RobotLink &robotLink;
+  TaskHandle_t task;
+  SemaphoreHandle_t imageLock;
+  volatile bool running;
+  uint8_t *gray;
+  uint8_t *full; // thumbnail in gray before the downscale
+  uint16_t width;
+  uint16_t height;
+  uint32_t sequence; // last thumbnail taken
+  Stats counters;
+  int64_t lastSent; // last frame to the UNO
+
+  static void taskMain(void *arg);
+  void process();
+  bool convert(const AnalyticsTap::Thumbnail &thumb);
+};
@@ -1,59 +1,129 @@
 #include "camera.h"
 #include "web_server.h"
+#include "robot_link.h"
+#include "wifi_link.h"
+#include "analytics_tap.h"
+#include "line_camera.h"
+#include "frame_recorder.h"
+#include "flash_log.h"
+#include "blob_camera.h"
+#include "boot_timeline.h"
+#include "task_config.h"
 #include <Arduino.h>
 
 // Global variables - defined here
 int gpLed = 4; // Light
 String WiFiAddr = "";
-byte txdata[3] = {0xA5, 0, 0x5A};
+BootTimeline bootTimeline = {};
 
 // WiFi credentials
 const char *ssid = "M&D";
 const char *password = "Dory@1234";
 
+// How long setup() waits for the network and for the camera before reporting
+const uint32_t Wifi_Timeout_Ms = 20000;
+const uint32_t Camera_Timeout_Ms = 10000;
+
 // Global objects
 Camera camera;
+RobotLink robotLink(Serial);
+WiFiLink wifiLink;
+AnalyticsTap analyticsTap(camera);
+LineCamera lineCamera(analyticsTap, robotLink);
+BlobCamera blobCamera(analyticsTap, robotLink);
+FrameRecorder recorder(camera);
+FlashLog flashLog(camera, robotLink);
 WebServer *server = nullptr;
 
+static SemaphoreHandle_t cameraDone = nullptr;
+static bool cameraOk = false;
+
+// Sensor probing and frame buffer setup take most of a second, run them while
+// the radio associates
+static void cameraInitTask(void *)
+{
+  cameraOk = camera.init();
+  if (cameraOk)
+  {
+    BootTimeline::mark(bootTimeline.cameraReady);
+  }
+  xSemaphoreGive(cameraDone);
+  vTaskDelete(nullptr);
+}
+
+// Runs in the WiFi supervisor task every time the station gets an address.
+// The first call starts the servers, later ones restart them because the
+// sockets they held died with the old link or the car roamed to another AP.
+static void onWiFiConnected(void *)
+{
+  if (server->running())
+  {
+    server->restart();
+  }
+  else
+  {
+    server->start();
+    BootTimeline::mark(bootTimeline.serversUp);
+  }
+
+  WiFiAddr = wifiLink.address();
+  Serial.print("Camera Ready! Use 'http://");
+  Serial.print(WiFiAddr);
+  Serial.println("' to connect");
+}
+
 void setup()
 {
   Serial.begin(115200);
   Serial.setDebugOutput(true);
   Serial.println();
 
-  // Initialize camera
-  if (!camera.init())
-  {
-    Serial.println("Camera initialization failed");
-    return;
-  }
-
   // Configure LED
   pinMode(gpLed, OUTPUT);
   digitalWrite(gpLed, LOW);
 
-  // Initialize web server
-  server = new WebServer(camera);
-  server->setWiFiCredentials(ssid, password);
+  // Commands can go out as soon as the servers are up
+  robotLink.begin();
+
+  // Camera handlers answer 503 until the init task is done
+  server = new WebServer(camera, robotLink, wifiLink, analyticsTap, lineCamera, blobCamera, recorder, flashLog);
 
   Serial.print("WiFi connecting");
-  if (!server->connectToWiFi())
+  wifiLink.begin(ssid, password, onWiFiConnected);
+
+  cameraDone = xSemaphoreCreateBinary();
+  xTaskCreatePinnedToCore(cameraInitTask, "camera_init", 4096, nullptr, TASK_CAMERA_INIT_PRIORITY, nullptr,
+                          TASK_CAMERA_INIT_CORE);
+
+  // The supervisor keeps retrying in the background, a slow AP only delays
+  // the report below
+  if (!wifiLink.waitConnected(Wifi_Timeout_Ms))
   {
-    Serial.println("WiFi connection failed");
-    return;
+    Serial.println("WiFi not connected yet, still retrying");
   }
-  Serial.println("WiFi connected");
-
-  server->start();
 
-  Serial.print("Camera Ready! Use 'http://");
-  Serial.print(server->getWiFiAddress());
-  WiFiAddr = server->getWiFiAddress();
-  Serial.println("' to connect");
+  if (xSemaphoreTake(cameraDone, pdMS_TO_TICKS(Camera_Timeout_Ms)) != pdTRUE || !cameraOk)
+  {
+    Serial.println("Camera initialization failed");
+    return;
+  }
+  analyticsTap.begin();
+  recorder.begin();
+  flashLog.begin();
+  lineCamera.begin();
+  blobCamera.begin();
+  Serial.printf("Boot: wifi start %u ms, camera %u ms, network %u ms, servers %u ms\n",
+                BootTimeline::ms(bootTimeline.wifiStart), BootTimeline::ms(bootTimeline.cameraReady),
+                BootTimeline::ms(bootTimeline.networkUp), BootTimeline::ms(bootTimeline.serversUp));
 }
 
 void loop()
 {
-  // Do nothing. Everything is done in another task by the web server
-  delay(10000);
+#if TASK_CONTROL_QUEUE
+  // Everything runs in its own task, the UNO link in the control task
+  vTaskDelete(nullptr);
+#else
+  robotLink.poll();
+  delay(RobotLink::Poll_Ms);
+#endif
 }
@@ -0,0 +1,263 @@
+#include "parallel_jpeg.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "img_converters.h"
+#include "task_config.h"
+
+static portMUX_TYPE statsLock = portMUX_INITIALIZER_UNLOCKED;
+
+// JPEG markers
+static const uint8_t Marker_SOF0 = 0xC0;
+static const uint8_t Marker_RST0 = 0xD0;
+static const uint8_t Marker_EOI = 0xD9;
+static const uint8_t Marker_SOS = 0xDA;
+static const uint8_t Marker_DRI = 0xDD;
+
+// Bytes per pixel of the formats the encoder takes, 0 for the others
+static uint8_t pixelBytes(pixformat_t format)
+{
+  switch (format)
+  {
+  case PIXFORMAT_RGB565:
+  case PIXFORMAT_YUV422:
+    return 2;
+  case PIXFORMAT_RGB888:
+    return 3;
+  case PIXFORMAT_GRAYSCALE:
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+// Offset of the entropy coded data, the first byte after the SOS segment, 0
+// when the header is broken. sof and sos get the offsets of those markers.
+static size_t scanStart(const uint8_t *jpeg, size_t len, size_t &sof, size_t &sos)
+{
+  size_t pos = 2; // SOI
+  sof = 0;
+  while (pos + 4 <= len && jpeg[pos] == 0xFF)
+  {
+    uint8_t marker = jpeg[pos + 1];
+    size_t segment = (jpeg[pos + 2] << 8) | jpeg[pos + 3];
+    if (marker == Marker_SOF0)
+    {
+      sof = pos;
+    }
+    if (marker == Marker_SOS)
+    {
+      sos = pos;
+      pos += 2 + segment;
+      return sof && pos <= len ? pos : 0;
+    }
+    pos += 2 + segment;
+  }
+  return 0;
+}
+
+ParallelJpegEncoder::ParallelJpegEncoder()
+    : workers(), lock(nullptr), done(nullptr), stripeBuffers(nullptr), bufferedStripes(0), frame(nullptr),
+      jobQuality(0), stripeCount(0), stripes(), counters()
+{
+  lock = xSemaphoreCreateMutex();
+}
+
+bool ParallelJpegEncoder::start()
+{
+  if (workers[0])
+  {
+    return true;
+  }
+  done = xSemaphoreCreateCounting(2, 0);
+  if (!done)
+  {
+    return false;
+  }
+  for (int core = 0; core < 2; core++)
+  {
+    // Same priority as the HTTP servers, so the stream waits for them
+    xTaskCreatePinnedToCore(workerMain, core ? "jpeg_enc1" : "jpeg_enc0", Worker_Stack, this,
+                            TASK_JPEG_WORKER_PRIORITY, &workers[core], core);
+  }
+  return workers[0] && workers[1];
+}
+
+// The PSRAM is shared with the frame buffers and the recorder and trace
+// rings, so only the stripes in use get a buffer. Called with the lock held.
+bool ParallelJpegEncoder::reserveStripes(uint8_t count)
+{
+  if (count <= bufferedStripes)
+  {
+    return true;
+  }
+  free(stripeBuffers);
+  stripeBuffers = (uint8_t *)heap_caps_malloc(Stripe_Buffer_Bytes * count, MALLOC_CAP_SPIRAM);
+  bufferedStripes = stripeBuffers ? count : 0;
+  return stripeBuffers != nullptr;
+}
+
+bool ParallelJpegEncoder::encode(const camera_fb_t *fb, uint8_t quality, uint8_t *out, size_t capacity,
+                                 size_t &len, uint8_t stripe_count)
+{
+  uint8_t bytes = pixelBytes(fb->format);
+  if (!bytes || !lock)
+  {
+    return false;
+  }
+
+  stripe_count = constrain(stripe_count, 1, Max_Stripes);
+  xSemaphoreTake(lock, portMAX_DELAY);
+  if (!start() || !reserveStripes(stripe_count))
+  {
+    xSemaphoreGive(lock);
+    return false;
+  }
+  int64_t begin = esp_timer_get_time();
+
+  // Stripes of whole MCU rows: 16 lines with 4:2:0 chroma, 8 for grayscale
+  uint8_t mcu = fb->format == PIXFORMAT_GRAYSCALE ? 8 : 16;
+  uint16_t stripe_height = (fb->height + stripe_count - 1) / stripe_count;
+  stripe_height = (stripe_height + mcu - 1) / mcu * mcu;
+  size_t row_bytes = fb->width * bytes;
+
+  frame = fb;
+  jobQuality = quality;
+  stripeCount = 0;
+  for (uint16_t y = 0; y < fb->height; y += stripe_height)
+  {
+    Stripe &s = stripes[stripeCount];
+    uint16_t left = fb->height - y;
+    s.height = left < stripe_height ? left : stripe_height;
+    s.src = fb->buf + y * row_bytes;
+    s.srcLen = s.height * row_bytes;
+    s.buf = stripeBuffers + stripeCount * Stripe_Buffer_Bytes;
+    s.len = 0;
+    s.ok = false;
+    stripeCount++;
+  }
+
+  xTaskNotifyGive(workers[0]);
+  xTaskNotifyGive(workers[1]);
+  xSemaphoreTake(done, portMAX_DELAY);
+  xSemaphoreTake(done, portMAX_DELAY);
+
+  uint16_t restart_interval = (fb->width + mcu - 1) / mcu * (stripe_height / mcu);
+  len = stitch(out, capacity, restart_interval);
+  frame = nullptr;
+  uint32_t elapsed = esp_timer_get_time() - begin;
+  xSemaphoreGive(lock);
+
+  portENTER_CRITICAL(&statsLock);
+  if (len)
+  {
+    counters.frames++;
+    counters.encodeUs = elapsed;
+    counters.totalUs += elapsed;
+    counters.bytes = len;
+  }
+  else
+  {
+    counters.failures++;
+  }
+  portEXIT_CRITICAL(&statsLock);
+  return len > 0;
+}
+
+ParallelJpegEncoder::Stats ParallelJpegEncoder::stats() const
+{
+  portENTER_CRITICAL(&statsLock);
+  Stats s = counters;
+  portEXIT_CRITICAL(&statsLock);
+  return s;
+}
+
+void ParallelJpegEncoder::workerMain(void *arg)
+{
+  ParallelJpegEncoder *self = (ParallelJpegEncoder *)arg;
+  uint8_t first = xTaskGetCurrentTaskHandle() == self->workers[0] ? 0 : 1;
+  for (;;)
+  {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    self->encodeStripes(first);
+    xSemaphoreGive(self->done);
+  }
+}
+
+// Worker 0 takes the even stripes, worker 1 the odd ones
+void ParallelJpegEncoder::encodeStripes(uint8_t first)
+{
+  for (uint8_t i = first; i < stripeCount; i += 2)
+  {
+    Stripe &s = stripes[i];
+    s.ok = fmt2jpg_cb((uint8_t *)s.src, s.srcLen, frame->width, s.height, frame->format, jobQuality, writeStripe,
+                      &s) &&
+           s.len >= 4 && s.buf[s.len - 2] == 0xFF && s.buf[s.len - 1] == Marker_EOI;
+  }
+}
+
+size_t ParallelJpegEncoder::writeStripe(void *arg, size_t index, const void *data, size_t len)
+{
+  Stripe *s = (Stripe *)arg;
+  if (index + len > Stripe_Buffer_Bytes)
+  {
+    return 0;
+  }
+  memcpy(s->buf + index, data, len);
+  s->len = index + len;
+  return len;
+}
+
+size_t ParallelJpegEncoder::stitch(uint8_t *out, size_t capacity, uint16_t restart_interval)
+{
+  for (uint8_t i = 0; i < stripeCount; i++)
+  {
+    if (!stripes[i].ok)
+    {
+      return 0;
+    }
+  }
+
+  // Header of the first stripe with the full height, and a DRI segment in
+  // front of its SOS
+  const Stripe &head = stripes[0];
+  size_t sof = 0;
+  size_t sos = 0;
+  size_t data_start = scanStart(head.buf, head.len, sof, sos);
+  const size_t Dri_Bytes = 6;
+  if (!data_start || data_start + Dri_Bytes > capacity)
+  {
+    return 0;
+  }
+  memcpy(out, head.buf, sos);
+  // FF C0, length, precision, then the height
+  out[sof + 5] = frame->height >> 8;
+  out[sof + 6] = frame->height & 0xFF;
+  const uint8_t dri[Dri_Bytes] = {0xFF, Marker_DRI, 0x00, 0x04, (uint8_t)(restart_interval >> 8),
+                                  (uint8_t)(restart_interval & 0xFF)};
+  memcpy(out + sos, dri, Dri_Bytes);
+  size_t pos = sos + Dri_Bytes;
+  memcpy(out + pos, head.buf + sos, data_start - sos);
+  pos += data_start - sos;
+
+  // Scan data of every stripe without its header and EOI, RST0..RST7 in
+  // between and EOI at the end
+  for (uint8_t i = 0; i < stripeCount; i++)
+  {
+    const Stripe &s = stripes[i];
+    size_t start = i == 0 ? data_start : scanStart(s.buf, s.len, sof, sos);
+    if (!start || start + 2 > s.len)
+    {
+      return 0;
+    }
+    size_t bytes = s.len - 2 - start;
+    if (pos + bytes + 2 > capacity)
+    {
+      return 0;
+    }
+    memcpy(out + pos, s.buf + start, bytes);
+    pos += bytes;
+    out[pos++] = 0xFF;
+    out[pos++] = i + 1 < stripeCount ? Marker_RST0 + (i & 7) : Marker_EOI;
+  }
+  return pos;
+}
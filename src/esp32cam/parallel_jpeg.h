@@ -0,0 +1,78 @@
+#pragma once
+
+#include <Arduino.h>
+#include "esp_camera.h"
+#include "freertos/semphr.h"
+
+// JPEG encoder for RGB565, YUV422, RGB888 and grayscale frames that uses
+// both cores. The frame is cut into stripes of whole MCU rows, a worker task
+// on each core encodes every other stripe with the img_converters encoder,
+// and the stripes are stitched into one baseline JPEG: the header of the
+// first stripe with the full height and a restart interval of one stripe,
+// then the entropy coded data of each stripe separated by RSTn markers.
+// Every stripe starts its DC prediction from zero, which is exactly what a
+// restart marker tells the decoder.
+class ParallelJpegEncoder
+{
+public:
+  static const uint8_t Max_Stripes = 8;
+  // One per core
+  static const uint8_t Default_Stripes = 2;
+  // Encoder output of one stripe, PSRAM. Buffers are allocated for the
+  // stripe count asked for and grown when a call asks for more.
+  static const uint32_t Stripe_Buffer_Bytes = 64 * 1024;
+  // Output buffer callers should provide, fits VGA at quality 80 with room
+  static const uint32_t Output_Bytes = 128 * 1024;
+  // The encoder keeps its tables on the stack
+  static const uint32_t Worker_Stack = 16 * 1024;
+
+  struct Stats
+  {
+    uint32_t frames;
+    uint32_t failures;
+    uint32_t encodeUs; // last frame
+    uint64_t totalUs;
+    uint32_t bytes; // last frame
+  };
+
+  ParallelJpegEncoder();
+
+  // Encodes fb into out. False for JPEG frames and unknown formats, or when
+  // a stripe or the result did not fit. The worker tasks are set up on the
+  // first call. Callers are served one at a time.
+  bool encode(const camera_fb_t *fb, uint8_t quality, uint8_t *out, size_t capacity, size_t &len,
+              uint8_t stripes = Default_Stripes);
+  Stats stats() const;
+
+private:
+  struct Stripe
+  {
+    const uint8_t *src;
+    size_t srcLen;
+    uint16_t height;
+    uint8_t *buf;
+    size_t len;
+    bool ok;
+  };
+
+  TaskHandle_t workers[2];
+  SemaphoreHandle_t lock;
+  SemaphoreHandle_t done;
+  uint8_t *stripeBuffers;
+  uint8_t bufferedStripes; // stripes stripeBuffers holds
+
+  // Current job, written by encode() before the workers are woken
+  const camera_fb_t *frame;
+  uint8_t jobQuality;
+  uint8_t stripeCount;
+  Stripe stripes[Max_Stripes];
+  Stats counters;
+
+  bool start();
+  bool reserveStripes(uint8_t count);
+  static void workerMain(void *arg);
+  void encodeStripes(uint8_t first);
+  size_t stitch(uint8_t *out, size_t capacity, uint16_t restart_interval);
+
+  static size_t writeStripe(void *arg, size_t index, const void *data, size_t len);
+};
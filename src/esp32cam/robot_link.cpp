@@ -0,0 +1,412 @@
+#include "robot_link.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+
+static portMUX_TYPE traceLock = portMUX_INITIALIZER_UNLOCKED;
+static portMUX_TYPE latencyLock = portMUX_INITIALIZER_UNLOCKED;
+static portMUX_TYPE commandLock = portMUX_INITIALIZER_UNLOCKED;
+static portMUX_TYPE textLock = portMUX_INITIALIZER_UNLOCKED;
+
+RobotLink::RobotLink(HardwareSerial &serial)
+    : serial(serial), queue(nullptr), sendLatency(), commands(), commandTotal(0), frameLen(0), frameSize(0), textLen(0),
+      inReport(false), pendingReport(nullptr), pendingLen(0), report(nullptr), reportLen(0), reportSeq(0), trace(nullptr),
+      traceHead(0), traceSize(0), traceTotal(0), traceCleared(0), traceTime(0), traceLastRaw(0)
+{
+  for (uint8_t i = 0; i < protocol::RadarSectors; i++)
+  {
+    radarDist[i] = 0;
+    radarTime[i] = 0;
+  }
+}
+
+void RobotLink::begin()
+{
+#if TASK_CONTROL_QUEUE
+  queue = xQueueCreate(Queue_Depth, sizeof(Outgoing));
+  xTaskCreatePinnedToCore(taskMain, "control", TASK_CONTROL_STACK, this, TASK_CONTROL_PRIORITY, nullptr,
+                          TASK_CONTROL_CORE);
+#endif
+}
+
+bool RobotLink::send(const void *frame, size_t len, int64_t clientUs)
+{
+  Outgoing out;
+  out.queuedUs = esp_timer_get_time();
+  out.clientUs = clientUs;
+  out.len = len < Max_Send_Bytes ? len : Max_Send_Bytes;
+  memcpy(out.data, frame, out.len);
+  if (!queue)
+  {
+    // Legacy topology or before begin(), written from the caller's task
+    write(out);
+    return true;
+  }
+  if (xQueueSend(queue, &out, 0) != pdTRUE)
+  {
+    portENTER_CRITICAL(&latencyLock);
+    sendLatency.dropped++;
+    portEXIT_CRITICAL(&latencyLock);
+    return false;
+  }
+  return true;
+}
+
+void RobotLink::write(const Outgoing &out)
+{
+  serial.write(out.data, out.len);
+  int64_t written = esp_timer_get_time();
+  if (out.len == sizeof(protocol::CommandFrame) && protocol::isCommandFrame(out.data))
+  {
+    recordCommand(out, written);
+  }
+  uint32_t us = written - out.queuedUs;
+  uint32_t bucket = us / Latency_Bucket_Us;
+  portENTER_CRITICAL(&latencyLock);
+  sendLatency.samples++;
+  sendLatency.buckets[bucket < Latency_Buckets ? bucket : Latency_Buckets]++;
+  if (us > sendLatency.maxUs)
+  {
+    sendLatency.maxUs = us;
+  }
+  portEXIT_CRITICAL(&latencyLock);
+}
+
+void RobotLink::recordCommand(const Outgoing &out, int64_t writtenUs)
+{
+  CommandTiming c;
+  c.command = out.data[1];
+  c.clientUs = out.clientUs;
+  c.queuedUs = out.queuedUs;
+  c.writtenUs = writtenUs;
+  c.ackUs = 0;
+  portENTER_CRITICAL(&commandLock);
+  c.seq = ++commandTotal;
+  commands[(c.seq - 1) % Command_History] = c;
+  portEXIT_CRITICAL(&commandLock);
+}
+
+void RobotLink::matchAck(uint8_t command)
+{
+  int64_t now = esp_timer_get_time();
+  portENTER_CRITICAL(&commandLock);
+  uint32_t oldest = commandTotal > Command_History ? commandTotal - Command_History : 0;
+  for (uint32_t i = oldest; i < commandTotal; i++)
+  {
+    // The oldest command of this kind still waiting, a lost ack only holds
+    // up the ones after it until the timeout
+    CommandTiming &c = commands[i % Command_History];
+    if (!c.ackUs && c.command == command && now - c.writtenUs < Ack_Timeout_Ms * 1000LL)
+    {
+      c.ackUs = now;
+      break;
+    }
+  }
+  portEXIT_CRITICAL(&commandLock);
+}
+
+size_t RobotLink::commandsSince(uint32_t seq, CommandTiming *out, size_t max)
+{
+  int64_t expired = esp_timer_get_time() - Ack_Timeout_Ms * 1000LL;
+  size_t count = 0;
+  portENTER_CRITICAL(&commandLock);
+  if (seq > commandTotal)
+  {
+    // A page still counting from before a reboot
+    seq = 0;
+  }
+  uint32_t oldest = commandTotal > Command_History ? commandTotal - Command_History : 0;
+  for (uint32_t i = seq > oldest ? seq : oldest; i < commandTotal && count < max; i++)
+  {
+    const CommandTiming &c = commands[i % Command_History];
+    if (!c.ackUs && c.writtenUs > expired)
+    {
+      break;
+    }
+    out[count++] = c;
+  }
+  portEXIT_CRITICAL(&commandLock);
+  return count;
+}
+
+void RobotLink::taskMain(void *arg)
+{
+  RobotLink *self = (RobotLink *)arg;
+  for (;;)
+  {
+    // A command wakes the task at once, the UNO's frames wait for the timeout
+    Outgoing out;
+    if (xQueueReceive(self->queue, &out, pdMS_TO_TICKS(Poll_Ms)) == pdTRUE)
+    {
+      self->write(out);
+      while (xQueueReceive(self->queue, &out, 0) == pdTRUE)
+      {
+        self->write(out);
+      }
+    }
+    self->poll();
+  }
+}
+
+RobotLink::Latency RobotLink::latency()
+{
+  portENTER_CRITICAL(&latencyLock);
+  Latency l = sendLatency;
+  portEXIT_CRITICAL(&latencyLock);
+  return l;
+}
+
+void RobotLink::clearLatency()
+{
+  portENTER_CRITICAL(&latencyLock);
+  memset(&sendLatency, 0, sizeof(sendLatency));
+  portEXIT_CRITICAL(&latencyLock);
+}
+
+uint32_t RobotLink::percentileUs(const Latency &latency, uint8_t percent)
+{
+  if (!latency.samples)
+  {
+    return 0;
+  }
+  uint32_t rank = ((uint64_t)latency.samples * percent + 99) / 100;
+  uint32_t seen = 0;
+  for (uint8_t i = 0; i < Latency_Buckets; i++)
+  {
+    seen += latency.buckets[i];
+    if (seen >= rank)
+    {
+      uint32_t edge = (i + 1) * Latency_Bucket_Us;
+      return edge < latency.maxUs ? edge : latency.maxUs;
+    }
+  }
+  return latency.maxUs;
+}
+
+void RobotLink::poll()
+{
+  // The UNO also prints plain text lines, anything outside a frame is text
+  while (serial.available() > 0)
+  {
+    uint8_t c = serial.read();
+    if (frameLen == 0)
+    {
+      if (c == protocol::RadarHeader)
+      {
+        frameSize = sizeof(protocol::RadarFrame);
+      }
+      else if (c == protocol::TraceHeader)
+      {
+        frameSize = sizeof(protocol::TraceFrame);
+      }
+      else if (c == protocol::AckHeader)
+      {
+        frameSize = sizeof(protocol::CommandFrame);
+      }
+      else
+      {
+        handleText(c);
+        continue;
+      }
+    }
+    frame[frameLen++] = c;
+    if (frameLen == frameSize)
+    {
+      handleFrame();
+      frameLen = 0;
+    }
+  }
+}
+
+void RobotLink::handleFrame()
+{
+  if (protocol::isRadarFrame(frame))
+  {
+    radarDist[frame[1]] = protocol::radarDistance(frame);
+    radarTime[frame[1]] = millis();
+  }
+  else if (protocol::isTraceFrame(frame))
+  {
+    addTrace();
+  }
+  else if (protocol::isAckFrame(frame))
+  {
+    matchAck(frame[1]);
+  }
+}
+
+void RobotLink::handleText(char c)
+{
+  if (c == '\r')
+  {
+    return;
+  }
+  if (c != '\n')
+  {
+    if (textLen < Text_Line_Length)
+    {
+      textLine[textLen++] = c;
+    }
+    return;
+  }
+  textLine[textLen] = 0;
+  textLen = 0;
+
+  if (strcmp(textLine, protocol::ProfileReportBegin) == 0)
+  {
+    if (!pendingReport)
+    {
+      pendingReport = (char *)malloc(Profile_Report_Size);
+      report = (char *)malloc(Profile_Report_Size);
+    }
+    inReport = pendingReport && report;
+    pendingLen = 0;
+  }
+  else if (inReport && strcmp(textLine, protocol::ProfileReportEnd) == 0)
+  {
+    inReport = false;
+    portENTER_CRITICAL(&textLock);
+    memcpy(report, pendingReport, pendingLen);
+    reportLen = pendingLen;
+    reportSeq++;
+    portEXIT_CRITICAL(&textLock);
+  }
+  else if (inReport)
+  {
+    // Lines that do not fit are dropped whole
+    size_t len = strlen(textLine);
+    if (pendingLen + len + 1 <= Profile_Report_Size)
+    {
+      memcpy(pendingReport + pendingLen, textLine, len);
+      pendingLen += len;
+      pendingReport[pendingLen++] = '\n';
+    }
+  }
+}
+
+size_t RobotLink::profileReport(char *out, size_t size, uint32_t &seq)
+{
+  portENTER_CRITICAL(&textLock);
+  size_t len = reportLen < size ? reportLen : size;
+  if (len)
+  {
+    memcpy(out, report, len);
+  }
+  seq = reportSeq;
+  portEXIT_CRITICAL(&textLock);
+  return len;
+}
+
+uint32_t RobotLink::profileSeq()
+{
+  portENTER_CRITICAL(&textLock);
+  uint32_t seq = reportSeq;
+  portEXIT_CRITICAL(&textLock);
+  return seq;
+}
+
+void RobotLink::addTrace()
+{
+  if (!trace)
+  {
+    // Allocated on first use, in PSRAM when the board has it
+    trace = (TraceSample *)heap_caps_malloc(Trace_Capacity * sizeof(TraceSample), MALLOC_CAP_SPIRAM);
+    if (!trace)
+    {
+      trace = (TraceSample *)malloc(Trace_Capacity * sizeof(TraceSample));
+    }
+    if (!trace)
+    {
+      return;
+    }
+  }
+
+  // The UNO sends 16 bit milliseconds, samples are far closer than a wrap
+  uint16_t raw = protocol::traceTime(frame);
+  bool first = traceSize == 0 || frame[1] == protocol::Trace_Mode;
+  traceTime = first ? raw : traceTime + (uint16_t)(raw - traceLastRaw);
+  traceLastRaw = raw;
+
+  TraceSample sample;
+  sample.time = traceTime;
+  sample.kind = frame[1];
+  for (uint8_t i = 0; i < 3; i++)
+  {
+    sample.value[i] = protocol::traceValue(frame, i);
+  }
+
+  portENTER_CRITICAL(&traceLock);
+  trace[(traceHead + traceSize) % Trace_Capacity] = sample;
+  if (traceSize < Trace_Capacity)
+  {
+    traceSize++;
+  }
+  else
+  {
+    traceHead = (traceHead + 1) % Trace_Capacity;
+  }
+  traceTotal++;
+  portEXIT_CRITICAL(&traceLock);
+}
+
+size_t RobotLink::traceCount()
+{
+  portENTER_CRITICAL(&traceLock);
+  size_t count = traceSize;
+  portEXIT_CRITICAL(&traceLock);
+  return count;
+}
+
+bool RobotLink::traceSample(size_t index, TraceSample &sample)
+{
+  bool found = false;
+  portENTER_CRITICAL(&traceLock);
+  if (index < traceSize)
+  {
+    sample = trace[(traceHead + index) % Trace_Capacity];
+    found = true;
+  }
+  portEXIT_CRITICAL(&traceLock);
+  return found;
+}
+
+void RobotLink::clearTrace()
+{
+  portENTER_CRITICAL(&traceLock);
+  traceHead = 0;
+  traceSize = 0;
+  traceCleared = traceTotal;
+  portEXIT_CRITICAL(&traceLock);
+}
+
+size_t RobotLink::traceSince(uint32_t &cursor, TraceSample *out, size_t max, uint32_t &lost)
+{
+  size_t count = 0;
+  portENTER_CRITICAL(&traceLock);
+  uint32_t oldest = traceTotal - traceSize;
+  lost = 0;
+  if (cursor < traceCleared)
+  {
+    cursor = traceCleared;
+  }
+  if (cursor < oldest)
+  {
+    lost = oldest - cursor;
+    cursor = oldest;
+  }
+  for (; count < max && cursor < traceTotal; count++, cursor++)
+  {
+    out[count] = trace[(traceHead + cursor - oldest) % Trace_Capacity];
+  }
+  portEXIT_CRITICAL(&traceLock);
+  return count;
+}
+
+uint16_t RobotLink::radarDistance(uint8_t bin) const
+{
+  return bin < protocol::RadarSectors ? radarDist[bin] : 0;
+}
+
+uint32_t RobotLink::radarTimestamp(uint8_t bin) const
+{
+  return bin < protocol::RadarSectors ? radarTime[bin] : 0;
+}
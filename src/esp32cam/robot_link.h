@@ -0,0 +1,147 @@
+#pragma once
+
+#include <Arduino.h>
+#include <robot_protocol.h>
+#include "freertos/queue.h"
+#include "task_config.h"
+
+// One trace frame with its time unwrapped to 32 bits
+struct TraceSample
+{
+  uint32_t time;
+  uint8_t kind;
+  uint16_t value[3];
+};
+
+// The serial link to the UNO. Frames for the UNO go through a queue to the
+// control task, the highest priority task in task_config.h, which writes
+// them and parses the frames the UNO sends back in between. Plain text
+// lines from the UNO are only kept for the profile report.
+//
+// The UNO acknowledges every command frame after the loop pass that acted on
+// it. Acks are matched to the commands in order of the command byte, the
+// time they arrive is only as fine as the Poll_Ms the control task waits.
+class RobotLink
+{
+public:
+  // Trace samples kept for /trace, the oldest are overwritten
+  static const size_t Trace_Capacity = 4096;
+  static const uint8_t Queue_Depth = 16;
+  static const uint8_t Max_Send_Bytes = 8;
+  // Incoming frames wait in the UART buffer this long at most
+  static const uint32_t Poll_Ms = 5;
+  // Send latency histogram, queued to written
+  static const uint32_t Latency_Bucket_Us = 100;
+  static const uint8_t Latency_Buckets = 100;
+  // Command timings kept for /latency, an ack later than the timeout is lost
+  static const uint8_t Command_History = 32;
+  static const uint32_t Ack_Timeout_Ms = 1000;
+  // Text the UNO prints between frames, longer lines are cut
+  static const uint8_t Text_Line_Length = 96;
+  static const size_t Profile_Report_Size = 1024;
+
+  struct Latency
+  {
+    uint32_t samples;
+    uint32_t dropped; // queue full
+    uint32_t maxUs;
+    uint32_t buckets[Latency_Buckets + 1]; // the last one holds the rest
+  };
+
+  // One command frame on its way to the motors, esp_timer microseconds
+  struct CommandTiming
+  {
+    uint32_t seq; // 1 for the first command since boot
+    uint8_t command;
+    int64_t clientUs;  // sent by the browser, on the car's clock, 0 when unknown
+    int64_t queuedUs;  // handed to send()
+    int64_t writtenUs; // in the UART
+    int64_t ackUs;     // the UNO's ack came in, 0 until then or when lost
+  };
+
+  RobotLink(HardwareSerial &serial);
+
+  // Starts the control task, without TASK_CONTROL_QUEUE poll() has to be
+  // called from loop()
+  void begin();
+  // Any task may send, it never blocks. False when the queue was full.
+  // clientUs is when the command left the browser, see CommandTiming.
+  bool send(const void *frame, size_t len, int64_t clientUs = 0);
+  // Parses whatever has arrived so far
+  void poll();
+
+  Latency latency();
+  void clearLatency();
+  // Percentile of the histogram in microseconds, bucket resolution
+  static uint32_t percentileUs(const Latency &latency, uint8_t percent);
+
+  // Commands after seq that were acknowledged or timed out, oldest first.
+  // Stops at the first one still waiting for its ack.
+  size_t commandsSince(uint32_t seq, CommandTiming *out, size_t max);
+
+  uint16_t radarDistance(uint8_t bin) const;
+  // millis() when the sector was last updated, 0 if never
+  uint32_t radarTimestamp(uint8_t bin) const;
+
+  // The UNO's last loop profile report, see protocol::ProfileQuery. Returns
+  // its length; seq counts the reports received so far.
+  size_t profileReport(char *out, size_t size, uint32_t &seq);
+  uint32_t profileSeq();
+
+  // Buffered trace samples, oldest first
+  size_t traceCount();
+  bool traceSample(size_t index, TraceSample &sample);
+  void clearTrace();
+  // Samples that came in after the cursor, oldest first, and moves the
+  // cursor past them. lost counts the ones overwritten before they were
+  // read, samples dropped by clearTrace() are skipped without counting.
+  size_t traceSince(uint32_t &cursor, TraceSample *out, size_t max, uint32_t &lost);
+
+private:
+  struct Outgoing
+  {
+    int64_t queuedUs;
+    int64_t clientUs;
+    uint8_t len;
+    uint8_t data[Max_Send_Bytes];
+  };
+
+  HardwareSerial &serial;
+  QueueHandle_t queue;
+  Latency sendLatency;
+  // Ring of command timings, shared with the HTTP server task under commandLock
+  CommandTiming commands[Command_History];
+  uint32_t commandTotal;
+  uint8_t frame[sizeof(protocol::TraceFrame)];
+  uint8_t frameLen;
+  uint8_t frameSize;
+  char textLine[Text_Line_Length + 1];
+  uint8_t textLen;
+  // Report lines are collected into pendingReport until its end marker
+  bool inReport;
+  char *pendingReport;
+  size_t pendingLen;
+  char *report; // shared with the HTTP server task under textLock
+  size_t reportLen;
+  uint32_t reportSeq;
+
+  volatile uint16_t radarDist[protocol::RadarSectors];
+  volatile uint32_t radarTime[protocol::RadarSectors];
+
+  // Ring of trace samples, shared with the HTTP server task under traceLock
+  TraceSample *trace;
+  size_t traceHead;
+  size_t traceSize;
+  uint32_t traceTotal; // samples received, clearTrace() keeps counting
+  uint32_t traceCleared; // traceTotal at the last clearTrace()
+  uint32_t traceTime;
+  uint16_t traceLastRaw;
+
+  static void taskMain(void *arg);
+  void write(const Outgoing &out);
+  void handleFrame();
+  void handleText(char c);
+  void recordCommand(const Outgoing &out, int64_t writtenUs);
+  void matchAck(uint8_t command);
+  void addTrace();
+};
@@ -0,0 +1,87 @@
+#pragma once
+
+// Task topology. Core 0 (PRO_CPU) is the networking core: the precompiled
+// framework already runs the WiFi driver, lwIP, esp_timer and the camera
+// driver's DMA task there, all above every priority below. The control HTTP
+// server, the WiFi supervisor and the flash log writer join them. Core 1
+// (APP_CPU) is the capture core: the stream server, whose handler captures
+// and encodes every frame, the analytics tap and the vision tasks. The UNO
+// control link sits above all of them so a command never waits for a frame.
+//
+// Every value is a build flag, e.g. -DTASK_CONTROL_PRIORITY=12 in
+// platformio.ini. -DTASK_TOPOLOGY_LEGACY gives back the placement from
+// before: both HTTP servers on any core, commands written to the UART from
+// the HTTP task and the UNO link polled from loop(). /bench/control and
+// src/control_bench compare the two.
+
+#include "freertos/FreeRTOS.h"
+
+#ifdef TASK_TOPOLOGY_LEGACY
+#define TASK_CONTROL_QUEUE 0
+#define TASK_HTTP_CORE tskNO_AFFINITY
+#define TASK_STREAM_CORE tskNO_AFFINITY
+#endif
+
+// UNO control link, see RobotLink. 0 writes commands from the caller's task
+#ifndef TASK_CONTROL_QUEUE
+#define TASK_CONTROL_QUEUE 1
+#endif
+#ifndef TASK_CONTROL_CORE
+#define TASK_CONTROL_CORE 1
+#endif
+#ifndef TASK_CONTROL_PRIORITY
+#define TASK_CONTROL_PRIORITY 10
+#endif
+#ifndef TASK_CONTROL_STACK
+#define TASK_CONTROL_STACK 3072
+#endif
+
+// Port 80: pages, commands and settings
+#ifndef TASK_HTTP_CORE
+#define TASK_HTTP_CORE 0
+#endif
+#ifndef TASK_HTTP_PRIORITY
+#define TASK_HTTP_PRIORITY 5
+#endif
+
+// Port 81: the MJPEG stream
+#ifndef TASK_STREAM_CORE
+#define TASK_STREAM_CORE 1
+#endif
+#ifndef TASK_STREAM_PRIORITY
+#define TASK_STREAM_PRIORITY 5
+#endif
+
+// Stripe encoders, one on each core by design
+#ifndef TASK_JPEG_WORKER_PRIORITY
+#define TASK_JPEG_WORKER_PRIORITY 5
+#endif
+
+#ifndef TASK_CAMERA_INIT_CORE
+#define TASK_CAMERA_INIT_CORE 1
+#endif
+#ifndef TASK_CAMERA_INIT_PRIORITY
+#define TASK_CAMERA_INIT_PRIORITY 5
+#endif
+
+// Analytics tap, line and blob tracking: below the stream so it keeps going
+#ifndef TASK_VISION_CORE
+#define TASK_VISION_CORE 1
+#endif
+#ifndef TASK_VISION_PRIORITY
+#define TASK_VISION_PRIORITY 4
+#endif
+
+#ifndef TASK_WIFI_SUPERVISOR_CORE
+#define TASK_WIFI_SUPERVISOR_CORE 0
+#endif
+#ifndef TASK_WIFI_SUPERVISOR_PRIORITY
+#define TASK_WIFI_SUPERVISOR_PRIORITY 3
+#endif
+
+#ifndef TASK_FLASH_LOG_CORE
+#define TASK_FLASH_LOG_CORE 0
+#endif
+#ifndef TASK_FLASH_LOG_PRIORITY
+#define TASK_FLASH_LOG_PRIORITY 1
+#endif
@@ -0,0 +1,109 @@
+# Minifies the pages in this directory into web_assets.h, gzipped and as they
+# are, which web_server.cpp serves with an ETag for each. Runs before every
+# esp32cam build (extra_scripts in platformio.ini) and only rewrites the
+# header when an asset changed. Standalone:
+#   python3 src/esp32cam/web/build_assets.py
+
+import gzip
+import hashlib
+import os
+import re
+
+# file, URI, content type
+ASSETS = [
+    ("index.html", "/", "text/html"),
+    ("gamepad.html", "/gamepad", "text/html"),
+    ("latency.js", "/latency.js", "application/javascript"),
+]
+
+WHITESPACE = re.compile(r"\s")
+
+
+def minify(file, text):
+    # Whitespace only: indentation and blank lines go, line breaks stay so no
+    # script relies on a semicolon that is not there. Comments stay as well,
+    # telling one from the same characters in a string or template takes a
+    # real parser. gzip takes care of the rest.
+    lines = []
+    for line in text.splitlines():
+        line = line.strip()
+        if line:
+            lines.append(line)
+    minified = "\n".join(lines) + "\n"
+    if WHITESPACE.sub("", minified) != WHITESPACE.sub("", text):
+        raise SystemExit("web assets: minifying %s changed more than whitespace" % file)
+    return minified
+
+
+def etag(data):
+    return hashlib.sha1(data).hexdigest()[:16]
+
+
+def c_array(name, data):
+    rows = []
+    for i in range(0, len(data), 16):
+        rows.append("    " + ", ".join("0x%02x" % b for b in data[i:i + 16]) + ",")
+    return "static const uint8_t %s[] = {\n%s\n};\n" % (name, "\n".join(rows))
+
+
+def generate(web_dir, header):
+    arrays = []
+    entries = []
+    report = []
+    for file, uri, content_type in ASSETS:
+        with open(os.path.join(web_dir, file), "rb") as f:
+            source = f.read()
+        minified = minify(file, source.decode("utf-8")).encode("utf-8")
+        # mtime 0 so the same page always gives the same bytes and ETag
+        packed = gzip.compress(minified, 9, mtime=0)
+        name = "web_" + re.sub(r"\W", "_", file)
+        arrays.append(c_array(name + "_gz", packed))
+        arrays.append(c_array(name, minified))
+        # Each encoding is its own representation with its own strong ETag
+        entries.append('    {"%s", "%s", %s_gz, sizeof(%s_gz), "\\"%s\\"", %s, sizeof(%s), "\\"%s\\""},' %
+                       (uri, content_type, name, name, etag(packed), name, name, etag(minified)))
+        report.append("%s %d -> %d -> %d bytes" % (file, len(source), len(minified), len(packed)))
+
+    text = """// Generated by web/build_assets.py from web/, do not edit
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct WebAsset
+{
+  const char *uri;
+  const char *type;
+  const uint8_t *gzip;
+  size_t gzipLen;
+  const char *gzipEtag; // strong, quoted
+  const uint8_t *plain; // for clients that do not accept gzip
+  size_t plainLen;
+  const char *plainEtag;
+};
+
+%s
+static const WebAsset web_assets[] = {
+%s
+};
+""" % ("\n".join(arrays), "\n".join(entries))
+
+    try:
+        with open(header) as f:
+            if f.read() == text:
+                return report
+    except IOError:
+        pass
+    with open(header, "w") as f:
+        f.write(text)
+    return report
+
+
+try:
+    Import("env")  # noqa: F821, PlatformIO pre: script
+    esp32cam_dir = os.path.join(env.subst("$PROJECT_DIR"), "src", "esp32cam")  # noqa: F821
+except NameError:
+    esp32cam_dir = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+for line in generate(os.path.join(esp32cam_dir, "web"), os.path.join(esp32cam_dir, "web_assets.h")):
+    print("web assets: " + line)
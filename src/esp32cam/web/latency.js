@@ -0,0 +1,218 @@
+// Staleness of the view and of the commands, for the robot and gamepad
+// pages. Everything is timed on the car's clock, esp_timer milliseconds
+// since boot, which the stream's X-Timestamp and /time share.
+const LATENCY_SYNC_PINGS = 8;
+const LATENCY_SYNC_MS = 30000;
+const LATENCY_PLOT_MS = 30000;
+const LATENCY_POLL_MS = 500;
+
+const latency = {
+  offsetMs: null,  // car clock minus performance.now(), null until synced
+  syncRttMs: null, // round trip of the /time reply the offset came from
+  display: [],     // [car ms, capture to display ms]
+  uart: [],        // [car ms, command sent to in the UART ms]
+  ack: [],         // [car ms, command sent to acknowledged by the UNO ms]
+  after: 0         // last command read from /latency
+};
+
+function carNow() {
+  return performance.now() + latency.offsetMs;
+}
+
+// The reply with the shortest round trip waited least, the car read its
+// clock half way through it
+async function syncCarClock() {
+  let best = null;
+  try {
+    for (let i = 0; i < LATENCY_SYNC_PINGS; i++) {
+      const t0 = performance.now();
+      const reply = await (await fetch('/time', {cache: 'no-store'})).json();
+      const t1 = performance.now();
+      if (!best || t1 - t0 < best.rtt) {
+        best = {rtt: t1 - t0, offset: reply.car_us / 1000 - (t0 + t1) / 2};
+      }
+    }
+  } catch (error) {
+    console.error('Time sync:', error);
+  }
+  if (best) {
+    latency.offsetMs = best.offset;
+    latency.syncRttMs = best.rtt;
+  }
+  setTimeout(syncCarClock, LATENCY_SYNC_MS);
+}
+
+// Command URL carrying its send time, plain until the clock is synced
+function commandUrl(command) {
+  return '/' + command + (latency.offsetMs === null ? '' : '?t=' + Math.round(carNow()));
+}
+
+function addLatency(series, at, ms) {
+  series.push([at, ms]);
+  while (series.length && series[0][0] < at - LATENCY_PLOT_MS) {
+    series.shift();
+  }
+}
+
+// Frames are shown one at a time, the newest one waiting replaces any older
+let frameBusy = false;
+let frameNext = null;
+
+function showFrame(photo, jpeg, captured) {
+  if (frameBusy) {
+    frameNext = {jpeg, captured};
+    return;
+  }
+  frameBusy = true;
+  const url = URL.createObjectURL(new Blob([jpeg], {type: 'image/jpeg'}));
+  const done = shown => {
+    URL.revokeObjectURL(url);
+    // Painted by the next animation frame
+    requestAnimationFrame(() => {
+      if (shown && captured !== null && latency.offsetMs !== null) {
+        const now = carNow();
+        addLatency(latency.display, now, now - captured);
+      }
+      frameBusy = false;
+      if (frameNext) {
+        const next = frameNext;
+        frameNext = null;
+        showFrame(photo, next.jpeg, next.captured);
+      }
+    });
+  };
+  photo.onload = () => done(true);
+  photo.onerror = () => done(false);
+  photo.src = url;
+}
+
+function indexOfHeaderEnd(buffer) {
+  for (let i = 0; i + 3 < buffer.length; i++) {
+    if (buffer[i] === 13 && buffer[i + 1] === 10 && buffer[i + 2] === 13 && buffer[i + 3] === 10) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// Reads the MJPEG stream itself, an <img> pointed at it hides the part
+// headers with X-Timestamp. Reopens it once the link or the server is back.
+async function playStream(photo, url) {
+  try {
+    const response = await fetch(url + '?t=' + Date.now(), {cache: 'no-store'});
+    const reader = response.body.getReader();
+    const decoder = new TextDecoder();
+    let buffer = new Uint8Array(0);
+    let part = null;
+    for (;;) {
+      const {done, value} = await reader.read();
+      if (done) {
+        break;
+      }
+      const joined = new Uint8Array(buffer.length + value.length);
+      joined.set(buffer);
+      joined.set(value, buffer.length);
+      buffer = joined;
+      for (;;) {
+        if (!part) {
+          // Boundary and part headers, the JPEG follows
+          const end = indexOfHeaderEnd(buffer);
+          if (end < 0) {
+            break;
+          }
+          const headers = decoder.decode(buffer.subarray(0, end));
+          const length = /Content-Length:\s*(\d+)/i.exec(headers);
+          const stamp = /X-Timestamp:\s*(\d+)\.(\d+)/i.exec(headers);
+          buffer = buffer.subarray(end + 4);
+          if (!length) {
+            continue;
+          }
+          part = {length: +length[1], captured: stamp ? +stamp[1] * 1000 + +stamp[2] / 1000 : null};
+        }
+        if (buffer.length < part.length) {
+          break;
+        }
+        showFrame(photo, buffer.slice(0, part.length), part.captured);
+        buffer = buffer.subarray(part.length);
+        part = null;
+      }
+    }
+  } catch (error) {
+    console.error('Stream:', error);
+  }
+  setTimeout(() => playStream(photo, url), 1000);
+}
+
+function pollCommandLatency() {
+  fetch('/latency?after=' + latency.after, {cache: 'no-store'})
+    .then(response => response.json())
+    .then(report => {
+      report.commands.forEach(c => {
+        latency.after = c.seq;
+        // Without a send time the network is not in it
+        if (!c.synced) {
+          return;
+        }
+        addLatency(latency.uart, c.sent_ms, c.uart_ms);
+        if (c.ack_ms >= 0) {
+          addLatency(latency.ack, c.sent_ms, c.ack_ms);
+        }
+      });
+    })
+    .catch(error => console.error('Latency:', error))
+    .finally(() => setTimeout(pollCommandLatency, LATENCY_POLL_MS));
+}
+
+function lastLatency(series) {
+  return series.length ? Math.round(series[series.length - 1][1]) + ' ms' : '-';
+}
+
+function drawLatency(overlay, canvas) {
+  if (latency.offsetMs === null) {
+    overlay.textContent = 'syncing clock';
+    return;
+  }
+  overlay.textContent = 'view ' + lastLatency(latency.display) + ' | to UART ' + lastLatency(latency.uart) +
+    ' | to ack ' + lastLatency(latency.ack) + ' | sync +/-' + Math.round(latency.syncRttMs / 2) + ' ms';
+
+  const ctx = canvas.getContext('2d');
+  const now = carNow();
+  const lines = [[latency.display, '#4CAF50', 'view'], [latency.uart, '#2196F3', 'to UART'],
+                 [latency.ack, '#FF9800', 'to ack']];
+  let top = 100;
+  lines.forEach(([series]) => series.forEach(([, ms]) => { top = Math.max(top, Math.ceil(ms / 100) * 100); }));
+  ctx.clearRect(0, 0, canvas.width, canvas.height);
+  ctx.fillStyle = '#888';
+  ctx.font = '10px Arial';
+  ctx.fillText(top + ' ms', 2, 10);
+  lines.forEach(([series, colour, name], i) => {
+    ctx.fillStyle = colour;
+    ctx.fillText(name, 60 + i * 60, 10);
+    ctx.strokeStyle = colour;
+    ctx.beginPath();
+    series.forEach(([at, ms], j) => {
+      const x = canvas.width * (1 - (now - at) / LATENCY_PLOT_MS);
+      const y = canvas.height * (1 - ms / top);
+      if (j) {
+        ctx.lineTo(x, y);
+      } else {
+        ctx.moveTo(x, y);
+      }
+    });
+    ctx.stroke();
+  });
+}
+
+// Plays the stream into photo and keeps the overlay and the plot current.
+// Browsers without readable fetch bodies get the plain stream.
+function startLatency(photo, streamUrl, overlay, canvas) {
+  if (!window.ReadableStream || !window.TextDecoder) {
+    photo.onerror = () => setTimeout(() => { photo.src = streamUrl + '?t=' + Date.now(); }, 1000);
+    photo.src = streamUrl;
+    return;
+  }
+  syncCarClock();
+  playStream(photo, streamUrl);
+  pollCommandLatency();
+  setInterval(() => drawLatency(overlay, canvas), 250);
+}
@@ -1,32 +1,50 @@
 #include "web_server.h"
 #include "esp_timer.h"
 #include "img_converters.h"
+#include "esp_heap_caps.h"
 #include "fb_gfx.h"
 #include "esp32-hal-ledc.h"
+#include <robot_protocol.h>
+#include "boot_timeline.h"
+#include "frame_change.h"
+#include "jpeg_decode.h"
+#include "kernel_bench.h"
+#include "task_config.h"
+#include "web_assets.h"
 
 // External variables - declared here, defined in main.cpp
 extern int gpLed;
 extern String WiFiAddr;
-extern byte txdata[3];
-
-// Constants from original code
-const int Forward = 92;
-const int Backward = 163;
-const int Turn_Left = 149;
-const int Turn_Right = 106;
-const int Top_Left = 20;
-const int Bottom_Left = 129;
-const int Top_Right = 72;
-const int Bottom_Right = 34;
-const int Stop = 0;
-const int Clockwise = 83;
-const int Contrarotate = 172;
-const int Moedl1 = 25;
-const int Moedl2 = 26;
-const int Moedl3 = 27;
-const int Moedl4 = 28;
-const int MotorLeft = 230;
-const int MotorRight = 231;
+
+// Robot commands forwarded to the UNO, one URI each
+struct RobotCommand
+{
+  const char *uri;
+  uint8_t command;
+  const char *name;
+};
+
+static const RobotCommand robot_commands[] = {
+    {"/go", protocol::Forward, "Go"},
+    {"/back", protocol::Backward, "Back"},
+    {"/left", protocol::Turn_Left, "Left"},
+    {"/right", protocol::Turn_Right, "Right"},
+    {"/stop", protocol::Stop, "Stop"},
+    {"/leftup", protocol::Top_Left, "LeftUp"},
+    {"/leftdown", protocol::Bottom_Left, "LeftDown"},
+    {"/rightup", protocol::Top_Right, "RightUp"},
+    {"/rightdown", protocol::Bottom_Right, "RightDown"},
+    {"/clockwise", protocol::Clockwise, "Clockwise"},
+    {"/contrario", protocol::Contrarotate, "Contrario"},
+    {"/model1", protocol::Mode1, "Model1"},
+    {"/model2", protocol::Mode2, "Model2"},
+    {"/model3", protocol::Mode3, "Model3"},
+    {"/model4", protocol::Mode4, "Model4"},
+    {"/motorleft", protocol::MotorLeft, "MotorLeft"},
+    {"/motorright", protocol::MotorRight, "MotorRight"},
+    {"/profilereset", protocol::ProfileReset, "ProfileReset"},
+    {"/tracestart", protocol::TraceStart, "TraceStart"},
+    {"/tracestop", protocol::TraceStop, "TraceStop"}};
 
 #define PART_BOUNDARY "123456789000000000000987654321"
 static const char *_STREAM_CONTENT_TYPE = "multipart/x-mixed-replace;boundary=" PART_BOUNDARY;
@@ -34,51 +52,46 @@ static const char *_STREAM_BOUNDARY = "\r\n--" PART_BOUNDARY "\r\n";
 static const char *_STREAM_PART = "Content-Type: image/jpeg\r\nContent-Length: %u\r\nX-Timestamp: %d.%06d\r\n\r\n";
 
 char WebServer::part_buf[128];
+WebServer::StreamStats WebServer::streamStats = {};
+bool WebServer::suppressStatic = true;
 
-WebServer::WebServer(Camera &camera) : camera(camera), stream_httpd(nullptr), camera_httpd(nullptr), ssid(nullptr), password(nullptr) {}
+WebServer::WebServer(Camera &camera, RobotLink &robotLink, WiFiLink &wifiLink, AnalyticsTap &analyticsTap, LineCamera &lineCamera, BlobCamera &blobCamera, FrameRecorder &recorder, FlashLog &flashLog) : camera(camera), robotLink(robotLink), wifiLink(wifiLink), analyticsTap(analyticsTap), lineCamera(lineCamera), blobCamera(blobCamera), recorder(recorder), flashLog(flashLog), jpegEncoder(), stream_httpd(nullptr), camera_httpd(nullptr) {}
 
-void WebServer::setWiFiCredentials(const char *ssid, const char *password)
+// Handlers that need the camera answer 503 while it is still starting
+esp_err_t WebServer::sendCameraNotReady(httpd_req_t *req)
 {
-  this->ssid = ssid;
-  this->password = password;
+  httpd_resp_set_status(req, "503 Service Unavailable");
+  httpd_resp_set_hdr(req, "Retry-After", "1");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  return httpd_resp_send(req, "Camera starting", HTTPD_RESP_USE_STRLEN);
 }
 
-bool WebServer::connectToWiFi()
+void WebServer::reportFirstFrame()
 {
-  if (!ssid || !password)
-  {
-    return false;
-  }
-
-  WiFi.begin(ssid, password);
-  WiFi.setSleep(false);
-
-  // Wait for connection
-  int attempts = 0;
-  while (WiFi.status() != WL_CONNECTED && attempts < 20)
-  {
-    delay(500);
-    attempts++;
-  }
-
-  if (WiFi.status() == WL_CONNECTED)
+  if (BootTimeline::mark(bootTimeline.firstFrame))
   {
-    wifiAddress = WiFi.localIP().toString();
-    return true;
+    Serial.printf("Boot to first frame: %u ms (wifi start %u, camera %u, network %u, servers %u)\n",
+                  BootTimeline::ms(bootTimeline.firstFrame), BootTimeline::ms(bootTimeline.wifiStart),
+                  BootTimeline::ms(bootTimeline.cameraReady), BootTimeline::ms(bootTimeline.networkUp),
+                  BootTimeline::ms(bootTimeline.serversUp));
   }
-  return false;
 }
 
-String WebServer::getWiFiAddress() const
+static void keepGlobalContext(void *)
 {
-  return wifiAddress;
 }
 
 void WebServer::start()
 {
   httpd_config_t config = HTTPD_DEFAULT_CONFIG();
-  config.max_uri_handlers = 30;
+  config.max_uri_handlers = 64;
   config.max_resp_headers = 30;
+  config.core_id = TASK_HTTP_CORE;
+  config.task_priority = TASK_HTTP_PRIORITY;
+  // The command handlers reach the robot link through it, httpd would free()
+  // it when the server stops
+  config.global_user_ctx = this;
+  config.global_user_ctx_free_fn = keepGlobalContext;
 
   Serial.println("Starting web server on port 80");
   esp_err_t err = httpd_start(&camera_httpd, &config);
@@ -91,6 +104,8 @@ void WebServer::start()
 
   config.server_port = 81;
   config.ctrl_port = config.ctrl_port + 1;
+  config.core_id = TASK_STREAM_CORE;
+  config.task_priority = TASK_STREAM_PRIORITY;
 
   Serial.println("Starting stream server on port 81");
   err = httpd_start(&stream_httpd, &config);
@@ -102,6 +117,29 @@ void WebServer::start()
   setupStreamServer();
 }
 
+void WebServer::stop()
+{
+  // Waits for the server tasks, a stream handler blocked in a send gives up
+  // after the socket send timeout
+  if (stream_httpd)
+  {
+    httpd_stop(stream_httpd);
+    stream_httpd = nullptr;
+  }
+  if (camera_httpd)
+  {
+    httpd_stop(camera_httpd);
+    camera_httpd = nullptr;
+  }
+}
+
+void WebServer::restart()
+{
+  Serial.println("Restarting web servers");
+  stop();
+  start();
+}
+
 // Helper methods
 esp_err_t WebServer::parseGet(httpd_req_t *req, char **obuf)
 {
@@ -127,14 +165,49 @@ esp_err_t WebServer::parseGet(httpd_req_t *req, char **obuf)
   return ESP_FAIL;
 }
 
+int WebServer::parseGetVar(char *buf, const char *key, int def)
+{
+  char value[16];
+  if (httpd_query_key_value(buf, key, value, sizeof(value)) != ESP_OK)
+  {
+    return def;
+  }
+  return atoi(value);
+}
+
+// Comma separated list of numbers, the defaults when the key is missing
+static int parseGetList(const char *buf, const char *key, int *out, int max, const int *def, int def_count)
+{
+  char value[64];
+  if (!buf || httpd_query_key_value(buf, key, value, sizeof(value)) != ESP_OK)
+  {
+    for (int i = 0; i < def_count; i++)
+    {
+      out[i] = def[i];
+    }
+    return def_count;
+  }
+  int count = 0;
+  char *save = nullptr;
+  for (char *item = strtok_r(value, ",", &save); item && count < max; item = strtok_r(nullptr, ",", &save))
+  {
+    out[count++] = atoi(item);
+  }
+  return count;
+}
+
 void WebServer::registerHandlers()
 {
-  httpd_uri_t index_uri = {
-      .uri = "/",
-      .method = HTTP_GET,
-      .handler = indexHandler,
-      .user_ctx = this};
-  httpd_register_uri_handler(camera_httpd, &index_uri);
+  // Pages and scripts from web/, each one carries its asset
+  for (const WebAsset &asset : web_assets)
+  {
+    httpd_uri_t asset_uri = {
+        .uri = asset.uri,
+        .method = HTTP_GET,
+        .handler = assetHandler,
+        .user_ctx = (void *)&asset};
+    httpd_register_uri_handler(camera_httpd, &asset_uri);
+  }
 
   httpd_uri_t status_uri = {
       .uri = "/status",
@@ -157,37 +230,79 @@ void WebServer::registerHandlers()
       .user_ctx = this};
   httpd_register_uri_handler(camera_httpd, &capture_uri);
 
-  // Register gamepad handler
-  httpd_uri_t gamepad_uri = {
-      .uri = "/gamepad",
+  httpd_uri_t radar_uri = {
+      .uri = "/radar",
+      .method = HTTP_GET,
+      .handler = radarHandler,
+      .user_ctx = this};
+  httpd_register_uri_handler(camera_httpd, &radar_uri);
+
+  httpd_uri_t trace_uri = {
+      .uri = "/trace",
+      .method = HTTP_GET,
+      .handler = traceHandler,
+      .user_ctx = this};
+  httpd_register_uri_handler(camera_httpd, &trace_uri);
+
+  httpd_uri_t profile_uri = {
+      .uri = "/profile",
+      .method = HTTP_GET,
+      .handler = profileHandler,
+      .user_ctx = this};
+  httpd_register_uri_handler(camera_httpd, &profile_uri);
+
+  httpd_uri_t camprofile_uri = {
+      .uri = "/camprofile",
       .method = HTTP_GET,
-      .handler = gamepadHandler,
+      .handler = captureProfileHandler,
       .user_ctx = this};
-  httpd_register_uri_handler(camera_httpd, &gamepad_uri);
-
-  // Register all robot control handlers
-  const httpd_uri_t movement_handlers[] = {
-      {"/go", HTTP_GET, goHandler, this},
-      {"/back", HTTP_GET, backHandler, this},
-      {"/left", HTTP_GET, leftHandler, this},
-      {"/right", HTTP_GET, rightHandler, this},
-      {"/stop", HTTP_GET, stopHandler, this},
-      {"/leftup", HTTP_GET, leftUpHandler, this},
-      {"/leftdown", HTTP_GET, leftDownHandler, this},
-      {"/rightup", HTTP_GET, rightUpHandler, this},
-      {"/rightdown", HTTP_GET, rightDownHandler, this},
-      {"/clockwise", HTTP_GET, clockwiseHandler, this},
-      {"/contrario", HTTP_GET, contrarioHandler, this},
+  httpd_register_uri_handler(camera_httpd, &camprofile_uri);
+
+  // Raw sensor access
+  const httpd_uri_t sensor_handlers[] = {
+      {"/xclk", HTTP_GET, xclkHandler, this},
+      {"/reg", HTTP_GET, regHandler, this},
+      {"/greg", HTTP_GET, gregHandler, this},
+      {"/pll", HTTP_GET, pllHandler, this},
+      {"/resolution", HTTP_GET, winHandler, this},
+      {"/bench/sensor", HTTP_GET, sensorBenchHandler, this},
+      {"/bench/kernels", HTTP_GET, kernelBenchHandler, this},
+      {"/bench/jpeg", HTTP_GET, jpegBenchHandler, this},
+      {"/bench/control", HTTP_GET, controlBenchHandler, this},
+      {"/roi", HTTP_GET, roiHandler, this},
+      {"/tap", HTTP_GET, tapHandler, this},
+      {"/vision", HTTP_GET, visionHandler, this},
+      {"/vision/frame", HTTP_GET, visionFrameHandler, this},
+      {"/blob", HTTP_GET, blobHandler, this},
+      {"/blob/frame", HTTP_GET, blobFrameHandler, this},
+      {"/recorder", HTTP_GET, recorderHandler, this},
+      {"/recording", HTTP_GET, recordingHandler, this},
+      {"/logger", HTTP_GET, loggerHandler, this},
+      {"/log", HTTP_GET, logHandler, this},
+      {"/time", HTTP_GET, timeHandler, this},
+      {"/latency", HTTP_GET, latencyHandler, this}};
+
+  for (const auto &handler : sensor_handlers)
+  {
+    httpd_register_uri_handler(camera_httpd, &handler);
+  }
+
+  // Register all robot control handlers, each one carries its command table entry
+  for (const RobotCommand &command : robot_commands)
+  {
+    httpd_uri_t command_uri = {
+        .uri = command.uri,
+        .method = HTTP_GET,
+        .handler = commandHandler,
+        .user_ctx = (void *)&command};
+    httpd_register_uri_handler(camera_httpd, &command_uri);
+  }
+
+  const httpd_uri_t led_handlers[] = {
       {"/ledon", HTTP_GET, ledOnHandler, this},
-      {"/ledoff", HTTP_GET, ledOffHandler, this},
-      {"/model1", HTTP_GET, model1Handler, this},
-      {"/model2", HTTP_GET, model2Handler, this},
-      {"/model3", HTTP_GET, model3Handler, this},
-      {"/model4", HTTP_GET, model4Handler, this},
-      {"/motorleft", HTTP_GET, motorLeftHandler, this},
-      {"/motorright", HTTP_GET, motorRightHandler, this}};
+      {"/ledoff", HTTP_GET, ledOffHandler, this}};
 
-  for (const auto &handler : movement_handlers)
+  for (const auto &handler : led_handlers)
   {
     httpd_register_uri_handler(camera_httpd, &handler);
   }
@@ -212,102 +327,21 @@ void WebServer::setupStreamServer()
   }
 }
 
-// Movement handlers implementation
-esp_err_t WebServer::goHandler(httpd_req_t *req)
-{
-  txdata[1] = Forward;
-  Serial.write(txdata, 3);
-  Serial.println("Go");
-  httpd_resp_set_type(req, "text/html");
-  return httpd_resp_send(req, "OK", 2);
-}
-
-esp_err_t WebServer::backHandler(httpd_req_t *req)
-{
-  txdata[1] = Backward;
-  Serial.write(txdata, 3);
-  Serial.println("Back");
-  httpd_resp_set_type(req, "text/html");
-  return httpd_resp_send(req, "OK", 2);
-}
-
-esp_err_t WebServer::leftHandler(httpd_req_t *req)
-{
-  txdata[1] = Turn_Left;
-  Serial.write(txdata, 3);
-  Serial.println("Left");
-  httpd_resp_set_type(req, "text/html");
-  return httpd_resp_send(req, "OK", 2);
-}
-
-esp_err_t WebServer::rightHandler(httpd_req_t *req)
-{
-  txdata[1] = Turn_Right;
-  Serial.write(txdata, 3);
-  Serial.println("Right");
-  httpd_resp_set_type(req, "text/html");
-  return httpd_resp_send(req, "OK", 2);
-}
-
-esp_err_t WebServer::stopHandler(httpd_req_t *req)
-{
-  txdata[1] = Stop;
-  Serial.write(txdata, 3);
-  Serial.println("Stop");
-  httpd_resp_set_type(req, "text/html");
-  return httpd_resp_send(req, "OK", 2);
-}
-
-esp_err_t WebServer::leftUpHandler(httpd_req_t *req)
-{
-  txdata[1] = Top_Left;
-  Serial.write(txdata, 3);
-  Serial.println("LeftUp");
-  httpd_resp_set_type(req, "text/html");
-  return httpd_resp_send(req, "OK", 2);
-}
-
-esp_err_t WebServer::leftDownHandler(httpd_req_t *req)
-{
-  txdata[1] = Bottom_Left;
-  Serial.write(txdata, 3);
-  Serial.println("LeftDown");
-  httpd_resp_set_type(req, "text/html");
-  return httpd_resp_send(req, "OK", 2);
-}
-
-esp_err_t WebServer::rightUpHandler(httpd_req_t *req)
-{
-  txdata[1] = Top_Right;
-  Serial.write(txdata, 3);
-  Serial.println("RightUp");
-  httpd_resp_set_type(req, "text/html");
-  return httpd_resp_send(req, "OK", 2);
-}
-
-esp_err_t WebServer::rightDownHandler(httpd_req_t *req)
-{
-  txdata[1] = Bottom_Right;
-  Serial.write(txdata, 3);
-  Serial.println("RightDown");
-  httpd_resp_set_type(req, "text/html");
-  return httpd_resp_send(req, "OK", 2);
-}
-
-esp_err_t WebServer::clockwiseHandler(httpd_req_t *req)
-{
-  txdata[1] = Clockwise;
-  Serial.write(txdata, 3);
-  Serial.println("Clockwise");
-  httpd_resp_set_type(req, "text/html");
-  return httpd_resp_send(req, "OK", 2);
-}
-
-esp_err_t WebServer::contrarioHandler(httpd_req_t *req)
+// Movement, mode and servo commands
+esp_err_t WebServer::commandHandler(httpd_req_t *req)
 {
-  txdata[1] = Contrarotate;
-  Serial.write(txdata, 3);
-  Serial.println("Contrario");
+  const RobotCommand *command = (const RobotCommand *)req->user_ctx;
+  WebServer *server = (WebServer *)httpd_get_global_user_ctx(req->handle);
+  protocol::CommandFrame frame = protocol::encodeCommand(command->command);
+  // The pages add ?t= with the time they sent it, already on the car's clock
+  int64_t client_us = 0;
+  char query[32];
+  if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK)
+  {
+    client_us = parseGetVar(query, "t", 0) * 1000LL;
+  }
+  server->robotLink.send(&frame, sizeof(frame), client_us);
+  Serial.println(command->name);
   httpd_resp_set_type(req, "text/html");
   return httpd_resp_send(req, "OK", 2);
 }
@@ -328,65 +362,15 @@ esp_err_t WebServer::ledOffHandler(httpd_req_t *req)
   return httpd_resp_send(req, "OK", 2);
 }
 
-esp_err_t WebServer::model1Handler(httpd_req_t *req)
-{
-  txdata[1] = Moedl1;
-  Serial.write(txdata, 3);
-  Serial.println("Model1");
-  httpd_resp_set_type(req, "text/html");
-  return httpd_resp_send(req, "OK", 2);
-}
-
-esp_err_t WebServer::model2Handler(httpd_req_t *req)
-{
-  txdata[1] = Moedl2;
-  Serial.write(txdata, 3);
-  Serial.println("Model2");
-  httpd_resp_set_type(req, "text/html");
-  return httpd_resp_send(req, "OK", 2);
-}
-
-esp_err_t WebServer::model3Handler(httpd_req_t *req)
-{
-  txdata[1] = Moedl3;
-  Serial.write(txdata, 3);
-  Serial.println("Model3");
-  httpd_resp_set_type(req, "text/html");
-  return httpd_resp_send(req, "OK", 2);
-}
-
-esp_err_t WebServer::model4Handler(httpd_req_t *req)
-{
-  txdata[1] = Moedl4;
-  Serial.write(txdata, 3);
-  Serial.println("Model4");
-  httpd_resp_set_type(req, "text/html");
-  return httpd_resp_send(req, "OK", 2);
-}
-
-esp_err_t WebServer::motorLeftHandler(httpd_req_t *req)
-{
-  txdata[1] = MotorLeft;
-  Serial.write(txdata, 3);
-  Serial.println("MotorLeft");
-  httpd_resp_set_type(req, "text/html");
-  return httpd_resp_send(req, "OK", 2);
-}
-
-esp_err_t WebServer::motorRightHandler(httpd_req_t *req)
-{
-  txdata[1] = MotorRight;
-  Serial.write(txdata, 3);
-  Serial.println("MotorRight");
-  httpd_resp_set_type(req, "text/html");
-  return httpd_resp_send(req, "OK", 2);
-}
-
 // Camera control handlers
 esp_err_t WebServer::captureHandler(httpd_req_t *req)
 {
   WebServer *server = (WebServer *)req->user_ctx;
   Camera &camera = server->camera;
+  if (!camera.ready())
+  {
+    return sendCameraNotReady(req);
+  }
 
   camera_fb_t *fb = camera.capture();
   if (!fb)
@@ -395,6 +379,7 @@ esp_err_t WebServer::captureHandler(httpd_req_t *req)
     httpd_resp_send_500(req);
     return ESP_FAIL;
   }
+  server->reportFirstFrame();
 
   httpd_resp_set_type(req, "image/jpeg");
   httpd_resp_set_hdr(req, "Content-Disposition", "inline; filename=capture.jpg");
@@ -416,6 +401,10 @@ esp_err_t WebServer::cmdHandler(httpd_req_t *req)
   Camera &camera = server->camera;
   char *buf = nullptr;
 
+  if (!camera.ready())
+  {
+    return sendCameraNotReady(req);
+  }
   if (server->parseGet(req, &buf) != ESP_OK)
   {
     return ESP_FAIL;
@@ -448,6 +437,34 @@ esp_err_t WebServer::cmdHandler(httpd_req_t *req)
   {
     res = s->set_quality(s, val);
   }
+  else if (!strcmp(variable, "line_kp") || !strcmp(variable, "line_ki") ||
+           !strcmp(variable, "line_kd") || !strcmp(variable, "line_speed"))
+  {
+    // Line follower tuning is forwarded to the UNO as a parameter frame
+    uint8_t param = protocol::LineKp;
+    if (!strcmp(variable, "line_ki"))
+      param = protocol::LineKi;
+    else if (!strcmp(variable, "line_kd"))
+      param = protocol::LineKd;
+    else if (!strcmp(variable, "line_speed"))
+      param = protocol::LineSpeed;
+    protocol::ParameterFrame frame = protocol::encodeParameter(param, constrain(val, 0, 255));
+    server->robotLink.send(&frame, sizeof(frame));
+  }
+  else if (!strcmp(variable, "stream_suppress"))
+  {
+    // Hold back unchanged frames on the stream
+    suppressStatic = val != 0;
+  }
+  else if (!strcmp(variable, "profile"))
+  {
+    res = camera.applyProfile(val) ? 0 : -1;
+  }
+  else if (!strcmp(variable, "wifi_static"))
+  {
+    // Pin the current address so the next boot skips DHCP
+    res = server->wifiLink.pinAddress(val != 0) ? 0 : -1;
+  }
   // ... Add other camera settings as needed
 
   if (res)
@@ -461,12 +478,50 @@ esp_err_t WebServer::cmdHandler(httpd_req_t *req)
 
 esp_err_t WebServer::statusHandler(httpd_req_t *req)
 {
-  static char json_response[1024];
+  static char json_response[1536];
 
-  sensor_t *s = ((WebServer *)req->user_ctx)->camera.getSensor();
+  WebServer *server = (WebServer *)req->user_ctx;
+  if (!server->camera.ready())
+  {
+    return sendCameraNotReady(req);
+  }
+  sensor_t *s = server->camera.getSensor();
   char *p = json_response;
   *p++ = '{';
 
+  // Boot milestones in ms since reset, 0 when not reached yet
+  p += sprintf(p, "\"boot_wifi_ms\":%u,", BootTimeline::ms(bootTimeline.wifiStart));
+  p += sprintf(p, "\"boot_camera_ms\":%u,", BootTimeline::ms(bootTimeline.cameraReady));
+  p += sprintf(p, "\"boot_network_ms\":%u,", BootTimeline::ms(bootTimeline.networkUp));
+  p += sprintf(p, "\"boot_servers_ms\":%u,", BootTimeline::ms(bootTimeline.serversUp));
+  p += sprintf(p, "\"boot_first_frame_ms\":%u,", BootTimeline::ms(bootTimeline.firstFrame));
+  p += sprintf(p, "\"wifi_fast_connect\":%u,", server->wifiLink.fastConnect());
+
+  // Link outages since boot, times in ms
+  WiFiLink::Stats link = server->wifiLink.stats();
+  p += sprintf(p, "\"wifi_outages\":%u,", (unsigned)link.outages);
+  p += sprintf(p, "\"wifi_reconnects\":%u,", (unsigned)link.reconnects);
+  p += sprintf(p, "\"wifi_outage_total_ms\":%u,", (unsigned)link.outageTotalMs);
+  p += sprintf(p, "\"wifi_outage_last_ms\":%u,", (unsigned)link.outageLastMs);
+  p += sprintf(p, "\"wifi_outage_longest_ms\":%u,", (unsigned)link.outageLongestMs);
+  p += sprintf(p, "\"wifi_rssi\":%d,", WiFi.RSSI());
+
+  uint8_t profile = server->camera.profile();
+  p += sprintf(p, "\"capture_profile\":\"%s\",", Camera::Profiles[profile].name);
+  p += sprintf(p, "\"capture_fps\":%.1f,", server->camera.measuredFps(profile));
+
+  // Frames held back while the scene was static, the send time they saved is
+  // estimated from the average send time of the frames that went out
+  const StreamStats &stream = streamStats;
+  uint32_t send_us = stream.sent ? stream.sendUs / stream.sent : 0;
+  p += sprintf(p, "\"stream_static\":%u,", stream.staticScene);
+  p += sprintf(p, "\"stream_sent\":%u,", (unsigned)stream.sent);
+  p += sprintf(p, "\"stream_skipped\":%u,", (unsigned)stream.skipped);
+  p += sprintf(p, "\"stream_kb_sent\":%u,", (unsigned)(stream.bytesSent / 1024));
+  p += sprintf(p, "\"stream_kb_saved\":%u,", (unsigned)(stream.bytesSkipped / 1024));
+  p += sprintf(p, "\"stream_send_ms_saved\":%u,", (unsigned)(stream.skipped * (uint64_t)send_us / 1000));
+  p += sprintf(p, "\"stream_detect_us\":%u,", (unsigned)(stream.detected ? stream.detectUs / stream.detected : 0));
+
   p += sprintf(p, "\"framesize\":%u,", s->status.framesize);
   p += sprintf(p, "\"quality\":%u,", s->status.quality);
   p += sprintf(p, "\"brightness\":%d,", s->status.brightness);
@@ -499,614 +554,1286 @@ esp_err_t WebServer::statusHandler(httpd_req_t *req)
   return httpd_resp_send(req, json_response, strlen(json_response));
 }
 
-// Index page handler
-esp_err_t WebServer::indexHandler(httpd_req_t *req)
+esp_err_t WebServer::radarHandler(httpd_req_t *req)
 {
-  static const char PROGMEM INDEX_HTML[] = R"rawliteral(
-<!DOCTYPE html>
-<html>
-<head>
-  <title>ESP32-CAM Robot</title>
-  <meta name="viewport" content="width=device-width, initial-scale=1">
-  <style>
-    body { font-family: Arial; text-align: center; margin:0px auto; padding-top: 30px;}
-    table { margin-left: auto; margin-right: auto; }
-    td { padding: 8 px; }
-    .button {
-      background-color: lightgrey;
-      width: 90px;
-      height: 40px;
-      border: none;
-      color: black;
-      text-align: center;
-      text-decoration: none;
-      display: inline-block;
-      font-size: 16px;
-      margin: 2px;
-      cursor: pointer;
-      -webkit-touch-callout: none;
-      -webkit-user-select: none;
-      -khtml-user-select: none;
-      -moz-user-select: none;
-      -ms-user-select: none;
-      user-select: none;
-      -webkit-tap-highlight-color: rgba(0,0,0,0);
-    }
-    img {
-      width: auto;
-      max-width: 100%;
-      height: auto;
-      display: block;
-      margin: 20px auto;
-    }
-    .nav-link {
-      display: inline-block;
-      background-color: #4CAF50;
-      color: white;
-      padding: 10px 20px;
-      text-decoration: none;
-      border-radius: 5px;
-      margin: 10px;
-      font-weight: bold;
-    }
-    .video-container {
-      width: 100%;
-      max-width: 640px;
-      margin: 0 auto;
-      text-align: center;
-    }
-    .controls-container {
-      margin-top: 20px;
-      text-align: center;
-    }
-  </style>
-</head>
-<body>
-  <h1>ESP32-CAM Robot</h1>
-  <div class="video-container">
-    <a href="/gamepad" class="nav-link">Gamepad Controller</a>
-    <img src="" id="photo">
-  </div>
-  <div class="controls-container">
-    <p align=center>
-      <button class="button" onmousedown="toggleCheckbox('leftup');" onmouseup="toggleCheckbox('stop');" ontouchstart="toggleCheckbox('leftup');" ontouchend="toggleCheckbox('stop')"><b>LeftUp</b></button>&nbsp;
-      <button class="button" onmousedown="toggleCheckbox('go');" onmouseup="toggleCheckbox('stop');" ontouchstart="toggleCheckbox('go');" ontouchend="toggleCheckbox('stop')"><b>Forward</b></button>&nbsp;
-      <button class="button" onmousedown="toggleCheckbox('rightup');" onmouseup="toggleCheckbox('stop');" ontouchstart="toggleCheckbox('rightup');" ontouchend="toggleCheckbox('stop')"><b>RightUp</b></button>
-    </p>
-    <p align=center>
-      <button class="button" onmousedown="toggleCheckbox('left');" onmouseup="toggleCheckbox('stop');" ontouchstart="toggleCheckbox('left');" ontouchend="toggleCheckbox('stop')"><b>Left</b></button>&nbsp;
-      <button style="background-color:indianred" class="button" onmousedown="toggleCheckbox('stop');" onmouseup="toggleCheckbox('stop');" ontouchstart="toggleCheckbox('stop');" ontouchend="toggleCheckbox('stop')"><b>Stop</b></button>&nbsp;
-      <button class="button" onmousedown="toggleCheckbox('right');" onmouseup="toggleCheckbox('stop');" ontouchstart="toggleCheckbox('right');" ontouchend="toggleCheckbox('stop')"><b>Right</b></button>
-    </p>
-    <p align=center>
-      <button class="button" onmousedown="toggleCheckbox('leftdown');" onmouseup="toggleCheckbox('stop');" ontouchstart="toggleCheckbox('leftdown');" ontouchend="toggleCheckbox('stop')"><b>LeftDown</b></button>&nbsp;
-      <button class="button" onmousedown="toggleCheckbox('back');" onmouseup="toggleCheckbox('stop');" ontouchstart="toggleCheckbox('back');" ontouchend="toggleCheckbox('stop')"><b>Backward</b></button>&nbsp;
-      <button class="button" onmousedown="toggleCheckbox('rightdown');" onmouseup="toggleCheckbox('stop');" ontouchstart="toggleCheckbox('rightdown');" ontouchend="toggleCheckbox('stop')"><b>RightDown</b></button>
-    </p>
-    <p align=center>
-      <button class="button" onmousedown="toggleCheckbox('clockwise');" onmouseup="toggleCheckbox('stop');" ontouchstart="toggleCheckbox('clockwise');" ontouchend="toggleCheckbox('stop')"><b>Clockwise</b></button>&nbsp;
-      <button class="button" onmousedown="toggleCheckbox('contrario');" onmouseup="toggleCheckbox('stop');" ontouchstart="toggleCheckbox('contrario');" ontouchend="toggleCheckbox('stop')"><b>Contrario</b></button>
-    </p>
-    <p align=center>
-      <button class="button" onmousedown="toggleCheckbox('model1');" onmouseup="toggleCheckbox('model1');" ontouchstart="toggleCheckbox('model1');" ontouchend="toggleCheckbox('model1')"><b>Model1</b></button>&nbsp;
-      <button class="button" onmousedown="toggleCheckbox('model2');" onmouseup="toggleCheckbox('model2');" ontouchstart="toggleCheckbox('model2');" ontouchend="toggleCheckbox('model2')"><b>Model2</b></button>
-    </p>
-    <p align=center>
-      <button class="button" onmousedown="toggleCheckbox('model3');" onmouseup="toggleCheckbox('model3');" ontouchstart="toggleCheckbox('model3');" ontouchend="toggleCheckbox('model3')"><b>Model3</b></button>&nbsp;
-      <button class="button" onmousedown="toggleCheckbox('model4');" onmouseup="toggleCheckbox('model4');" ontouchstart="toggleCheckbox('model4');" ontouchend="toggleCheckbox('model4')"><b>Model4</b></button>
-    </p>
-    <p align=center>
-      <button class="button" onmousedown="toggleCheckbox('motorleft');" onmouseup="toggleCheckbox('stop');" ontouchstart="toggleCheckbox('motorleft');" ontouchend="toggleCheckbox('stop')"><b>MotorLeft</b></button>&nbsp;
-      <button class="button" onmousedown="toggleCheckbox('motorright');" onmouseup="toggleCheckbox('stop');" ontouchstart="toggleCheckbox('motorright');" ontouchend="toggleCheckbox('stop')"><b>MotorRight</b></button>
-    </p>
-    <p align=center>
-      <button style="background-color:yellow" class="button" onmousedown="toggleCheckbox('ledon')"><b>Light ON</b></button>&nbsp;
-      <button style="background-color:indianred" class="button" onmousedown="toggleCheckbox('stop');" onmouseup="toggleCheckbox('stop');" ontouchstart="toggleCheckbox('stop');" ontouchend="toggleCheckbox('stop')"><b>Stop</b></button>&nbsp;
-      <button style="background-color:yellow" class="button" onmousedown="toggleCheckbox('ledoff')"><b>Light OFF</b></button>
-    </p>
-  </div>
-  <script>
-    // Global functions for button handlers
-    function toggleCheckbox(command) {
-      fetch('/' + command)
-        .then(response => {
-          if (!response.ok) {
-            throw new Error('Network response was not ok');
-          }
-          return response.text();
-        })
-        .catch(error => {
-          console.error('Error:', error);
-        });
-    }
+  static char json_response[512];
 
-    function toggleFullscreen() {
-      const videoContainer = document.querySelector('.video-container');
-      if (!document.fullscreenElement) {
-        videoContainer.requestFullscreen().catch(err => {
-          console.error(`Error attempting to enable fullscreen: ${err.message}`);
-        });
-      } else {
-        document.exitFullscreen();
-      }
-    }
-
-    // Initialize everything when the page loads
-    window.addEventListener('DOMContentLoaded', function() {
-      // Camera stream
-      const photo = document.getElementById('photo');
-      photo.src = 'http://' + window.location.hostname + ':81/stream';
-
-      // Gamepad state
-      let gamepad = null;
-      let buttonElements = [];
-      let buttonStates = [];
-      let debugContent = document.getElementById('debug-content');
-      let lastTimestamp = 0;
-      let pollCount = 0;
-      let lastPollTime = 0;
-      let animationFrameId = null;
-
-      // DOM elements
-      const statusElement = document.getElementById('status');
-      const controllerNameElement = document.getElementById('controller-name');
-      const controllerIdElement = document.getElementById('controller-id');
-      const controllerTimestampElement = document.getElementById('controller-timestamp');
-      const controllerMappingElement = document.getElementById('controller-mapping');
-      const controllerConnectedElement = document.getElementById('controller-connected');
-      const controllerButtonsCountElement = document.getElementById('controller-buttons-count');
-      const controllerAxesCountElement = document.getElementById('controller-axes-count');
-      const buttonGridElement = document.getElementById('button-grid');
-      const leftStickElement = document.getElementById('left-stick');
-      const rightStickElement = document.getElementById('right-stick');
-      const leftXElement = document.getElementById('left-x');
-      const leftYElement = document.getElementById('left-y');
-      const rightXElement = document.getElementById('right-x');
-      const rightYElement = document.getElementById('right-y');
-
-      // Button names for PS5 DualSense with mapped actions
-      const buttonNames = [
-        'Cross', 'Circle', 'Square', 'Triangle',
-        'L1', 'R1', 'L2', 'R2',
-        'Share', 'Options', 'L3', 'R3',
-        'Up', 'Down', 'Left', 'Right',
-        'PS', 'Touch Pad'
-      ];
-
-      // Button mapping for robot controls
-      const buttonMappings = {
-        'Up': 'go',           // Up
-        'Down': 'back',       // Down
-        'Left': 'left',       // Left
-        'Right': 'right',     // Right
-        'L1': 'motorleft',    // L1 for MotorLeft
-        'R1': 'motorright',   // R1 for MotorRight
-        'Cross': 'model1',    // Cross for Model1
-        'Square': 'model2',   // Square for Model2
-        'Triangle': 'model3', // Triangle for Model3
-        'Circle': 'model4',   // Circle for Model4
-        'R3': 'ledtoggle',    // R3 for LED toggle
-        'Touch Pad': 'stop'   // Touch Pad for Stop
-      };
-
-      // Threshold for analog stick movement
-      const STICK_THRESHOLD = 0.3;
-
-      // Current movement state
-      let currentMovement = 'stop';
-      let currentRotation = 'stop';
-      let ledState = false;
-
-      // Log debug information
-      function logDebug(message) {
-        const timestamp = new Date().toISOString().split('T')[1].split('.')[0];
-        const logLine = document.createElement('div');
-        logLine.textContent = `[${timestamp}] ${message}`;
-        debugContent.appendChild(logLine);
-        debugContent.scrollTop = debugContent.scrollHeight;
-      }
-
-      // Initialize button grid
-      function initButtonGrid() {
-        try {
-          buttonGridElement.innerHTML = '';
-          buttonElements = [];
-          buttonStates = [];
-
-          // Initialize with a minimum set of buttons
-          const initialButtonCount = 20; // Set higher than expected button count
-
-          for (let i = 0; i < initialButtonCount; i++) {
-            const buttonDiv = document.createElement('div');
-            buttonDiv.className = 'button';
-            buttonDiv.id = `button-${i}`;
-            buttonDiv.textContent = buttonNames[i] || `Button ${i}`;
-
-            // Add visual indicator for mapped buttons
-            const buttonName = buttonNames[i] || `Button ${i}`;
-            if (buttonMappings[buttonName]) {
-              buttonDiv.style.backgroundColor = '#4CAF50';
-              buttonDiv.style.color = 'white';
-            }
-
-            buttonGridElement.appendChild(buttonDiv);
-            buttonElements.push(buttonDiv);
-            buttonStates.push(false);
-          }
-
-          logDebug(`Initialized button grid with ${initialButtonCount} buttons`);
-        } catch (error) {
-          logDebug(`Error initializing button grid: ${error.message}`);
-        }
-      }
-
-      // Function to send commands to the robot
-      function sendCommand(command) {
-        fetch(`/${command}`)
-          .then(response => {
-            if (!response.ok) {
-              throw new Error(`HTTP error! status: ${response.status}`);
-            }
-            return response.text();
-          })
-          .then(text => {
-            logDebug(`Command ${command} sent successfully`);
-          })
-          .catch(error => {
-            logDebug(`Error sending command ${command}: ${error.message}`);
-          });
-      }
-
-      // Update button states
-      function updateButtons(buttons) {
-        if (!buttons || buttons.length === 0) {
-          return;
-        }
-
-        try {
-          for (let i = 0; i < buttons.length; i++) {
-            const buttonElement = buttonElements[i];
-            if (!buttonElement) {
-              // If we don't have an element for this button index, create one
-              const buttonDiv = document.createElement('div');
-              buttonDiv.className = 'button';
-              buttonDiv.id = `button-${i}`;
-              buttonDiv.textContent = buttonNames[i] || `Button ${i}`;
-
-              // Add visual indicator for mapped buttons
-              const buttonName = buttonNames[i] || `Button ${i}`;
-              if (buttonMappings[buttonName]) {
-                buttonDiv.style.backgroundColor = '#4CAF50';
-                buttonDiv.style.color = 'white';
-              }
-
-              buttonGridElement.appendChild(buttonDiv);
-              buttonElements[i] = buttonDiv;
-              buttonStates[i] = false;
-              logDebug(`Created new button element for index ${i}`);
-            }
-
-            const isPressed = buttons[i].pressed || buttons[i].value > 0.5;
-            if (isPressed !== buttonStates[i]) {
-              buttonStates[i] = isPressed;
-              const buttonName = buttonNames[i] || `Button ${i}`;
-
-              // Update button appearance
-              if (buttonMappings[buttonName]) {
-                // Mapped buttons use a different color scheme
-                buttonElement.style.backgroundColor = isPressed ? '#45a049' : '#4CAF50';
-                buttonElement.style.color = 'white';
-              } else {
-                // Regular buttons use the default color scheme
-                buttonElement.classList.toggle('pressed', isPressed);
-              }
-
-              // Log button state
-              logDebug(`Button ${i} (${buttonName}): ${isPressed ? 'Pressed' : 'Released'}`);
-
-              // Handle mapped buttons
-              if (buttonMappings[buttonName]) {
-                // Special handling for L1/R1 - stop when released
-                if ((buttonName === 'L1' || buttonName === 'R1') && !isPressed) {
-                  logDebug(`Sending command: stop (${buttonName} released)`);
-                  sendCommand('stop');
-                }
-                // Special handling for directional buttons - stop when released
-                else if ((buttonName === 'Up' || buttonName === 'Down' ||
-                         buttonName === 'Left' || buttonName === 'Right') && !isPressed) {
-                  logDebug(`Sending command: stop (${buttonName} released)`);
-                  sendCommand('stop');
-                }
-                // Special handling for R3 - toggle LED
-                else if (buttonName === 'R3' && isPressed) {
-                  ledState = !ledState;
-                  const command = ledState ? 'ledon' : 'ledoff';
-                  logDebug(`Sending command: ${command} (LED ${ledState ? 'ON' : 'OFF'})`);
-                  sendCommand(command);
-                }
-                // Handle other buttons
-                else if (isPressed) {
-                  // Send command to robot
-                  const command = buttonMappings[buttonName];
-                  logDebug(`Sending command: ${command}`);
-                  sendCommand(command);
-                }
-              }
-
-              // Special handling for L2/R2 triggers
-              if ((buttonName.includes('L2') || buttonName.includes('R2')) && buttons[i].value) {
-                const value = buttons[i].value;
-                logDebug(`${buttonName} pressure: ${(value * 100).toFixed(0)}%`);
-              }
-            }
-          }
-        } catch (error) {
-          logDebug(`Error updating buttons: ${error.message}`);
-        }
-      }
-
-      // Update analog sticks
-      function updateAnalogSticks(axes) {
-        if (!axes || axes.length === 0) {
-          return;
-        }
-
-        // Left stick (axes 0 and 1) - 8-directional movement
-        if (axes.length >= 2) {
-          const leftX = axes[0];
-          const leftY = axes[1];
-
-          leftStickElement.style.transform = `translate(calc(-50% + ${leftX * 50}px), calc(-50% + ${leftY * 50}px))`;
-          leftXElement.textContent = leftX.toFixed(2);
-          leftYElement.textContent = leftY.toFixed(2);
-
-          // Determine movement direction based on stick position
-          let newMovement = 'stop';
-
-          if (Math.abs(leftX) > STICK_THRESHOLD || Math.abs(leftY) > STICK_THRESHOLD) {
-            // Calculate angle in degrees (0 is right, 90 is down, 180 is left, 270 is up)
-            const angle = Math.atan2(leftY, leftX) * (180 / Math.PI);
-
-            // Map angle to 8 directions
-            if (angle >= -22.5 && angle < 22.5) {
-              newMovement = 'right';
-            } else if (angle >= 22.5 && angle < 67.5) {
-              newMovement = 'rightdown';
-            } else if (angle >= 67.5 && angle < 112.5) {
-              newMovement = 'back';
-            } else if (angle >= 112.5 && angle < 157.5) {
-              newMovement = 'leftdown';
-            } else if (angle >= 157.5 || angle < -157.5) {
-              newMovement = 'left';
-            } else if (angle >= -157.5 && angle < -112.5) {
-              newMovement = 'leftup';
-            } else if (angle >= -112.5 && angle < -67.5) {
-              newMovement = 'go';
-            } else if (angle >= -67.5 && angle < -22.5) {
-              newMovement = 'rightup';
-            }
-          }
+  RobotLink &link = ((WebServer *)req->user_ctx)->robotLink;
+  uint32_t now = millis();
+  char *p = json_response;
 
-          // Only send command if movement has changed
-          if (newMovement !== currentMovement) {
-            currentMovement = newMovement;
-            logDebug(`Left stick movement: ${currentMovement}`);
-            sendCommand(currentMovement);
-          }
-        }
+  p += sprintf(p, "{\"start\":%u,\"step\":%u,\"dist\":[", protocol::RadarFirstAngle, protocol::RadarSectorWidth);
+  for (uint8_t i = 0; i < protocol::RadarSectors; i++)
+  {
+    p += sprintf(p, i ? ",%u" : "%u", link.radarDistance(i));
+  }
+  p += sprintf(p, "],\"age\":[");
+  for (uint8_t i = 0; i < protocol::RadarSectors; i++)
+  {
+    uint32_t ts = link.radarTimestamp(i);
+    p += sprintf(p, i ? ",%ld" : "%ld", ts ? (long)(now - ts) : -1L);
+  }
+  p += sprintf(p, "]}");
 
-        // Right stick (axes 2 and 3) - Rotation control
-        if (axes.length >= 4) {
-          const rightX = axes[2];
-          const rightY = axes[3];
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  return httpd_resp_send(req, json_response, p - json_response);
+}
 
-          rightStickElement.style.transform = `translate(calc(-50% + ${rightX * 50}px), calc(-50% + ${rightY * 50}px))`;
-          rightXElement.textContent = rightX.toFixed(2);
-          rightYElement.textContent = rightY.toFixed(2);
+// Asks the UNO for its loop profile and returns the report it prints, 504
+// when none comes back, e.g. from a build without LOOP_PROFILER
+esp_err_t WebServer::profileHandler(httpd_req_t *req)
+{
+  static const uint32_t Profile_Timeout_Ms = 500;
+  static char report[RobotLink::Profile_Report_Size];
 
-          // Determine rotation based on right stick X axis
-          let newRotation = 'stop';
+  RobotLink &link = ((WebServer *)req->user_ctx)->robotLink;
+  uint32_t seq = link.profileSeq();
+  protocol::CommandFrame frame = protocol::encodeCommand(protocol::ProfileQuery);
+  link.send(&frame, sizeof(frame));
 
-          if (Math.abs(rightX) > STICK_THRESHOLD) {
-            if (rightX > 0) {
-              newRotation = 'clockwise';
-            } else {
-              newRotation = 'contrario';
-            }
-          }
+  size_t len = 0;
+  uint32_t latest = seq;
+  for (uint32_t waited = 0; latest == seq && waited < Profile_Timeout_Ms; waited += RobotLink::Poll_Ms)
+  {
+    vTaskDelay(pdMS_TO_TICKS(RobotLink::Poll_Ms));
+    len = link.profileReport(report, sizeof(report), latest);
+  }
 
-          // Only send command if rotation has changed
-          if (newRotation !== currentRotation) {
-            currentRotation = newRotation;
-            logDebug(`Right stick rotation: ${currentRotation}`);
-            sendCommand(currentRotation);
-          }
-        }
-      }
+  httpd_resp_set_type(req, "text/plain");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  if (latest == seq)
+  {
+    httpd_resp_set_status(req, "504 Gateway Timeout");
+    return httpd_resp_send(req, "No profile report from the UNO", HTTPD_RESP_USE_STRLEN);
+  }
+  return httpd_resp_send(req, report, len);
+}
 
-      // Update controller info
-      function updateControllerInfo() {
-        if (gamepad) {
-          controllerNameElement.textContent = gamepad.id;
-          controllerIdElement.textContent = `ID: ${gamepad.index}`;
-          controllerTimestampElement.textContent = `Timestamp: ${gamepad.timestamp}`;
-          controllerMappingElement.textContent = `Mapping: ${gamepad.mapping || 'standard'}`;
-          controllerConnectedElement.textContent = `Connected: ${gamepad.connected ? 'Yes' : 'No'}`;
-          controllerButtonsCountElement.textContent = `Buttons: ${gamepad.buttons.length}`;
-          controllerAxesCountElement.textContent = `Axes: ${gamepad.axes.length}`;
-        }
-      }
+// Trace samples from the UNO as CSV, /trace?clear=1 empties the buffer afterwards
+esp_err_t WebServer::traceHandler(httpd_req_t *req)
+{
+  static char chunk[1024];
+
+  RobotLink &link = ((WebServer *)req->user_ctx)->robotLink;
+  bool clear = false;
+  char query[32];
+  char value[8];
+  if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+      httpd_query_key_value(query, "clear", value, sizeof(value)) == ESP_OK)
+  {
+    clear = atoi(value) != 0;
+  }
 
-      // Game loop
-      function gameLoop() {
-        try {
-          // Get the latest gamepad state directly
-          const gamepads = navigator.getGamepads();
-          const currentGamepad = gamepads[0]; // Focus on first gamepad
-
-          if (currentGamepad) {
-            if (!gamepad || gamepad.index !== currentGamepad.index) {
-              logDebug(`New gamepad detected: ${currentGamepad.id}`);
-              logDebug(`Number of buttons: ${currentGamepad.buttons.length}`);
-              logDebug(`Number of axes: ${currentGamepad.axes.length}`);
-              logDebug('Button mappings:');
-              Object.entries(buttonMappings).forEach(([button, command]) => {
-                logDebug(`${button} -> ${command}`);
-              });
-              gamepad = currentGamepad;
-              updateControllerInfo();
-            }
-
-            // Always update the reference
-            gamepad = currentGamepad;
-
-            // Update UI
-            updateButtons(gamepad.buttons);
-            updateAnalogSticks(gamepad.axes);
-
-            // Log polling every 100 frames
-            pollCount++;
-            if (pollCount % 100 === 0) {
-              logDebug(`Still polling (count: ${pollCount}), Gamepad connected: ${gamepad.connected}`);
-            }
-
-            statusElement.textContent = `Controller: Connected (${gamepad.id})`;
-            statusElement.className = 'status connected';
-          } else if (gamepad) {
-            logDebug('Gamepad disconnected');
-            gamepad = null;
-            statusElement.textContent = 'Controller: Disconnected';
-            statusElement.className = 'status disconnected';
-          }
-        } catch (error) {
-          logDebug(`Error in gameLoop: ${error.message}`);
-        }
+  httpd_resp_set_type(req, "text/csv");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
 
-        // Request next frame
-        animationFrameId = requestAnimationFrame(gameLoop);
+  size_t len = sprintf(chunk, "time_ms,kind,a,b,c\n");
+  size_t count = link.traceCount();
+  TraceSample sample;
+  for (size_t i = 0; i < count && link.traceSample(i, sample); i++)
+  {
+    len += sprintf(chunk + len, "%u,%s,%u,%u,%u\n", (unsigned)sample.time, protocol::traceKindName(sample.kind),
+                   sample.value[0], sample.value[1], sample.value[2]);
+    // A line is well under 64 bytes
+    if (len > sizeof(chunk) - 64)
+    {
+      if (httpd_resp_send_chunk(req, chunk, len) != ESP_OK)
+      {
+        return ESP_FAIL;
       }
+      len = 0;
+    }
+  }
+  if (len > 0 && httpd_resp_send_chunk(req, chunk, len) != ESP_OK)
+  {
+    return ESP_FAIL;
+  }
 
-      // Add a legend for mapped buttons
-      function addButtonLegend() {
-        const legendDiv = document.createElement('div');
-        legendDiv.style.marginTop = '20px';
-        legendDiv.style.padding = '10px';
-        legendDiv.style.backgroundColor = '#f8f9fa';
-        legendDiv.style.borderRadius = '5px';
-
-        const legendTitle = document.createElement('h3');
-        legendTitle.textContent = 'Controller Mappings';
-        legendDiv.appendChild(legendTitle);
-
-        const mappingsList = document.createElement('ul');
-        mappingsList.style.listStyle = 'none';
-        mappingsList.style.padding = '0';
-
-        // Add button mappings
-        const buttonMappingsTitle = document.createElement('h4');
-        buttonMappingsTitle.textContent = 'Button Mappings';
-        mappingsList.appendChild(buttonMappingsTitle);
-
-        Object.entries(buttonMappings).forEach(([button, command]) => {
-          const listItem = document.createElement('li');
-          listItem.style.margin = '5px 0';
-          listItem.textContent = `${button} -> ${command}`;
-          mappingsList.appendChild(listItem);
-        });
-
-        // Add analog stick mappings
-        const stickMappingsTitle = document.createElement('h4');
-        stickMappingsTitle.textContent = 'Analog Stick Mappings';
-        stickMappingsTitle.style.marginTop = '15px';
-        mappingsList.appendChild(stickMappingsTitle);
-
-        const leftStickItem = document.createElement('li');
-        leftStickItem.style.margin = '5px 0';
-        leftStickItem.textContent = 'Left Stick -> 8-directional movement (Forward, Backward, Left, Right, and diagonals)';
-        mappingsList.appendChild(leftStickItem);
-
-        const rightStickItem = document.createElement('li');
-        rightStickItem.style.margin = '5px 0';
-        rightStickItem.textContent = 'Right Stick -> Rotation (Left = Counterclockwise, Right = Clockwise)';
-        mappingsList.appendChild(rightStickItem);
-
-        legendDiv.appendChild(mappingsList);
-        document.querySelector('.container').insertBefore(legendDiv, document.querySelector('.debug-info'));
-      }
+  if (clear)
+  {
+    link.clearTrace();
+  }
+  return httpd_resp_send_chunk(req, NULL, 0);
+}
 
-      // Event listeners
-      window.addEventListener('gamepadconnected', (e) => {
-        logDebug(`Gamepad connected event: ${e.gamepad.id} (index: ${e.gamepad.index})`);
-        logDebug(`Mapping: ${e.gamepad.mapping}`);
-        logDebug(`Buttons: ${e.gamepad.buttons.length}, Axes: ${e.gamepad.axes.length}`);
-
-        // Start polling immediately
-        gamepad = e.gamepad;
-        lastTimestamp = e.gamepad.timestamp;
-        statusElement.textContent = `Controller: Connected (${e.gamepad.id})`;
-        statusElement.className = 'status connected';
-
-        // Force an immediate update
-        updateControllerInfo();
-        updateButtons(gamepad.buttons);
-        updateAnalogSticks(gamepad.axes);
-      });
-
-      window.addEventListener('gamepaddisconnected', (e) => {
-        logDebug(`Gamepad disconnected event: ${e.gamepad.id} (index: ${e.gamepad.index})`);
-        if (gamepad && gamepad.index === e.gamepad.index) {
-          gamepad = null;
-          statusElement.textContent = 'Controller: Disconnected';
-          statusElement.className = 'status disconnected';
-        }
-      });
+// Capture profiles as JSON, /camprofile?name=low-latency switches and keeps
+// the choice across reboots
+esp_err_t WebServer::captureProfileHandler(httpd_req_t *req)
+{
+  static char json_response[512];
 
-      // Clean up on page unload
-      window.addEventListener('beforeunload', () => {
-        logDebug('Page unloading - cleaning up');
-        if (animationFrameId) {
-          cancelAnimationFrame(animationFrameId);
-        }
-      });
+  Camera &camera = ((WebServer *)req->user_ctx)->camera;
+  if (!camera.ready())
+  {
+    return sendCameraNotReady(req);
+  }
 
-      // Initialize
-      logDebug('Initializing gamepad controller page');
-      initButtonGrid();
-      addButtonLegend();
+  char query[48];
+  char name[24];
+  if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+      httpd_query_key_value(query, "name", name, sizeof(name)) == ESP_OK)
+  {
+    int id = Camera::profileByName(name);
+    if (id < 0)
+    {
+      httpd_resp_send_404(req);
+      return ESP_FAIL;
+    }
+    camera.applyProfile(id);
+  }
 
-      // Start the game loop
-      gameLoop();
-    });
-  </script>
-</body>
-</html>
-)rawliteral";
+  char *p = json_response;
+  p += sprintf(p, "{\"active\":\"%s\",\"profiles\":[", Camera::Profiles[camera.profile()].name);
+  for (uint8_t i = 0; i < Profile_Count; i++)
+  {
+    const CaptureProfile &profile = Camera::Profiles[i];
+    p += sprintf(p, "%s{\"name\":\"%s\",\"framesize\":%u,\"quality\":%d,\"xclk\":%d,\"fixed_exposure\":%d,\"fps\":%.1f}",
+                 i ? "," : "", profile.name, profile.framesize, profile.quality, profile.xclkMhz,
+                 profile.fixedExposure, camera.measuredFps(i));
+  }
+  p += sprintf(p, "]}");
 
-  httpd_resp_set_type(req, "text/html");
-  return httpd_resp_send(req, INDEX_HTML, strlen(INDEX_HTML));
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  return httpd_resp_send(req, json_response, p - json_response);
 }
 
-// Stream handler implementation
-esp_err_t WebServer::streamHandler(httpd_req_t *req)
+// Raw sensor access, the parameters follow the sensor driver calls
+esp_err_t WebServer::xclkHandler(httpd_req_t *req)
 {
   WebServer *server = (WebServer *)req->user_ctx;
-  Camera &camera = server->camera;
-  struct timeval _timestamp;
-  esp_err_t res = ESP_OK;
-  size_t _jpg_buf_len = 0;
-  uint8_t *_jpg_buf = NULL;
-  char *part_buf[128];
-
-  static int64_t last_frame = 0;
-  if (!last_frame)
+  char *buf = nullptr;
+  if (!server->camera.ready())
   {
-    last_frame = esp_timer_get_time();
+    return sendCameraNotReady(req);
   }
-
-  res = httpd_resp_set_type(req, _STREAM_CONTENT_TYPE);
-  if (res != ESP_OK)
+  if (parseGet(req, &buf) != ESP_OK)
   {
-    return res;
+    return ESP_FAIL;
+  }
+  int xclk = parseGetVar(buf, "xclk", 20);
+  free(buf);
+
+  Serial.printf("Set XCLK: %d MHz\n", xclk);
+  if (server->camera.setXclk(xclk))
+  {
+    return httpd_resp_send_500(req);
+  }
+
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  return httpd_resp_send(req, NULL, 0);
+}
+
+esp_err_t WebServer::regHandler(httpd_req_t *req)
+{
+  WebServer *server = (WebServer *)req->user_ctx;
+  char *buf = nullptr;
+  if (!server->camera.ready())
+  {
+    return sendCameraNotReady(req);
+  }
+  if (parseGet(req, &buf) != ESP_OK)
+  {
+    return ESP_FAIL;
+  }
+  int reg = parseGetVar(buf, "reg", -1);
+  int mask = parseGetVar(buf, "mask", 0xFF);
+  int val = parseGetVar(buf, "val", -1);
+  free(buf);
+  if (reg < 0 || val < 0)
+  {
+    return httpd_resp_send_404(req);
+  }
+
+  Serial.printf("Set Register: reg 0x%02x, mask 0x%02x, value 0x%02x\n", reg, mask, val);
+  if (server->camera.setReg(reg, mask, val))
+  {
+    return httpd_resp_send_500(req);
+  }
+
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  return httpd_resp_send(req, NULL, 0);
+}
+
+esp_err_t WebServer::gregHandler(httpd_req_t *req)
+{
+  WebServer *server = (WebServer *)req->user_ctx;
+  char *buf = nullptr;
+  if (!server->camera.ready())
+  {
+    return sendCameraNotReady(req);
+  }
+  if (parseGet(req, &buf) != ESP_OK)
+  {
+    return ESP_FAIL;
+  }
+  int reg = parseGetVar(buf, "reg", -1);
+  int mask = parseGetVar(buf, "mask", 0xFF);
+  free(buf);
+  if (reg < 0)
+  {
+    return httpd_resp_send_404(req);
+  }
+
+  int res = server->camera.getReg(reg, mask);
+  if (res < 0)
+  {
+    return httpd_resp_send_500(req);
+  }
+
+  char value[16];
+  int len = snprintf(value, sizeof(value), "%d", res);
+  httpd_resp_set_type(req, "text/plain");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  return httpd_resp_send(req, value, len);
+}
+
+esp_err_t WebServer::pllHandler(httpd_req_t *req)
+{
+  WebServer *server = (WebServer *)req->user_ctx;
+  char *buf = nullptr;
+  if (!server->camera.ready())
+  {
+    return sendCameraNotReady(req);
+  }
+  if (parseGet(req, &buf) != ESP_OK)
+  {
+    return ESP_FAIL;
+  }
+  int bypass = parseGetVar(buf, "bypass", 0);
+  int mul = parseGetVar(buf, "mul", 0);
+  int sys = parseGetVar(buf, "sys", 0);
+  int root = parseGetVar(buf, "root", 0);
+  int pre = parseGetVar(buf, "pre", 0);
+  int seld5 = parseGetVar(buf, "seld5", 0);
+  int pclken = parseGetVar(buf, "pclken", 0);
+  int pclk = parseGetVar(buf, "pclk", 0);
+  free(buf);
+
+  Serial.printf("Set Pll: bypass %d, mul %d, sys %d, root %d, pre %d, seld5 %d, pclken %d, pclk %d\n", bypass, mul,
+                sys, root, pre, seld5, pclken, pclk);
+  if (server->camera.setPLL(bypass, mul, sys, root, pre, seld5, pclken, pclk))
+  {
+    return httpd_resp_send_500(req);
+  }
+
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  return httpd_resp_send(req, NULL, 0);
+}
+
+esp_err_t WebServer::winHandler(httpd_req_t *req)
+{
+  WebServer *server = (WebServer *)req->user_ctx;
+  char *buf = nullptr;
+  if (!server->camera.ready())
+  {
+    return sendCameraNotReady(req);
+  }
+  if (parseGet(req, &buf) != ESP_OK)
+  {
+    return ESP_FAIL;
+  }
+  int startX = parseGetVar(buf, "sx", 0);
+  int startY = parseGetVar(buf, "sy", 0);
+  int endX = parseGetVar(buf, "ex", 0);
+  int endY = parseGetVar(buf, "ey", 0);
+  int offsetX = parseGetVar(buf, "offx", 0);
+  int offsetY = parseGetVar(buf, "offy", 0);
+  int totalX = parseGetVar(buf, "tx", 0);
+  int totalY = parseGetVar(buf, "ty", 0);
+  int outputX = parseGetVar(buf, "ox", 0);
+  int outputY = parseGetVar(buf, "oy", 0);
+  bool scale = parseGetVar(buf, "scale", 0) == 1;
+  bool binning = parseGetVar(buf, "binning", 0) == 1;
+  free(buf);
+  if (!Camera::fitsFrameBuffers(outputX, outputY))
+  {
+    return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "ox, oy up to 640x480");
+  }
+
+  Serial.printf("Set Window: Start: %d %d, End: %d %d, Offset: %d %d, Total: %d %d, Output: %d %d, Scale: %u, "
+                "Binning: %u\n",
+                startX, startY, endX, endY, offsetX, offsetY, totalX, totalY, outputX, outputY, scale, binning);
+  if (server->camera.setResRaw(startX, startY, endX, endY, offsetX, offsetY, totalX, totalY, outputX, outputY, scale,
+                               binning))
+  {
+    return httpd_resp_send_500(req);
+  }
+
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  return httpd_resp_send(req, NULL, 0);
+}
+
+// Region of interest streaming. /roi?x=600&y=400&w=400&h=300&fs=5 streams that
+// part of the sensor at QVGA, /roi?clear=1 returns to the full field. The
+// reply describes the current window in full resolution sensor pixels.
+esp_err_t WebServer::roiHandler(httpd_req_t *req)
+{
+  static char json_response[192];
+
+  Camera &camera = ((WebServer *)req->user_ctx)->camera;
+  if (!camera.ready())
+  {
+    return sendCameraNotReady(req);
+  }
+
+  char query[96];
+  if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK)
+  {
+    if (parseGetVar(query, "clear", 0))
+    {
+      camera.clearWindow();
+    }
+    else
+    {
+      int w = parseGetVar(query, "w", 0);
+      int h = parseGetVar(query, "h", 0);
+      int fs = parseGetVar(query, "fs", FRAMESIZE_QVGA);
+      if (w <= 0 || h <= 0 || fs < 0 ||
+          !camera.setWindow(parseGetVar(query, "x", 0), parseGetVar(query, "y", 0), w, h, (framesize_t)fs))
+      {
+        return httpd_resp_send_500(req);
+      }
+    }
+  }
+
+  CameraWindow roi = camera.window();
+  int len = snprintf(json_response, sizeof(json_response),
+                     "{\"active\":%u,\"x\":%d,\"y\":%d,\"w\":%d,\"h\":%d,\"framesize\":%u,"
+                     "\"sensor_width\":%d,\"sensor_height\":%d}",
+                     roi.active, roi.x, roi.y, roi.width, roi.height, roi.output, Camera::Sensor_Width,
+                     Camera::Sensor_Height);
+
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  return httpd_resp_send(req, json_response, len);
+}
+
+// Analytics tap counters: frames offered by capture(), copied, held back
+// while the last one was still decoding, and the cost of copy and decode.
+esp_err_t WebServer::tapHandler(httpd_req_t *req)
+{
+  static char json_response[384];
+
+  AnalyticsTap &tap = ((WebServer *)req->user_ctx)->analyticsTap;
+  AnalyticsTap::Stats s = tap.stats();
+  AnalyticsTap::Thumbnail thumb = {};
+  if (tap.acquire(0, thumb))
+  {
+    tap.release();
+  }
+  int len = snprintf(json_response, sizeof(json_response),
+                     "{\"consumers\":%u,\"offered\":%u,\"copied\":%u,\"busy\":%u,\"too_large\":%u,"
+                     "\"own_captures\":%u,\"decoded\":%u,\"failed\":%u,\"copy_us\":%u,\"decode_us\":%u,"
+                     "\"avg_decode_us\":%u,\"width\":%u,\"height\":%u,\"scale\":%u,\"sequence\":%u}",
+                     tap.consumers(), (unsigned)s.offered, (unsigned)s.copied, (unsigned)s.busy,
+                     (unsigned)s.tooLarge, (unsigned)s.ownCaptures, (unsigned)s.decoded, (unsigned)s.failed,
+                     (unsigned)s.copyUs, (unsigned)s.decodeUs,
+                     (unsigned)(s.decoded ? s.totalDecodeUs / s.decoded : 0), thumb.width, thumb.height, thumb.scale,
+                     (unsigned)thumb.sequence);
+
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  return httpd_resp_send(req, json_response, len);
+}
+
+// Camera line detection. /vision?line=1 starts sending the line position to
+// the UNO, /vision?line=0 stops. Replies with the detection statistics.
+esp_err_t WebServer::visionHandler(httpd_req_t *req)
+{
+  static char json_response[320];
+
+  LineCamera &line = ((WebServer *)req->user_ctx)->lineCamera;
+  char query[32];
+  if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK)
+  {
+    int enable = parseGetVar(query, "line", -1);
+    if (enable >= 0)
+    {
+      line.setEnabled(enable != 0);
+    }
+  }
+
+  LineCamera::Stats s = line.stats();
+  int len = snprintf(json_response, sizeof(json_response),
+                     "{\"line\":%u,\"frames\":%u,\"found\":%u,\"over_budget\":%u,\"budget_us\":%u,"
+                     "\"convert_us\":%u,\"fit_us\":%u,\"avg_us\":%u,\"max_us\":%u,"
+                     "\"last\":{\"found\":%u,\"offset\":%d,\"heading\":%d,\"rows\":%u}}",
+                     line.enabled(), (unsigned)s.frames, (unsigned)s.found, (unsigned)s.overBudget,
+                     (unsigned)LineCamera::Budget_Us, (unsigned)s.convertUs, (unsigned)s.fitUs,
+                     (unsigned)(s.frames ? s.totalUs / s.frames : 0), (unsigned)s.maxUs, s.last.found, s.last.offset,
+                     s.last.heading, s.last.rows);
+
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  return httpd_resp_send(req, json_response, len);
+}
+
+// Last grayscale image the line detection ran on, as PGM. Saved frames are
+// the input of the host test in src/vision_host.
+esp_err_t WebServer::visionFrameHandler(httpd_req_t *req)
+{
+  LineCamera &line = ((WebServer *)req->user_ctx)->lineCamera;
+  size_t size = LineCamera::Max_Width * LineCamera::Max_Height;
+  uint8_t *image = (uint8_t *)malloc(size);
+  uint16_t width = 0;
+  uint16_t height = 0;
+  if (!image || !line.copyImage(image, size, width, height))
+  {
+    free(image);
+    httpd_resp_send_404(req);
+    return ESP_FAIL;
+  }
+
+  char header[32];
+  int len = snprintf(header, sizeof(header), "P5 %u %u 255\n", width, height);
+  httpd_resp_set_type(req, "image/x-portable-graymap");
+  httpd_resp_set_hdr(req, "Content-Disposition", "inline; filename=vision.pgm");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  esp_err_t res = httpd_resp_send_chunk(req, header, len);
+  if (res == ESP_OK)
+  {
+    res = httpd_resp_send_chunk(req, (const char *)image, width * height);
+  }
+  free(image);
+  if (res != ESP_OK)
+  {
+    return res;
+  }
+  return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+// Colour target tracking for follow mode. /blob?track=1 starts sending the
+// target bearing and size to the UNO, /blob?track=0 stops, r, g, b and tol
+// set the target colour. Replies with the tracking statistics.
+esp_err_t WebServer::blobHandler(httpd_req_t *req)
+{
+  static char json_response[384];
+
+  BlobCamera &blob = ((WebServer *)req->user_ctx)->blobCamera;
+  char query[64];
+  if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK)
+  {
+    uint8_t red, green, blue, tolerance;
+    blob.target(red, green, blue, tolerance);
+    int r = parseGetVar(query, "r", red);
+    int g = parseGetVar(query, "g", green);
+    int b = parseGetVar(query, "b", blue);
+    int tol = parseGetVar(query, "tol", tolerance);
+    if (r < 0 || r > 255 || g < 0 || g > 255 || b < 0 || b > 255 || tol < 1 || tol > 255)
+    {
+      httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "r, g, b 0..255, tol 1..255");
+      return ESP_FAIL;
+    }
+    blob.setTarget(r, g, b, tol);
+
+    int enable = parseGetVar(query, "track", -1);
+    if (enable >= 0)
+    {
+      blob.setEnabled(enable != 0);
+    }
+  }
+
+  uint8_t red, green, blue, tolerance;
+  blob.target(red, green, blue, tolerance);
+  BlobCamera::Stats s = blob.stats();
+  int len = snprintf(json_response, sizeof(json_response),
+                     "{\"track\":%u,\"target\":[%u,%u,%u],\"tol\":%u,\"frames\":%u,\"found\":%u,"
+                     "\"rate_hz\":%.1f,\"target_hz\":%u,\"over_budget\":%u,\"track_us\":%u,"
+                     "\"avg_us\":%u,\"max_us\":%u,"
+                     "\"last\":{\"found\":%u,\"bearing\":%d,\"size\":%u,\"pixels\":%u,\"x\":%u,\"y\":%u}}",
+                     blob.enabled(), red, green, blue, tolerance, (unsigned)s.frames, (unsigned)s.found, s.rateHz,
+                     (unsigned)BlobCamera::Target_Rate_Hz, (unsigned)s.overBudget, (unsigned)s.trackUs, (unsigned)(s.frames ? s.totalUs / s.frames : 0), (unsigned)s.maxUs,
+                     s.last.found, s.last.bearing, s.last.size, (unsigned)s.last.pixels, s.last.centerX,
+                     s.last.centerY);
+
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  return httpd_resp_send(req, json_response, len);
+}
+
+// Last image the colour tracking ran on, as PPM, the input of the blob mode
+// of src/vision_host.
+esp_err_t WebServer::blobFrameHandler(httpd_req_t *req)
+{
+  BlobCamera &blob = ((WebServer *)req->user_ctx)->blobCamera;
+  size_t size = BlobCamera::Max_Width * BlobCamera::Max_Height * 3;
+  uint8_t *image = (uint8_t *)malloc(size);
+  uint16_t width = 0;
+  uint16_t height = 0;
+  if (!image || !blob.copyImage(image, size, width, height))
+  {
+    free(image);
+    httpd_resp_send_404(req);
+    return ESP_FAIL;
+  }
+
+  char header[32];
+  int len = snprintf(header, sizeof(header), "P6 %u %u 255\n", width, height);
+  httpd_resp_set_type(req, "image/x-portable-pixmap");
+  httpd_resp_set_hdr(req, "Content-Disposition", "inline; filename=blob.ppm");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  esp_err_t res = httpd_resp_send_chunk(req, header, len);
+  if (res == ESP_OK)
+  {
+    res = httpd_resp_send_chunk(req, (const char *)image, width * height * 3);
+  }
+  free(image);
+  if (res != ESP_OK)
+  {
+    return res;
+  }
+  return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+// Pre-roll recorder settings and state. /recorder?enable=1&seconds=10
+// &size_kb=1536&fps=15, a new size drops what was recorded.
+esp_err_t WebServer::recorderHandler(httpd_req_t *req)
+{
+  static char json_response[384];
+
+  FrameRecorder &recorder = ((WebServer *)req->user_ctx)->recorder;
+  char query[96];
+  if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK)
+  {
+    FrameRecorder::Config c = recorder.config();
+    c.enabled = parseGetVar(query, "enable", c.enabled) != 0;
+    c.seconds = parseGetVar(query, "seconds", c.seconds);
+    c.ringKb = parseGetVar(query, "size_kb", c.ringKb);
+    c.fps = parseGetVar(query, "fps", c.fps);
+    if (!recorder.configure(c))
+    {
+      httpd_resp_send_500(req);
+      return ESP_FAIL;
+    }
+  }
+
+  FrameRecorder::Config c = recorder.config();
+  FrameRecorder::Stats s = recorder.stats();
+  int len = snprintf(json_response, sizeof(json_response),
+                     "{\"enabled\":%u,\"seconds\":%u,\"size_kb\":%u,\"fps\":%u,\"frames\":%u,\"bytes\":%u,"
+                     "\"span_ms\":%u,\"recorded\":%u,\"skipped\":%u,\"too_large\":%u,\"copy_us\":%u,"
+                     "\"max_copy_us\":%u}",
+                     c.enabled, c.seconds, (unsigned)c.ringKb, c.fps, s.frames, (unsigned)s.bytes,
+                     (unsigned)s.spanMs, (unsigned)s.recorded, (unsigned)s.skipped, (unsigned)s.tooLarge,
+                     (unsigned)s.copyUs, (unsigned)s.maxCopyUs);
+
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  return httpd_resp_send(req, json_response, len);
+}
+
+static bool sendResponseChunk(const uint8_t *data, size_t len, void *ctx)
+{
+  return httpd_resp_send_chunk((httpd_req_t *)ctx, (const char *)data, len) == ESP_OK;
+}
+
+// The recorded window as a file, AVI by default or the JPEG frames back to
+// back with format=mjpeg. seconds=N takes only the last N seconds. Recording
+// pauses while the file is sent, the stream keeps going.
+esp_err_t WebServer::recordingHandler(httpd_req_t *req)
+{
+  FrameRecorder &recorder = ((WebServer *)req->user_ctx)->recorder;
+  char query[64];
+  FrameRecorder::Format format = FrameRecorder::Format_Avi;
+  int seconds = 0;
+  if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK)
+  {
+    char value[16];
+    if (httpd_query_key_value(query, "format", value, sizeof(value)) == ESP_OK && !strcmp(value, "mjpeg"))
+    {
+      format = FrameRecorder::Format_Mjpeg;
+    }
+    seconds = constrain(parseGetVar(query, "seconds", 0), 0, 60);
+  }
+  if (!recorder.stats().frames)
+  {
+    httpd_resp_send_404(req);
+    return ESP_FAIL;
+  }
+
+  bool avi = format == FrameRecorder::Format_Avi;
+  httpd_resp_set_type(req, avi ? "video/x-msvideo" : "video/x-motion-jpeg");
+  httpd_resp_set_hdr(req, "Content-Disposition",
+                     avi ? "attachment; filename=recording.avi" : "attachment; filename=recording.mjpeg");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  uint16_t frames = recorder.dump(format, seconds, sendResponseChunk, req);
+  Serial.printf("Recording: %u frames sent\n", frames);
+  return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+// Flash log settings and state. /logger?enable=1&frame_ms=5000
+// &telemetry_ms=500, frame_ms=0 logs telemetry only.
+esp_err_t WebServer::loggerHandler(httpd_req_t *req)
+{
+  static char json_response[384];
+
+  FlashLog &flashLog = ((WebServer *)req->user_ctx)->flashLog;
+  char query[96];
+  if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK)
+  {
+    FlashLog::Config c = flashLog.config();
+    c.enabled = parseGetVar(query, "enable", c.enabled) != 0;
+    c.frameMs = constrain(parseGetVar(query, "frame_ms", c.frameMs), 0, 60000);
+    c.telemetryMs = constrain(parseGetVar(query, "telemetry_ms", c.telemetryMs), 0, 60000);
+    flashLog.configure(c);
+  }
+
+  FlashLog::Config c = flashLog.config();
+  FlashLog::Stats s = flashLog.stats();
+  int len = snprintf(json_response, sizeof(json_response),
+                     "{\"enabled\":%u,\"frame_ms\":%u,\"telemetry_ms\":%u,\"sectors\":%u,\"sequence\":%u,"
+                     "\"frames\":%u,\"frames_skipped\":%u,\"own_captures\":%u,\"records\":%u,\"trace_lost\":%u,"
+                     "\"bytes_written\":%u,\"erases\":%u,\"max_flash_us\":%u}",
+                     c.enabled, c.frameMs, c.telemetryMs, s.sectors, (unsigned)s.sequence, (unsigned)s.frames,
+                     (unsigned)s.framesSkipped, (unsigned)s.ownCaptures, (unsigned)s.records, (unsigned)s.traceLost,
+                     (unsigned)s.bytesWritten, (unsigned)s.erases, (unsigned)s.maxFlashUs);
+
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  return httpd_resp_send(req, json_response, len);
+}
+
+// The flash log, read a sector at a time: the records as they are stored
+// (see flash_log.h) or with format=mjpeg the timelapse frames
+esp_err_t WebServer::logHandler(httpd_req_t *req)
+{
+  FlashLog &flashLog = ((WebServer *)req->user_ctx)->flashLog;
+  char query[32];
+  FlashLog::Format format = FlashLog::Format_Raw;
+  if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK)
+  {
+    char value[16];
+    if (httpd_query_key_value(query, "format", value, sizeof(value)) == ESP_OK && !strcmp(value, "mjpeg"))
+    {
+      format = FlashLog::Format_Mjpeg;
+    }
+  }
+  if (!flashLog.stats().sectors)
+  {
+    httpd_resp_send_404(req);
+    return ESP_FAIL;
+  }
+
+  bool raw = format == FlashLog::Format_Raw;
+  httpd_resp_set_type(req, raw ? "application/octet-stream" : "video/x-motion-jpeg");
+  httpd_resp_set_hdr(req, "Content-Disposition",
+                     raw ? "attachment; filename=flash_log.bin" : "attachment; filename=timelapse.mjpeg");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  uint32_t sent = flashLog.dump(format, sendResponseChunk, req);
+  Serial.printf("Flash log: %u %s sent\n", (unsigned)sent, raw ? "records" : "frames");
+  return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+// -1 for a task that may run on either core
+static int taskCore(BaseType_t core)
+{
+  return core == tskNO_AFFINITY ? -1 : core;
+}
+
+// Time from a command handler handing a frame to the robot link until it is
+// in the UART, over every frame sent since boot or the last ?reset=1, as
+// JSON with the histogram in Latency_Bucket_Us steps. The HTTP round trip
+// the driver sees comes from src/control_bench, which streams at full rate
+// while it sends commands and reads this at the end.
+esp_err_t WebServer::controlBenchHandler(httpd_req_t *req)
+{
+  static char json_response[1536];
+
+  RobotLink &robotLink = ((WebServer *)req->user_ctx)->robotLink;
+  char query[32];
+  if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK && parseGetVar(query, "reset", 0))
+  {
+    robotLink.clearLatency();
+  }
+
+  RobotLink::Latency l = robotLink.latency();
+  int len = snprintf(json_response, sizeof(json_response),
+                     "{\"topology\":\"%s\",\"http_core\":%d,\"stream_core\":%d,\"control_core\":%d,"
+                     "\"control_priority\":%d,\"samples\":%u,\"dropped\":%u,\"p50_us\":%u,\"p90_us\":%u,"
+                     "\"p99_us\":%u,\"max_us\":%u,\"bucket_us\":%u,\"histogram\":[",
+                     TASK_CONTROL_QUEUE ? "queued" : "legacy", taskCore(TASK_HTTP_CORE), taskCore(TASK_STREAM_CORE),
+                     taskCore(TASK_CONTROL_CORE), TASK_CONTROL_PRIORITY, (unsigned)l.samples, (unsigned)l.dropped,
+                     (unsigned)RobotLink::percentileUs(l, 50), (unsigned)RobotLink::percentileUs(l, 90),
+                     (unsigned)RobotLink::percentileUs(l, 99), (unsigned)l.maxUs,
+                     (unsigned)RobotLink::Latency_Bucket_Us);
+  // Up to the last bucket in use, the overflow bucket counts the rest
+  int last = RobotLink::Latency_Buckets;
+  while (last > 0 && !l.buckets[last])
+  {
+    last--;
+  }
+  for (int i = 0; i <= last && len < (int)sizeof(json_response) - 16; i++)
+  {
+    len += snprintf(json_response + len, sizeof(json_response) - len, i ? ",%u" : "%u", (unsigned)l.buckets[i]);
+  }
+  len += snprintf(json_response + len, sizeof(json_response) - len, "]}");
+
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  return httpd_resp_send(req, json_response, len);
+}
+
+// The car's clock for the pages: esp_timer microseconds since boot, which
+// the stream's X-Timestamp shares. latency.js keeps the reply with the
+// shortest round trip and takes it as read half way through.
+esp_err_t WebServer::timeHandler(httpd_req_t *req)
+{
+  char json_response[40];
+  int len = snprintf(json_response, sizeof(json_response), "{\"car_us\":%lld}", (long long)esp_timer_get_time());
+
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  return httpd_resp_send(req, json_response, len);
+}
+
+static float elapsedMs(int64_t from_us, int64_t to_us)
+{
+  return (to_us - from_us) / 1000.0f;
+}
+
+// Commands the UNO acknowledged or never did, in milliseconds after the
+// browser sent them: http_ms in the handler, uart_ms in the UART, ack_ms
+// back from the UNO after the loop pass that drove the motors, -1 when the
+// ack was lost. Commands sent without ?t= have synced 0 and count from the
+// handler. /latency?after=<seq> skips the ones already read.
+esp_err_t WebServer::latencyHandler(httpd_req_t *req)
+{
+  static char json_response[4096];
+  static RobotLink::CommandTiming timings[RobotLink::Command_History];
+
+  RobotLink &robotLink = ((WebServer *)req->user_ctx)->robotLink;
+  char query[32];
+  uint32_t after = 0;
+  if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK)
+  {
+    after = parseGetVar(query, "after", 0);
+  }
+
+  size_t count = robotLink.commandsSince(after, timings, RobotLink::Command_History);
+  int len = snprintf(json_response, sizeof(json_response), "{\"commands\":[");
+  for (size_t i = 0; i < count && len < (int)sizeof(json_response) - 160; i++)
+  {
+    const RobotLink::CommandTiming &c = timings[i];
+    int64_t sent = c.clientUs ? c.clientUs : c.queuedUs;
+    len += snprintf(json_response + len, sizeof(json_response) - len,
+                    "%s{\"seq\":%u,\"command\":%u,\"synced\":%u,\"sent_ms\":%lld,\"http_ms\":%.1f,"
+                    "\"uart_ms\":%.1f,\"ack_ms\":%.1f}",
+                    i ? "," : "", (unsigned)c.seq, c.command, c.clientUs != 0, (long long)(sent / 1000),
+                    elapsedMs(sent, c.queuedUs), elapsedMs(sent, c.writtenUs),
+                    c.ackUs ? elapsedMs(sent, c.ackUs) : -1.0f);
+  }
+  len += snprintf(json_response + len, sizeof(json_response) - len, "]}");
+
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  return httpd_resp_send(req, json_response, len);
+}
+
+struct KernelBenchReport
+{
+  httpd_req_t *req;
+  uint16_t width;
+  uint16_t height;
+  uint32_t cpuMhz;
+  esp_err_t res;
+};
+
+static bool sendKernelBenchRow(const KernelBench::Result &r, void *arg)
+{
+  KernelBenchReport *report = (KernelBenchReport *)arg;
+  char row[128];
+  if (!r.allocated)
+  {
+    snprintf(row, sizeof(row), "%s,%s,%u,%u,,,,,no memory\n", r.kernel, r.memory, report->width, report->height);
+  }
+  else
+  {
+    snprintf(row, sizeof(row), "%s,%s,%u,%u,%.2f,%.2f,%.2f,%u,%s\n", r.kernel, r.memory, report->width,
+             report->height, (float)r.cycles / r.pixels, (float)r.refCycles / r.pixels,
+             r.cycles ? (float)r.refCycles / r.cycles : 0.0f, (unsigned)(r.cycles / report->cpuMhz),
+             r.ok ? "ok" : "MISMATCH");
+  }
+  report->res = httpd_resp_sendstr_chunk(report->req, row);
+  return report->res == ESP_OK;
+}
+
+// Image kernels of lib/image_kernels in CPU cycles per pixel, as CSV, for
+// the image in internal SRAM, in PSRAM and in PSRAM through banded copies.
+// /bench/kernels?w=160&h=120&repeats=5, the width a multiple of 8. The host
+// numbers come from "program kernels" in src/vision_host.
+esp_err_t WebServer::kernelBenchHandler(httpd_req_t *req)
+{
+  char query[64];
+  const char *buf = httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK ? query : nullptr;
+  int width = buf ? parseGetVar(query, "w", 160) : 160;
+  int height = buf ? parseGetVar(query, "h", 120) : 120;
+  int repeats = buf ? constrain(parseGetVar(query, "repeats", 5), 1, 50) : 5;
+  if (width < 8 || width > 1600 || width % 8 || height < 8 || height > 1200)
+  {
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "w 8..1600 in steps of 8, h 8..1200");
+    return ESP_FAIL;
+  }
+
+  httpd_resp_set_type(req, "text/csv");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  httpd_resp_sendstr_chunk(req, "kernel,memory,width,height,cycles_per_px,ref_cycles_per_px,speedup,us,check\n");
+
+  KernelBenchReport report = {req, (uint16_t)width, (uint16_t)height, getCpuFrequencyMhz(), ESP_OK};
+  KernelBench::run(width, height, repeats, sendKernelBenchRow, &report);
+  if (report.res != ESP_OK)
+  {
+    return report.res;
+  }
+  return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+struct BenchJpeg
+{
+  const uint8_t *buf;
+  size_t len;
+};
+
+static size_t readBenchJpeg(void *arg, size_t index, uint8_t *buf, size_t len)
+{
+  BenchJpeg *jpeg = (BenchJpeg *)arg;
+  if (index + len > jpeg->len)
+  {
+    len = jpeg->len - index;
+  }
+  if (buf)
+  {
+    memcpy(buf, jpeg->buf + index, len);
+  }
+  return len;
+}
+
+static bool dropBenchBlock(void *, uint16_t, uint16_t, uint16_t, uint16_t, uint8_t *)
+{
+  return true;
+}
+
+// Whether a JPEG decodes, at 1/8 scale which still walks all scan data
+static bool jpegDecodes(const uint8_t *buf, size_t len)
+{
+  BenchJpeg jpeg = {buf, len};
+  return jpegDecode(len, JPG_SCALE_8X, readBenchJpeg, dropBenchBlock, &jpeg) == ESP_OK;
+}
+
+// Encode time of the parallel JPEG encoder against the single frame2jpg()
+// call the stream used, as CSV. The sensor stays in JPEG mode: a captured
+// frame is decoded and converted to the raw format, then encoded frames
+// times per path. /bench/jpeg?format=rgb565|yuv422|gray&quality=80&frames=10
+// &stripes=1,2,4
+esp_err_t WebServer::jpegBenchHandler(httpd_req_t *req)
+{
+  static const int Default_Stripes[] = {1, 2, 4};
+
+  WebServer *server = (WebServer *)req->user_ctx;
+  Camera &camera = server->camera;
+  if (!camera.ready())
+  {
+    return sendCameraNotReady(req);
+  }
+
+  char query[96];
+  const char *buf = httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK ? query : nullptr;
+  int quality = buf ? constrain(parseGetVar(query, "quality", 80), 1, 100) : 80;
+  int frames = buf ? constrain(parseGetVar(query, "frames", 10), 1, 100) : 10;
+  int stripe_list[ParallelJpegEncoder::Max_Stripes];
+  int stripe_count = parseGetList(buf, "stripes", stripe_list, ParallelJpegEncoder::Max_Stripes, Default_Stripes, 3);
+  char format_name[16] = "rgb565";
+  if (buf)
+  {
+    httpd_query_key_value(query, "format", format_name, sizeof(format_name));
+  }
+  pixformat_t format = !strcmp(format_name, "yuv422") ? PIXFORMAT_YUV422
+                       : !strcmp(format_name, "gray") ? PIXFORMAT_GRAYSCALE
+                                                      : PIXFORMAT_RGB565;
+  if (format == PIXFORMAT_RGB565)
+  {
+    strcpy(format_name, "rgb565");
+  }
+
+  camera_fb_t *fb = camera.capture();
+  if (!fb || fb->format != PIXFORMAT_JPEG)
+  {
+    if (fb)
+    {
+      camera.returnFrame(fb);
+    }
+    httpd_resp_send_500(req);
+    return ESP_FAIL;
+  }
+  camera_fb_t raw = {};
+  raw.width = fb->width;
+  raw.height = fb->height;
+  raw.format = format;
+  size_t pixels = raw.width * raw.height;
+  raw.len = pixels * (format == PIXFORMAT_GRAYSCALE ? 1 : 2);
+  uint8_t *rgb = (uint8_t *)heap_caps_malloc(pixels * 3, MALLOC_CAP_SPIRAM);
+  raw.buf = (uint8_t *)heap_caps_malloc(raw.len, MALLOC_CAP_SPIRAM);
+  uint8_t *out = (uint8_t *)heap_caps_malloc(ParallelJpegEncoder::Output_Bytes, MALLOC_CAP_SPIRAM);
+  bool ok = rgb && raw.buf && out;
+  if (ok)
+  {
+    // fmt2rgb888() decodes with esp_jpg_decode()
+    JpegDecodeLock lock;
+    ok = fmt2rgb888(fb->buf, fb->len, fb->format, rgb);
+  }
+  camera.returnFrame(fb);
+  if (!ok)
+  {
+    free(rgb);
+    free(raw.buf);
+    free(out);
+    httpd_resp_send_500(req);
+    return ESP_FAIL;
+  }
+
+  // The channel order does not change the encode time
+  for (size_t i = 0; i < pixels; i++)
+  {
+    const uint8_t *p = rgb + 3 * i;
+    int y = (77 * p[0] + 150 * p[1] + 29 * p[2]) >> 8;
+    if (format == PIXFORMAT_GRAYSCALE)
+    {
+      raw.buf[i] = y;
+    }
+    else if (format == PIXFORMAT_YUV422)
+    {
+      // Y0 U Y1 V, each pixel brings its own Y and half the chroma
+      int chroma = i & 1 ? ((p[0] - y) * 183 >> 8) + 128 : ((p[2] - y) * 144 >> 8) + 128;
+      raw.buf[2 * i] = y;
+      raw.buf[2 * i + 1] = constrain(chroma, 0, 255);
+    }
+    else
+    {
+      // Big endian, as the sensor sends it
+      raw.buf[2 * i] = (p[0] & 0xF8) | (p[1] >> 5);
+      raw.buf[2 * i + 1] = ((p[1] & 0x1C) << 3) | (p[2] >> 3);
+    }
+  }
+  free(rgb);
+
+  httpd_resp_set_type(req, "text/csv");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  httpd_resp_sendstr_chunk(req, "path,format,stripes,width,height,quality,frames,avg_ms,min_ms,jpeg_bytes,speedup,valid\n");
+
+  char row[160];
+  float single_ms = 0;
+  esp_err_t res = ESP_OK;
+  // Path 0 is the single frame2jpg() call, then one run per stripe count
+  for (int path = 0; path <= stripe_count && res == ESP_OK; path++)
+  {
+    int stripes = path ? stripe_list[path - 1] : 1;
+    if (stripes < 1 || stripes > ParallelJpegEncoder::Max_Stripes)
+    {
+      continue;
+    }
+    int64_t total = 0;
+    int64_t fastest = INT64_MAX;
+    size_t len = 0;
+    bool valid = true;
+    for (int n = 0; n < frames && valid; n++)
+    {
+      uint8_t *jpeg = nullptr;
+      int64_t start = esp_timer_get_time();
+      if (path)
+      {
+        valid = server->jpegEncoder.encode(&raw, quality, out, ParallelJpegEncoder::Output_Bytes, len, stripes);
+        jpeg = out;
+      }
+      else
+      {
+        valid = frame2jpg(&raw, quality, &jpeg, &len);
+      }
+      int64_t elapsed = esp_timer_get_time() - start;
+      total += elapsed;
+      fastest = min(fastest, elapsed);
+      if (valid && n == 0)
+      {
+        valid = jpegDecodes(jpeg, len);
+      }
+      if (!path)
+      {
+        free(jpeg);
+      }
+    }
+
+    float avg_ms = total / 1000.0f / frames;
+    if (!path)
+    {
+      single_ms = avg_ms;
+    }
+    snprintf(row, sizeof(row), "%s,%s,%d,%u,%u,%d,%d,%.2f,%.2f,%u,%.2f,%s\n", path ? "parallel" : "frame2jpg",
+             format_name, stripes, raw.width, raw.height, quality, frames, avg_ms, fastest / 1000.0f,
+             (unsigned)len, single_ms && valid ? single_ms / avg_ms : 0.0f, valid ? "yes" : "no");
+    res = httpd_resp_sendstr_chunk(req, row);
+  }
+
+  free(raw.buf);
+  free(out);
+  if (res != ESP_OK)
+  {
+    return res;
+  }
+  return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+// Sweeps frame size, XCLK and optionally the PLL multiplier and measures the
+// capture rate and JPEG size of each combination, as CSV. Lists are comma
+// separated: /bench/sensor?fs=5,8&xclk=10,20&frames=20, PLL sweeps need the
+// other PLL fields as pll=bypass,mul,sys,root,pre,seld5,pclken,pclk plus
+// mul=a,b,c. Streams stall while it runs, the capture profile is restored at
+// the end.
+esp_err_t WebServer::sensorBenchHandler(httpd_req_t *req)
+{
+  static const int Warmup_Frames = 3;
+  static const int Max_Steps = 8;
+  static const int Default_Sizes[] = {FRAMESIZE_QQVGA, FRAMESIZE_QVGA, FRAMESIZE_VGA};
+  static const int Default_Clocks[] = {10, 16, 20, 24};
+  static char row[160];
+
+  WebServer *server = (WebServer *)req->user_ctx;
+  Camera &camera = server->camera;
+  if (!camera.ready())
+  {
+    return sendCameraNotReady(req);
+  }
+
+  char query[160];
+  const char *buf = httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK ? query : nullptr;
+  int sizes[Max_Steps];
+  int clocks[Max_Steps];
+  int muls[Max_Steps];
+  int pll[8];
+  int size_count = parseGetList(buf, "fs", sizes, Max_Steps, Default_Sizes, 3);
+  int clock_count = parseGetList(buf, "xclk", clocks, Max_Steps, Default_Clocks, 4);
+  int mul_count = parseGetList(buf, "mul", muls, Max_Steps, nullptr, 0);
+  bool use_pll = parseGetList(buf, "pll", pll, 8, nullptr, 0) == 8;
+  int frames = buf ? constrain(parseGetVar(query, "frames", 20), 1, 100) : 20;
+  if (!use_pll)
+  {
+    mul_count = 0;
+  }
+
+  sensor_t *s = camera.getSensor();
+  camera_sensor_info_t *info = esp_camera_sensor_get_info(&s->id);
+  const char *sensor_name = info ? info->name : "unknown";
+
+  httpd_resp_set_type(req, "text/csv");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  httpd_resp_sendstr_chunk(req, "sensor,xclk_mhz,pll_mul,framesize,width,height,fps,jpeg_bytes,failures,applied\n");
+
+  esp_err_t res = ESP_OK;
+  for (int i = 0; i < size_count && res == ESP_OK; i++)
+  {
+    if (sizes[i] < 0 || sizes[i] > Camera::Max_Frame_Size)
+    {
+      continue;
+    }
+    for (int j = 0; j < clock_count && res == ESP_OK; j++)
+    {
+      // A run without PLL override when no multipliers were given
+      for (int k = 0; k < (mul_count ? mul_count : 1) && res == ESP_OK; k++)
+      {
+        if (mul_count)
+        {
+          pll[1] = muls[k];
+        }
+        bool applied = camera.configure((framesize_t)sizes[i], clocks[j], mul_count ? pll : nullptr);
+
+        for (int n = 0; n < Warmup_Frames; n++)
+        {
+          camera_fb_t *fb = camera.capture();
+          if (fb)
+          {
+            camera.returnFrame(fb);
+          }
+        }
+
+        int good = 0;
+        int failures = 0;
+        size_t bytes = 0;
+        int64_t start = esp_timer_get_time();
+        for (int n = 0; n < frames; n++)
+        {
+          camera_fb_t *fb = camera.capture();
+          // A frame without the JPEG start marker is a DMA overrun
+          if (fb && fb->len > 2 && fb->buf[0] == 0xFF && fb->buf[1] == 0xD8)
+          {
+            good++;
+            bytes += fb->len;
+          }
+          else
+          {
+            failures++;
+          }
+          if (fb)
+          {
+            camera.returnFrame(fb);
+          }
+        }
+        int64_t elapsed = esp_timer_get_time() - start;
+
+        int len = snprintf(row, sizeof(row), "%s,%d,%d,%d,%u,%u,%.1f,%u,%d,%u\n", sensor_name, clocks[j],
+                           mul_count ? muls[k] : -1, sizes[i], resolution[sizes[i]].width,
+                           resolution[sizes[i]].height, elapsed > 0 ? good * 1000000.0 / elapsed : 0.0,
+                           good ? (unsigned)(bytes / good) : 0, failures, applied);
+        res = httpd_resp_send_chunk(req, row, len);
+      }
+    }
+  }
+
+  camera.applyProfile(camera.profile(), false);
+  if (res != ESP_OK)
+  {
+    return res;
+  }
+  return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+// Pages and scripts, minified and gzipped at build time by
+// web/build_assets.py. Every browser this page runs in takes gzip, so they
+// are never sent any other way. no-cache makes the browser ask each time,
+// the answer is a 304 until the firmware brings a different page.
+// Header list elements, comma separated with optional spaces around them.
+// Trims one in place and returns it.
+static char *trimListItem(char *item)
+{
+  while (*item == ' ' || *item == '\t')
+  {
+    item++;
+  }
+  char *end = item + strlen(item);
+  while (end > item && (end[-1] == ' ' || end[-1] == '\t'))
+  {
+    *--end = 0;
+  }
+  return item;
+}
+
+// Whether an If-None-Match list names etag or is "*". The comparison is
+// weak, a W/ prefix is ignored, as RFC 7232 asks for this header.
+static bool etagListed(char *list, const char *etag)
+{
+  char *save = nullptr;
+  for (char *item = strtok_r(list, ",", &save); item; item = strtok_r(nullptr, ",", &save))
+  {
+    item = trimListItem(item);
+    if (!strncmp(item, "W/", 2))
+    {
+      item += 2;
+    }
+    if (!strcmp(item, "*") || !strcmp(item, etag))
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Whether an Accept-Encoding list takes gzip with a q above 0, directly or
+// through "*"
+static bool gzipAccepted(char *list)
+{
+  float gzip_q = -1;
+  float any_q = -1;
+  char *save = nullptr;
+  for (char *item = strtok_r(list, ",", &save); item; item = strtok_r(nullptr, ",", &save))
+  {
+    char *params = strchr(item, ';');
+    if (params)
+    {
+      *params++ = 0;
+    }
+    float q = 1;
+    const char *q_param = params ? strstr(params, "q=") : nullptr;
+    if (q_param)
+    {
+      q = atof(q_param + 2);
+    }
+    item = trimListItem(item);
+    if (!strcasecmp(item, "gzip") || !strcasecmp(item, "x-gzip"))
+    {
+      gzip_q = q;
+    }
+    else if (!strcmp(item, "*"))
+    {
+      any_q = q;
+    }
+  }
+  return gzip_q >= 0 ? gzip_q > 0 : any_q > 0;
+}
+
+// The gzip copy goes to clients that ask for it, every other one gets the
+// plain copy. Without an Accept-Encoding header that is the plain one too,
+// curl and other simple clients send none. Headers too long for the buffers
+// count as missing.
+esp_err_t WebServer::assetHandler(httpd_req_t *req)
+{
+  const WebAsset *asset = (const WebAsset *)req->user_ctx;
+  char list[128];
+  bool gzip = httpd_req_get_hdr_value_str(req, "Accept-Encoding", list, sizeof(list)) == ESP_OK &&
+              gzipAccepted(list);
+  const char *etag = gzip ? asset->gzipEtag : asset->plainEtag;
+  httpd_resp_set_hdr(req, "ETag", etag);
+  httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+  httpd_resp_set_hdr(req, "Vary", "Accept-Encoding");
+
+  if (httpd_req_get_hdr_value_str(req, "If-None-Match", list, sizeof(list)) == ESP_OK && etagListed(list, etag))
+  {
+    httpd_resp_set_status(req, "304 Not Modified");
+    return httpd_resp_send(req, NULL, 0);
+  }
+
+  httpd_resp_set_type(req, asset->type);
+  if (!gzip)
+  {
+    return httpd_resp_send(req, (const char *)asset->plain, asset->plainLen);
+  }
+  httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+  return httpd_resp_send(req, (const char *)asset->gzip, asset->gzipLen);
+}
+
+// Stream handler implementation. While the scene does not change, frames
+// are only sent at the keep-alive rate, the first changed frame goes out at
+// once.
+esp_err_t WebServer::streamHandler(httpd_req_t *req)
+{
+  WebServer *server = (WebServer *)req->user_ctx;
+  Camera &camera = server->camera;
+  if (!camera.ready())
+  {
+    return sendCameraNotReady(req);
+  }
+  struct timeval _timestamp;
+  esp_err_t res = ESP_OK;
+  size_t _jpg_buf_len = 0;
+  uint8_t *_jpg_buf = NULL;
+  char *part_buf[128];
+
+  static int64_t last_frame = 0;
+  if (!last_frame)
+  {
+    last_frame = esp_timer_get_time();
+  }
+
+  // Too big for the server task stack
+  FrameChangeDetector *detector = new FrameChangeDetector();
+  // Encoder output for frames that are not JPEG, allocated on the first one
+  uint8_t *jpg_out = nullptr;
+  uint32_t static_frames = 0;
+  int64_t last_sent = 0;
+
+  res = httpd_resp_set_type(req, _STREAM_CONTENT_TYPE);
+  if (res != ESP_OK)
+  {
+    delete detector;
+    return res;
   }
 
   httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
@@ -1116,6 +1843,7 @@ esp_err_t WebServer::streamHandler(httpd_req_t *req)
 
   while (true)
   {
+    bool send = true;
     camera_fb_t *fb = camera.capture();
     if (!fb)
     {
@@ -1124,11 +1852,27 @@ esp_err_t WebServer::streamHandler(httpd_req_t *req)
     }
     else
     {
+      server->reportFirstFrame();
       _timestamp.tv_sec = fb->timestamp.tv_sec;
       _timestamp.tv_usec = fb->timestamp.tv_usec;
       if (fb->format != PIXFORMAT_JPEG)
       {
-        bool jpeg_converted = frame2jpg(fb, 80, &_jpg_buf, &_jpg_buf_len);
+        // Both cores into the stream's own buffer, the single call if that
+        // fails
+        if (!jpg_out)
+        {
+          jpg_out = (uint8_t *)heap_caps_malloc(ParallelJpegEncoder::Output_Bytes, MALLOC_CAP_SPIRAM);
+        }
+        bool jpeg_converted =
+            jpg_out && server->jpegEncoder.encode(fb, 80, jpg_out, ParallelJpegEncoder::Output_Bytes, _jpg_buf_len);
+        if (jpeg_converted)
+        {
+          _jpg_buf = jpg_out;
+        }
+        else
+        {
+          jpeg_converted = frame2jpg(fb, 80, &_jpg_buf, &_jpg_buf_len);
+        }
         camera.returnFrame(fb);
         fb = NULL;
         if (!jpeg_converted)
@@ -1141,23 +1885,51 @@ esp_err_t WebServer::streamHandler(httpd_req_t *req)
       {
         _jpg_buf_len = fb->len;
         _jpg_buf = fb->buf;
+
+        if (suppressStatic)
+        {
+          bool changed = detector->changed(fb);
+          streamStats.detectUs += detector->costUs();
+          streamStats.detected++;
+          static_frames = changed ? 0 : static_frames + 1;
+          send = static_frames < Static_Frames || esp_timer_get_time() - last_sent >= Keep_Alive_Ms * 1000LL;
+        }
       }
     }
+    streamStats.staticScene = static_frames >= Static_Frames;
 
-    if (res == ESP_OK)
+    int64_t send_start = esp_timer_get_time();
+    if (res == ESP_OK && send)
     {
       res = httpd_resp_send_chunk(req, _STREAM_BOUNDARY, strlen(_STREAM_BOUNDARY));
     }
-    if (res == ESP_OK)
+    if (res == ESP_OK && send)
     {
       size_t hlen = snprintf((char *)part_buf, 128, _STREAM_PART, _jpg_buf_len, _timestamp.tv_sec, _timestamp.tv_usec);
       res = httpd_resp_send_chunk(req, (const char *)part_buf, hlen);
     }
-    if (res == ESP_OK)
+    if (res == ESP_OK && send)
     {
       res = httpd_resp_send_chunk(req, (const char *)_jpg_buf, _jpg_buf_len);
     }
 
+    if (res == ESP_OK)
+    {
+      if (send)
+      {
+        detector->accept();
+        last_sent = esp_timer_get_time();
+        streamStats.sent++;
+        streamStats.bytesSent += _jpg_buf_len;
+        streamStats.sendUs += last_sent - send_start;
+      }
+      else
+      {
+        streamStats.skipped++;
+        streamStats.bytesSkipped += _jpg_buf_len;
+      }
+    }
+
     if (fb)
     {
       camera.returnFrame(fb);
@@ -1166,7 +1938,10 @@ esp_err_t WebServer::streamHandler(httpd_req_t *req)
     }
     else if (_jpg_buf)
     {
-      free(_jpg_buf);
+      if (_jpg_buf != jpg_out)
+      {
+        free(_jpg_buf);
+      }
       _jpg_buf = NULL;
     }
 
@@ -1174,6 +1949,10 @@ esp_err_t WebServer::streamHandler(httpd_req_t *req)
     {
       break;
     }
+    if (!send)
+    {
+      continue;
+    }
 
     int64_t fr_end = esp_timer_get_time();
     int64_t frame_time = fr_end - last_frame;
@@ -1185,684 +1964,9 @@ esp_err_t WebServer::streamHandler(httpd_req_t *req)
                   1000.0 / (uint32_t)frame_time);
   }
 
+  delete detector;
+  free(jpg_out);
+  streamStats.staticScene = false;
   Serial.println("Stream ended");
   return res;
 }
-
-// Gamepad handler implementation
-esp_err_t WebServer::gamepadHandler(httpd_req_t *req)
-{
-  static const char PROGMEM GAMEPAD_HTML[] = R"rawliteral(
-<!DOCTYPE html>
-<html>
-<head>
-  <title>ESP32-CAM Gamepad Controller</title>
-  <meta name="viewport" content="width=device-width, initial-scale=1">
-  <style>
-    body {
-      font-family: Arial, sans-serif;
-      text-align: center;
-      margin: 0 auto;
-      padding: 20px;
-      max-width: 800px;
-    }
-    .container {
-      display: flex;
-      flex-direction: column;
-      align-items: center;
-    }
-    .status {
-      margin: 20px 0;
-      padding: 10px;
-      border-radius: 5px;
-      font-weight: bold;
-    }
-    .connected {
-      background-color: #d4edda;
-      color: #155724;
-    }
-    .disconnected {
-      background-color: #f8d7da;
-      color: #721c24;
-    }
-    .gamepad-info {
-      display: flex;
-      flex-wrap: wrap;
-      justify-content: center;
-      gap: 20px;
-      margin-top: 20px;
-    }
-    .button-grid {
-      display: grid;
-      grid-template-columns: repeat(4, 1fr);
-      gap: 10px;
-      margin-top: 20px;
-    }
-    .button {
-      padding: 10px;
-      border: 1px solid #ccc;
-      border-radius: 5px;
-      background-color: #f8f9fa;
-    }
-    .button.pressed {
-      background-color: #007bff;
-      color: white;
-    }
-    .analog-stick {
-      width: 150px;
-      height: 150px;
-      border: 1px solid #ccc;
-      border-radius: 50%;
-      position: relative;
-      margin: 20px auto;
-    }
-    .stick {
-      width: 20px;
-      height: 20px;
-      background-color: #007bff;
-      border-radius: 50%;
-      position: absolute;
-      top: 50%;
-      left: 50%;
-      transform: translate(-50%, -50%);
-    }
-    .axis-labels {
-      display: flex;
-      justify-content: space-between;
-      width: 150px;
-      margin: 0 auto;
-    }
-    .axis-value {
-      font-family: monospace;
-      margin-top: 5px;
-    }
-    .nav-link {
-      display: inline-block;
-      background-color: #4CAF50;
-      color: white;
-      padding: 10px 20px;
-      text-decoration: none;
-      border-radius: 5px;
-      margin: 10px;
-      font-weight: bold;
-    }
-    .debug-info {
-      margin-top: 20px;
-      padding: 10px;
-      background-color: #f8f9fa;
-      border: 1px solid #ddd;
-      border-radius: 5px;
-      text-align: left;
-      font-family: monospace;
-      max-height: 200px;
-      overflow-y: auto;
-    }
-    .video-container {
-      position: relative;
-      width: 100%;
-      max-width: 640px;
-      margin: 20px auto;
-    }
-    .video-container img {
-      width: 100%;
-      height: auto;
-      display: block;
-    }
-    .fullscreen-btn {
-      position: absolute;
-      top: 10px;
-      right: 10px;
-      background-color: rgba(0, 0, 0, 0.5);
-      color: white;
-      border: none;
-      padding: 5px 10px;
-      border-radius: 3px;
-      cursor: pointer;
-      z-index: 1000;
-    }
-    .fullscreen-btn:hover {
-      background-color: rgba(0, 0, 0, 0.7);
-    }
-  </style>
-</head>
-<body>
-  <div class="container">
-    <h1>ESP32-CAM Gamepad Controller</h1>
-    <a href="/" class="nav-link">Back to Robot Control</a>
-
-    <div class="video-container">
-      <img src="" id="photo">
-      <button class="fullscreen-btn" onclick="toggleFullscreen()">Fullscreen</button>
-    </div>
-
-    <div id="status" class="status disconnected">
-      Controller: Disconnected
-    </div>
-
-    <div id="gamepad-info" class="gamepad-info">
-      <div>
-        <h3>Controller Info</h3>
-        <p id="controller-name">No controller connected</p>
-        <p id="controller-id">ID: -</p>
-        <p id="controller-timestamp">Timestamp: -</p>
-        <p id="controller-mapping">Mapping: -</p>
-        <p id="controller-connected">Connected: -</p>
-        <p id="controller-buttons-count">Buttons: -</p>
-        <p id="controller-axes-count">Axes: -</p>
-      </div>
-    </div>
-
-    <div class="button-grid" id="button-grid">
-      <!-- Buttons will be dynamically added here -->
-    </div>
-
-    <div class="analog-sticks">
-      <div>
-        <h3>Left Stick</h3>
-        <div class="analog-stick">
-          <div class="stick" id="left-stick"></div>
-        </div>
-        <div class="axis-labels">
-          <span>X: <span id="left-x" class="axis-value">0.00</span></span>
-          <span>Y: <span id="left-y" class="axis-value">0.00</span></span>
-        </div>
-      </div>
-
-      <div>
-        <h3>Right Stick</h3>
-        <div class="analog-stick">
-          <div class="stick" id="right-stick"></div>
-        </div>
-        <div class="axis-labels">
-          <span>X: <span id="right-x" class="axis-value">0.00</span></span>
-          <span>Y: <span id="right-y" class="axis-value">0.00</span></span>
-        </div>
-      </div>
-    </div>
-
-    <div class="debug-info" id="debug-info">
-      <h3>Debug Information</h3>
-      <div id="debug-content"></div>
-    </div>
-  </div>
-
-  <script>
-    // Global functions for button handlers
-    function toggleCheckbox(command) {
-      fetch('/' + command)
-        .then(response => {
-          if (!response.ok) {
-            throw new Error('Network response was not ok');
-          }
-          return response.text();
-        })
-        .catch(error => {
-          console.error('Error:', error);
-        });
-    }
-
-    function toggleFullscreen() {
-      const videoContainer = document.querySelector('.video-container');
-      if (!document.fullscreenElement) {
-        videoContainer.requestFullscreen().catch(err => {
-          console.error(`Error attempting to enable fullscreen: ${err.message}`);
-        });
-      } else {
-        document.exitFullscreen();
-      }
-    }
-
-    // Initialize everything when the page loads
-    window.addEventListener('DOMContentLoaded', function() {
-      // Camera stream
-      const photo = document.getElementById('photo');
-      photo.src = 'http://' + window.location.hostname + ':81/stream';
-
-      // Gamepad state
-      let gamepad = null;
-      let buttonElements = [];
-      let buttonStates = [];
-      let debugContent = document.getElementById('debug-content');
-      let lastTimestamp = 0;
-      let pollCount = 0;
-      let lastPollTime = 0;
-      let animationFrameId = null;
-
-      // DOM elements
-      const statusElement = document.getElementById('status');
-      const controllerNameElement = document.getElementById('controller-name');
-      const controllerIdElement = document.getElementById('controller-id');
-      const controllerTimestampElement = document.getElementById('controller-timestamp');
-      const controllerMappingElement = document.getElementById('controller-mapping');
-      const controllerConnectedElement = document.getElementById('controller-connected');
-      const controllerButtonsCountElement = document.getElementById('controller-buttons-count');
-      const controllerAxesCountElement = document.getElementById('controller-axes-count');
-      const buttonGridElement = document.getElementById('button-grid');
-      const leftStickElement = document.getElementById('left-stick');
-      const rightStickElement = document.getElementById('right-stick');
-      const leftXElement = document.getElementById('left-x');
-      const leftYElement = document.getElementById('left-y');
-      const rightXElement = document.getElementById('right-x');
-      const rightYElement = document.getElementById('right-y');
-
-      // Button names for PS5 DualSense with mapped actions
-      const buttonNames = [
-        'Cross', 'Circle', 'Square', 'Triangle',
-        'L1', 'R1', 'L2', 'R2',
-        'Share', 'Options', 'L3', 'R3',
-        'Up', 'Down', 'Left', 'Right',
-        'PS', 'Touch Pad'
-      ];
-
-      // Button mapping for robot controls
-      const buttonMappings = {
-        'Up': 'go',           // Up
-        'Down': 'back',       // Down
-        'Left': 'left',       // Left
-        'Right': 'right',     // Right
-        'L1': 'motorleft',    // L1 for MotorLeft
-        'R1': 'motorright',   // R1 for MotorRight
-        'Cross': 'model1',    // Cross for Model1
-        'Square': 'model2',   // Square for Model2
-        'Triangle': 'model3', // Triangle for Model3
-        'Circle': 'model4',   // Circle for Model4
-        'R3': 'ledtoggle',    // R3 for LED toggle
-        'Touch Pad': 'stop'   // Touch Pad for Stop
-      };
-
-      // Threshold for analog stick movement
-      const STICK_THRESHOLD = 0.3;
-
-      // Current movement state
-      let currentMovement = 'stop';
-      let currentRotation = 'stop';
-      let ledState = false;
-
-      // Log debug information
-      function logDebug(message) {
-        const timestamp = new Date().toISOString().split('T')[1].split('.')[0];
-        const logLine = document.createElement('div');
-        logLine.textContent = `[${timestamp}] ${message}`;
-        debugContent.appendChild(logLine);
-        debugContent.scrollTop = debugContent.scrollHeight;
-      }
-
-      // Initialize button grid
-      function initButtonGrid() {
-        try {
-          buttonGridElement.innerHTML = '';
-          buttonElements = [];
-          buttonStates = [];
-
-          // Initialize with a minimum set of buttons
-          const initialButtonCount = 20; // Set higher than expected button count
-
-          for (let i = 0; i < initialButtonCount; i++) {
-            const buttonDiv = document.createElement('div');
-            buttonDiv.className = 'button';
-            buttonDiv.id = `button-${i}`;
-            buttonDiv.textContent = buttonNames[i] || `Button ${i}`;
-
-            // Add visual indicator for mapped buttons
-            const buttonName = buttonNames[i] || `Button ${i}`;
-            if (buttonMappings[buttonName]) {
-              buttonDiv.style.backgroundColor = '#4CAF50';
-              buttonDiv.style.color = 'white';
-            }
-
-            buttonGridElement.appendChild(buttonDiv);
-            buttonElements.push(buttonDiv);
-            buttonStates.push(false);
-          }
-
-          logDebug(`Initialized button grid with ${initialButtonCount} buttons`);
-        } catch (error) {
-          logDebug(`Error initializing button grid: ${error.message}`);
-        }
-      }
-
-      // Function to send commands to the robot
-      function sendCommand(command) {
-        fetch(`/${command}`)
-          .then(response => {
-            if (!response.ok) {
-              throw new Error(`HTTP error! status: ${response.status}`);
-            }
-            return response.text();
-          })
-          .then(text => {
-            logDebug(`Command ${command} sent successfully`);
-          })
-          .catch(error => {
-            logDebug(`Error sending command ${command}: ${error.message}`);
-          });
-      }
-
-      // Update button states
-      function updateButtons(buttons) {
-        if (!buttons || buttons.length === 0) {
-          return;
-        }
-
-        try {
-          for (let i = 0; i < buttons.length; i++) {
-            const buttonElement = buttonElements[i];
-            if (!buttonElement) {
-              // If we don't have an element for this button index, create one
-              const buttonDiv = document.createElement('div');
-              buttonDiv.className = 'button';
-              buttonDiv.id = `button-${i}`;
-              buttonDiv.textContent = buttonNames[i] || `Button ${i}`;
-
-              // Add visual indicator for mapped buttons
-              const buttonName = buttonNames[i] || `Button ${i}`;
-              if (buttonMappings[buttonName]) {
-                buttonDiv.style.backgroundColor = '#4CAF50';
-                buttonDiv.style.color = 'white';
-              }
-
-              buttonGridElement.appendChild(buttonDiv);
-              buttonElements[i] = buttonDiv;
-              buttonStates[i] = false;
-              logDebug(`Created new button element for index ${i}`);
-            }
-
-            const isPressed = buttons[i].pressed || buttons[i].value > 0.5;
-            if (isPressed !== buttonStates[i]) {
-              buttonStates[i] = isPressed;
-              const buttonName = buttonNames[i] || `Button ${i}`;
-
-              // Update button appearance
-              if (buttonMappings[buttonName]) {
-                // Mapped buttons use a different color scheme
-                buttonElement.style.backgroundColor = isPressed ? '#45a049' : '#4CAF50';
-                buttonElement.style.color = 'white';
-              } else {
-                // Regular buttons use the default color scheme
-                buttonElement.classList.toggle('pressed', isPressed);
-              }
-
-              // Log button state
-              logDebug(`Button ${i} (${buttonName}): ${isPressed ? 'Pressed' : 'Released'}`);
-
-              // Handle mapped buttons
-              if (buttonMappings[buttonName]) {
-                // Special handling for L1/R1 - stop when released
-                if ((buttonName === 'L1' || buttonName === 'R1') && !isPressed) {
-                  logDebug(`Sending command: stop (${buttonName} released)`);
-                  sendCommand('stop');
-                }
-                // Special handling for directional buttons - stop when released
-                else if ((buttonName === 'Up' || buttonName === 'Down' ||
-                         buttonName === 'Left' || buttonName === 'Right') && !isPressed) {
-                  logDebug(`Sending command: stop (${buttonName} released)`);
-                  sendCommand('stop');
-                }
-                // Special handling for R3 - toggle LED
-                else if (buttonName === 'R3' && isPressed) {
-                  ledState = !ledState;
-                  const command = ledState ? 'ledon' : 'ledoff';
-                  logDebug(`Sending command: ${command} (LED ${ledState ? 'ON' : 'OFF'})`);
-                  sendCommand(command);
-                }
-                // Handle other buttons
-                else if (isPressed) {
-                  // Send command to robot
-                  const command = buttonMappings[buttonName];
-                  logDebug(`Sending command: ${command}`);
-                  sendCommand(command);
-                }
-              }
-
-              // Special handling for L2/R2 triggers
-              if ((buttonName.includes('L2') || buttonName.includes('R2')) && buttons[i].value) {
-                const value = buttons[i].value;
-                logDebug(`${buttonName} pressure: ${(value * 100).toFixed(0)}%`);
-              }
-            }
-          }
-        } catch (error) {
-          logDebug(`Error updating buttons: ${error.message}`);
-        }
-      }
-
-      // Update analog sticks
-      function updateAnalogSticks(axes) {
-        if (!axes || axes.length === 0) {
-          return;
-        }
-
-        // Left stick (axes 0 and 1) - 8-directional movement
-        if (axes.length >= 2) {
-          const leftX = axes[0];
-          const leftY = axes[1];
-
-          leftStickElement.style.transform = `translate(calc(-50% + ${leftX * 50}px), calc(-50% + ${leftY * 50}px))`;
-          leftXElement.textContent = leftX.toFixed(2);
-          leftYElement.textContent = leftY.toFixed(2);
-
-          // Determine movement direction based on stick position
-          let newMovement = 'stop';
-
-          if (Math.abs(leftX) > STICK_THRESHOLD || Math.abs(leftY) > STICK_THRESHOLD) {
-            // Calculate angle in degrees (0 is right, 90 is down, 180 is left, 270 is up)
-            const angle = Math.atan2(leftY, leftX) * (180 / Math.PI);
-
-            // Map angle to 8 directions
-            if (angle >= -22.5 && angle < 22.5) {
-              newMovement = 'right';
-            } else if (angle >= 22.5 && angle < 67.5) {
-              newMovement = 'rightdown';
-            } else if (angle >= 67.5 && angle < 112.5) {
-              newMovement = 'back';
-            } else if (angle >= 112.5 && angle < 157.5) {
-              newMovement = 'leftdown';
-            } else if (angle >= 157.5 || angle < -157.5) {
-              newMovement = 'left';
-            } else if (angle >= -157.5 && angle < -112.5) {
-              newMovement = 'leftup';
-            } else if (angle >= -112.5 && angle < -67.5) {
-              newMovement = 'go';
-            } else if (angle >= -67.5 && angle < -22.5) {
-              newMovement = 'rightup';
-            }
-          }
-
-          // Only send command if movement has changed
-          if (newMovement !== currentMovement) {
-            currentMovement = newMovement;
-            logDebug(`Left stick movement: ${currentMovement}`);
-            sendCommand(currentMovement);
-          }
-        }
-
-        // Right stick (axes 2 and 3) - Rotation control
-        if (axes.length >= 4) {
-          const rightX = axes[2];
-          const rightY = axes[3];
-
-          rightStickElement.style.transform = `translate(calc(-50% + ${rightX * 50}px), calc(-50% + ${rightY * 50}px))`;
-          rightXElement.textContent = rightX.toFixed(2);
-          rightYElement.textContent = rightY.toFixed(2);
-
-          // Determine rotation based on right stick X axis
-          let newRotation = 'stop';
-
-          if (Math.abs(rightX) > STICK_THRESHOLD) {
-            if (rightX > 0) {
-              newRotation = 'clockwise';
-            } else {
-              newRotation = 'contrario';
-            }
-          }
-
-          // Only send command if rotation has changed
-          if (newRotation !== currentRotation) {
-            currentRotation = newRotation;
-            logDebug(`Right stick rotation: ${currentRotation}`);
-            sendCommand(currentRotation);
-          }
-        }
-      }
-
-      // Update controller info
-      function updateControllerInfo() {
-        if (gamepad) {
-          controllerNameElement.textContent = gamepad.id;
-          controllerIdElement.textContent = `ID: ${gamepad.index}`;
-          controllerTimestampElement.textContent = `Timestamp: ${gamepad.timestamp}`;
-          controllerMappingElement.textContent = `Mapping: ${gamepad.mapping || 'standard'}`;
-          controllerConnectedElement.textContent = `Connected: ${gamepad.connected ? 'Yes' : 'No'}`;
-          controllerButtonsCountElement.textContent = `Buttons: ${gamepad.buttons.length}`;
-          controllerAxesCountElement.textContent = `Axes: ${gamepad.axes.length}`;
-        }
-      }
-
-      // Game loop
-      function gameLoop() {
-        try {
-          // Get the latest gamepad state directly
-          const gamepads = navigator.getGamepads();
-          const currentGamepad = gamepads[0]; // Focus on first gamepad
-
-          if (currentGamepad) {
-            if (!gamepad || gamepad.index !== currentGamepad.index) {
-              logDebug(`New gamepad detected: ${currentGamepad.id}`);
-              logDebug(`Number of buttons: ${currentGamepad.buttons.length}`);
-              logDebug(`Number of axes: ${currentGamepad.axes.length}`);
-              logDebug('Button mappings:');
-              Object.entries(buttonMappings).forEach(([button, command]) => {
-                logDebug(`${button} -> ${command}`);
-              });
-              gamepad = currentGamepad;
-              updateControllerInfo();
-            }
-
-            // Always update the reference
-            gamepad = currentGamepad;
-
-            // Update UI
-            updateButtons(gamepad.buttons);
-            updateAnalogSticks(gamepad.axes);
-
-            // Log polling every 100 frames
-            pollCount++;
-            if (pollCount % 100 === 0) {
-              logDebug(`Still polling (count: ${pollCount}), Gamepad connected: ${gamepad.connected}`);
-            }
-
-            statusElement.textContent = `Controller: Connected (${gamepad.id})`;
-            statusElement.className = 'status connected';
-          } else if (gamepad) {
-            logDebug('Gamepad disconnected');
-            gamepad = null;
-            statusElement.textContent = 'Controller: Disconnected';
-            statusElement.className = 'status disconnected';
-          }
-        } catch (error) {
-          logDebug(`Error in gameLoop: ${error.message}`);
-        }
-
-        // Request next frame
-        animationFrameId = requestAnimationFrame(gameLoop);
-      }
-
-      // Add a legend for mapped buttons
-      function addButtonLegend() {
-        const legendDiv = document.createElement('div');
-        legendDiv.style.marginTop = '20px';
-        legendDiv.style.padding = '10px';
-        legendDiv.style.backgroundColor = '#f8f9fa';
-        legendDiv.style.borderRadius = '5px';
-
-        const legendTitle = document.createElement('h3');
-        legendTitle.textContent = 'Controller Mappings';
-        legendDiv.appendChild(legendTitle);
-
-        const mappingsList = document.createElement('ul');
-        mappingsList.style.listStyle = 'none';
-        mappingsList.style.padding = '0';
-
-        // Add button mappings
-        const buttonMappingsTitle = document.createElement('h4');
-        buttonMappingsTitle.textContent = 'Button Mappings';
-        mappingsList.appendChild(buttonMappingsTitle);
-
-        Object.entries(buttonMappings).forEach(([button, command]) => {
-          const listItem = document.createElement('li');
-          listItem.style.margin = '5px 0';
-          listItem.textContent = `${button} -> ${command}`;
-          mappingsList.appendChild(listItem);
-        });
-
-        // Add analog stick mappings
-        const stickMappingsTitle = document.createElement('h4');
-        stickMappingsTitle.textContent = 'Analog Stick Mappings';
-        stickMappingsTitle.style.marginTop = '15px';
-        mappingsList.appendChild(stickMappingsTitle);
-
-        const leftStickItem = document.createElement('li');
-        leftStickItem.style.margin = '5px 0';
-        leftStickItem.textContent = 'Left Stick -> 8-directional movement (Forward, Backward, Left, Right, and diagonals)';
-        mappingsList.appendChild(leftStickItem);
-
-        const rightStickItem = document.createElement('li');
-        rightStickItem.style.margin = '5px 0';
-        rightStickItem.textContent = 'Right Stick -> Rotation (Left = Counterclockwise, Right = Clockwise)';
-        mappingsList.appendChild(rightStickItem);
-
-        legendDiv.appendChild(mappingsList);
-        document.querySelector('.container').insertBefore(legendDiv, document.querySelector('.debug-info'));
-      }
-
-      // Event listeners
-      window.addEventListener('gamepadconnected', (e) => {
-        logDebug(`Gamepad connected event: ${e.gamepad.id} (index: ${e.gamepad.index})`);
-        logDebug(`Mapping: ${e.gamepad.mapping}`);
-        logDebug(`Buttons: ${e.gamepad.buttons.length}, Axes: ${e.gamepad.axes.length}`);
-
-        // Start polling immediately
-        gamepad = e.gamepad;
-        lastTimestamp = e.gamepad.timestamp;
-        statusElement.textContent = `Controller: Connected (${e.gamepad.id})`;
-        statusElement.className = 'status connected';
-
-        // Force an immediate update
-        updateControllerInfo();
-        updateButtons(gamepad.buttons);
-        updateAnalogSticks(gamepad.axes);
-      });
-
-      window.addEventListener('gamepaddisconnected', (e) => {
-        logDebug(`Gamepad disconnected event: ${e.gamepad.id} (index: ${e.gamepad.index})`);
-        if (gamepad && gamepad.index === e.gamepad.index) {
-          gamepad = null;
-          statusElement.textContent = 'Controller: Disconnected';
-          statusElement.className = 'status disconnected';
-        }
-      });
-
-      // Clean up on page unload
-      window.addEventListener('beforeunload', () => {
-        logDebug('Page unloading - cleaning up');
-        if (animationFrameId) {
-          cancelAnimationFrame(animationFrameId);
-        }
-      });
-
-      // Initialize
-      logDebug('Initializing gamepad controller page');
-      initButtonGrid();
-      addButtonLegend();
-
-      // Start the game loop
-      gameLoop();
-    });
-  </script>
-</body>
-</html>
-)rawliteral";
-
-  httpd_resp_set_type(req, "text/html");
-  return httpd_resp_send(req, GAMEPAD_HTML, strlen(GAMEPAD_HTML));
-}
@@ -2,66 +2,103 @@
 
 #include "esp_http_server.h"
 #include "camera.h"
-#include <WiFi.h>
+#include "robot_link.h"
+#include "wifi_link.h"
+#include "analytics_tap.h"
+#include "line_camera.h"
+#include "blob_camera.h"
+#include "parallel_jpeg.h"
+#include "frame_recorder.h"
+#include "flash_log.h"
 
 class WebServer
 {
 public:
-  WebServer(Camera &camera);
+  WebServer(Camera &camera, RobotLink &robotLink, WiFiLink &wifiLink, AnalyticsTap &analyticsTap,
+            LineCamera &lineCamera, BlobCamera &blobCamera, FrameRecorder &recorder, FlashLog &flashLog);
   void start();
-  void setWiFiCredentials(const char *ssid, const char *password);
-  bool connectToWiFi();
-  String getWiFiAddress() const;
+  void stop();
+  // Brings both servers back after the link returned, stream clients reconnect
+  void restart();
+  bool running() const { return camera_httpd != nullptr && stream_httpd != nullptr; }
+
+  // Stream counters since boot, all viewers together
+  struct StreamStats
+  {
+    uint32_t sent;
+    uint32_t skipped; // unchanged frames held back
+    uint64_t bytesSent;
+    uint64_t bytesSkipped;
+    uint64_t sendUs;   // time spent sending the sent frames
+    uint64_t detectUs; // time spent in the change detector
+    uint32_t detected;
+    bool staticScene;
+  };
 
 private:
+  // Unchanged frames in a row before the stream drops to the keep-alive rate
+  static const uint32_t Static_Frames = 10;
+  static const uint32_t Keep_Alive_Ms = 1000;
+
   Camera &camera;
+  RobotLink &robotLink;
+  WiFiLink &wifiLink;
+  AnalyticsTap &analyticsTap;
+  LineCamera &lineCamera;
+  BlobCamera &blobCamera;
+  FrameRecorder &recorder;
+  FlashLog &flashLog;
+  ParallelJpegEncoder jpegEncoder;
   httpd_handle_t stream_httpd;
   httpd_handle_t camera_httpd;
-  String wifiAddress;
-  const char *ssid;
-  const char *password;
 
   static char part_buf[128]; // Buffer for stream parts
+  static StreamStats streamStats;
+  static bool suppressStatic;
 
   void registerHandlers();
   void setupStreamServer();
+  void reportFirstFrame();
 
   // Handler methods
-  static esp_err_t indexHandler(httpd_req_t *req);
+  static esp_err_t assetHandler(httpd_req_t *req);
   static esp_err_t streamHandler(httpd_req_t *req);
   static esp_err_t captureHandler(httpd_req_t *req);
   static esp_err_t cmdHandler(httpd_req_t *req);
   static esp_err_t statusHandler(httpd_req_t *req);
+  static esp_err_t radarHandler(httpd_req_t *req);
+  static esp_err_t traceHandler(httpd_req_t *req);
+  static esp_err_t profileHandler(httpd_req_t *req);
+  static esp_err_t captureProfileHandler(httpd_req_t *req);
   static esp_err_t xclkHandler(httpd_req_t *req);
   static esp_err_t regHandler(httpd_req_t *req);
   static esp_err_t gregHandler(httpd_req_t *req);
   static esp_err_t pllHandler(httpd_req_t *req);
   static esp_err_t winHandler(httpd_req_t *req);
+  static esp_err_t sensorBenchHandler(httpd_req_t *req);
+  static esp_err_t kernelBenchHandler(httpd_req_t *req);
+  static esp_err_t jpegBenchHandler(httpd_req_t *req);
+  static esp_err_t controlBenchHandler(httpd_req_t *req);
+  static esp_err_t roiHandler(httpd_req_t *req);
+  static esp_err_t tapHandler(httpd_req_t *req);
+  static esp_err_t visionHandler(httpd_req_t *req);
+  static esp_err_t visionFrameHandler(httpd_req_t *req);
+  static esp_err_t blobHandler(httpd_req_t *req);
+  static esp_err_t blobFrameHandler(httpd_req_t *req);
+  static esp_err_t recorderHandler(httpd_req_t *req);
+  static esp_err_t recordingHandler(httpd_req_t *req);
+  static esp_err_t loggerHandler(httpd_req_t *req);
+  static esp_err_t logHandler(httpd_req_t *req);
+  static esp_err_t timeHandler(httpd_req_t *req);
+  static esp_err_t latencyHandler(httpd_req_t *req);
 
   // Robot control handlers
-  static esp_err_t goHandler(httpd_req_t *req);
-  static esp_err_t backHandler(httpd_req_t *req);
-  static esp_err_t leftHandler(httpd_req_t *req);
-  static esp_err_t rightHandler(httpd_req_t *req);
-  static esp_err_t stopHandler(httpd_req_t *req);
-  static esp_err_t leftUpHandler(httpd_req_t *req);
-  static esp_err_t leftDownHandler(httpd_req_t *req);
-  static esp_err_t rightUpHandler(httpd_req_t *req);
-  static esp_err_t rightDownHandler(httpd_req_t *req);
-  static esp_err_t clockwiseHandler(httpd_req_t *req);
-  static esp_err_t contrarioHandler(httpd_req_t *req);
+  static esp_err_t commandHandler(httpd_req_t *req);
   static esp_err_t ledOnHandler(httpd_req_t *req);
   static esp_err_t ledOffHandler(httpd_req_t *req);
-  static esp_err_t model1Handler(httpd_req_t *req);
-  static esp_err_t model2Handler(httpd_req_t *req);
-  static esp_err_t model3Handler(httpd_req_t *req);
-  static esp_err_t model4Handler(httpd_req_t *req);
-  static esp_err_t motorLeftHandler(httpd_req_t *req);
-  static esp_err_t motorRightHandler(httpd_req_t *req);
 
   // Helper methods
+  static esp_err_t sendCameraNotReady(httpd_req_t *req);
   static esp_err_t parseGet(httpd_req_t *req, char **obuf);
   static int parseGetVar(char *buf, const char *key, int def);
-
-  static esp_err_t gamepadHandler(httpd_req_t *req);
 };
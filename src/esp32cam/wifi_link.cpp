@@ -0,0 +1,242 @@
+#include "wifi_link.h"
+#include "boot_timeline.h"
+#include "task_config.h"
+
+// Level: the station has an address
+static const EventBits_t Connected_Bit = BIT0;
+// Edges for the supervisor, cleared as it consumes them
+static const EventBits_t Up_Event_Bit = BIT1;
+static const EventBits_t Down_Event_Bit = BIT2;
+
+// WiFi events arrive in the event task without a context pointer
+static WiFiLink *instance = nullptr;
+static EventGroupHandle_t linkEvents = nullptr;
+
+WiFiLink::WiFiLink()
+    : ssid(nullptr), password(nullptr), events(nullptr), usingCache(false), onConnected(nullptr), context(nullptr),
+      outages(0), reconnects(0), outageTotalMs(0), outageLastMs(0), outageLongestMs(0), outageStart(0)
+{
+}
+
+void WiFiLink::begin(const char *ssid, const char *password, ConnectedCallback onConnected, void *context)
+{
+  this->ssid = ssid;
+  this->password = password;
+  this->onConnected = onConnected;
+  this->context = context;
+  events = xEventGroupCreate();
+  instance = this;
+  linkEvents = events;
+
+  prefs.begin("wifi", false);
+
+  // The driver would otherwise write its own config to flash on every begin()
+  // and run its own reconnects behind the supervisor's back
+  WiFi.persistent(false);
+  WiFi.mode(WIFI_STA);
+  WiFi.setSleep(false);
+  WiFi.setAutoReconnect(false);
+  // When roaming, join the strongest AP rather than the first one found
+  WiFi.setScanMethod(WIFI_ALL_CHANNEL_SCAN);
+  WiFi.setSortMethod(WIFI_CONNECT_AP_BY_SIGNAL);
+  WiFi.onEvent(onEvent);
+
+  BootTimeline::mark(bootTimeline.wifiStart);
+  connect(true);
+
+  // With the WiFi stack on the networking core, see task_config.h
+  xTaskCreatePinnedToCore(supervisorTask, "wifi_supervisor", 4096, this, TASK_WIFI_SUPERVISOR_PRIORITY, nullptr,
+                          TASK_WIFI_SUPERVISOR_CORE);
+}
+
+void WiFiLink::connect(bool useCache)
+{
+  uint8_t bssid[6];
+  uint8_t channel = prefs.getUChar("channel", 0);
+  usingCache = useCache && channel != 0 && prefs.getBytes("bssid", bssid, sizeof(bssid)) == sizeof(bssid);
+
+  if (usingCache && prefs.getBool("static", false))
+  {
+    WiFi.config(IPAddress(prefs.getUInt("ip", 0)), IPAddress(prefs.getUInt("gateway", 0)),
+                IPAddress(prefs.getUInt("subnet", 0)), IPAddress(prefs.getUInt("dns", 0)));
+  }
+  else
+  {
+    // An empty configuration switches DHCP back on
+    WiFi.config(INADDR_NONE, INADDR_NONE, INADDR_NONE);
+  }
+
+  if (usingCache)
+  {
+    Serial.printf("WiFi: joining cached AP on channel %u\n", channel);
+    WiFi.begin(ssid, password, channel, bssid);
+  }
+  else
+  {
+    WiFi.begin(ssid, password);
+  }
+}
+
+void WiFiLink::supervisorTask(void *arg)
+{
+  ((WiFiLink *)arg)->supervise();
+}
+
+void WiFiLink::supervise()
+{
+  uint32_t backoff = Backoff_Min_Ms;
+  uint32_t attempt = 0;
+
+  for (;;)
+  {
+    if (connected())
+    {
+      xEventGroupWaitBits(events, Down_Event_Bit, pdTRUE, pdFALSE, portMAX_DELAY);
+      if (connected())
+      {
+        continue;
+      }
+      outageStart = millis() | 1;
+      outages++;
+      Serial.println("WiFi: link lost, reconnecting");
+      backoff = Backoff_Min_Ms;
+      attempt = 0;
+      // The first retry goes back to the same AP, it usually just rebooted
+      // or the car drove through a dead spot
+      reconnects++;
+      connect(true);
+    }
+
+    uint32_t timeout = usingCache ? Fast_Connect_Timeout_Ms : Scan_Connect_Timeout_Ms;
+    EventBits_t bits = xEventGroupWaitBits(events, Up_Event_Bit, pdTRUE, pdFALSE, pdMS_TO_TICKS(timeout));
+    if ((bits & Up_Event_Bit) && connected())
+    {
+      // Disconnects seen while associating are stale now
+      xEventGroupClearBits(events, Down_Event_Bit);
+      if (outageStart)
+      {
+        uint32_t ms = millis() - outageStart;
+        outageStart = 0;
+        outageLastMs = ms;
+        outageTotalMs += ms;
+        if (ms > outageLongestMs)
+        {
+          outageLongestMs = ms;
+        }
+        Serial.printf("WiFi: back after %u ms\n", (unsigned)ms);
+      }
+      if (onConnected)
+      {
+        onConnected(context);
+      }
+      continue;
+    }
+
+    // The cached AP is gone or out of reach: scan from now on
+    if (usingCache)
+    {
+      Serial.println("WiFi: cached AP did not answer, scanning");
+      clearCache();
+    }
+    WiFi.disconnect();
+    attempt++;
+    Serial.printf("WiFi: attempt %u failed, next in %u ms\n", (unsigned)attempt, (unsigned)backoff);
+    vTaskDelay(pdMS_TO_TICKS(backoff));
+    backoff = backoff * 2 < Backoff_Max_Ms ? backoff * 2 : Backoff_Max_Ms;
+
+    xEventGroupClearBits(events, Up_Event_Bit | Down_Event_Bit);
+    reconnects++;
+    connect(false);
+  }
+}
+
+bool WiFiLink::waitConnected(uint32_t timeout_ms)
+{
+  return xEventGroupWaitBits(events, Connected_Bit, pdFALSE, pdTRUE, pdMS_TO_TICKS(timeout_ms)) & Connected_Bit;
+}
+
+bool WiFiLink::connected() const
+{
+  return events && (xEventGroupGetBits(events) & Connected_Bit);
+}
+
+String WiFiLink::address() const
+{
+  return WiFi.localIP().toString();
+}
+
+WiFiLink::Stats WiFiLink::stats() const
+{
+  Stats s;
+  s.outages = outages;
+  s.reconnects = reconnects;
+  s.outageTotalMs = outageTotalMs;
+  s.outageLastMs = outageLastMs;
+  s.outageLongestMs = outageLongestMs;
+  return s;
+}
+
+void WiFiLink::onEvent(arduino_event_id_t event, arduino_event_info_t info)
+{
+  (void)info;
+  if (!instance)
+  {
+    return;
+  }
+  switch (event)
+  {
+  case ARDUINO_EVENT_WIFI_STA_GOT_IP:
+    BootTimeline::mark(bootTimeline.networkUp);
+    instance->saveCache();
+    xEventGroupSetBits(linkEvents, Connected_Bit | Up_Event_Bit);
+    break;
+  case ARDUINO_EVENT_WIFI_STA_DISCONNECTED:
+  case ARDUINO_EVENT_WIFI_STA_LOST_IP:
+    xEventGroupClearBits(linkEvents, Connected_Bit);
+    xEventGroupSetBits(linkEvents, Down_Event_Bit);
+    break;
+  default:
+    break;
+  }
+}
+
+void WiFiLink::saveCache()
+{
+  // Only written when something changed, NVS pages wear out
+  uint8_t cached[6];
+  const uint8_t *bssid = WiFi.BSSID();
+  uint8_t channel = WiFi.channel();
+  bool same = prefs.getBytes("bssid", cached, sizeof(cached)) == sizeof(cached) &&
+              memcmp(cached, bssid, sizeof(cached)) == 0 && prefs.getUChar("channel", 0) == channel;
+  if (!same)
+  {
+    prefs.putBytes("bssid", bssid, 6);
+    prefs.putUChar("channel", channel);
+  }
+}
+
+void WiFiLink::clearCache()
+{
+  prefs.remove("bssid");
+  prefs.remove("channel");
+  usingCache = false;
+}
+
+bool WiFiLink::pinAddress(bool enable)
+{
+  if (!enable)
+  {
+    prefs.putBool("static", false);
+    return true;
+  }
+  if (!connected())
+  {
+    return false;
+  }
+  prefs.putUInt("ip", (uint32_t)WiFi.localIP());
+  prefs.putUInt("gateway", (uint32_t)WiFi.gatewayIP());
+  prefs.putUInt("subnet", (uint32_t)WiFi.subnetMask());
+  prefs.putUInt("dns", (uint32_t)WiFi.dnsIP());
+  prefs.putBool("static", true);
+  return true;
+}
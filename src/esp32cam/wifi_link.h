@@ -0,0 +1,75 @@
+#pragma once
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <Preferences.h>
+#include "freertos/event_groups.h"
+
+// Station connection to the access point. The BSSID and channel of the last
+// successful association are kept in NVS so a reboot skips the scan, and the
+// address can be pinned there too so it also skips DHCP.
+//
+// A supervisor task owns the connection: it reacts to WiFi events, retries
+// with exponential backoff when the link drops and calls the connected
+// callback every time an address is assigned, from its own task.
+class WiFiLink
+{
+public:
+  // A cached AP that does not answer within this time is dropped for a full scan
+  static const uint32_t Fast_Connect_Timeout_Ms = 3000;
+  // Time a full scan and association gets before it counts as failed
+  static const uint32_t Scan_Connect_Timeout_Ms = 6000;
+  // Pause after a failed attempt, doubling up to the maximum
+  static const uint32_t Backoff_Min_Ms = 250;
+  static const uint32_t Backoff_Max_Ms = 8000;
+
+  struct Stats
+  {
+    uint32_t outages;         // link losses after the first connection
+    uint32_t reconnects;      // connection attempts made by the supervisor
+    uint32_t outageTotalMs;   // time spent without a link, finished outages
+    uint32_t outageLastMs;    // length of the last finished outage
+    uint32_t outageLongestMs; // longest finished outage
+  };
+
+  typedef void (*ConnectedCallback)(void *context);
+
+  WiFiLink();
+
+  // Starts associating and the supervisor task, returns immediately
+  void begin(const char *ssid, const char *password, ConnectedCallback onConnected = nullptr,
+             void *context = nullptr);
+  bool waitConnected(uint32_t timeout_ms);
+  bool connected() const;
+  String address() const;
+  // Whether the running connection attempt uses the cached AP
+  bool fastConnect() const { return usingCache; }
+  Stats stats() const;
+
+  // Keeps the current address, gateway and DNS as a static configuration
+  bool pinAddress(bool enable);
+
+private:
+  const char *ssid;
+  const char *password;
+  EventGroupHandle_t events;
+  Preferences prefs;
+  volatile bool usingCache;
+  ConnectedCallback onConnected;
+  void *context;
+
+  // Written by the supervisor task only
+  volatile uint32_t outages;
+  volatile uint32_t reconnects;
+  volatile uint32_t outageTotalMs;
+  volatile uint32_t outageLastMs;
+  volatile uint32_t outageLongestMs;
+  volatile uint32_t outageStart; // millis() when the link dropped, 0 when up
+
+  static void onEvent(arduino_event_id_t event, arduino_event_info_t info);
+  static void supervisorTask(void *arg);
+  void supervise();
+  void connect(bool useCache);
+  void saveCache();
+  void clearCache();
+};
@@ -0,0 +1,293 @@
+#include <Arduino.h>
+#include <Servo.h>
+#include <stdio.h>
+#include <deque>
+#include <robot_protocol.h>
+#include "sim_arduino.h"
+
+// Rough AVR costs so loop timing keeps its shape in virtual time
+static const uint64_t Digital_Write_Us = 4;
+static const uint64_t Analog_Read_Us = 112;
+static const uint64_t Shift_Out_Us = 120;
+static const uint64_t Uart_Byte_Us = 87; // 10 bits at 115200 baud
+static const size_t Rx_Buffer_Bytes = 64; // SERIAL_RX_BUFFER_SIZE of the AVR core
+
+struct RxByte {
+    uint64_t arrival;
+    uint8_t value;
+};
+
+static SimWorld world;
+static std::deque<RxByte> rx;      // on the wire
+static std::deque<uint8_t> rxBuffer; // received, what Serial.read() returns
+static unsigned long rxOverflow = 0;
+static uint8_t txFrame[sizeof(protocol::TraceFrame)]; // ack or trace frame being written
+static size_t txLength = 0;
+static size_t txSize = 0;
+static unsigned long txAcks = 0;
+static FILE *traceFile = nullptr;
+static uint32_t traceTime = 0;
+static uint16_t traceLastRaw = 0;
+static bool traceStarted = false;
+static bool echo_tx = false;
+
+HardwareSerial Serial;
+
+SimWorld &simWorld() {
+    return world;
+}
+
+void simSerialSend(const uint8_t *data, size_t length) {
+    uint64_t at = rx.empty() || rx.back().arrival < world.now() ? world.now() : rx.back().arrival;
+    for (size_t i = 0; i < length; i++) {
+        at += Uart_Byte_Us;
+        rx.push_back(RxByte{at, data[i]});
+    }
+}
+
+unsigned long simSerialOverflow() {
+    return rxOverflow;
+}
+
+unsigned long simSerialAcks() {
+    return txAcks;
+}
+
+void simSerialRecord(FILE *file) {
+    traceFile = file;
+    traceStarted = false;
+    if (traceFile)
+        fprintf(traceFile, "time_ms,kind,a,b,c\n");
+}
+
+// Writes a trace frame the way the ESP32 serves it at /trace, with the 16 bit
+// time unwrapped as in RobotLink::addTrace()
+static void recordTrace(const uint8_t *frame) {
+    if (!traceFile)
+        return;
+    uint16_t raw = protocol::traceTime(frame);
+    bool first = !traceStarted || frame[1] == protocol::Trace_Mode;
+    traceTime = first ? raw : traceTime + (uint16_t)(raw - traceLastRaw);
+    traceLastRaw = raw;
+    traceStarted = true;
+    fprintf(traceFile, "%u,%s,%u,%u,%u\n", (unsigned)traceTime, protocol::traceKindName(frame[1]),
+            protocol::traceValue(frame, 0), protocol::traceValue(frame, 1), protocol::traceValue(frame, 2));
+}
+
+static void transmit(uint8_t c) {
+    if (txLength == 0) {
+        if (c == protocol::AckHeader)
+            txSize = sizeof(protocol::CommandFrame);
+        else if (c == protocol::TraceHeader)
+            txSize = sizeof(protocol::TraceFrame);
+        else
+            return;
+    }
+    txFrame[txLength++] = c;
+    if (txLength < txSize)
+        return;
+    txLength = 0;
+    if (protocol::isAckFrame(txFrame))
+        txAcks++;
+    else if (protocol::isTraceFrame(txFrame))
+        recordTrace(txFrame);
+}
+
+// Moves the bytes that have arrived into the RX buffer. The AVR core drops
+// what arrives while the buffer is full, the firmware cannot read in between.
+static void receive() {
+    while (!rx.empty() && rx.front().arrival <= world.now()) {
+        if (rxBuffer.size() < Rx_Buffer_Bytes)
+            rxBuffer.push_back(rx.front().value);
+        else
+            rxOverflow++;
+        rx.pop_front();
+    }
+}
+
+void simSerialEcho(bool echo) {
+    echo_tx = echo;
+}
+
+// ---------------------------------------------------------------------------
+// Time
+
+unsigned long millis() {
+    return (unsigned long)(world.now() / 1000);
+}
+
+unsigned long micros() {
+    return (unsigned long)world.now();
+}
+
+void delay(unsigned long ms) {
+    world.advance((uint64_t)ms * 1000);
+}
+
+void delayMicroseconds(unsigned int us) {
+    world.advance(us);
+}
+
+// ---------------------------------------------------------------------------
+// Pins
+
+void pinMode(uint8_t pin, uint8_t mode) {
+    (void)pin;
+    (void)mode;
+}
+
+void digitalWrite(uint8_t pin, uint8_t val) {
+    world.advance(Digital_Write_Us);
+    if (pin == Sim_Stcp_Pin && val == HIGH)
+        world.latched = world.shiftRegister;
+    else if (pin == Sim_En_Pin)
+        world.enabled = val == LOW; // output enable is active low
+}
+
+int digitalRead(uint8_t pin) {
+    (void)pin;
+    world.advance(Digital_Write_Us);
+    return LOW;
+}
+
+int analogRead(uint8_t pin) {
+    world.advance(Analog_Read_Us);
+    for (int i = 0; i < 3; i++) {
+        if (pin == Sim_Line_Pins[i])
+            return world.lineSensor(i);
+    }
+    return 0;
+}
+
+void analogWrite(uint8_t pin, int val) {
+    world.advance(Digital_Write_Us);
+    if (pin == Sim_Pwm1_Pin)
+        world.pwmLeft = val;
+    else if (pin == Sim_Pwm2_Pin)
+        world.pwmRight = val;
+}
+
+void shiftOut(uint8_t dataPin, uint8_t clockPin, uint8_t bitOrder, uint8_t val) {
+    world.advance(Shift_Out_Us);
+    if (dataPin != Sim_Data_Pin || clockPin != Sim_Shcp_Pin)
+        return;
+    if (bitOrder == LSBFIRST) {
+        uint8_t reversed = 0;
+        for (int i = 0; i < 8; i++)
+            reversed |= ((val >> i) & 1) << (7 - i);
+        val = reversed;
+    }
+    world.shiftRegister = val;
+}
+
+unsigned long pulseIn(uint8_t pin, uint8_t state, unsigned long timeout) {
+    if (pin != Sim_Echo_Pin || state != HIGH) {
+        world.advance(timeout);
+        return 0;
+    }
+    return world.echoMicros(timeout);
+}
+
+// ---------------------------------------------------------------------------
+// Servo
+
+uint8_t Servo::attach(int pin) {
+    _pin = pin;
+    return 0;
+}
+
+void Servo::write(int angle) {
+    if (_pin == Sim_Servo_Pin)
+        world.servoTarget = constrain(angle, 0, 180);
+}
+
+int Servo::read() {
+    return (int)(world.servoTarget + 0.5);
+}
+
+// ---------------------------------------------------------------------------
+// Print and Serial
+
+size_t Print::write(const uint8_t *buffer, size_t size) {
+    for (size_t i = 0; i < size; i++)
+        write(buffer[i]);
+    return size;
+}
+
+size_t Print::print(const char *s) {
+    return write((const uint8_t *)s, strlen(s));
+}
+
+size_t Print::print(char c) {
+    return write((uint8_t)c);
+}
+
+size_t Print::print(long n) {
+    char text[24];
+    snprintf(text, sizeof(text), "%ld", n);
+    return print(text);
+}
+
+size_t Print::print(unsigned long n) {
+    char text[24];
+    snprintf(text, sizeof(text), "%lu", n);
+    return print(text);
+}
+
+size_t Print::print(double n, int digits) {
+    char text[40];
+    snprintf(text, sizeof(text), "%.*f", digits, n);
+    return print(text);
+}
+
+size_t Print::println() {
+    return print("\r\n");
+}
+
+int HardwareSerial::available() {
+    receive();
+    return (int)rxBuffer.size();
+}
+
+int HardwareSerial::read() {
+    if (available() == 0)
+        return -1;
+    uint8_t value = rxBuffer.front();
+    rxBuffer.pop_front();
+    return value;
+}
+
+size_t HardwareSerial::readBytes(uint8_t *buffer, size_t length) {
+    uint64_t deadline = world.now() + (uint64_t)_timeout * 1000;
+    size_t count = 0;
+    while (count < length) {
+        if (available() > 0) {
+            buffer[count++] = (uint8_t)read();
+            deadline = world.now() + (uint64_t)_timeout * 1000;
+            continue;
+        }
+        // Like Stream::timedRead(), wait for the next byte or give up
+        if (rx.empty() || rx.front().arrival > deadline) {
+            world.advance(deadline - world.now());
+            break;
+        }
+        world.advance(rx.front().arrival - world.now());
+    }
+    return count;
+}
+
+size_t HardwareSerial::write(uint8_t c) {
+    // The UNO transmit buffer is small, assume it drains as fast as we print
+    transmit(c);
+    if (echo_tx)
+        putchar(c);
+    return 1;
+}
+
+size_t HardwareSerial::write(const uint8_t *buffer, size_t size) {
+    for (size_t i = 0; i < size; i++)
+        transmit(buffer[i]);
+    if (echo_tx)
+        fwrite(buffer, 1, size, stdout);
+    return size;
+}
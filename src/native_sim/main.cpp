@@ -0,0 +1,942 @@
+// Host simulation of the UNO firmware. src/arduino_uno is compiled unmodified
+// against the mocked Arduino core in mock/ and drives the kinematic car in
+// sim_world.h on a virtual clock, much faster than real time.
+//
+//   pio run -e native && .pio/build/native/program avoid --runs 100
+//
+// "follow" moves a board back and forth in front of the car, streams its
+// bearing and size the way the ESP32-CAM does (--camera-hz frames a second,
+// 0 for none) and times how long a command waits behind them in the UNO's
+// RX buffer. --max-follow-error and --max-follow-settle fail the run when
+// the car does not keep up:
+//
+//   .pio/build/native/program follow --runs 10 --max-follow-error 5 --max-follow-settle 2500
+//
+// "replay" feeds a trace recorded on the car (GET /trace on the ESP32) back
+// into the firmware and checks reaction times, so recorded runs can serve as
+// regression checks. Line tracking traces are also scored: lap time from the
+// heading the recorded motor output turns through, deviation from the
+// recorded line sensors as the firmware estimates it. traces/track_oval.csv
+// was recorded from the track scenario with --record.
+//
+//   .pio/build/native/program replay track.csv --max-line-reaction 40
+//   .pio/build/native/program replay src/native_sim/traces/track_oval.csv
+//       --max-lap-ms 10000 --max-line-deviation 0.5
+//
+// Every run forks so the firmware's globals start from scratch each time.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <robot_protocol.h>
+#include "sim_arduino.h"
+#include "trace_replay.h"
+
+void setup();
+void loop();
+
+static const double Pi = 3.14159265358979323846;
+// CPU time of one pass through loop() besides the mocked I/O
+static const uint64_t Loop_Overhead_Us = 30;
+// Metrics ignore the first part of a run while the car gets going
+static const double Settle_S = 2.0;
+// Replayed traces start once setup() has finished
+static const uint32_t Replay_Lead_Ms = 200;
+// Line readings below this are off the tape, as in line_follower.cpp
+static const int Line_Black = 400;
+// and below this they carry no weight in the position estimate
+static const int Line_White = 200;
+// follow: the ESP32-CAM's view of the board, and a harmless command sent
+// once a second from Probe_Start_S to time how long the UNO takes to act
+static const double Camera_Fov = 60 * 3.14159265358979323846 / 180;
+static const double Board_Width = 0.30;
+static const double Probe_Start_S = 3.0;
+static const double Probe_Interval_S = 1.0;
+// follow: from Follow_Steps_S on the board jumps by Follow_Step back and
+// forth, the car has settled once it is within Follow_Settled_Cm again
+static const double Follow_Steps_S = 45;
+static const double Follow_Step_Interval_S = 3;
+static const double Follow_Step = 0.15;
+static const double Follow_Settled_Cm = 4;
+
+enum Scenario
+{
+  Scenario_Avoid,
+  Scenario_Track,
+  Scenario_Follow,
+  Scenario_Replay
+};
+
+struct Options
+{
+  Scenario scenario = Scenario_Avoid;
+  int runs = 1;
+  double seconds = 60;
+  uint32_t seed = 1;
+  double noise = 0.02;
+  bool verbose = false;
+  bool decisions = false;
+  // replay expectations, negative to leave unchecked
+  double maxLineReactionMs = -1;
+  double maxAvoidMs = -1;
+  double maxLapMs = -1;
+  double maxLineDeviationCm = -1;
+  // follow expectations: mean distance error against the moving board, and
+  // time to settle after each step of it
+  double maxFollowErrorCm = -1;
+  double maxFollowSettleMs = -1;
+  // CSV of the run's trace frames, as /trace serves them
+  const char *record = nullptr;
+  // follow: VisionTarget frames per second, 0 for none
+  double cameraHz = 0;
+};
+
+struct Metrics
+{
+  double seconds;
+  double distance; // metres driven
+  unsigned long collisions;
+
+  // avoid: an encounter starts with a wall 20 cm ahead of the bumper and ends
+  // once there is 35 cm of room again
+  unsigned long encounters;
+  unsigned long unresolved;
+  double avoidTotalMs;
+  double avoidMaxMs;
+
+  // track: deviation of the centre line sensor from the tape; replay: the
+  // same estimated from the recorded sensors while line tracking
+  double laps;
+  double lineSumCm;
+  double lineMaxCm;
+  unsigned long lineSamples;
+  double offLineMs;
+  // replay: completed laps, one full turn of the car each
+  double lapTotalMs;
+  double lapMinMs;
+  double lapMaxMs;
+
+  // follow: distance error against the 20 cm set point
+  double followSumCm;
+  double followSqSumCm;
+  double followMaxCm;
+  unsigned long followSamples;
+  // follow: steps of the board, time to settle and steps the car never
+  // settled on before the next one
+  unsigned long followSteps;
+  unsigned long followUnsettled;
+  double followSettleTotalMs;
+  double followSettleMaxMs;
+  // follow: probe command sent to ack written
+  unsigned long probeAcks;
+  unsigned long probeLost; // no ack before the next probe
+  double probeTotalMs;
+  double probeMaxMs;
+  unsigned long rxOverflow; // bytes the UNO's RX buffer dropped
+
+  // replay: time from the line sensors losing the tape to the first search
+  // spin, and from leaving Forward in avoidance mode to driving on again
+  unsigned long lineLosses;
+  unsigned long lineReactions;
+  double lineReactionTotalMs;
+  double lineReactionMaxMs;
+  unsigned long maneuvers;
+  double maneuverTotalMs;
+  double maneuverMaxMs;
+  unsigned long decisions;
+  unsigned long recordedDecisions;
+};
+
+struct RunState
+{
+  Options options;
+  Metrics metrics;
+  Vec last;
+  // avoid
+  bool inEncounter;
+  double encounterStart;
+  // track
+  double trackLength;
+  double lastAlong;
+  double progress;
+  // follow
+  double targetX;
+  int followStep;
+  double stepAt; // -1 once settled
+  double nextFrame;
+  double nextProbe;
+  double probeSent;
+  unsigned long acks;
+  // replay
+  bool lineLost;
+  bool lineReacted;
+  double lineLostAt;
+  bool inManeuver;
+  double maneuverStart;
+  uint8_t pattern;
+  int pwmLeft, pwmRight;
+  bool lapping;
+  double lapStart;
+  double lastHeading;
+  double turned; // radians since line tracking started
+  double nextLapMark;
+};
+
+static TraceReplay replay;
+
+static double uniform(uint32_t &state)
+{
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return state / 4294967296.0;
+}
+
+static void addBox(SimWorld &world, Vec centre, double half)
+{
+  Vec a{centre.x - half, centre.y - half}, b{centre.x + half, centre.y - half};
+  Vec c{centre.x + half, centre.y + half}, d{centre.x - half, centre.y + half};
+  world.walls.push_back(Segment{a, b});
+  world.walls.push_back(Segment{b, c});
+  world.walls.push_back(Segment{c, d});
+  world.walls.push_back(Segment{d, a});
+}
+
+// Oval of two 1 m straights joined by half circles, driven counterclockwise
+static void addOval(SimWorld &world, double straight, double radius)
+{
+  const int arc_steps = 24;
+  double h = straight / 2;
+  for (int i = 0; i <= arc_steps; i++)
+  {
+    double a = -Pi / 2 + Pi * i / arc_steps;
+    world.track.push_back(Vec{h + radius * cos(a), radius * sin(a)});
+  }
+  for (int i = 0; i <= arc_steps; i++)
+  {
+    double a = Pi / 2 + Pi * i / arc_steps;
+    world.track.push_back(Vec{-h + radius * cos(a), radius * sin(a)});
+  }
+}
+
+static void buildScene(RunState &run, uint32_t seed)
+{
+  SimWorld &world = simWorld();
+  uint32_t rng = seed * 2654435761u + 1;
+  world.seed(seed);
+
+  switch (run.options.scenario)
+  {
+  case Scenario_Avoid:
+  {
+    // 2.5 m square room with a few boxes kept clear of the start
+    const double half = 1.25;
+    addBox(world, Vec{0, 0}, half);
+    for (int i = 0; i < 4; i++)
+    {
+      Vec c;
+      do
+      {
+        c = Vec{(uniform(rng) - 0.5) * 2 * (half - 0.3), (uniform(rng) - 0.5) * 2 * (half - 0.3)};
+      } while (fabs(c.x) < 0.35 && fabs(c.y) < 0.35);
+      addBox(world, c, 0.08 + uniform(rng) * 0.1);
+    }
+    world.heading = (uniform(rng) - 0.5) * 2 * Pi;
+    world.echoDropout = run.options.noise;
+    world.echoSpurious = run.options.noise / 2;
+    break;
+  }
+  case Scenario_Track:
+  {
+    const double radius = 0.35;
+    addOval(world, 1.0, radius);
+    world.position = Vec{-0.3, -radius + (uniform(rng) - 0.5) * 0.02};
+    world.heading = (uniform(rng) - 0.5) * 20 * Pi / 180;
+    run.trackLength = world.trackLength();
+    world.trackDistance(world.carPoint(SimWorld::Line_Offset, 0), &run.lastAlong);
+    break;
+  }
+  case Scenario_Follow:
+    // A board held in front of the car, moved by onStep()
+    run.targetX = 0.5;
+    world.walls.push_back(Segment{Vec{run.targetX, -0.15}, Vec{run.targetX, 0.15}});
+    world.echoDropout = run.options.noise;
+    world.echoSpurious = run.options.noise / 2;
+    break;
+  case Scenario_Replay:
+    // Sensors come from the trace, the car only needs room to move
+    replay.rewind();
+    for (const TraceReplay::Sample &s : replay.samples())
+    {
+      if (s.kind == protocol::Trace_Drive)
+        run.metrics.recordedDecisions++;
+    }
+    break;
+  }
+  run.last = world.position;
+}
+
+// Lap time and line deviation of a line tracking trace. The track is a
+// closed loop, so one lap is one full turn of a second car that drives the
+// recorded motor output; the replayed firmware's own output would drift
+// away from the recorded run as soon as it decides differently. Laps are
+// timed between half turns, in the middle of a bend, where the heading
+// changes fast; on a straight its crossing time would be ill-defined.
+static void scoreLap(RunState &run, SimWorld &world, double t, bool lost)
+{
+  static SimWorld recordedCar;
+  Metrics &m = run.metrics;
+  const double dt_ms = 1;
+  if (!run.lapping)
+  {
+    run.lapping = true;
+    run.lapStart = -1;
+    run.nextLapMark = Pi;
+    recordedCar.heading = 0;
+    run.lastHeading = 0;
+    run.turned = 0;
+  }
+  TraceReplay::Sample drive;
+  if (replay.recordedDrive(drive))
+  {
+    recordedCar.enabled = true;
+    recordedCar.latched = drive.value[0];
+    recordedCar.pwmLeft = drive.value[1];
+    recordedCar.pwmRight = drive.value[2];
+  }
+  recordedCar.advance((uint64_t)(dt_ms * 1000));
+  double delta = recordedCar.heading - run.lastHeading;
+  if (delta > Pi)
+    delta -= 2 * Pi;
+  if (delta < -Pi)
+    delta += 2 * Pi;
+  run.turned += delta;
+  run.lastHeading = recordedCar.heading;
+  if (fabs(run.turned) >= run.nextLapMark)
+  {
+    if (run.lapStart >= 0)
+    {
+      double ms = (t - run.lapStart) * 1000;
+      if (m.laps == 0 || ms < m.lapMinMs)
+        m.lapMinMs = ms;
+      if (ms > m.lapMaxMs)
+        m.lapMaxMs = ms;
+      m.lapTotalMs += ms;
+      m.laps++;
+    }
+    run.lapStart = t;
+    run.nextLapMark += 2 * Pi;
+  }
+
+  if (lost)
+  {
+    m.offLineMs += dt_ms;
+    return;
+  }
+  // Weighted average of the sensors as in line_follower.cpp, 1 at a sensor
+  long w[3];
+  for (int i = 0; i < 3; i++)
+    w[i] = world.replayLine[i] > Line_White ? world.replayLine[i] - Line_White : 0;
+  double cm = fabs((double)(w[2] - w[0]) / (w[0] + w[1] + w[2])) * SimWorld::Line_Spacing * 100;
+  m.lineSumCm += cm;
+  if (cm > m.lineMaxCm)
+    m.lineMaxCm = cm;
+  m.lineSamples++;
+}
+
+static void replayStep(RunState &run, SimWorld &world, double t)
+{
+  Metrics &m = run.metrics;
+  uint32_t now_ms = (uint32_t)(world.now() / 1000);
+  if (now_ms < Replay_Lead_Ms)
+    return;
+  replay.apply(world, now_ms - Replay_Lead_Ms);
+
+  bool lost = world.replayLine[0] < Line_Black && world.replayLine[1] < Line_Black &&
+              world.replayLine[2] < Line_Black;
+  if (replay.mode() == 3)
+    scoreLap(run, world, t, lost);
+  else
+    run.lapping = false;
+  run.followStep = -1;
+  run.stepAt = -1;
+  if (lost && !run.lineLost && replay.mode() == 3)
+  {
+    run.lineLost = true;
+    run.lineReacted = false;
+    run.lineLostAt = t;
+    m.lineLosses++;
+  }
+  else if (!lost)
+  {
+    run.lineLost = false;
+  }
+
+  uint8_t pattern = world.enabled ? world.latched : (uint8_t)protocol::Stop;
+  if (pattern == run.pattern && world.pwmLeft == run.pwmLeft && world.pwmRight == run.pwmRight)
+    return;
+  run.pattern = pattern;
+  run.pwmLeft = world.pwmLeft;
+  run.pwmRight = world.pwmRight;
+  m.decisions++;
+  if (run.options.decisions)
+    printf("%8u ms  pattern %3u  pwm %3d %3d\n", now_ms - Replay_Lead_Ms, pattern, world.pwmLeft, world.pwmRight);
+
+  if (run.lineLost && !run.lineReacted && (pattern == protocol::Clockwise || pattern == protocol::Contrarotate))
+  {
+    double ms = (t - run.lineLostAt) * 1000;
+    run.lineReacted = true;
+    m.lineReactions++;
+    m.lineReactionTotalMs += ms;
+    if (ms > m.lineReactionMaxMs)
+      m.lineReactionMaxMs = ms;
+  }
+
+  if (replay.mode() != 1)
+  {
+    run.inManeuver = false;
+  }
+  else if (!run.inManeuver && pattern != protocol::Forward && pattern != protocol::Stop)
+  {
+    run.inManeuver = true;
+    run.maneuverStart = t;
+  }
+  else if (run.inManeuver && pattern == protocol::Forward)
+  {
+    double ms = (t - run.maneuverStart) * 1000;
+    run.inManeuver = false;
+    m.maneuvers++;
+    m.maneuverTotalMs += ms;
+    if (ms > m.maneuverMaxMs)
+      m.maneuverMaxMs = ms;
+  }
+}
+
+// What the ESP32 sends in follow mode: the board's bearing and size as the
+// camera sees it, and a probe command whose ack times the UNO's reaction
+static void followLink(RunState &run, SimWorld &world, double t)
+{
+  Metrics &m = run.metrics;
+  if (run.options.cameraHz > 0 && t >= run.nextFrame)
+  {
+    run.nextFrame = t + 1 / run.options.cameraHz;
+    Vec eye = world.carPoint(SimWorld::Sonar_Offset, 0);
+    double dx = run.targetX - eye.x, dy = -eye.y;
+    double angle = atan2(dy, dx) - world.heading;
+    double distance = sqrt(dx * dx + dy * dy);
+    bool found = fabs(angle) < Camera_Fov / 2 && distance > 0.05;
+    // Positive bearings are to the right, y is to the left
+    int bearing = (int)(-angle / (Camera_Fov / 2) * 127);
+    double width = Board_Width / (2 * distance * tan(Camera_Fov / 2));
+    protocol::ParameterFrame frame = protocol::encodeVisionTarget(found, bearing, width >= 1 ? 255 : width * 255);
+    simSerialSend((const uint8_t *)&frame, sizeof(frame));
+  }
+
+  unsigned long acks = simSerialAcks();
+  if (run.probeSent >= 0 && acks > run.acks)
+  {
+    double ms = (t - run.probeSent) * 1000;
+    m.probeAcks++;
+    m.probeTotalMs += ms;
+    if (ms > m.probeMaxMs)
+      m.probeMaxMs = ms;
+    run.probeSent = -1;
+  }
+  run.acks = acks;
+  if (t >= run.nextProbe)
+  {
+    if (run.probeSent >= 0)
+      m.probeLost++;
+    // Stopping a trace that never started changes nothing
+    protocol::CommandFrame frame = protocol::encodeCommand(protocol::TraceStop);
+    simSerialSend((const uint8_t *)&frame, sizeof(frame));
+    run.nextProbe = t + Probe_Interval_S;
+    run.probeSent = t;
+  }
+}
+
+static void onStep(SimWorld &world, void *context)
+{
+  RunState &run = *(RunState *)context;
+  Metrics &m = run.metrics;
+  double t = world.now() / 1e6;
+  const double dt_ms = 1;
+
+  double dx = world.position.x - run.last.x, dy = world.position.y - run.last.y;
+  m.distance += sqrt(dx * dx + dy * dy);
+  run.last = world.position;
+  m.collisions = world.collisions();
+
+  switch (run.options.scenario)
+  {
+  case Scenario_Avoid:
+  {
+    // Room in front of the bumper, independent of where the scanner points
+    double ahead = world.rayDistance(world.carPoint(SimWorld::Car_Radius, 0), world.heading, 4.0);
+    bool close = ahead >= 0 && ahead < 0.20;
+    bool clear = ahead < 0 || ahead > 0.35;
+    if (!run.inEncounter && close)
+    {
+      run.inEncounter = true;
+      run.encounterStart = t;
+    }
+    else if (run.inEncounter && clear)
+    {
+      double ms = (t - run.encounterStart) * 1000;
+      run.inEncounter = false;
+      m.encounters++;
+      m.avoidTotalMs += ms;
+      if (ms > m.avoidMaxMs)
+        m.avoidMaxMs = ms;
+    }
+    break;
+  }
+  case Scenario_Track:
+  {
+    double along;
+    double d = world.trackDistance(world.carPoint(SimWorld::Line_Offset, 0), &along);
+    double length = run.trackLength;
+    double delta = along - run.lastAlong;
+    if (delta > length / 2)
+      delta -= length;
+    if (delta < -length / 2)
+      delta += length;
+    run.progress += delta;
+    run.lastAlong = along;
+    m.laps = run.progress / length;
+
+    if (t < Settle_S)
+      break;
+    double cm = d * 100;
+    m.lineSumCm += cm;
+    if (cm > m.lineMaxCm)
+      m.lineMaxCm = cm;
+    m.lineSamples++;
+    // None of the three sensors can see the tape any more
+    if (d > world.lineWidth / 2 + SimWorld::Line_Spacing)
+      m.offLineMs += dt_ms;
+    break;
+  }
+  case Scenario_Follow:
+  {
+    // The board wanders between 25 and 75 cm from the start line, then it is
+    // moved by hand: steps that the distance filter first rejects as
+    // outliers and then has to accept
+    if (t < Follow_Steps_S)
+    {
+      run.targetX = 0.5 + 0.25 * sin(2 * Pi * t / 6) * (t < 30 ? 1 : 0.5) + 0.05 * sin(2 * Pi * t / 1.7);
+    }
+    else
+    {
+      int step = (int)((t - Follow_Steps_S) / Follow_Step_Interval_S);
+      run.targetX = step % 2 ? 0.4 + Follow_Step : 0.4;
+      if (step != run.followStep)
+      {
+        if (run.followStep >= 0 && run.stepAt >= 0)
+          m.followUnsettled++;
+        run.followStep = step;
+        run.stepAt = t;
+        m.followSteps++;
+      }
+    }
+    world.walls[0] = Segment{Vec{run.targetX, -0.15}, Vec{run.targetX, 0.15}};
+    if (t < Settle_S)
+      break;
+    double gap = (run.targetX - world.carPoint(SimWorld::Sonar_Offset, 0).x) * 100;
+    double error = fabs(gap - 20);
+    m.followSumCm += error;
+    m.followSqSumCm += error * error;
+    if (error > m.followMaxCm)
+      m.followMaxCm = error;
+    m.followSamples++;
+    if (run.stepAt >= 0 && error < Follow_Settled_Cm)
+    {
+      double ms = (t - run.stepAt) * 1000;
+      m.followSettleTotalMs += ms;
+      if (ms > m.followSettleMaxMs)
+        m.followSettleMaxMs = ms;
+      run.stepAt = -1;
+    }
+    followLink(run, world, t);
+    break;
+  }
+  case Scenario_Replay:
+    replayStep(run, world, t);
+    break;
+  }
+}
+
+static Metrics simulate(const Options &options, uint32_t seed)
+{
+  static RunState run;
+  memset(&run.metrics, 0, sizeof(run.metrics));
+  run.options = options;
+  run.inEncounter = false;
+  run.progress = 0;
+  run.lineLost = false;
+  run.inManeuver = false;
+  run.pattern = protocol::Stop;
+  run.pwmLeft = 0;
+  run.pwmRight = 0;
+  run.lapping = false;
+  run.nextFrame = Settle_S;
+  run.nextProbe = Probe_Start_S;
+  run.probeSent = -1;
+  run.acks = 0;
+
+  SimWorld &world = simWorld();
+  buildScene(run, seed);
+  world.onStep = onStep;
+  world.stepContext = &run;
+  simSerialEcho(options.verbose);
+  FILE *record = options.record ? fopen(options.record, "w") : nullptr;
+  simSerialRecord(record);
+
+  setup();
+  if (options.scenario != Scenario_Replay)
+  {
+    static const uint8_t mode_for[] = {protocol::Mode2, protocol::Mode4, protocol::Mode3};
+    protocol::CommandFrame frame = protocol::encodeCommand(mode_for[options.scenario]);
+    simSerialSend((const uint8_t *)&frame, sizeof(frame));
+    if (record)
+    {
+      frame = protocol::encodeCommand(protocol::TraceStart);
+      simSerialSend((const uint8_t *)&frame, sizeof(frame));
+    }
+  }
+
+  uint64_t end = (uint64_t)(options.seconds * 1e6);
+  while (world.now() < end)
+  {
+    loop();
+    world.advance(Loop_Overhead_Us);
+  }
+
+  if (run.inEncounter || run.inManeuver)
+    run.metrics.unresolved++;
+  // A step the end of the run cut short is not counted
+  if (run.stepAt >= 0 && world.now() / 1e6 - run.stepAt >= Follow_Step_Interval_S)
+    run.metrics.followUnsettled++;
+  else if (run.stepAt >= 0)
+    run.metrics.followSteps--;
+  run.metrics.rxOverflow = simSerialOverflow();
+  run.metrics.seconds = world.now() / 1e6;
+  if (record)
+    fclose(record);
+  return run.metrics;
+}
+
+// Runs one simulation in a child process and collects its metrics
+static bool simulateIsolated(const Options &options, uint32_t seed, Metrics &out)
+{
+  int fds[2];
+  if (pipe(fds) != 0)
+    return false;
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid < 0)
+    return false;
+  if (pid == 0)
+  {
+    close(fds[0]);
+    Metrics m = simulate(options, seed);
+    ssize_t written = write(fds[1], &m, sizeof(m));
+    fflush(stdout);
+    _exit(written == (ssize_t)sizeof(m) ? 0 : 1);
+  }
+  close(fds[1]);
+  ssize_t got = read(fds[0], &out, sizeof(out));
+  close(fds[0]);
+  int status = 0;
+  waitpid(pid, &status, 0);
+  return got == (ssize_t)sizeof(out) && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static void printRun(const Options &options, const char *label, const Metrics &m)
+{
+  printf("%-11s %6.1f m  collisions %-3lu ", label, m.distance, m.collisions);
+  switch (options.scenario)
+  {
+  case Scenario_Avoid:
+    printf("encounters %-4lu time-to-avoid mean %6.0f ms max %6.0f ms unresolved %lu\n", m.encounters,
+           m.encounters ? m.avoidTotalMs / m.encounters : 0.0, m.avoidMaxMs, m.unresolved);
+    break;
+  case Scenario_Track:
+    printf("laps %5.2f  deviation mean %5.2f cm max %5.2f cm  off line %6.0f ms\n", m.laps,
+           m.lineSamples ? m.lineSumCm / m.lineSamples : 0.0, m.lineMaxCm, m.offLineMs);
+    break;
+  case Scenario_Follow:
+    printf("error mean %5.2f cm rms %5.2f cm max %5.2f cm  settle mean %4.0f ms max %4.0f ms unsettled %lu"
+           "  command mean %4.0f ms max %4.0f ms lost %lu  rx overflow %lu\n",
+           m.followSamples ? m.followSumCm / m.followSamples : 0.0,
+           m.followSamples ? sqrt(m.followSqSumCm / m.followSamples) : 0.0, m.followMaxCm,
+           m.followSteps > m.followUnsettled ? m.followSettleTotalMs / (m.followSteps - m.followUnsettled) : 0.0,
+           m.followSettleMaxMs, m.followUnsettled, m.probeAcks ? m.probeTotalMs / m.probeAcks : 0.0, m.probeMaxMs,
+           m.probeLost, m.rxOverflow);
+    break;
+  case Scenario_Replay:
+    printf("decisions %lu (recorded %lu)\n", m.decisions, m.recordedDecisions);
+    printf("  line lost %lu times, reacted %lu: mean %5.0f ms max %5.0f ms\n", m.lineLosses, m.lineReactions,
+           m.lineReactions ? m.lineReactionTotalMs / m.lineReactions : 0.0, m.lineReactionMaxMs);
+    printf("  avoidance maneuvers %lu: mean %5.0f ms max %5.0f ms, unfinished %lu\n", m.maneuvers,
+           m.maneuvers ? m.maneuverTotalMs / m.maneuvers : 0.0, m.maneuverMaxMs, m.unresolved);
+    printf("  laps %.0f: mean %5.0f ms best %5.0f ms worst %5.0f ms, deviation mean %5.2f cm max %5.2f cm"
+           ", off line %6.0f ms\n",
+           m.laps, m.laps ? m.lapTotalMs / m.laps : 0.0, m.lapMinMs, m.lapMaxMs,
+           m.lineSamples ? m.lineSumCm / m.lineSamples : 0.0, m.lineMaxCm, m.offLineMs);
+    break;
+  }
+}
+
+// Replay expectations, false when one of them is missed
+static bool checkReplay(const Options &options, const Metrics &m)
+{
+  bool ok = true;
+  if (options.maxLineReactionMs >= 0)
+  {
+    if (m.lineReactionMaxMs > options.maxLineReactionMs)
+    {
+      printf("FAIL line reaction %.0f ms exceeds %.0f ms\n", m.lineReactionMaxMs, options.maxLineReactionMs);
+      ok = false;
+    }
+    if (m.lineReactions < m.lineLosses)
+    {
+      printf("FAIL the line was lost %lu times but searched for only %lu\n", m.lineLosses, m.lineReactions);
+      ok = false;
+    }
+  }
+  if (options.maxAvoidMs >= 0)
+  {
+    if (m.maneuverMaxMs > options.maxAvoidMs)
+    {
+      printf("FAIL avoidance took %.0f ms, more than %.0f ms\n", m.maneuverMaxMs, options.maxAvoidMs);
+      ok = false;
+    }
+    if (m.unresolved > 0)
+    {
+      printf("FAIL avoidance still running at the end of the trace\n");
+      ok = false;
+    }
+  }
+  if (options.maxLapMs >= 0)
+  {
+    if (m.laps == 0)
+    {
+      printf("FAIL no complete lap in the trace\n");
+      ok = false;
+    }
+    else if (m.lapMaxMs > options.maxLapMs)
+    {
+      printf("FAIL a lap took %.0f ms, more than %.0f ms\n", m.lapMaxMs, options.maxLapMs);
+      ok = false;
+    }
+  }
+  if (options.maxLineDeviationCm >= 0 && m.lineSamples &&
+      m.lineSumCm / m.lineSamples > options.maxLineDeviationCm)
+  {
+    printf("FAIL mean line deviation %.2f cm exceeds %.2f cm\n", m.lineSumCm / m.lineSamples,
+           options.maxLineDeviationCm);
+    ok = false;
+  }
+  return ok;
+}
+
+// Follow expectations over all runs, false when one of them is missed
+static bool checkFollow(const Options &options, const Metrics &m)
+{
+  bool ok = true;
+  double mean = m.followSamples ? m.followSumCm / m.followSamples : 0.0;
+  if (options.maxFollowErrorCm >= 0 && mean > options.maxFollowErrorCm)
+  {
+    printf("FAIL mean follow error %.2f cm exceeds %.2f cm\n", mean, options.maxFollowErrorCm);
+    ok = false;
+  }
+  if (options.maxFollowSettleMs >= 0)
+  {
+    if (m.followSettleMaxMs > options.maxFollowSettleMs)
+    {
+      printf("FAIL the car took %.0f ms to settle after a step, more than %.0f ms\n", m.followSettleMaxMs,
+             options.maxFollowSettleMs);
+      ok = false;
+    }
+    if (m.followUnsettled > 0)
+    {
+      printf("FAIL the car never settled after %lu of %lu steps\n", m.followUnsettled, m.followSteps);
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+static void usage(const char *name)
+{
+  fprintf(stderr,
+          "usage: %s avoid|track|follow [--runs N] [--seconds S] [--seed N] [--noise P] [--record CSV]\n"
+          "                [--verbose]\n"
+          "       %s follow [--camera-hz N] [--max-follow-error CM] [--max-follow-settle MS] ...\n"
+          "       %s replay TRACE.csv [--max-line-reaction MS] [--max-avoid MS] [--max-lap-ms MS]\n"
+          "                [--max-line-deviation CM] [--decisions] [--verbose]\n"
+          "  --noise P   chance per ultrasonic shot of a lost echo, half as likely a spurious one\n"
+          "  --record    write the trace of the run as /trace serves it, the last run with --runs\n"
+          "  --verbose   print what the firmware writes to Serial\n"
+          "  --decisions print every change of the motor output\n"
+          "  --camera-hz also send the camera's VisionTarget frames at this rate\n",
+          name, name, name);
+}
+
+int main(int argc, char **argv)
+{
+  Options options;
+  if (argc < 2)
+  {
+    usage(argv[0]);
+    return 2;
+  }
+  if (strcmp(argv[1], "avoid") == 0)
+    options.scenario = Scenario_Avoid;
+  else if (strcmp(argv[1], "track") == 0)
+    options.scenario = Scenario_Track;
+  else if (strcmp(argv[1], "follow") == 0)
+    options.scenario = Scenario_Follow;
+  else if (strcmp(argv[1], "replay") == 0 && argc > 2)
+    options.scenario = Scenario_Replay;
+  else
+  {
+    usage(argv[0]);
+    return 2;
+  }
+
+  int first_option = 2;
+  if (options.scenario == Scenario_Replay)
+  {
+    if (!replay.load(argv[2]))
+    {
+      fprintf(stderr, "cannot read a trace from %s\n", argv[2]);
+      return 2;
+    }
+    options.seconds = (Replay_Lead_Ms + replay.duration()) / 1000.0 + 1;
+    first_option = 3;
+  }
+
+  for (int i = first_option; i < argc; i++)
+  {
+    bool has_value = i + 1 < argc;
+    if (strcmp(argv[i], "--runs") == 0 && has_value)
+      options.runs = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--seconds") == 0 && has_value)
+      options.seconds = atof(argv[++i]);
+    else if (strcmp(argv[i], "--seed") == 0 && has_value)
+      options.seed = (uint32_t)strtoul(argv[++i], nullptr, 10);
+    else if (strcmp(argv[i], "--noise") == 0 && has_value)
+      options.noise = atof(argv[++i]);
+    else if (strcmp(argv[i], "--verbose") == 0)
+      options.verbose = true;
+    else if (strcmp(argv[i], "--decisions") == 0)
+      options.decisions = true;
+    else if (strcmp(argv[i], "--max-line-reaction") == 0 && has_value)
+      options.maxLineReactionMs = atof(argv[++i]);
+    else if (strcmp(argv[i], "--max-avoid") == 0 && has_value)
+      options.maxAvoidMs = atof(argv[++i]);
+    else if (strcmp(argv[i], "--max-lap-ms") == 0 && has_value)
+      options.maxLapMs = atof(argv[++i]);
+    else if (strcmp(argv[i], "--max-line-deviation") == 0 && has_value)
+      options.maxLineDeviationCm = atof(argv[++i]);
+    else if (strcmp(argv[i], "--record") == 0 && has_value && options.scenario != Scenario_Replay)
+      options.record = argv[++i];
+    else if (strcmp(argv[i], "--max-follow-error") == 0 && has_value && options.scenario == Scenario_Follow)
+      options.maxFollowErrorCm = atof(argv[++i]);
+    else if (strcmp(argv[i], "--max-follow-settle") == 0 && has_value && options.scenario == Scenario_Follow)
+      options.maxFollowSettleMs = atof(argv[++i]);
+    else if (strcmp(argv[i], "--camera-hz") == 0 && has_value)
+      options.cameraHz = atof(argv[++i]);
+    else
+    {
+      usage(argv[0]);
+      return 2;
+    }
+  }
+
+  if (options.scenario == Scenario_Replay)
+  {
+    // A replay is deterministic, one run says it all
+    Metrics m;
+    if (!simulateIsolated(options, options.seed, m))
+    {
+      fprintf(stderr, "replay failed\n");
+      return 1;
+    }
+    printRun(options, "replay", m);
+    return checkReplay(options, m) ? 0 : 1;
+  }
+
+  struct timespec start, finish;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  Metrics total;
+  memset(&total, 0, sizeof(total));
+  int completed = 0;
+  for (int i = 0; i < options.runs; i++)
+  {
+    uint32_t seed = options.seed + i;
+    Metrics m;
+    if (!simulateIsolated(options, seed, m))
+    {
+      fprintf(stderr, "seed %u: simulation failed\n", seed);
+      continue;
+    }
+    char label[16];
+    snprintf(label, sizeof(label), "seed %u", seed);
+    printRun(options, label, m);
+    completed++;
+    total.seconds += m.seconds;
+    total.distance += m.distance;
+    total.collisions += m.collisions;
+    total.encounters += m.encounters;
+    total.unresolved += m.unresolved;
+    total.avoidTotalMs += m.avoidTotalMs;
+    if (m.avoidMaxMs > total.avoidMaxMs)
+      total.avoidMaxMs = m.avoidMaxMs;
+    total.laps += m.laps;
+    total.lineSumCm += m.lineSumCm;
+    total.lineSamples += m.lineSamples;
+    if (m.lineMaxCm > total.lineMaxCm)
+      total.lineMaxCm = m.lineMaxCm;
+    total.offLineMs += m.offLineMs;
+    total.followSumCm += m.followSumCm;
+    total.followSqSumCm += m.followSqSumCm;
+    total.followSamples += m.followSamples;
+    if (m.followMaxCm > total.followMaxCm)
+      total.followMaxCm = m.followMaxCm;
+    total.followSteps += m.followSteps;
+    total.followUnsettled += m.followUnsettled;
+    total.followSettleTotalMs += m.followSettleTotalMs;
+    if (m.followSettleMaxMs > total.followSettleMaxMs)
+      total.followSettleMaxMs = m.followSettleMaxMs;
+    total.probeAcks += m.probeAcks;
+    total.probeLost += m.probeLost;
+    total.probeTotalMs += m.probeTotalMs;
+    if (m.probeMaxMs > total.probeMaxMs)
+      total.probeMaxMs = m.probeMaxMs;
+    total.rxOverflow += m.rxOverflow;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &finish);
+  double wall = (finish.tv_sec - start.tv_sec) + (finish.tv_nsec - start.tv_nsec) / 1e9;
+  if (completed > 1)
+  {
+    // Averages per run, maxima over all runs
+    total.distance /= completed;
+    total.laps /= completed;
+    total.offLineMs /= completed;
+    printf("---\n");
+    printRun(options, "total", total);
+  }
+  printf("%d runs, %.0f s simulated in %.2f s (%.0fx real time)\n", completed, total.seconds, wall,
+         wall > 0 ? total.seconds / wall : 0.0);
+  bool ok = checkFollow(options, total);
+  return completed == options.runs && ok ? 0 : 1;
+}
@@ -0,0 +1,18 @@
+#ifndef SERVO_MOCK_H
+#define SERVO_MOCK_H
+
+#include <Arduino.h>
+
+// The simulated servo slews towards the written angle at its physical speed
+class Servo {
+public:
+    uint8_t attach(int pin);
+    void write(int angle);
+    int read();
+    bool attached() { return _pin >= 0; }
+
+private:
+    int _pin = -1;
+};
+
+#endif
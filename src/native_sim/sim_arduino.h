@@ -0,0 +1,36 @@
+#ifndef SIM_ARDUINO_H
+#define SIM_ARDUINO_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "sim_world.h"
+
+// Glue between the mocked Arduino core and the simulated world
+
+// Wiring of the car, as in src/arduino_uno/main.cpp
+const uint8_t Sim_Servo_Pin = 9;
+const uint8_t Sim_Pwm1_Pin = 5;
+const uint8_t Sim_Pwm2_Pin = 6;
+const uint8_t Sim_Shcp_Pin = 2;
+const uint8_t Sim_En_Pin = 7;
+const uint8_t Sim_Data_Pin = 8;
+const uint8_t Sim_Stcp_Pin = 4;
+const uint8_t Sim_Echo_Pin = 13;
+const uint8_t Sim_Line_Pins[3] = {14, 15, 16}; // A0..A2
+
+// The world every mocked call reads from and advances
+SimWorld &simWorld();
+
+// Queue bytes on the UNO's RX line, they arrive at 115200 baud from now on
+void simSerialSend(const uint8_t *data, size_t length);
+// Bytes lost because the firmware's 64 byte RX buffer was full
+unsigned long simSerialOverflow();
+// Ack frames the firmware has written so far
+unsigned long simSerialAcks();
+// Write the trace frames the firmware sends as /trace CSV, nullptr to stop
+void simSerialRecord(FILE *file);
+// Copy what the firmware prints to stdout
+void simSerialEcho(bool echo);
+
+#endif
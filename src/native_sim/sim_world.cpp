@@ -0,0 +1,241 @@
+#include "sim_world.h"
+
+#include <math.h>
+#include <robot_protocol.h>
+
+static const double Pi = 3.14159265358979323846;
+static const double Step_S = 0.001;            // physics step
+static const double Sonar_Range = 4.0;         // metres
+static const double Sonar_Half_Cone = 7.5;     // degrees, rays at the cone edges
+static const int Line_Black = 850;             // analogRead() over the line
+static const int Line_White = 90;              // analogRead() over the floor
+static const double Line_Blur = 0.004;         // sensor spot radius
+
+// Wheel directions for each 74HC595 pattern: front left, front right, rear
+// left, rear right. Left wheels run at PWM1, right wheels at PWM2.
+static const int8_t Wheel_Signs[protocol::Direction_Count][4] = {
+    {0, 0, 0, 0},     // Dir_Stop
+    {1, 1, 1, 1},     // Dir_Forward
+    {-1, -1, -1, -1}, // Dir_Backward
+    {-1, 1, 1, -1},   // Dir_Turn_Left
+    {1, -1, -1, 1},   // Dir_Turn_Right
+    {0, 1, 1, 0},     // Dir_Top_Left
+    {-1, 0, 0, -1},   // Dir_Bottom_Left
+    {1, 0, 0, 1},     // Dir_Top_Right
+    {0, -1, -1, 0},   // Dir_Bottom_Right
+    {1, -1, 1, -1},   // Dir_Clockwise
+    {-1, 1, -1, 1},   // Dir_Contrarotate
+};
+
+static double dot(Vec a, Vec b) { return a.x * b.x + a.y * b.y; }
+static Vec sub(Vec a, Vec b) { return Vec{a.x - b.x, a.y - b.y}; }
+
+static double segmentDistance(Vec p, Segment s, double *t_out) {
+    Vec ab = sub(s.b, s.a);
+    double len2 = dot(ab, ab);
+    double t = len2 > 0 ? dot(sub(p, s.a), ab) / len2 : 0;
+    t = t < 0 ? 0 : (t > 1 ? 1 : t);
+    if (t_out)
+        *t_out = t;
+    Vec d = sub(p, Vec{s.a.x + ab.x * t, s.a.y + ab.y * t});
+    return sqrt(dot(d, d));
+}
+
+// Distance along the ray to the segment, -1 when it misses
+static double rayHit(Vec origin, Vec dir, Segment s) {
+    Vec e = sub(s.b, s.a);
+    double denom = dir.x * e.y - dir.y * e.x;
+    if (fabs(denom) < 1e-12)
+        return -1;
+    Vec w = sub(s.a, origin);
+    double t = (w.x * e.y - w.y * e.x) / denom;
+    double u = (w.x * dir.y - w.y * dir.x) / denom;
+    return t >= 0 && u >= 0 && u <= 1 ? t : -1;
+}
+
+SimWorld::SimWorld() {
+    lineWidth = 0.018;
+    echoDropout = 0;
+    echoSpurious = 0;
+    replaying = false;
+    replayRangeCm = -1;
+    replayLine[0] = replayLine[1] = replayLine[2] = Line_White;
+    position = Vec{0, 0};
+    heading = 0;
+    shiftRegister = 0;
+    latched = 0;
+    enabled = false;
+    pwmLeft = 0;
+    pwmRight = 0;
+    servoAngle = 90;
+    servoTarget = 90;
+    onStep = nullptr;
+    stepContext = nullptr;
+    _now = 0;
+    _rng = 1;
+    _speed = 0;
+    _collisions = 0;
+    _touching = false;
+}
+
+double SimWorld::random() {
+    // xorshift32, reproducible for a given seed
+    _rng ^= _rng << 13;
+    _rng ^= _rng >> 17;
+    _rng ^= _rng << 5;
+    return _rng / 4294967296.0;
+}
+
+void SimWorld::advance(uint64_t us) {
+    uint64_t target = _now + us;
+    const uint64_t step_us = (uint64_t)(Step_S * 1e6);
+    // Physics runs on fixed step boundaries whatever the call granularity
+    while ((_now / step_us + 1) * step_us <= target) {
+        _now = (_now / step_us + 1) * step_us;
+        step(Step_S);
+    }
+    _now = target;
+}
+
+Vec SimWorld::carPoint(double forward, double left) const {
+    double c = cos(heading), s = sin(heading);
+    return Vec{position.x + forward * c - left * s, position.y + forward * s + left * c};
+}
+
+bool SimWorld::blocked(Vec p) const {
+    for (const Segment &w : walls) {
+        if (segmentDistance(p, w, nullptr) < Car_Radius)
+            return true;
+    }
+    return false;
+}
+
+void SimWorld::step(double dt) {
+    // Servo horn
+    double delta = servoTarget - servoAngle;
+    double max_move = Servo_Speed * dt;
+    servoAngle += delta > max_move ? max_move : (delta < -max_move ? -max_move : delta);
+
+    // Mecanum kinematics from the wheel speeds
+    double vx = 0, vy = 0, w = 0;
+    int8_t dir = protocol::commandDirection(latched);
+    if (enabled && dir > 0) {
+        double left = pwmLeft < Stall_Pwm ? 0 : Max_Wheel_Speed * pwmLeft / 255.0;
+        double right = pwmRight < Stall_Pwm ? 0 : Max_Wheel_Speed * pwmRight / 255.0;
+        const int8_t *s = Wheel_Signs[dir];
+        double fl = s[0] * left, fr = s[1] * right, rl = s[2] * left, rr = s[3] * right;
+        vx = (fl + fr + rl + rr) / 4;
+        vy = (-fl + fr + rl - rr) / 4;
+        w = (-fl + fr - rl + rr) / (4 * Wheel_Base);
+    }
+
+    double c = cos(heading), s = sin(heading);
+    Vec next{position.x + (vx * c - vy * s) * dt, position.y + (vx * s + vy * c) * dt};
+    heading += w * dt;
+    if (heading > Pi)
+        heading -= 2 * Pi;
+    if (heading < -Pi)
+        heading += 2 * Pi;
+
+    bool hit = blocked(next);
+    if (hit) {
+        if (!_touching)
+            _collisions++;
+        _speed = 0;
+    } else {
+        _speed = sqrt(vx * vx + vy * vy);
+        position = next;
+    }
+    _touching = hit;
+
+    if (onStep)
+        onStep(*this, stepContext);
+}
+
+double SimWorld::rayDistance(Vec origin, double angle, double range) const {
+    Vec dir{cos(angle), sin(angle)};
+    double nearest = -1;
+    for (const Segment &wall : walls) {
+        double d = rayHit(origin, dir, wall);
+        if (d >= 0 && d <= range && (nearest < 0 || d < nearest))
+            nearest = d;
+    }
+    return nearest;
+}
+
+double SimWorld::sonarDistance() const {
+    Vec origin = carPoint(Sonar_Offset, 0);
+    double centre = heading + (servoAngle - 90) * Pi / 180;
+    double nearest = -1;
+    for (int ray = -1; ray <= 1; ray++) {
+        double d = rayDistance(origin, centre + ray * Sonar_Half_Cone * Pi / 180, Sonar_Range);
+        if (d >= 0 && (nearest < 0 || d < nearest))
+            nearest = d;
+    }
+    return nearest;
+}
+
+unsigned long SimWorld::echoMicros(unsigned long timeout) {
+    double d;
+    if (replaying) {
+        d = replayRangeCm < 0 ? -1 : replayRangeCm / 100;
+    } else {
+        d = sonarDistance();
+        double r = random();
+        if (r < echoDropout)
+            d = -1;
+        else if (r < echoDropout + echoSpurious)
+            d = 0.03 + random() * 0.3;
+    }
+
+    // The HC-SR04 raises echo about 450 us after the trigger
+    advance(450);
+    unsigned long echo = d < 0 ? 38000 : (unsigned long)(d * 100 * 58);
+    if (echo > timeout) {
+        advance(timeout);
+        return 0;
+    }
+    advance(echo);
+    return echo;
+}
+
+double SimWorld::trackDistance(Vec p, double *along) const {
+    double best = -1, walked = 0, best_along = 0;
+    for (size_t i = 0; i < track.size(); i++) {
+        Segment s{track[i], track[(i + 1) % track.size()]};
+        double t;
+        double d = segmentDistance(p, s, &t);
+        Vec e = sub(s.b, s.a);
+        double len = sqrt(dot(e, e));
+        if (best < 0 || d < best) {
+            best = d;
+            best_along = walked + t * len;
+        }
+        walked += len;
+    }
+    if (along)
+        *along = best_along;
+    return best;
+}
+
+double SimWorld::trackLength() const {
+    double total = 0;
+    for (size_t i = 0; i < track.size(); i++) {
+        Vec e = sub(track[(i + 1) % track.size()], track[i]);
+        total += sqrt(dot(e, e));
+    }
+    return total;
+}
+
+int SimWorld::lineSensor(int index) const {
+    if (replaying)
+        return replayLine[index];
+    if (track.empty())
+        return Line_White;
+    Vec p = carPoint(Line_Offset, (1 - index) * Line_Spacing);
+    double edge = trackDistance(p) - lineWidth / 2;
+    // Linear fade while the sensor spot straddles the edge of the tape
+    double cover = 0.5 - edge / (2 * Line_Blur);
+    cover = cover < 0 ? 0 : (cover > 1 ? 1 : cover);
+    return (int)(Line_White + (Line_Black - Line_White) * cover);
+}
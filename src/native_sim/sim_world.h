@@ -0,0 +1,91 @@
+#ifndef SIM_WORLD_H
+#define SIM_WORLD_H
+
+#include <stdint.h>
+#include <vector>
+
+// Flat 2D world for the host simulation: a mecanum car driven by the latched
+// 74HC595 pattern and the two PWM outputs, the ultrasonic sensor on its
+// servo, three line sensors and a set of walls. Units are metres, radians and
+// microseconds; x forward and y left in the car frame, heading 0 along +x.
+struct Vec {
+    double x, y;
+};
+
+struct Segment {
+    Vec a, b;
+};
+
+class SimWorld {
+public:
+    // Car geometry and drive train
+    static constexpr double Car_Radius = 0.10;      // collision circle
+    static constexpr double Wheel_Base = 0.16;      // lx + ly of the mecanum layout
+    static constexpr double Max_Wheel_Speed = 0.60; // m/s at PWM 255
+    static constexpr int Stall_Pwm = 60;            // wheels do not turn below this
+    static constexpr double Sonar_Offset = 0.09;    // sensor ahead of the centre
+    static constexpr double Line_Offset = 0.07;     // line sensors ahead of the centre
+    static constexpr double Line_Spacing = 0.015;   // between neighbouring line sensors
+    static constexpr double Servo_Speed = 450;      // degrees per second, physical horn
+
+    SimWorld();
+
+    // Scene
+    std::vector<Segment> walls;
+    std::vector<Vec> track; // closed polyline of the black line
+    double lineWidth;
+    // Chance per shot of a lost echo or a spurious short reading
+    double echoDropout;
+    double echoSpurious;
+    void seed(uint32_t seed) { _rng = seed ? seed : 1; }
+
+    // While replaying a trace the recorded readings replace the modelled ones
+    bool replaying;
+    double replayRangeCm; // negative for no echo
+    int replayLine[3];
+
+    // Car pose
+    Vec position;
+    double heading;
+
+    // Actuators, written by the mocked Arduino core
+    uint8_t shiftRegister;
+    uint8_t latched;
+    bool enabled;
+    int pwmLeft, pwmRight;
+    double servoAngle, servoTarget;
+
+    uint64_t now() const { return _now; }
+    void advance(uint64_t us);
+
+    // Sensors
+    double sonarDistance() const; // metres along the beam, -1 when nothing is in range
+    double rayDistance(Vec origin, double angle, double range) const;
+    unsigned long echoMicros(unsigned long timeout);
+    int lineSensor(int index) const; // 0 left, 1 centre, 2 right
+    // Distance from a point to the track centre line and how far along it
+    double trackDistance(Vec p, double *along = nullptr) const;
+    double trackLength() const;
+
+    Vec carPoint(double forward, double left) const;
+    double velocity() const { return _speed; }
+    unsigned long collisions() const { return _collisions; }
+    bool touching() const { return _touching; }
+
+    // Called after every physics step, e.g. to move targets or sample metrics
+    void (*onStep)(SimWorld &world, void *context);
+    void *stepContext;
+
+private:
+    uint64_t _now;
+    uint32_t _rng;
+    double _speed;
+    unsigned long _collisions;
+    bool _touching;
+
+    void step(double dt);
+    bool blocked(Vec p) const;
+    double random();
+};
+
+#endif
@@ -0,0 +1,97 @@
+#include "trace_replay.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <robot_protocol.h>
+#include "sim_arduino.h"
+
+static int kindByName(const char *name) {
+    for (uint8_t kind = 0; kind < protocol::Trace_Kinds; kind++) {
+        if (strcmp(name, protocol::traceKindName(kind)) == 0)
+            return kind;
+    }
+    return -1;
+}
+
+bool TraceReplay::load(const char *path) {
+    FILE *file = fopen(path, "r");
+    if (!file)
+        return false;
+
+    _samples.clear();
+    char line[128];
+    uint32_t first = 0;
+    while (fgets(line, sizeof(line), file)) {
+        unsigned long time;
+        char name[16];
+        unsigned a, b, c;
+        // The header line and anything else malformed is skipped
+        if (sscanf(line, "%lu,%15[^,],%u,%u,%u", &time, name, &a, &b, &c) != 5)
+            continue;
+        int kind = kindByName(name);
+        if (kind < 0)
+            continue;
+        if (_samples.empty() || time < first)
+            first = time;
+        Sample sample;
+        sample.time = (uint32_t)time;
+        sample.kind = (uint8_t)kind;
+        sample.value[0] = a;
+        sample.value[1] = b;
+        sample.value[2] = c;
+        _samples.push_back(sample);
+    }
+    fclose(file);
+    // Frames can reach the ESP32 slightly out of order around a command
+    std::stable_sort(_samples.begin(), _samples.end(),
+                     [](const Sample &a, const Sample &b) { return a.time < b.time; });
+    for (Sample &sample : _samples)
+        sample.time -= first;
+    rewind();
+    return !_samples.empty();
+}
+
+void TraceReplay::rewind() {
+    _next = 0;
+    _mode = -1;
+    _drive = -1;
+}
+
+bool TraceReplay::recordedDrive(Sample &sample) const {
+    if (_drive < 0)
+        return false;
+    sample = _samples[_drive];
+    return true;
+}
+
+void TraceReplay::apply(SimWorld &world, uint32_t elapsed_ms) {
+    world.replaying = true;
+    for (; _next < _samples.size() && _samples[_next].time <= elapsed_ms; _next++) {
+        const Sample &s = _samples[_next];
+        switch (s.kind) {
+        case protocol::Trace_Mode:
+        case protocol::Trace_Command: {
+            uint8_t command = s.kind == protocol::Trace_Mode ? protocol::Mode1 + s.value[0] : s.value[0];
+            if (protocol::modeIndex(command) >= 0)
+                _mode = protocol::modeIndex(command);
+            protocol::CommandFrame frame = protocol::encodeCommand(command);
+            simSerialSend((const uint8_t *)&frame, sizeof(frame));
+            break;
+        }
+        case protocol::Trace_Range:
+            world.replayRangeCm = s.value[0];
+            break;
+        case protocol::Trace_Line:
+            for (int i = 0; i < 3; i++)
+                world.replayLine[i] = s.value[i];
+            break;
+        case protocol::Trace_Drive:
+            // Recorded motor decisions are for comparison only
+            _drive = (int)_next;
+            break;
+        default:
+            break;
+        }
+    }
+}
@@ -0,0 +1,40 @@
+#ifndef TRACE_REPLAY_H
+#define TRACE_REPLAY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include "sim_world.h"
+
+// A trace recorded on the car (the CSV served by the ESP32 at /trace), fed
+// back into the firmware: commands go to the serial port, sensor samples
+// replace the modelled readings and hold until the next sample.
+class TraceReplay {
+public:
+    struct Sample {
+        uint32_t time; // ms from the first sample
+        uint8_t kind;  // protocol::TraceKind
+        uint16_t value[3];
+    };
+
+    bool load(const char *path);
+    const std::vector<Sample> &samples() const { return _samples; }
+    uint32_t duration() const { return _samples.empty() ? 0 : _samples.back().time; }
+
+    void rewind();
+    // Applies every sample due at elapsed_ms
+    void apply(SimWorld &world, uint32_t elapsed_ms);
+    bool done() const { return _next >= _samples.size(); }
+    // Mode index the car is in at the current replay position, -1 if unknown
+    int mode() const { return _mode; }
+    // Last recorded motor output applied, false before the first one
+    bool recordedDrive(Sample &sample) const;
+
+private:
+    std::vector<Sample> _samples;
+    size_t _next;
+    int _mode;
+    int _drive; // index of the last Trace_Drive sample applied, -1 for none
+};
+
+#endif
@@ -0,0 +1,717 @@
+// Host test of the camera vision in lib/line_vision, lib/blob_vision and
+// lib/image_kernels on recorded frames. Line frames are 8 bit PGM files as served by GET
+// /vision/frame on the ESP32, colour frames are PPM files as served by GET
+// /blob/frame. The expected line offset or target bearing can be checked;
+// --expect applies to the files before it that have none yet:
+//
+//   pio run -e vision_host
+//   .pio/build/vision_host/program frame1.pgm frame2.pgm --expect -40 --tolerance 10
+//   .pio/build/vision_host/program ball.ppm --target 200,40,40 --expect 30
+//
+// src/vision_host/frames holds rendered 80x60 line frames, the size the car
+// fits QVGA at, with vignetting, noise and RGB565 steps. Their expected
+// offsets are those of the least squares line through the tape centres on
+// the rows fitLine() scans, which for the curve is not where the tape crosses
+// the look-ahead row. platformio.ini has the command that checks all of them
+// within 3.
+//
+// "synthetic" and "blob" render frames with a known line or coloured target
+// under uneven lighting and noise and check that they are found. "blob" also
+// checks the word-packed tracker against the reference version:
+//
+//   .pio/build/vision_host/program synthetic --runs 1000 --max-error 3
+//   .pio/build/vision_host/program blob --runs 1000 --max-error 3
+//
+// "kernels" checks every image kernel against its reference version on
+// random images, including widths that leave a partial word, and reports
+// nanoseconds per pixel for both. GET /bench/kernels on the ESP32 reports
+// the same kernels in cycles per pixel.
+//
+//   .pio/build/vision_host/program kernels
+//
+// Exits with 1 when a check fails.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+#include <blob_vision.h>
+#include <image_kernels.h>
+#include <line_vision.h>
+
+// Same geometry as the ESP32 pipelines: QVGA decoded at 1/4 scale for the
+// line, at 1/2 scale (QQVGA) for the colour target
+static const uint16_t Synthetic_Width = 80;
+static const uint16_t Synthetic_Height = 60;
+static const uint16_t Blob_Width = 160;
+static const uint16_t Blob_Height = 120;
+// Tolerance of the colour targets, as on the ESP32
+static const uint8_t Blob_Tolerance = 12;
+// Repeats per frame for the timing
+static const int Timing_Repeats = 200;
+
+struct Frame
+{
+  uint16_t width;
+  uint16_t height;
+  std::vector<uint8_t> pixels;
+};
+
+struct ColorFrame
+{
+  uint16_t width;
+  uint16_t height;
+  std::vector<uint16_t> pixels;
+};
+
+struct FileCheck
+{
+  const char *path;
+  bool checkExpect;
+  int expect;
+};
+
+struct Options
+{
+  bool synthetic = false;
+  bool blob = false;
+  bool kernels = false;
+  uint8_t target[3] = {200, 40, 40};
+  int runs = 200;
+  uint32_t seed = 1;
+  double maxError = 3;
+  int tolerance = 10;
+  bool verbose = false;
+  std::vector<FileCheck> files;
+};
+
+static double nowNs()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Rows above this are too far ahead to see the tape reliably, as on the car
+static uint16_t firstRow(uint16_t height)
+{
+  return height / 3;
+}
+
+static vision::LineFit fit(const Frame &frame)
+{
+  uint16_t first = firstRow(frame.height);
+  return vision::fitLine(frame.pixels.data(), frame.width, frame.height, frame.width, first, first);
+}
+
+static double timeFit(const Frame &frame)
+{
+  volatile int sink = 0;
+  double start = nowNs();
+  for (int i = 0; i < Timing_Repeats; i++)
+  {
+    sink += fit(frame).offset;
+  }
+  (void)sink;
+  return (nowNs() - start) / Timing_Repeats;
+}
+
+static bool readPgm(const char *path, Frame &frame)
+{
+  FILE *f = fopen(path, "rb");
+  if (!f)
+  {
+    return false;
+  }
+  int width = 0;
+  int height = 0;
+  int maxval = 0;
+  bool ok = fscanf(f, "P5 %d %d %d", &width, &height, &maxval) == 3 && maxval == 255 && width > 0 && height > 0 &&
+            width <= 2048 && height <= 2048 && fgetc(f) != EOF;
+  if (ok)
+  {
+    frame.width = width;
+    frame.height = height;
+    frame.pixels.resize((size_t)width * height);
+    ok = fread(frame.pixels.data(), 1, frame.pixels.size(), f) == frame.pixels.size();
+  }
+  fclose(f);
+  return ok;
+}
+
+static uint16_t rgb565(int r, int g, int b)
+{
+  r = r < 0 ? 0 : r > 255 ? 255 : r;
+  g = g < 0 ? 0 : g > 255 ? 255 : g;
+  b = b < 0 ? 0 : b > 255 ? 255 : b;
+  return ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3);
+}
+
+static bool readPpm(const char *path, ColorFrame &frame)
+{
+  FILE *f = fopen(path, "rb");
+  if (!f)
+  {
+    return false;
+  }
+  int width = 0;
+  int height = 0;
+  int maxval = 0;
+  bool ok = fscanf(f, "P6 %d %d %d", &width, &height, &maxval) == 3 && maxval == 255 && width > 0 && height > 0 &&
+            width <= 2048 && height <= 2048 && fgetc(f) != EOF;
+  if (ok)
+  {
+    std::vector<uint8_t> rgb((size_t)width * height * 3);
+    ok = fread(rgb.data(), 1, rgb.size(), f) == rgb.size();
+    frame.width = width;
+    frame.height = height;
+    frame.pixels.resize((size_t)width * height);
+    for (size_t i = 0; ok && i < frame.pixels.size(); i++)
+    {
+      frame.pixels[i] = rgb565(rgb[3 * i], rgb[3 * i + 1], rgb[3 * i + 2]);
+    }
+  }
+  fclose(f);
+  return ok;
+}
+
+static double uniform()
+{
+  return rand() / (RAND_MAX + 1.0);
+}
+
+// Dark tape of random width and angle on a floor lit from one side. Returns
+// the true offset at the look-ahead row in the units of LineFit::offset.
+static double renderLine(Frame &frame)
+{
+  frame.width = Synthetic_Width;
+  frame.height = Synthetic_Height;
+  frame.pixels.resize(frame.width * frame.height);
+
+  double half_width = 1.5 + 2.5 * uniform();
+  double center = frame.width * (0.2 + 0.6 * uniform());
+  // Pixels the line moves right per row going down
+  double slope = (uniform() - 0.5) * 1.2;
+  double floor_level = 150 + 80 * uniform();
+  double tape_level = 20 + 50 * uniform();
+  double gradient = (uniform() - 0.5) * 60;
+  uint16_t look_ahead = firstRow(frame.height);
+
+  for (int y = 0; y < frame.height; y++)
+  {
+    double line_x = center + slope * (y - look_ahead);
+    for (int x = 0; x < frame.width; x++)
+    {
+      double d = fabs(x + 0.5 - line_x);
+      // Soft edge one pixel wide, like the decoded thumbnail
+      double cover = d <= half_width - 0.5 ? 1 : d >= half_width + 0.5 ? 0 : half_width + 0.5 - d;
+      double v = floor_level + gradient * x / frame.width;
+      v += (tape_level - v) * cover;
+      v += (uniform() - 0.5) * 16;
+      frame.pixels[y * frame.width + x] = v < 0 ? 0 : v > 255 ? 255 : (uint8_t)v;
+    }
+  }
+  return (center - frame.width / 2.0) * 127 / (frame.width / 2.0);
+}
+
+static int runSynthetic(const Options &options)
+{
+  srand(options.seed);
+  int found = 0;
+  double error_sum = 0;
+  double error_max = 0;
+  double ns_sum = 0;
+  Frame frame;
+  for (int run = 0; run < options.runs; run++)
+  {
+    double truth = renderLine(frame);
+    vision::LineFit result = fit(frame);
+    ns_sum += timeFit(frame);
+    if (!result.found)
+    {
+      if (options.verbose)
+      {
+        printf("run %d: line at %.1f not found\n", run, truth);
+      }
+      continue;
+    }
+    found++;
+    double error = fabs(result.offset - truth);
+    error_sum += error;
+    if (error > error_max)
+    {
+      error_max = error;
+    }
+    if (options.verbose)
+    {
+      printf("run %d: truth %.1f fit %d heading %d rows %u\n", run, truth, result.offset, result.heading,
+             result.rows);
+    }
+  }
+
+  double mean_error = found ? error_sum / found : 0;
+  double ns = ns_sum / options.runs;
+  printf("synthetic %ux%u: %d runs, found %d (%.1f%%), offset error mean %.2f max %.2f, %.0f ns per frame (%.1f ns "
+         "per pixel)\n",
+         Synthetic_Width, Synthetic_Height, options.runs, found, 100.0 * found / options.runs, mean_error, error_max,
+         ns, ns / (Synthetic_Width * Synthetic_Height));
+
+  bool ok = found == options.runs && mean_error <= options.maxError;
+  if (!ok)
+  {
+    printf("FAIL: every frame must be found with a mean error of at most %.1f\n", options.maxError);
+  }
+  return ok ? 0 : 1;
+}
+
+static bool sameBlob(const vision::BlobResult &a, const vision::BlobResult &b)
+{
+  return a.found == b.found && a.pixels == b.pixels && a.bearing == b.bearing && a.size == b.size &&
+         a.centerX == b.centerX && a.centerY == b.centerY;
+}
+
+static double timeBlob(const ColorFrame &frame, const vision::ColorTarget &target, bool reference)
+{
+  volatile int sink = 0;
+  double start = nowNs();
+  for (int i = 0; i < Timing_Repeats; i++)
+  {
+    vision::BlobResult blob =
+        reference ? vision::findBlobReference(frame.pixels.data(), frame.width, frame.height, frame.width, target)
+                  : vision::findBlob(frame.pixels.data(), frame.width, frame.height, frame.width, target);
+    sink += blob.bearing;
+  }
+  (void)sink;
+  return (nowNs() - start) / Timing_Repeats;
+}
+
+// Disc in the target colour on a floor and clutter of other colours, lit
+// from one side. Returns the true bearing in the units of BlobResult.
+static double renderBlob(ColorFrame &frame, const uint8_t *color)
+{
+  frame.width = Blob_Width;
+  frame.height = Blob_Height;
+  frame.pixels.resize(frame.width * frame.height);
+
+  double radius = 6 + 20 * uniform();
+  double cx = radius + (frame.width - 2 * radius) * uniform();
+  double cy = radius + (frame.height - 2 * radius) * uniform();
+  double light = 0.6 + 0.5 * uniform();
+  double gradient = (uniform() - 0.5) * 0.4;
+  for (int y = 0; y < frame.height; y++)
+  {
+    for (int x = 0; x < frame.width; x++)
+    {
+      double shade = light * (1 + gradient * (x - frame.width / 2.0) / frame.width);
+      double dx = x + 0.5 - cx;
+      double dy = y + 0.5 - cy;
+      int r, g, b;
+      if (dx * dx + dy * dy <= radius * radius)
+      {
+        r = color[0];
+        g = color[1];
+        b = color[2];
+      }
+      else
+      {
+        // Gray floor with green and blue clutter stripes
+        int stripe = (x / 16 + y / 24) % 3;
+        r = 120;
+        g = stripe == 1 ? 160 : 120;
+        b = stripe == 2 ? 170 : 120;
+      }
+      double noise = (uniform() - 0.5) * 20;
+      frame.pixels[y * frame.width + x] = rgb565(r * shade + noise, g * shade + noise, b * shade + noise);
+    }
+  }
+  return (cx - frame.width / 2.0) * 127 / (frame.width / 2.0);
+}
+
+static int runBlob(const Options &options)
+{
+  srand(options.seed);
+  vision::ColorTarget target =
+      vision::colorTarget(options.target[0], options.target[1], options.target[2], Blob_Tolerance);
+  int found = 0;
+  int mismatches = 0;
+  double error_sum = 0;
+  double error_max = 0;
+  double packed_ns = 0;
+  double reference_ns = 0;
+  ColorFrame frame;
+  for (int run = 0; run < options.runs; run++)
+  {
+    double truth = renderBlob(frame, options.target);
+    vision::BlobResult blob = vision::findBlob(frame.pixels.data(), frame.width, frame.height, frame.width, target);
+    vision::BlobResult reference =
+        vision::findBlobReference(frame.pixels.data(), frame.width, frame.height, frame.width, target);
+    if (!sameBlob(blob, reference))
+    {
+      mismatches++;
+    }
+    // Timing every frame would dominate the run
+    if (run % 10 == 0)
+    {
+      packed_ns += timeBlob(frame, target, false);
+      reference_ns += timeBlob(frame, target, true);
+    }
+    if (!blob.found)
+    {
+      if (options.verbose)
+      {
+        printf("run %d: target at %.1f not found\n", run, truth);
+      }
+      continue;
+    }
+    found++;
+    double error = fabs(blob.bearing - truth);
+    error_sum += error;
+    if (error > error_max)
+    {
+      error_max = error;
+    }
+    if (options.verbose)
+    {
+      printf("run %d: truth %.1f bearing %d size %u pixels %u\n", run, truth, blob.bearing, blob.size,
+             (unsigned)blob.pixels);
+    }
+  }
+
+  int timed = (options.runs + 9) / 10;
+  double pixels = Blob_Width * Blob_Height;
+  double mean_error = found ? error_sum / found : 0;
+  printf("blob %ux%u: %d runs, found %d (%.1f%%), bearing error mean %.2f max %.2f, reference mismatches %d\n",
+         Blob_Width, Blob_Height, options.runs, found, 100.0 * found / options.runs, mean_error, error_max,
+         mismatches);
+  printf("word-packed %.2f ns per pixel, reference %.2f ns per pixel\n", packed_ns / timed / pixels,
+         reference_ns / timed / pixels);
+
+  bool ok = found == options.runs && mismatches == 0 && mean_error <= options.maxError;
+  if (!ok)
+  {
+    printf("FAIL: every target must be found, match the reference and have a mean error of at most %.1f\n",
+           options.maxError);
+  }
+  return ok ? 0 : 1;
+}
+
+// Buffers shared by the kernel cases. Each case writes to the reference
+// outputs when asked for the reference version so the two can be compared.
+struct KernelImages
+{
+  uint16_t width;
+  uint16_t height;
+  uint16_t stride; // gray rows, a multiple of 4
+  std::vector<uint16_t> rgb;
+  std::vector<uint8_t> yuv;
+  std::vector<uint8_t> gray;
+  std::vector<uint8_t> out[2];
+  std::vector<uint32_t> sums[2];
+};
+
+typedef void (*KernelRun)(KernelImages &images, bool reference);
+
+struct KernelCase
+{
+  const char *name;
+  KernelRun run;
+};
+
+// Scratch of the banded case, a small internal SRAM buffer on the ESP32
+static const uint32_t Band_Scratch = 8 * 1024;
+
+static void runRgb565Gray(KernelImages &k, bool reference)
+{
+  uint32_t count = k.width * k.height;
+  (reference ? vision::rgb565ToGrayReference : vision::rgb565ToGray)(k.rgb.data(), k.out[reference].data(), count);
+}
+
+static void runYuv422Gray(KernelImages &k, bool reference)
+{
+  uint32_t count = k.width * k.height;
+  (reference ? vision::yuv422ToGrayReference : vision::yuv422ToGray)(k.yuv.data(), k.out[reference].data(), count);
+}
+
+static void runDownscale(KernelImages &k, bool reference, uint8_t factor)
+{
+  (reference ? vision::downscaleReference : vision::downscale)(k.gray.data(), k.width, k.height, k.stride, factor,
+                                                               k.out[reference].data());
+}
+
+static void runDownscale2(KernelImages &k, bool reference)
+{
+  runDownscale(k, reference, 2);
+}
+
+static void runDownscale4(KernelImages &k, bool reference)
+{
+  runDownscale(k, reference, 4);
+}
+
+static void runDownscale8(KernelImages &k, bool reference)
+{
+  runDownscale(k, reference, 8);
+}
+
+struct BandContext
+{
+  KernelImages *images;
+  uint8_t factor;
+};
+
+static void downscaleBand(const uint8_t *band, uint16_t rows, uint16_t first_row, void *arg)
+{
+  BandContext *ctx = (BandContext *)arg;
+  KernelImages &k = *ctx->images;
+  uint8_t *out = k.out[0].data() + (uint32_t)(first_row / ctx->factor) * (k.width / ctx->factor);
+  vision::downscale(band, k.width, rows, k.stride, ctx->factor, out);
+}
+
+// Downscale 4x band by band through a small scratch buffer, the PSRAM path
+static void runBandedDownscale4(KernelImages &k, bool reference)
+{
+  if (reference)
+  {
+    runDownscale(k, true, 4);
+    return;
+  }
+  static std::vector<uint8_t> scratch(Band_Scratch);
+  BandContext ctx = {&k, 4};
+  vision::forEachBand(k.gray.data(), k.stride, k.height, k.stride, scratch.data(), scratch.size(), ctx.factor,
+                      downscaleBand, &ctx);
+}
+
+static void runIntegral(KernelImages &k, bool reference)
+{
+  (reference ? vision::integralImageReference : vision::integralImage)(k.gray.data(), k.width, k.height, k.stride,
+                                                                       k.sums[reference].data());
+}
+
+static void runThreshold(KernelImages &k, bool reference)
+{
+  uint32_t count = k.stride * k.height;
+  uint32_t set = (reference ? vision::thresholdReference : vision::threshold)(k.gray.data(), k.out[reference].data(),
+                                                                             count, 100);
+  k.sums[reference][0] = set;
+}
+
+static void runRowSums(KernelImages &k, bool reference)
+{
+  (reference ? vision::rowSumsReference : vision::rowSums)(k.gray.data(), k.width, k.height, k.stride,
+                                                           k.sums[reference].data());
+}
+
+static void runColumnSums(KernelImages &k, bool reference)
+{
+  (reference ? vision::columnSumsReference : vision::columnSums)(k.gray.data(), k.width, k.height, k.stride,
+                                                                 k.sums[reference].data());
+}
+
+static const KernelCase Kernel_Cases[] = {
+    {"rgb565_gray", runRgb565Gray},  {"yuv422_gray", runYuv422Gray},
+    {"downscale_2x", runDownscale2}, {"downscale_4x", runDownscale4},
+    {"downscale_8x", runDownscale8}, {"downscale_4x_banded", runBandedDownscale4},
+    {"integral", runIntegral},       {"threshold", runThreshold},
+    {"row_sums", runRowSums},        {"column_sums", runColumnSums}};
+
+static void fillKernelImages(KernelImages &k, uint16_t width, uint16_t height)
+{
+  k.width = width;
+  k.height = height;
+  k.stride = (width + 3) & ~3;
+  uint32_t count = (uint32_t)k.stride * height;
+  k.rgb.resize(count);
+  k.yuv.resize(2 * count);
+  k.gray.resize(count);
+  for (uint32_t i = 0; i < count; i++)
+  {
+    k.rgb[i] = rand();
+    k.yuv[2 * i] = rand();
+    k.yuv[2 * i + 1] = rand();
+    k.gray[i] = rand();
+  }
+  for (int i = 0; i < 2; i++)
+  {
+    k.out[i].assign(count, 0);
+    k.sums[i].assign((uint32_t)(width + 1) * (height + 1), 0);
+  }
+}
+
+static double timeKernel(KernelImages &k, KernelRun run, bool reference)
+{
+  double start = nowNs();
+  for (int i = 0; i < Timing_Repeats; i++)
+  {
+    run(k, reference);
+  }
+  return (nowNs() - start) / Timing_Repeats / (k.width * k.height);
+}
+
+static int runKernels(const Options &options)
+{
+  // QQVGA and QVGA as on the car, plus a width that ends in a partial word
+  const uint16_t Sizes[][2] = {{160, 120}, {320, 240}, {157, 119}};
+  srand(options.seed);
+  int failures = 0;
+  printf("%-20s %9s %12s %12s %8s\n", "kernel", "size", "packed ns/px", "ref ns/px", "speedup");
+  for (const auto &size : Sizes)
+  {
+    KernelImages images;
+    fillKernelImages(images, size[0], size[1]);
+    for (const KernelCase &kernel : Kernel_Cases)
+    {
+      kernel.run(images, false);
+      kernel.run(images, true);
+      bool same = images.out[0] == images.out[1] && images.sums[0] == images.sums[1];
+      double packed = timeKernel(images, kernel.run, false);
+      double reference = timeKernel(images, kernel.run, true);
+      printf("%-20s %5ux%-3u %12.2f %12.2f %7.1fx%s\n", kernel.name, size[0], size[1], packed, reference,
+             reference / packed, same ? "" : "  MISMATCH");
+      failures += !same;
+    }
+  }
+  if (failures)
+  {
+    printf("FAIL: %d kernels differ from their reference\n", failures);
+  }
+  return failures ? 1 : 0;
+}
+
+static int runColorFile(const Options &options, const FileCheck &file)
+{
+  const char *path = file.path;
+  ColorFrame frame;
+  if (!readPpm(path, frame))
+  {
+    fprintf(stderr, "%s: not an 8 bit binary PPM\n", path);
+    return 1;
+  }
+  vision::ColorTarget target =
+      vision::colorTarget(options.target[0], options.target[1], options.target[2], Blob_Tolerance);
+  vision::BlobResult blob = vision::findBlob(frame.pixels.data(), frame.width, frame.height, frame.width, target);
+  double ns = timeBlob(frame, target, false);
+  printf("%s: %ux%u found %u bearing %d size %u pixels %u, %.0f ns (%.2f ns per pixel)\n", path, frame.width,
+         frame.height, blob.found, blob.bearing, blob.size, (unsigned)blob.pixels, ns,
+         ns / (frame.width * frame.height));
+  if (file.checkExpect && (!blob.found || abs(blob.bearing - file.expect) > options.tolerance))
+  {
+    printf("FAIL: %s expected bearing %d +-%d\n", path, file.expect, options.tolerance);
+    return 1;
+  }
+  return 0;
+}
+
+static int runFiles(const Options &options)
+{
+  int failures = 0;
+  for (const FileCheck &file : options.files)
+  {
+    const char *path = file.path;
+    size_t len = strlen(path);
+    if (len > 4 && !strcmp(path + len - 4, ".ppm"))
+    {
+      failures += runColorFile(options, file);
+      continue;
+    }
+    Frame frame;
+    if (!readPgm(path, frame))
+    {
+      fprintf(stderr, "%s: not an 8 bit binary PGM\n", path);
+      failures++;
+      continue;
+    }
+    vision::LineFit result = fit(frame);
+    double ns = timeFit(frame);
+    printf("%s: %ux%u found %u offset %d heading %d rows %u, %.0f ns (%.1f ns per pixel)\n", path, frame.width,
+           frame.height, result.found, result.offset, result.heading, result.rows, ns,
+           ns / (frame.width * frame.height));
+    if (file.checkExpect && (!result.found || abs(result.offset - file.expect) > options.tolerance))
+    {
+      printf("FAIL: %s expected offset %d +-%d\n", path, file.expect, options.tolerance);
+      failures++;
+    }
+  }
+  return failures ? 1 : 0;
+}
+
+static void usage()
+{
+  fprintf(stderr, "usage: program synthetic|blob|kernels [--runs N] [--seed N] [--max-error E] [--verbose]\n"
+                  "       program frame.pgm|frame.ppm... [--expect OFFSET] [frame... --expect OFFSET]... [--tolerance T]\n"
+                  "       colour targets: --target R,G,B (default 200,40,40)\n");
+}
+
+int main(int argc, char **argv)
+{
+  Options options;
+  for (int i = 1; i < argc; i++)
+  {
+    const char *arg = argv[i];
+    bool has_value = i + 1 < argc;
+    if (!strcmp(arg, "synthetic"))
+      options.synthetic = true;
+    else if (!strcmp(arg, "blob"))
+      options.blob = true;
+    else if (!strcmp(arg, "kernels"))
+      options.kernels = true;
+    else if (!strcmp(arg, "--target") && has_value)
+    {
+      int r, g, b;
+      if (sscanf(argv[++i], "%d,%d,%d", &r, &g, &b) != 3)
+      {
+        usage();
+        return 2;
+      }
+      options.target[0] = r;
+      options.target[1] = g;
+      options.target[2] = b;
+    }
+    else if (!strcmp(arg, "--runs") && has_value)
+      options.runs = atoi(argv[++i]);
+    else if (!strcmp(arg, "--seed") && has_value)
+      options.seed = strtoul(argv[++i], nullptr, 10);
+    else if (!strcmp(arg, "--max-error") && has_value)
+      options.maxError = atof(argv[++i]);
+    else if (!strcmp(arg, "--expect") && has_value)
+    {
+      int expect = atoi(argv[++i]);
+      for (FileCheck &file : options.files)
+      {
+        if (!file.checkExpect)
+        {
+          file.checkExpect = true;
+          file.expect = expect;
+        }
+      }
+    }
+    else if (!strcmp(arg, "--tolerance") && has_value)
+      options.tolerance = atoi(argv[++i]);
+    else if (!strcmp(arg, "--verbose"))
+      options.verbose = true;
+    else if (arg[0] != '-')
+      options.files.push_back({arg, false, 0});
+    else
+    {
+      usage();
+      return 2;
+    }
+  }
+
+  int modes = options.synthetic + options.blob + options.kernels + !options.files.empty();
+  if (modes != 1 || options.runs <= 0)
+  {
+    usage();
+    return 2;
+  }
+  if (options.blob)
+  {
+    return runBlob(options);
+  }
+  if (options.kernels)
+  {
+    return runKernels(options);
+  }
+  return options.synthetic ? runSynthetic(options) : runFiles(options);
+}